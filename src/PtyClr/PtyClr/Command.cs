@@ -6,6 +6,9 @@
         GetWinSize = 2,
         SetWinSize = 3,
         GetAttributes = 4,
-        SetAttributes = 5
+        SetAttributes = 5,
+        GetStats = 6,
+        Protocol = 7,
+        GetScrollback = 8
     }
 }
\ No newline at end of file
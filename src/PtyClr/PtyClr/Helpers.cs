@@ -50,11 +50,50 @@ namespace PtyClr
             return buff;
         }
 
+        internal static unsafe WinSize ToWinSize([NotNull] this byte[] buff)
+        {
+            if (buff.Length != Constants.WinSizeSize)
+                throw new InvalidDataException($"Expected {Constants.WinSizeSize} bytes, got {buff.Length}.");
+
+            var winSize = new WinSize();
+            buff.WriteToPtr(winSize.Bytes);
+            return winSize;
+        }
+
+        internal static unsafe Termios ToTermios([NotNull] this byte[] buff)
+        {
+            if (buff.Length != Constants.Termios_size)
+                throw new InvalidDataException($"Expected {Constants.Termios_size} bytes, got {buff.Length}.");
+
+            var termios = new Termios();
+            buff.WriteToPtr(termios.Bytes);
+            return termios;
+        }
+
+        // Number of counters (ushort), followed by the counters.
+        internal static PtyStats ToPtyStats([NotNull] this byte[] buff)
+        {
+            if (buff.Length < 2 || buff.Length != 2 + BitConverter.ToUInt16(buff, 0) * 8)
+                throw new InvalidDataException("Invalid statistics.");
+
+            return new PtyStats(buff.ToCounters(2, BitConverter.ToUInt16(buff, 0)));
+        }
+
+        private static ulong[] ToCounters([NotNull] this byte[] buff, int index, int count)
+        {
+            var counters = new ulong[count];
+
+            for (var i = 0; i < count; ++i)
+                counters[i] = BitConverter.ToUInt64(buff, index + i * 8);
+
+            return counters;
+        }
+
         #endregion Byte array conversions
 
         #region Stream helpers
 
-        private static async Task<byte[]> ReadExactAsync([NotNull] this PipeStream stream, int count,
+        internal static async Task<byte[]> ReadExactAsync([NotNull] this PipeStream stream, int count,
             CancellationToken cancellationToken)
         {
             byte[] buff = new byte[count];
@@ -142,6 +181,31 @@ namespace PtyClr
             return termios;
         }
 
+        internal static async Task<PtyStats> ReadStatsAsync([NotNull] this PipeStream stream,
+            CancellationToken cancellationToken)
+        {
+            var countBuff = await stream.ReadExactAsync(2, cancellationToken);
+
+            if (countBuff == null)
+                return null;
+
+            var count = BitConverter.ToUInt16(countBuff, 0);
+            var buff = await stream.ReadExactAsync(count * 8, cancellationToken);
+
+            return buff == null ? null : new PtyStats(buff.ToCounters(0, count));
+        }
+
+        internal static async Task<ushort?> ReadUInt16Async([NotNull] this PipeStream stream,
+            CancellationToken cancellationToken)
+        {
+            var buff = await stream.ReadExactAsync(2, cancellationToken);
+
+            if (buff == null)
+                return null;
+
+            return BitConverter.ToUInt16(buff, 0);
+        }
+
         #endregion Stream helpers
 
         internal static string QuoteIfNeeded([NotNull] this string input)
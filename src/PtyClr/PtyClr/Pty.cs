@@ -5,6 +5,8 @@ using System.Globalization;
 using System.IO;
 using System.IO.Pipes;
 using System.Linq;
+using System.Security.Principal;
+using System.Text;
 using System.Threading;
 using System.Threading.Tasks;
 using JetBrains.Annotations;
@@ -61,6 +63,11 @@ namespace PtyClr
         private AnonymousPipeServerStream _inputRecordStream;
         private AnonymousPipeServerStream _cmdInStream;
         private AnonymousPipeServerStream _cmdOutStream;
+        private NamedPipeServerStream _channelStream;
+        private PtyChannel _channel;
+
+        // The session outlives the mediator's client (see Spawn's persistPath), so the mediator isn't killed.
+        private bool _persistent;
 
         private bool _valid;
         private bool _disposed;
@@ -73,8 +80,17 @@ namespace PtyClr
 
         public string Arguments { get; private set; }
 
+        /// <summary>
+        /// Output pipe of the terminal (<c>null</c> if the streams are multiplexed).
+        /// </summary>
+        /// <seealso cref="Output"/>
         public PipeStream OutputStream => _outputStream;
 
+        /// <summary>
+        /// Output of the terminal, both with separate pipes and with multiplexed streams.
+        /// </summary>
+        public Stream Output => _channel?.Output ?? _outputStream;
+
         #endregion Properties
 
         #region Events
@@ -91,29 +107,45 @@ namespace PtyClr
 
         #region API methods
 
+        /// <param name="multiplexed">If <c>true</c>, a single duplex pipe carries the output, the input, the input
+        /// records and the commands (instead of five pipes), with batched writes and flow control. The output is
+        /// then available through <see cref="Output"/> only.</param>
+        /// <param name="persistPath">Multiplexed only. If specified, the session outlives this instance: on
+        /// <see cref="Dispose"/> (or if the pipe fails) it keeps running detached, and it can be reattached to with
+        /// <see cref="Attach"/>, through the Unix-domain socket at this (Cygwin / MSYS2) path.</param>
         public void Spawn([NotNull] string command, string arguments = null, ushort cols = 80,
             ushort rows = 25, IDictionary<string, string> environmentVariables = null, string workingDirectory = null,
-            LogLevel logLevel = LogLevel.None, bool sysLog = false)
+            LogLevel logLevel = LogLevel.None, bool sysLog = false, bool multiplexed = false, string persistPath = null)
         {
             if (string.IsNullOrEmpty(command))
                 throw new ArgumentNullException(nameof(command), "Argument is either null or empty.");
 
+            if (!string.IsNullOrEmpty(persistPath) && !multiplexed)
+                throw new ArgumentException("A persistent session has to be multiplexed.", nameof(persistPath));
+
+            var channelName = $"PtyClr-{Guid.NewGuid():N}";
+
             lock (_lock)
             {
                 if (_disposed)
                     throw new ObjectDisposedException(nameof(Pty));
 
-                if (_outputStream != null)
+                if (_outputStream != null || _channelStream != null)
                     throw new InvalidOperationException("The method can be called only once.");
 
-                _outputStream = new AnonymousPipeServerStream(PipeDirection.In, HandleInheritability.Inheritable);
+                if (multiplexed)
+                    _channelStream = new NamedPipeServerStream(channelName, PipeDirection.InOut, 1,
+                        PipeTransmissionMode.Byte, PipeOptions.Asynchronous);
+                else
+                    _outputStream = new AnonymousPipeServerStream(PipeDirection.In, HandleInheritability.Inheritable);
             }
 
             var mediatorExe = Helpers.FindMediatorExecutable(_ptyBuild);
 
             if (string.IsNullOrEmpty(mediatorExe))
             {
-                _outputStream.Dispose();
+                _outputStream?.Dispose();
+                _channelStream?.Dispose();
 
                 throw new Exception("Mediator executable not found.");
             }
@@ -121,13 +153,35 @@ namespace PtyClr
             ShellCommand = command;
             Arguments = arguments;
 
-            _inputStream = new AnonymousPipeServerStream(PipeDirection.Out, HandleInheritability.Inheritable);
-            _inputRecordStream = new AnonymousPipeServerStream(PipeDirection.Out, HandleInheritability.Inheritable);
-            _cmdInStream = new AnonymousPipeServerStream(PipeDirection.Out, HandleInheritability.Inheritable);
-            _cmdOutStream = new AnonymousPipeServerStream(PipeDirection.In, HandleInheritability.Inheritable);
+            string args;
+            NamedPipeClientStream channelClient = null;
 
-            var args =
-                $"--out {_outputStream.GetClientHandleAsString()} --ins {_inputStream.GetClientHandleAsString()} --inr {_inputRecordStream.GetClientHandleAsString()} --cmd {_cmdInStream.GetClientHandleAsString()};{_cmdOutStream.GetClientHandleAsString()} --rows {rows.ToString(NfiNoThousandsSeparator)} --cols {cols.ToString(NfiNoThousandsSeparator)} --log {((int) logLevel).ToString(NfiNoThousandsSeparator)}";
+            if (multiplexed)
+            {
+                // The mediator gets the (inheritable) client end of the pipe.
+                channelClient = new NamedPipeClientStream(".", channelName, PipeDirection.InOut,
+                    PipeOptions.None, TokenImpersonationLevel.None, HandleInheritability.Inheritable);
+
+                channelClient.Connect();
+                _channelStream.WaitForConnection();
+
+                args =
+                    $"--chan {channelClient.SafePipeHandle.DangerousGetHandle().ToInt64().ToString(NfiNoThousandsSeparator)}";
+            }
+            else
+            {
+                _inputStream = new AnonymousPipeServerStream(PipeDirection.Out, HandleInheritability.Inheritable);
+                _inputRecordStream =
+                    new AnonymousPipeServerStream(PipeDirection.Out, HandleInheritability.Inheritable);
+                _cmdInStream = new AnonymousPipeServerStream(PipeDirection.Out, HandleInheritability.Inheritable);
+                _cmdOutStream = new AnonymousPipeServerStream(PipeDirection.In, HandleInheritability.Inheritable);
+
+                args =
+                    $"--out {_outputStream.GetClientHandleAsString()} --ins {_inputStream.GetClientHandleAsString()} --inr {_inputRecordStream.GetClientHandleAsString()} --cmd {_cmdInStream.GetClientHandleAsString()};{_cmdOutStream.GetClientHandleAsString()}";
+            }
+
+            args +=
+                $" --rows {rows.ToString(NfiNoThousandsSeparator)} --cols {cols.ToString(NfiNoThousandsSeparator)} --log {((int) logLevel).ToString(NfiNoThousandsSeparator)}";
 
             if (!string.IsNullOrEmpty(workingDirectory))
                 args += $" --dir {workingDirectory.QuoteIfNeeded()}";
@@ -135,11 +189,76 @@ namespace PtyClr
             if (sysLog)
                 args += " --syslog";
 
+            if (!string.IsNullOrEmpty(persistPath))
+            {
+                args += $" --persist {persistPath.QuoteIfNeeded()}";
+
+                _persistent = true;
+            }
+
             args += $" - {command.Trim().QuoteIfNeeded()}";
 
             if (!string.IsNullOrEmpty(arguments))
                 args += " " + arguments.Trim();
 
+            StartMediator(mediatorExe, args, environmentVariables, multiplexed, channelClient);
+        }
+
+        /// <summary>
+        /// Attaches to a session that was spawned with a <c>persistPath</c> (by this or another process), instead of
+        /// spawning a new one. The client that's attached to it (if any) is detached. The recent output of the
+        /// session is replayed first. The streams are multiplexed, and <see cref="Dispose"/> detaches only.
+        /// </summary>
+        /// <param name="persistPath">The path the session was spawned with.</param>
+        public void Attach([NotNull] string persistPath, LogLevel logLevel = LogLevel.None, bool sysLog = false)
+        {
+            if (string.IsNullOrEmpty(persistPath))
+                throw new ArgumentNullException(nameof(persistPath), "Argument is either null or empty.");
+
+            var channelName = $"PtyClr-{Guid.NewGuid():N}";
+
+            lock (_lock)
+            {
+                if (_disposed)
+                    throw new ObjectDisposedException(nameof(Pty));
+
+                if (_outputStream != null || _channelStream != null)
+                    throw new InvalidOperationException("The method can be called only once.");
+
+                _channelStream = new NamedPipeServerStream(channelName, PipeDirection.InOut, 1,
+                    PipeTransmissionMode.Byte, PipeOptions.Asynchronous);
+            }
+
+            var mediatorExe = Helpers.FindMediatorExecutable(_ptyBuild);
+
+            if (string.IsNullOrEmpty(mediatorExe))
+            {
+                _channelStream.Dispose();
+
+                throw new Exception("Mediator executable not found.");
+            }
+
+            // The mediator only relays the channel to the session's socket.
+            var channelClient = new NamedPipeClientStream(".", channelName, PipeDirection.InOut,
+                PipeOptions.None, TokenImpersonationLevel.None, HandleInheritability.Inheritable);
+
+            channelClient.Connect();
+            _channelStream.WaitForConnection();
+
+            var args =
+                $"--chan {channelClient.SafePipeHandle.DangerousGetHandle().ToInt64().ToString(NfiNoThousandsSeparator)} --log {((int) logLevel).ToString(NfiNoThousandsSeparator)}";
+
+            if (sysLog)
+                args += " --syslog";
+
+            args += $" --attach {persistPath.QuoteIfNeeded()}";
+
+            StartMediator(mediatorExe, args, null, true, channelClient);
+        }
+
+        private void StartMediator(string mediatorExe, string args, IDictionary<string, string> environmentVariables,
+            bool multiplexed, NamedPipeClientStream channelClient)
+        {
             _mediatorProcess = new Process
             {
                 StartInfo =
@@ -169,23 +288,39 @@ namespace PtyClr
             catch
             {
                 _mediatorProcess.Dispose();
-                _outputStream.Dispose();
-                _inputStream.Dispose();
-                _inputRecordStream.Dispose();
-                _cmdInStream.Dispose();
-                _cmdOutStream.Dispose();
+                _outputStream?.Dispose();
+                _inputStream?.Dispose();
+                _inputRecordStream?.Dispose();
+                _cmdInStream?.Dispose();
+                _cmdOutStream?.Dispose();
+                channelClient?.Dispose();
+                _channelStream?.Dispose();
 
                 throw;
             }
 
-            _outputStream.DisposeLocalCopyOfClientHandle();
-            _inputStream.DisposeLocalCopyOfClientHandle();
-            _inputRecordStream.DisposeLocalCopyOfClientHandle();
-            _cmdInStream.DisposeLocalCopyOfClientHandle();
-            _cmdOutStream.DisposeLocalCopyOfClientHandle();
+            if (multiplexed)
+            {
+                channelClient.Dispose();
+
+                // Commands are always sent as protocol 2 frames through the channel.
+                _protocolVersion = ProtocolVersion2;
+
+                _channel = new PtyChannel(_channelStream, CompleteCommandFrame, ChannelFailed, _masterCts.Token);
+            }
+            else
+            {
+                _outputStream.DisposeLocalCopyOfClientHandle();
+                _inputStream.DisposeLocalCopyOfClientHandle();
+                _inputRecordStream.DisposeLocalCopyOfClientHandle();
+                _cmdInStream.DisposeLocalCopyOfClientHandle();
+                _cmdOutStream.DisposeLocalCopyOfClientHandle();
+            }
 
             lock (_lock)
                 _valid = true;
+
+            _channel?.Start();
         }
 
         public void WriteInput(byte[] input)
@@ -197,7 +332,10 @@ namespace PtyClr
             {
                 try
                 {
-                    _inputStream.Write(input, 0, input.Length);
+                    if (_channel != null)
+                        _channel.SendDataAsync(PtyChannel.FrameInput, input).GetAwaiter().GetResult();
+                    else
+                        _inputStream.Write(input, 0, input.Length);
                 }
                 catch (Exception e)
                 {
@@ -213,7 +351,9 @@ namespace PtyClr
             if (ValidateCall() is Exception ex)
                 return Task.FromException(ex);
 
-            return EnqueueInputAsync(input);
+            return _channel != null
+                ? _channel.SendDataAsync(PtyChannel.FrameInput, input)
+                : EnqueueInputAsync(input);
         }
 
         /// <summary>
@@ -329,6 +469,79 @@ namespace PtyClr
                 .ContinueWith(t => (Termios)t.Result, TaskContinuationOptions.OnlyOnRanToCompletion);
         }
 
+        public Task<PtyStats> GetStatsAsync(CancellationToken? cancellationToken = null)
+        {
+            if (ValidateCall() is Exception ex)
+                return Task.FromException<PtyStats>(ex);
+
+            return EnqueueAsync(new[] { (byte)Command.GetStats }, cancellationToken ?? CancellationToken.None)
+                .ContinueWith(t => (PtyStats)t.Result, TaskContinuationOptions.OnlyOnRanToCompletion);
+        }
+
+        /// <summary>
+        /// Returns the last <paramref name="count"/> bytes (or lines) of the output that the mediator keeps
+        /// (<c>--scrollback</c>, or the replay of a persistent session), as a single array. If <paramref name="count"/>
+        /// is <c>0</c>, all of it is returned. It fails if the output isn't kept.
+        /// </summary>
+        /// <remarks>
+        /// The mediator returns the scrollback in pages (one command each), so that a big one doesn't hold up the
+        /// output. The result ends where the scrollback ended when the first page was returned. It fails if the rest of
+        /// it is overwritten by the new output in the meantime.
+        /// </remarks>
+        /// <param name="count">The number of bytes or lines.</param>
+        /// <param name="lines">If <c>true</c>, <paramref name="count"/> is the number of lines.</param>
+        public Task<byte[]> GetScrollbackAsync(uint count, bool lines = false,
+            CancellationToken? cancellationToken = null)
+        {
+            if (ValidateCall() is Exception ex)
+                return Task.FromException<byte[]>(ex);
+
+            return GetScrollbackPagesAsync(lines ? ScrollbackLines : ScrollbackBytes, count,
+                cancellationToken ?? CancellationToken.None);
+        }
+
+        private async Task<byte[]> GetScrollbackPagesAsync(byte start, uint count, CancellationToken cancellationToken)
+        {
+            var page = await GetScrollbackPageAsync(start, count, 0, cancellationToken).ConfigureAwait(false);
+            var end = BitConverter.ToUInt64(page, sizeof(ulong));
+            var scrollback = new MemoryStream();
+
+            while (true)
+            {
+                var position = BitConverter.ToUInt64(page, 0);
+                var length = (int)Math.Min((ulong)(page.Length - ScrollbackPageHeaderSize), end - position);
+
+                scrollback.Write(page, ScrollbackPageHeaderSize, length);
+
+                position += (ulong)length;
+
+                if (position >= end || length == 0)
+                    return scrollback.ToArray();
+
+                page = await GetScrollbackPageAsync(ScrollbackFrom, 0, position, cancellationToken)
+                    .ConfigureAwait(false);
+            }
+        }
+
+        private async Task<byte[]> GetScrollbackPageAsync(byte start, uint count, ulong position,
+            CancellationToken cancellationToken)
+        {
+            var command = new byte[2 + sizeof(uint) + sizeof(ulong)];
+
+            command[0] = (byte)Command.GetScrollback;
+            command[1] = start;
+
+            Array.Copy(BitConverter.GetBytes(count), 0, command, 2, sizeof(uint));
+            Array.Copy(BitConverter.GetBytes(position), 0, command, 2 + sizeof(uint), sizeof(ulong));
+
+            var page = (byte[])await EnqueueAsync(command, cancellationToken).ConfigureAwait(false);
+
+            if (page.Length < ScrollbackPageHeaderSize)
+                throw new InvalidDataException($"Invalid scrollback page size: {page.Length}.");
+
+            return page;
+        }
+
         public Task SetAttributesAsync(Termios attributes, CancellationToken? cancellationToken = null)
         {
             if (ValidateCall() is Exception ex)
@@ -336,7 +549,7 @@ namespace PtyClr
 
             var command = new byte[Constants.Termios_size + 1];
 
-            command[0] = (byte)Command.SetWinSize;
+            command[0] = (byte)Command.SetAttributes;
 
             unsafe
             {
@@ -366,6 +579,8 @@ namespace PtyClr
 
             Dispose(cmdQueue, () => new ObjectDisposedException(nameof(Pty)));
 
+            FailPendingCommands();
+
             Queue<TaskCompletionSource<object>> tcsQueue;
 
             lock (_inputLock)
@@ -404,13 +619,17 @@ namespace PtyClr
 
             if (_mediatorProcess != null)
             {
-                try
+                // A persistent session is detached (by closing the channel below) rather than ended.
+                if (!_persistent)
                 {
-                    _mediatorProcess.Kill();
-                }
-                catch
-                {
-                    // ignored
+                    try
+                    {
+                        _mediatorProcess.Kill();
+                    }
+                    catch
+                    {
+                        // ignored
+                    }
                 }
 
                 _mediatorProcess.Dispose();
@@ -460,6 +679,17 @@ namespace PtyClr
             {
                 // ignored
             }
+
+            _channel?.Dispose();
+
+            try
+            {
+                _channelStream?.Dispose();
+            }
+            catch
+            {
+                // ignored
+            }
         }
 
         #endregion API Methods
@@ -476,7 +706,10 @@ namespace PtyClr
             {
                 try
                 {
-                    _inputRecordStream.Write(record, 0, record.Length);
+                    if (_channel != null)
+                        _channel.SendDataAsync(PtyChannel.FrameRecords, record).GetAwaiter().GetResult();
+                    else
+                        _inputRecordStream.Write(record, 0, record.Length);
                 }
                 catch (Exception e)
                 {
@@ -488,6 +721,9 @@ namespace PtyClr
 
         private Task EnqueueInputRecordAsync(byte[] record)
         {
+            if (_channel != null)
+                return _channel.SendDataAsync(PtyChannel.FrameRecords, record);
+
             var tcs = new TaskCompletionSource<object>(record);
 
             lock (_inRecLock)
@@ -670,10 +906,30 @@ namespace PtyClr
         private const byte SuccessByte = 0;
         private const byte FailureByte = 1;
 
+        // Protocol 2 frames: [length: uint][request id: uint][command / status: byte][arguments / result], where
+        // length counts everything after the length field.
+        private const ushort ProtocolVersion2 = 2;
+        private const int FrameLengthSize = 4;
+        private const int FrameHeaderSize = 9;
+
+        // Get-scrollback: where a page starts (the last bytes, the last lines, or a position), and the header of a page
+        // (its position, and the position where the scrollback ends).
+        private const byte ScrollbackBytes = 0;
+        private const byte ScrollbackLines = 1;
+        private const byte ScrollbackFrom = 2;
+        private const int ScrollbackPageHeaderSize = 2 * sizeof(ulong);
+
         private readonly object _commandLock = new object();
 
         private Queue<CommandPack> _commandQueue;
 
+        // Command protocol version, negotiated before the first command (0 until then).
+        private int _protocolVersion;
+
+        // Protocol 2: commands sent, but not answered yet, by request id.
+        private readonly Dictionary<uint, CommandPack> _pendingCommands = new Dictionary<uint, CommandPack>();
+        private uint _lastRequestId;
+
         private Task<object> EnqueueAsync(byte[] command, CancellationToken cancellationToken)
         {
             var cmd = new CommandPack(new TaskCompletionSource<object>(command), cancellationToken);
@@ -715,6 +971,9 @@ namespace PtyClr
                 if (queue == null)
                     return;
 
+                if (_protocolVersion == 0)
+                    await NegotiateProtocolAsync().ConfigureAwait(false);
+
                 while (queue.Any())
                 {
                     lock (_lock)
@@ -732,6 +991,14 @@ namespace PtyClr
                         }
                     }
 
+                    if (_protocolVersion >= ProtocolVersion2)
+                    {
+                        // The whole batch is sent at once, and the responses are matched by ReadResponseFramesAsync.
+                        await SendCommandFramesAsync(queue).ConfigureAwait(false);
+
+                        continue;
+                    }
+
                     var cmd = queue.Dequeue();
 
                     if (cmd.CancellationToken.IsCancellationRequested)
@@ -746,6 +1013,242 @@ namespace PtyClr
             }
         }
 
+        // Asks for protocol 2 (in protocol 1). If the mediator doesn't support it, protocol 1 is used.
+        private async Task NegotiateProtocolAsync()
+        {
+            var command = new byte[3];
+
+            command[0] = (byte)Command.Protocol;
+            BitConverter.GetBytes(ProtocolVersion2).CopyTo(command, 1);
+
+            var cmd = new CommandPack(new TaskCompletionSource<object>(command), CancellationToken.None);
+
+            await ExecuteCommandAsync(cmd).ConfigureAwait(false);
+
+            var task = cmd.TaskCompletionSource.Task;
+
+            _protocolVersion = task.Status == TaskStatus.RanToCompletion ? (ushort)task.Result : 1;
+
+            if (_protocolVersion >= ProtocolVersion2)
+                // ReSharper disable once AssignmentIsFullyDiscarded
+                _ = ReadResponseFramesAsync();
+        }
+
+        private async Task SendCommandFramesAsync([NotNull] Queue<CommandPack> queue)
+        {
+            var channelFrames = new List<Task>();
+
+            using (var frames = new MemoryStream())
+            {
+                while (queue.Any())
+                {
+                    var cmd = queue.Dequeue();
+
+                    if (cmd.CancellationToken.IsCancellationRequested)
+                    {
+                        cmd.TaskCompletionSource.TrySetCanceled(cmd.CancellationToken);
+
+                        continue;
+                    }
+
+                    var command = (byte[])cmd.TaskCompletionSource.Task.AsyncState;
+
+                    uint requestId;
+
+                    lock (_commandLock)
+                    {
+                        requestId = ++_lastRequestId;
+
+                        _pendingCommands[requestId] = cmd;
+                    }
+
+                    if (_channel == null)
+                        frames.Write(BitConverter.GetBytes((uint)(FrameHeaderSize - FrameLengthSize - 1 +
+                            command.Length)), 0, FrameLengthSize);
+
+                    frames.Write(BitConverter.GetBytes(requestId), 0, 4);
+                    frames.Write(command, 0, command.Length);
+
+                    if (_channel == null)
+                        continue;
+
+                    // Channel frames carry the command frame without its length field, and they are batched by the
+                    // channel itself.
+                    channelFrames.Add(_channel.SendAsync(PtyChannel.FrameCommand, frames.ToArray()));
+
+                    frames.SetLength(0);
+                }
+
+                try
+                {
+                    if (_channel != null)
+                        await Task.WhenAll(channelFrames).ConfigureAwait(false);
+                    else if (frames.Length > 0)
+                        await _cmdInStream.WriteAsync(frames.GetBuffer(), 0, (int)frames.Length, _masterCts.Token)
+                            .ConfigureAwait(false);
+                }
+                catch (Exception ex)
+                {
+                    ReportCorrupt(ex);
+
+                    FailPendingCommands();
+                }
+            }
+        }
+
+        private async Task ReadResponseFramesAsync()
+        {
+            while (true)
+            {
+                var header = await _cmdOutStream.ReadExactAsync(FrameHeaderSize, _masterCts.Token)
+                    .ConfigureAwait(false);
+
+                var resultLength = header == null
+                    ? -1
+                    : (int)BitConverter.ToUInt32(header, 0) - (FrameHeaderSize - FrameLengthSize);
+
+                var result = resultLength < 0
+                    ? null
+                    : resultLength == 0
+                        ? new byte[0]
+                        : await _cmdOutStream.ReadExactAsync(resultLength, _masterCts.Token).ConfigureAwait(false);
+
+                CommandPack cmd = null;
+
+                if (result != null)
+                {
+                    lock (_commandLock)
+                    {
+                        var requestId = BitConverter.ToUInt32(header, FrameLengthSize);
+
+                        if (_pendingCommands.TryGetValue(requestId, out cmd))
+                            _pendingCommands.Remove(requestId);
+                    }
+                }
+
+                if (cmd == null)
+                {
+                    // Disposed, or the stream is broken.
+                    ReportCorrupt();
+
+                    FailPendingCommands();
+
+                    return;
+                }
+
+                CompleteCommand(cmd, header[FrameHeaderSize - 1], result);
+            }
+        }
+
+        // Multiplexed channel: a response frame without its length field.
+        private void CompleteCommandFrame([NotNull] byte[] frame)
+        {
+            CommandPack cmd = null;
+
+            if (frame.Length >= FrameHeaderSize - FrameLengthSize)
+            {
+                lock (_commandLock)
+                {
+                    var requestId = BitConverter.ToUInt32(frame, 0);
+
+                    if (_pendingCommands.TryGetValue(requestId, out cmd))
+                        _pendingCommands.Remove(requestId);
+                }
+            }
+
+            if (cmd == null)
+            {
+                ReportCorrupt();
+
+                FailPendingCommands();
+
+                return;
+            }
+
+            var result = new byte[frame.Length - (FrameHeaderSize - FrameLengthSize)];
+
+            Array.Copy(frame, FrameHeaderSize - FrameLengthSize, result, 0, result.Length);
+
+            CompleteCommand(cmd, frame[FrameHeaderSize - FrameLengthSize - 1], result);
+        }
+
+        private void ChannelFailed(Exception ex)
+        {
+            ReportCorrupt(ex);
+
+            FailPendingCommands();
+        }
+
+        private void CompleteCommand([NotNull] CommandPack command, byte status, [NotNull] byte[] result)
+        {
+            if (status == FailureByte)
+            {
+                command.TaskCompletionSource.TrySetException(new Exception(Encoding.UTF8.GetString(result)));
+
+                return;
+            }
+
+            try
+            {
+                if (status != SuccessByte)
+                    throw new InvalidDataException($"Invalid status: {status}.");
+
+                switch ((Command)((byte[])command.TaskCompletionSource.Task.AsyncState)[0])
+                {
+                    case Command.GetWinSize:
+                        command.TaskCompletionSource.TrySetResult(result.ToWinSize());
+                        return;
+
+                    case Command.GetAttributes:
+                        command.TaskCompletionSource.TrySetResult(result.ToTermios());
+                        return;
+
+                    case Command.GetStats:
+                        command.TaskCompletionSource.TrySetResult(result.ToPtyStats());
+                        return;
+
+                    case Command.GetScrollback:
+                        command.TaskCompletionSource.TrySetResult(result);
+                        return;
+
+                    default:
+                        command.TaskCompletionSource.TrySetResult(null);
+                        return;
+                }
+            }
+            catch (Exception ex)
+            {
+                ReportCorrupt(ex);
+
+                command.TaskCompletionSource.TrySetException(new TerminalCorruptException());
+            }
+        }
+
+        private void FailPendingCommands()
+        {
+            List<CommandPack> pending;
+
+            lock (_commandLock)
+            {
+                pending = _pendingCommands.Values.ToList();
+
+                _pendingCommands.Clear();
+            }
+
+            bool disposed;
+
+            lock (_lock)
+                disposed = _disposed;
+
+            foreach (var cmd in pending)
+            {
+                if (disposed)
+                    cmd.TaskCompletionSource.TrySetException(new ObjectDisposedException(nameof(Pty)));
+                else
+                    cmd.TaskCompletionSource.TrySetException(new TerminalCorruptException());
+            }
+        }
+
         private async Task ExecuteCommandAsync(CommandPack command)
         {
             var cmd = (byte[])command.TaskCompletionSource.Task.AsyncState;
@@ -886,6 +1389,66 @@ namespace PtyClr
                     command.TaskCompletionSource.TrySetResult(null);
                     return;
 
+                case Command.Protocol:
+
+                    ushort? version;
+
+                    try
+                    {
+                        version = await _cmdOutStream.ReadUInt16Async(_masterCts.Token);
+                    }
+                    catch (Exception ex)
+                    {
+                        ReportCorrupt(ex);
+
+                        command.TaskCompletionSource.TrySetException(new TerminalCorruptException());
+
+                        return;
+                    }
+
+                    if (version == null)
+                    {
+                        ReportCorrupt();
+
+                        command.TaskCompletionSource.TrySetException(new TerminalCorruptException());
+
+                        return;
+                    }
+
+                    command.TaskCompletionSource.TrySetResult(version.Value);
+
+                    return;
+
+                case Command.GetStats:
+
+                    PtyStats stats;
+
+                    try
+                    {
+                        stats = await _cmdOutStream.ReadStatsAsync(_masterCts.Token);
+                    }
+                    catch (Exception ex)
+                    {
+                        ReportCorrupt(ex);
+
+                        command.TaskCompletionSource.TrySetException(new TerminalCorruptException());
+
+                        return;
+                    }
+
+                    if (stats == null)
+                    {
+                        ReportCorrupt();
+
+                        command.TaskCompletionSource.TrySetException(new TerminalCorruptException());
+
+                        return;
+                    }
+
+                    command.TaskCompletionSource.TrySetResult(stats);
+
+                    return;
+
                 default:
                     // Won't happen ever, but still...
                     ReportCorrupt();
@@ -905,7 +1468,7 @@ namespace PtyClr
                 if (_disposed)
                     return new ObjectDisposedException(nameof(Pty));
 
-                if (_outputStream == null)
+                if (_outputStream == null && _channelStream == null)
                     return new InvalidOperationException($"Method {nameof(Spawn)} must be called first.");
 
                 if (!_valid)
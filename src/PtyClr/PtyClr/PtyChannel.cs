@@ -0,0 +1,541 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.Pipes;
+using System.Linq;
+using System.Threading;
+using System.Threading.Tasks;
+using JetBrains.Annotations;
+
+namespace PtyClr
+{
+    /// <summary>
+    /// Client side of the multiplexed channel (<c>--chan</c>): a single duplex pipe that carries the output, the
+    /// input, the input records and the commands, as frames: <c>[length: uint][type: byte][payload]</c>, where length
+    /// counts everything after the length field (see <c>channel.h</c> on the native side).
+    /// </summary>
+    /// <remarks>
+    /// Frames that are sent while a write is in progress are batched, and written together with the next write.
+    /// Flow control: each side starts with <see cref="Window"/> of credit, and may send output (native side) or
+    /// input and records (this side) payload only while it has credit left. Credit is granted back (with a credit
+    /// frame) as the payload is consumed: the output is consumed when it's read from <see cref="Output"/>.
+    /// </remarks>
+    internal sealed class PtyChannel : IDisposable
+    {
+        #region Constants
+
+        internal const byte FrameOutput = 1;
+        internal const byte FrameInput = 2;
+        internal const byte FrameRecords = 3;
+        internal const byte FrameCommand = 4;
+        internal const byte FrameCredit = 5;
+
+        private const int FrameLengthSize = 4;
+        private const int FrameHeaderSize = 5;
+
+        // Largest payload of a frame we send (100 input records), and of a frame we receive.
+        private const int ClientMaxPayload = 2000;
+        private const int MaxPayload = 64 * 1024;
+
+        private const int Window = 256 * 1024;
+        private const int CreditBatch = Window / 4;
+
+        private const int ReadBufferSize = 64 * 1024;
+
+        #endregion Constants
+
+        #region Fields
+
+        private readonly PipeStream _stream;
+        private readonly Action<byte[]> _commandResponse;
+        private readonly Action<Exception> _failed;
+        private readonly CancellationToken _cancellationToken;
+        private readonly ChannelOutputStream _output;
+
+        private readonly object _sendLock = new object();
+        // Frames that aren't flow-controlled (commands and credit) overtake the data frames waiting for credit.
+        private readonly Queue<Frame> _controlQueue = new Queue<Frame>();
+        private readonly Queue<Frame> _dataQueue = new Queue<Frame>();
+        private bool _sending;
+        private long _sendCredit = Window;
+        private bool _broken;
+
+        #endregion Fields
+
+        #region Constructors
+
+        /// <param name="stream">Connected duplex pipe.</param>
+        /// <param name="commandResponse">Called with each command response frame (without its length field).</param>
+        /// <param name="failed">Called once, when the channel breaks (the exception is null on end of stream).</param>
+        /// <param name="cancellationToken">Cancels all the pending I/O.</param>
+        internal PtyChannel([NotNull] PipeStream stream, [NotNull] Action<byte[]> commandResponse,
+            [NotNull] Action<Exception> failed, CancellationToken cancellationToken)
+        {
+            _stream = stream;
+            _commandResponse = commandResponse;
+            _failed = failed;
+            _cancellationToken = cancellationToken;
+            _output = new ChannelOutputStream(this);
+        }
+
+        #endregion Constructors
+
+        #region Properties
+
+        /// <summary>
+        /// Output of the terminal.
+        /// </summary>
+        internal Stream Output => _output;
+
+        #endregion Properties
+
+        #region Internal methods
+
+        internal void Start() =>
+            // ReSharper disable once AssignmentIsFullyDiscarded
+            _ = ReadFramesAsync();
+
+        /// <summary>
+        /// Sends input (<see cref="FrameInput"/>) or input records (<see cref="FrameRecords"/>), split into frames
+        /// if needed. The task completes when everything is written.
+        /// </summary>
+        internal Task SendDataAsync(byte type, [NotNull] byte[] data)
+        {
+            if (data.Length <= ClientMaxPayload)
+                return SendAsync(type, data);
+
+            Task last = null;
+
+            for (var offset = 0; offset < data.Length; offset += ClientMaxPayload)
+            {
+                var chunk = new byte[Math.Min(ClientMaxPayload, data.Length - offset)];
+
+                Array.Copy(data, offset, chunk, 0, chunk.Length);
+
+                // The frames are written in order, so the last one completes after all the others.
+                last = SendAsync(type, chunk);
+            }
+
+            return last;
+        }
+
+        /// <summary>
+        /// Sends a frame. The task completes when it's written.
+        /// </summary>
+        internal Task SendAsync(byte type, [NotNull] byte[] payload)
+        {
+            var frame = new Frame(type, payload);
+
+            lock (_sendLock)
+            {
+                if (_broken)
+                    return Task.FromException(new TerminalCorruptException());
+
+                (IsFlowControlled(type) ? _dataQueue : _controlQueue).Enqueue(frame);
+
+                StartSendingIfNeeded();
+            }
+
+            return frame.TaskCompletionSource.Task;
+        }
+
+        public void Dispose() => Fail(new ObjectDisposedException(nameof(PtyChannel)), false);
+
+        #endregion Internal methods
+
+        #region Private methods
+
+        private static bool IsFlowControlled(byte type) => type == FrameInput || type == FrameRecords;
+
+        // Must be called with _sendLock held.
+        private void StartSendingIfNeeded()
+        {
+            if (_sending || !_controlQueue.Any() && (!_dataQueue.Any() || _dataQueue.Peek().Payload.Length > _sendCredit))
+                // Nothing to send, or waiting for credit.
+                return;
+
+            _sending = true;
+
+            // ReSharper disable once AssignmentIsFullyDiscarded
+            _ = WriteFramesAsync();
+        }
+
+        private async Task WriteFramesAsync()
+        {
+            while (true)
+            {
+                var batch = new List<Frame>();
+
+                using (var buffer = new MemoryStream())
+                {
+                    lock (_sendLock)
+                    {
+                        // Everything that's queued (and that we have credit for) is written at once.
+                        while (_controlQueue.Any())
+                            AddFrame(buffer, batch, _controlQueue.Dequeue());
+
+                        while (_dataQueue.Any() && _dataQueue.Peek().Payload.Length <= _sendCredit)
+                        {
+                            var frame = _dataQueue.Dequeue();
+
+                            _sendCredit -= frame.Payload.Length;
+
+                            AddFrame(buffer, batch, frame);
+                        }
+
+                        if (!batch.Any())
+                        {
+                            _sending = false;
+
+                            return;
+                        }
+                    }
+
+                    try
+                    {
+                        await _stream.WriteAsync(buffer.GetBuffer(), 0, (int)buffer.Length, _cancellationToken)
+                            .ConfigureAwait(false);
+                    }
+                    catch (Exception ex)
+                    {
+                        foreach (var frame in batch)
+                            frame.TaskCompletionSource.TrySetException(new TerminalCorruptException());
+
+                        Fail(ex, true);
+
+                        return;
+                    }
+                }
+
+                foreach (var frame in batch)
+                    frame.TaskCompletionSource.TrySetResult(null);
+            }
+        }
+
+        private static void AddFrame([NotNull] MemoryStream buffer, [NotNull] List<Frame> batch, [NotNull] Frame frame)
+        {
+            buffer.Write(BitConverter.GetBytes((uint)(FrameHeaderSize - FrameLengthSize + frame.Payload.Length)), 0,
+                FrameLengthSize);
+            buffer.WriteByte(frame.Type);
+            buffer.Write(frame.Payload, 0, frame.Payload.Length);
+
+            batch.Add(frame);
+        }
+
+        private async Task ReadFramesAsync()
+        {
+            var buffer = new byte[ReadBufferSize + FrameHeaderSize + MaxPayload];
+            var count = 0;
+
+            while (true)
+            {
+                int read;
+
+                try
+                {
+                    read = await _stream.ReadAsync(buffer, count, buffer.Length - count, _cancellationToken)
+                        .ConfigureAwait(false);
+                }
+                catch (Exception ex)
+                {
+                    Fail(ex, true);
+
+                    return;
+                }
+
+                if (read < 1)
+                {
+                    Fail(null, true);
+
+                    return;
+                }
+
+                count += read;
+
+                var position = 0;
+
+                // All the complete frames that are available.
+                while (count - position >= FrameHeaderSize)
+                {
+                    var length = (long)BitConverter.ToUInt32(buffer, position);
+                    var type = buffer[position + FrameHeaderSize - 1];
+
+                    if (length < FrameHeaderSize - FrameLengthSize ||
+                        length > FrameHeaderSize - FrameLengthSize + MaxPayload)
+                    {
+                        Fail(new InvalidDataException($"Invalid frame length: {length}."), true);
+
+                        return;
+                    }
+
+                    var payload = new byte[length - (FrameHeaderSize - FrameLengthSize)];
+                    var buffered = Math.Min(count - position - FrameHeaderSize, payload.Length);
+
+                    if (buffered < payload.Length && FrameLengthSize + length <= buffer.Length)
+                        break;
+
+                    Array.Copy(buffer, position + FrameHeaderSize, payload, 0, buffered);
+
+                    position += FrameHeaderSize + buffered;
+
+                    // A frame that doesn't fit into the buffer: the rest of it is read right into the payload.
+                    if (buffered < payload.Length && !await ReadPayloadAsync(payload, buffered).ConfigureAwait(false))
+                        return;
+
+                    switch (type)
+                    {
+                        case FrameOutput:
+                            _output.Add(payload);
+                            break;
+
+                        case FrameCommand:
+                            _commandResponse(payload);
+                            break;
+
+                        case FrameCredit when payload.Length == 4:
+                            lock (_sendLock)
+                            {
+                                _sendCredit += BitConverter.ToUInt32(payload, 0);
+
+                                StartSendingIfNeeded();
+                            }
+
+                            break;
+
+                        default:
+                            Fail(new InvalidDataException($"Invalid frame type: {type}."), true);
+
+                            return;
+                    }
+                }
+
+                // Moving the incomplete frame to the beginning.
+                Array.Copy(buffer, position, buffer, 0, count - position);
+
+                count -= position;
+            }
+        }
+
+        private async Task<bool> ReadPayloadAsync(byte[] payload, int offset)
+        {
+            while (offset < payload.Length)
+            {
+                int read;
+
+                try
+                {
+                    read = await _stream.ReadAsync(payload, offset, payload.Length - offset, _cancellationToken)
+                        .ConfigureAwait(false);
+                }
+                catch (Exception ex)
+                {
+                    Fail(ex, true);
+
+                    return false;
+                }
+
+                if (read < 1)
+                {
+                    Fail(null, true);
+
+                    return false;
+                }
+
+                offset += read;
+            }
+
+            return true;
+        }
+
+        // Output read by the app is granted back to the native side.
+        private void Consumed(int bytes) =>
+            // ReSharper disable once AssignmentIsFullyDiscarded
+            _ = SendAsync(FrameCredit, BitConverter.GetBytes((uint)bytes));
+
+        private void Fail(Exception ex, bool report)
+        {
+            List<Frame> frames;
+
+            lock (_sendLock)
+            {
+                if (_broken)
+                    return;
+
+                _broken = true;
+
+                frames = _controlQueue.Concat(_dataQueue).ToList();
+
+                _controlQueue.Clear();
+                _dataQueue.Clear();
+            }
+
+            foreach (var frame in frames)
+                frame.TaskCompletionSource.TrySetException(new TerminalCorruptException());
+
+            _output.Complete();
+
+            if (report)
+                _failed(ex);
+        }
+
+        #endregion Private methods
+
+        #region Nested types
+
+        private sealed class Frame
+        {
+            internal byte Type { get; }
+
+            [NotNull]
+            internal byte[] Payload { get; }
+
+            [NotNull]
+            internal TaskCompletionSource<object> TaskCompletionSource { get; } =
+                new TaskCompletionSource<object>(TaskCreationOptions.RunContinuationsAsynchronously);
+
+            internal Frame(byte type, [NotNull] byte[] payload)
+            {
+                Type = type;
+                Payload = payload;
+            }
+        }
+
+        // Read-only stream of the received output. At most Window bytes are buffered (the native side has no more
+        // credit than that), and the credit is granted back as the output is read.
+        private sealed class ChannelOutputStream : Stream
+        {
+            private readonly PtyChannel _channel;
+            private readonly object _lock = new object();
+            private readonly Queue<byte[]> _chunks = new Queue<byte[]>();
+            private int _offset;
+            private int _consumed;
+            private bool _completed;
+            private TaskCompletionSource<bool> _waiter;
+
+            internal ChannelOutputStream([NotNull] PtyChannel channel) => _channel = channel;
+
+            internal void Add([NotNull] byte[] chunk)
+            {
+                TaskCompletionSource<bool> waiter;
+
+                lock (_lock)
+                {
+                    _chunks.Enqueue(chunk);
+
+                    waiter = _waiter;
+                    _waiter = null;
+                }
+
+                waiter?.TrySetResult(true);
+            }
+
+            internal void Complete()
+            {
+                TaskCompletionSource<bool> waiter;
+
+                lock (_lock)
+                {
+                    _completed = true;
+
+                    waiter = _waiter;
+                    _waiter = null;
+                }
+
+                waiter?.TrySetResult(true);
+            }
+
+            public override bool CanRead => true;
+
+            public override bool CanSeek => false;
+
+            public override bool CanWrite => false;
+
+            public override long Length => throw new NotSupportedException();
+
+            public override long Position
+            {
+                get => throw new NotSupportedException();
+                set => throw new NotSupportedException();
+            }
+
+            public override int Read(byte[] buffer, int offset, int count) =>
+                ReadAsync(buffer, offset, count, CancellationToken.None).GetAwaiter().GetResult();
+
+            public override async Task<int> ReadAsync(byte[] buffer, int offset, int count,
+                CancellationToken cancellationToken)
+            {
+                while (true)
+                {
+                    Task wait;
+                    var read = 0;
+                    var grant = 0;
+
+                    lock (_lock)
+                    {
+                        while (read < count && _chunks.Any())
+                        {
+                            var chunk = _chunks.Peek();
+                            var length = Math.Min(count - read, chunk.Length - _offset);
+
+                            Array.Copy(chunk, _offset, buffer, offset + read, length);
+
+                            read += length;
+                            _offset += length;
+
+                            if (_offset < chunk.Length)
+                                continue;
+
+                            _chunks.Dequeue();
+                            _offset = 0;
+                        }
+
+                        if (read > 0 || _completed || count == 0)
+                        {
+                            _consumed += read;
+
+                            if (_consumed >= CreditBatch)
+                            {
+                                grant = _consumed;
+                                _consumed = 0;
+                            }
+
+                            wait = null;
+                        }
+                        else
+                        {
+                            if (_waiter == null)
+                                _waiter = new TaskCompletionSource<bool>(
+                                    TaskCreationOptions.RunContinuationsAsynchronously);
+
+                            wait = _waiter.Task;
+                        }
+                    }
+
+                    if (wait == null)
+                    {
+                        if (grant > 0)
+                            _channel.Consumed(grant);
+
+                        return read;
+                    }
+
+                    await Task.WhenAny(wait, Task.Delay(Timeout.Infinite, cancellationToken)).ConfigureAwait(false);
+
+                    cancellationToken.ThrowIfCancellationRequested();
+                }
+            }
+
+            public override void Flush()
+            {
+            }
+
+            public override long Seek(long offset, SeekOrigin origin) => throw new NotSupportedException();
+
+            public override void SetLength(long value) => throw new NotSupportedException();
+
+            public override void Write(byte[] buffer, int offset, int count) => throw new NotSupportedException();
+        }
+
+        #endregion Nested types
+    }
+}
@@ -0,0 +1,70 @@
+﻿using System;
+using System.Collections.Generic;
+// ReSharper disable MemberCanBePrivate.Global
+// ReSharper disable UnusedMember.Global
+
+namespace PtyClr
+{
+    /// <summary>
+    /// Snapshot of the runtime counters of a PTY session, returned by <see cref="Pty.GetStatsAsync"/>. Counters that
+    /// the native side doesn't provide (an older version) are 0.
+    /// </summary>
+    public class PtyStats
+    {
+        internal PtyStats(ulong[] counters)
+        {
+            Counters = counters ?? throw new ArgumentNullException(nameof(counters));
+        }
+
+        /// <summary>
+        /// All the counters, in the order defined by the native side (<c>stats.h</c>).
+        /// </summary>
+        public IReadOnlyList<ulong> Counters { get; }
+
+        public ulong LoopIterations => Get(0);
+        public ulong IdleWakeups => Get(1);
+        public ulong PtyReads => Get(2);
+        public ulong PtyBytesRead => Get(3);
+        public ulong OutputWrites => Get(4);
+        public ulong OutputBytesWritten => Get(5);
+        public ulong OutputStalls => Get(6);
+        public TimeSpan OutputStallDuration => TimeSpan.FromTicks((long)Get(7) * 10);
+        public ulong InputReads => Get(8);
+        public ulong InputBytesRead => Get(9);
+        public ulong RecordReads => Get(10);
+        public ulong KeyRecords => Get(11);
+        public ulong MouseRecords => Get(12);
+        public ulong ResizeRecords => Get(13);
+        public ulong OtherRecords => Get(14);
+        public ulong PtyWrites => Get(15);
+        public ulong PtyBytesWritten => Get(16);
+        public ulong PingCommands => Get(17);
+        public ulong GetWinSizeCommands => Get(18);
+        public ulong SetWinSizeCommands => Get(19);
+        public ulong GetAttributesCommands => Get(20);
+        public ulong SetAttributesCommands => Get(21);
+        public ulong GetStatsCommands => Get(22);
+        public ulong UnknownCommands => Get(23);
+        public ulong OutputBufferHighWater => Get(24);
+        public ulong PtyReadHighWater => Get(25);
+        public ulong KeyBatchHighWater => Get(26);
+        public ulong ChannelReads => Get(27);
+        public ulong ChannelFlushes => Get(28);
+        public ulong ChannelCreditWaits => Get(29);
+        public ulong HostSessionsStarted => Get(30);
+        public ulong HostSessionsFinished => Get(31);
+        public ulong PoolHits => Get(32);
+        public ulong PoolMisses => Get(33);
+        public TimeSpan PoolHitStartDuration => TimeSpan.FromTicks((long)Get(34) * 10);
+        public TimeSpan PoolMissStartDuration => TimeSpan.FromTicks((long)Get(35) * 10);
+        public ulong PoolShellsLaunched => Get(36);
+        public ulong PoolWarmShells => Get(37);
+        public ulong GetScrollbackCommands => Get(38);
+        public ulong OutputHighWaterCrossings => Get(39);
+        public ulong OutputLowWaterCrossings => Get(40);
+        public ulong OutputBytesDropped => Get(41);
+        public ulong PtyWriteStalls => Get(42);
+
+        private ulong Get(int index) => index < Counters.Count ? Counters[index] : 0;
+    }
+}
@@ -0,0 +1,197 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// Keystroke-to-echo latency: keystrokes are injected at a fixed rate into `--ins` (bytes) or `--inr` (key event
+// records), a `cat` behind a real PTY echoes them, and the time until each one shows up in `--out` is recorded.
+// Scenarios:
+// 1. Idle: nothing else is happening.
+// 2. Flood: `yes` is writing to the same PTY the whole time.
+// 3. Resize storm: the window size is changed (through the command pipes) every RESIZE_INTERVAL_MICROSECONDS.
+// Usage: bench_echo_latency [keystrokes] [keystrokes_per_second] [coalesce_delay_us]
+
+#include "bench_helpers.h"
+
+#include "../file_helpers.h"
+#include "../helpers.h"
+#include "../io_processor.h"
+#include "../logging.h"
+
+#include <atomic>
+#include <pthread.h>
+
+#define RESIZE_INTERVAL_MICROSECONDS 1000
+#define ECHO_TIMEOUT_MICROSECONDS 10000000
+#define SET_WINSIZE_COMMAND 3
+// Keystrokes cycle through these; the flood (`yes`) writes only 'y' and '\n'.
+#define FIRST_KEY 'a'
+#define KEY_COUNT 24
+
+enum scenario {
+    SCENARIO_IDLE,
+    SCENARIO_FLOOD,
+    SCENARIO_RESIZE_STORM
+};
+
+struct session {
+    int pty_fd;
+    int slave_pid;
+    int in_pipe[2];
+    int out_pipe[2];
+    int cin_pipe[2];
+    int cout_pipe[2];
+    bool records;
+    long long* sent_at;
+    std::atomic<int> echoed;
+    std::atomic<bool> stopping;
+    latency_histogram histogram;
+};
+
+static void* run_thread(void* arg) {
+    auto& s = *(session*) arg;
+    run(s.pty_fd, s.slave_pid, s.records ? -1 : s.in_pipe[0], s.records ? s.in_pipe[0] : -1, s.out_pipe[1],
+        s.cin_pipe[0], s.cout_pipe[1]);
+    close(s.out_pipe[1]);
+    return nullptr;
+}
+
+// Matches echoed keys (in order) to the time they were sent.
+static void* reader_thread(void* arg) {
+    auto& s = *(session*) arg;
+    static char buffer[64 * 1024];
+    ssize_t count;
+    while ((count = read(s.out_pipe[0], buffer, sizeof(buffer))) > 0) {
+        const auto now = monotonic_microseconds();
+        auto echoed = s.echoed.load(std::memory_order_relaxed);
+        for (auto i = 0; i < count; ++i)
+            if (buffer[i] >= FIRST_KEY && buffer[i] < FIRST_KEY + KEY_COUNT)
+                histogram_record(s.histogram, now - s.sent_at[echoed++]);
+        s.echoed.store(echoed, std::memory_order_release);
+    }
+    return nullptr;
+}
+
+static void* resize_thread(void* arg) {
+    auto& s = *(session*) arg;
+    auto wide{false};
+    while (!s.stopping.load()) {
+        const char command{SET_WINSIZE_COMMAND};
+        char response{0};
+        wide = !wide;
+        if (!write_bytes(s.cin_pipe[1], &command, 1) || !write_unsigned_short(s.cin_pipe[1], wide ? 132 : 80)
+            || !write_unsigned_short(s.cin_pipe[1], wide ? 50 : 25) || read(s.cout_pipe[0], &response, 1) != 1)
+            break;
+        usleep(RESIZE_INTERVAL_MICROSECONDS);
+    }
+    return nullptr;
+}
+
+static bool send_key(const session& s, char key) {
+    if (!s.records)
+        return write_bytes(s.in_pipe[1], &key, 1);
+    INPUT_RECORD record{};
+    record.EventType = KEY_EVENT;
+    record.Event.KeyEvent.bKeyDown = 1;
+    record.Event.KeyEvent.wRepeatCount = 1;
+    record.Event.KeyEvent.uChar.UnicodeChar = (WCHAR) key;
+    return write_bytes(s.in_pipe[1], (char*) &record, (int) sizeof(record));
+}
+
+static bool start_session(session& s, scenario kind) {
+    // Nothing may be inherited by the shell, or the pipes wouldn't be closed when `run` is done.
+    if (pipe2(s.in_pipe, O_CLOEXEC) != 0 || pipe2(s.out_pipe, O_CLOEXEC) != 0 || pipe2(s.cin_pipe, O_CLOEXEC) != 0
+        || pipe2(s.cout_pipe, O_CLOEXEC) != 0) {
+        printf("Failed to create the pipes.\n");
+        return false;
+    }
+    // Raw mode without echo: `cat` does the echoing, as a shell's line editor would.
+    termios terminal{};
+    cfmakeraw(&terminal);
+    cfsetispeed(&terminal, B38400);
+    cfsetospeed(&terminal, B38400);
+    terminal.c_cflag |= CREAD; // NOLINT(hicpp-signed-bitwise)
+    terminal.c_cc[VMIN] = 1;
+    winsize win_size{.ws_row = 25, .ws_col = 80, .ws_xpixel = 0, .ws_ypixel = 0};
+    s.slave_pid = forkpty(&s.pty_fd, nullptr, &terminal, &win_size);
+    if (s.slave_pid < 0) {
+        printf("'forkpty' failed.\n");
+        return false;
+    }
+    if (s.slave_pid == 0) {
+        execlp("sh", "sh", "-c", kind == SCENARIO_FLOOD ? "yes & exec cat" : "exec cat", nullptr);
+        _exit(1);
+    }
+    return true;
+}
+
+static void measure(const char* name, scenario kind, bool records, int keystrokes, int rate) {
+    auto& s = *(session*) calloc(1, sizeof(session));
+    s.records = records;
+    s.sent_at = (long long*) calloc(keystrokes, sizeof(long long));
+    histogram_clear(s.histogram);
+    if (!start_session(s, kind))
+        return;
+    pthread_t run_id;
+    pthread_t reader_id;
+    pthread_t resize_id;
+    pthread_create(&run_id, nullptr, run_thread, &s);
+    pthread_create(&reader_id, nullptr, reader_thread, &s);
+    if (kind == SCENARIO_RESIZE_STORM)
+        pthread_create(&resize_id, nullptr, resize_thread, &s);
+    // Let the session settle (the shell is exec-ed, and the flood is going).
+    usleep(100000);
+    const auto interval = 1000000LL / rate;
+    auto next = monotonic_microseconds();
+    for (auto i = 0; i < keystrokes; ++i) {
+        const auto wait = next - monotonic_microseconds();
+        if (wait > 0)
+            usleep((useconds_t) wait);
+        next += interval;
+        s.sent_at[i] = monotonic_microseconds();
+        if (!send_key(s, (char) (FIRST_KEY + i % KEY_COUNT))) {
+            printf("Failed to send a keystroke.\n");
+            break;
+        }
+    }
+    const auto deadline = monotonic_microseconds() + ECHO_TIMEOUT_MICROSECONDS;
+    while (s.echoed.load(std::memory_order_acquire) < keystrokes && monotonic_microseconds() < deadline)
+        usleep(1000);
+    s.stopping.store(true);
+    if (kind == SCENARIO_RESIZE_STORM)
+        pthread_join(resize_id, nullptr);
+    // The shell (and the flood) are in their own process group.
+    kill(-s.slave_pid, SIGKILL);
+    pthread_join(run_id, nullptr);
+    pthread_join(reader_id, nullptr);
+    if (s.echoed.load() < keystrokes)
+        printf("%-24s only %i of %i keystrokes echoed.\n", name, s.echoed.load(), keystrokes);
+    print_histogram_summary(name, s.histogram);
+    const int fds[]{s.in_pipe[0], s.in_pipe[1], s.out_pipe[0], s.cin_pipe[0], s.cin_pipe[1], s.cout_pipe[0],
+                    s.cout_pipe[1], s.pty_fd};
+    for (auto fd: fds)
+        close(fd);
+    free(s.sent_at);
+    free(&s);
+}
+
+int main(int argc, char** argv) {
+    _min_log_level = LOG_ERROR;
+    _debug_view = false;
+    const auto keystrokes = read_int_arg(argc, argv, 1, 2000);
+    const auto rate = read_int_arg(argc, argv, 2, 500);
+    _output_coalesce_delay_us = argc > 3 ? atoi(argv[3]) : 0;
+    printf("%i keystrokes at %i/s, output coalescing %s.\n", keystrokes, rate,
+           _output_coalesce_delay_us > 0 ? "enabled" : "disabled");
+    measure("--ins, idle", SCENARIO_IDLE, false, keystrokes, rate);
+    measure("--ins, flood", SCENARIO_FLOOD, false, keystrokes, rate);
+    measure("--ins, resize storm", SCENARIO_RESIZE_STORM, false, keystrokes, rate);
+    measure("--inr, idle", SCENARIO_IDLE, true, keystrokes, rate);
+    measure("--inr, flood", SCENARIO_FLOOD, true, keystrokes, rate);
+    measure("--inr, resize storm", SCENARIO_RESIZE_STORM, true, keystrokes, rate);
+    return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "bench_helpers.h"
+
+#include <sys/resource.h>
+
+static int compare_samples(const void* a, const void* b) {
+    const auto x = *(const long long*) a;
+    const auto y = *(const long long*) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void print_latency_summary(const char* name, long long* samples, int count) {
+    if (count <= 0) {
+        printf("%-24s no samples\n", name);
+        return;
+    }
+    qsort(samples, count, sizeof(long long), compare_samples);
+    long long total{0};
+    for (auto i = 0; i < count; ++i)
+        total += samples[i];
+    printf("%-24s n=%-6i min=%-8lli avg=%-8lli p50=%-8lli p99=%-8lli max=%-8lli (us)\n", name, count, samples[0],
+           total / count, samples[count / 2], samples[(count * 99) / 100], samples[count - 1]);
+}
+
+int read_int_arg(int argc, char** argv, int index, int default_value) {
+    if (index >= argc)
+        return default_value;
+    const auto value = atoi(argv[index]);
+    return value > 0 ? value : default_value;
+}
+
+static int histogram_index(long long value) {
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return value < 0 ? 0 : (int) value;
+    // value >> shift is in [HISTOGRAM_SUB_BUCKETS / 2, HISTOGRAM_SUB_BUCKETS)
+    const auto shift = 63 - __builtin_clzll((unsigned long long) value) - 6;
+    const auto index = HISTOGRAM_SUB_BUCKETS + (shift - 1) * (HISTOGRAM_SUB_BUCKETS / 2)
+                       + (int) (value >> shift) - HISTOGRAM_SUB_BUCKETS / 2;
+    return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+static long long histogram_upper_bound(int index) {
+    if (index < HISTOGRAM_SUB_BUCKETS)
+        return index;
+    const auto shift = (index - HISTOGRAM_SUB_BUCKETS) / (HISTOGRAM_SUB_BUCKETS / 2) + 1;
+    const auto sub_bucket = (index - HISTOGRAM_SUB_BUCKETS) % (HISTOGRAM_SUB_BUCKETS / 2) + HISTOGRAM_SUB_BUCKETS / 2;
+    return (((long long) sub_bucket + 1) << shift) - 1;
+}
+
+void histogram_clear(latency_histogram& histogram) {
+    memset(&histogram, 0, sizeof(histogram));
+}
+
+void histogram_record(latency_histogram& histogram, long long value) {
+    ++histogram.counts[histogram_index(value)];
+    if (histogram.total == 0 || value < histogram.min)
+        histogram.min = value;
+    if (value > histogram.max)
+        histogram.max = value;
+    ++histogram.total;
+}
+
+long long histogram_percentile(const latency_histogram& histogram, double percentile) {
+    auto target = (long long) (histogram.total * percentile / 100.0 + 0.999999);
+    if (target < 1)
+        target = 1;
+    long long seen{0};
+    for (auto i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram.counts[i];
+        if (seen >= target) {
+            const auto value = histogram_upper_bound(i);
+            return value < histogram.max ? value : histogram.max;
+        }
+    }
+    return histogram.max;
+}
+
+void print_histogram_summary(const char* name, const latency_histogram& histogram) {
+    if (histogram.total == 0) {
+        printf("%-24s no samples\n", name);
+        return;
+    }
+    printf("%-24s n=%-6lli min=%-7lli p50=%-7lli p99=%-7lli p99.9=%-7lli max=%-7lli (us)\n", name, histogram.total,
+           histogram.min, histogram_percentile(histogram, 50), histogram_percentile(histogram, 99),
+           histogram_percentile(histogram, 99.9), histogram.max);
+}
+
+long long cpu_microseconds() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return (long long) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+           + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
@@ -0,0 +1,44 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_BENCH_HELPERS_H
+#define PTYNATIVE_BENCH_HELPERS_H
+
+#include "../includes.h"
+
+// HDR-style histogram: values below HISTOGRAM_SUB_BUCKETS are recorded exactly, and larger ones with
+// HISTOGRAM_SUB_BUCKETS / 2 buckets per power of two (under 2% error).
+#define HISTOGRAM_SUB_BUCKETS 128
+#define HISTOGRAM_MAGNITUDES 40
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS + HISTOGRAM_MAGNITUDES * (HISTOGRAM_SUB_BUCKETS / 2))
+
+struct latency_histogram {
+    long long counts[HISTOGRAM_BUCKETS];
+    long long total;
+    long long min;
+    long long max;
+};
+
+void histogram_clear(latency_histogram& histogram);
+void histogram_record(latency_histogram& histogram, long long value);
+// Returns the (upper bound of the) value below which `percentile` % of the recorded values are.
+long long histogram_percentile(const latency_histogram& histogram, double percentile);
+// Prints min / p50 / p99 / p99.9 / max (in microseconds).
+void print_histogram_summary(const char* name, const latency_histogram& histogram);
+
+// Sorts the samples, and prints min / avg / p50 / p99 / max (in microseconds).
+void print_latency_summary(const char* name, long long* samples, int count);
+
+// Reads an optional positive integer argument, or returns default_value if it isn't specified.
+int read_int_arg(int argc, char** argv, int index, int default_value);
+
+// CPU time (user + system) used by this process so far.
+long long cpu_microseconds();
+
+#endif //PTYNATIVE_BENCH_HELPERS_H
@@ -0,0 +1,89 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// Key translation: the old per-record path (`wchar_to_char_string` + `write_exact` + `free` for every key) vs.
+// `key_translator` (in-place UTF-8 encoding, and one `write` per batch). The output goes to /dev/null, so the
+// numbers are dominated by conversion, allocation and syscall costs.
+// Usage: bench_key_translation [batches] [records_per_batch]
+
+#include "bench_helpers.h"
+
+#include "../helpers.h"
+#include "../key_translator.h"
+#include "../logging.h"
+
+// A mix of ASCII, 2-byte and 3-byte characters, as typed on a typical (non-English) keyboard.
+static const WCHAR sample_chars[]{u'a', u's', u'd', u'f', u' ', u'š', u'ć', u'J', u'€', u'\n'};
+#define SAMPLE_CHARS_COUNT ((int) (sizeof(sample_chars) / sizeof(sample_chars[0])))
+
+static bool old_path(int fd, const WCHAR* chars, int count) {
+    for (auto i = 0; i < count; ++i) {
+        char* char_string{nullptr};
+        auto success = wchar_to_char_string(CP_UTF8, &chars[i], &char_string, 1);
+        if (success)
+            success = write_exact(fd, char_string);
+        if (char_string)
+            free(char_string);
+        if (!success)
+            return false;
+    }
+    return true;
+}
+
+static bool new_path(key_translator& translator, const WCHAR* chars, int count) {
+    for (auto i = 0; i < count; ++i) {
+        auto repeat_count{1};
+        if (!key_translator_put_char(translator, chars[i], repeat_count))
+            return false;
+    }
+    return key_translator_flush(translator);
+}
+
+int main(int argc, char** argv) {
+    _min_log_level = LOG_ERROR;
+    const auto batches = read_int_arg(argc, argv, 1, 20000);
+    const auto batch_size = read_int_arg(argc, argv, 2, 16);
+    const auto fd = open("/dev/null", O_WRONLY); // NOLINT(hicpp-signed-bitwise)
+    if (fd < 0) {
+        printf("Failed to open /dev/null.\n");
+        return 1;
+    }
+    auto chars = (WCHAR*) malloc(batch_size * sizeof(WCHAR));
+    for (auto i = 0; i < batch_size; ++i)
+        chars[i] = sample_chars[i % SAMPLE_CHARS_COUNT];
+    auto old_samples = (long long*) malloc(batches * sizeof(long long));
+    auto new_samples = (long long*) malloc(batches * sizeof(long long));
+    key_translator translator{};
+    key_translator_init(translator, fd);
+    for (auto i = 0; i < batches; ++i) {
+        auto start = monotonic_microseconds();
+        old_path(fd, chars, batch_size);
+        old_samples[i] = monotonic_microseconds() - start;
+        start = monotonic_microseconds();
+        new_path(translator, chars, batch_size);
+        new_samples[i] = monotonic_microseconds() - start;
+    }
+    printf("%i batches of %i key records.\n", batches, batch_size);
+    printf("Writes per batch: old %i, new 1.\n", batch_size);
+    long long old_total{0};
+    long long new_total{0};
+    for (auto i = 0; i < batches; ++i) {
+        old_total += old_samples[i];
+        new_total += new_samples[i];
+    }
+    printf("Per record: old %.1f ns, new %.1f ns.\n", old_total * 1000.0 / ((double) batches * batch_size),
+           new_total * 1000.0 / ((double) batches * batch_size));
+    print_latency_summary("old: batch", old_samples, batches);
+    print_latency_summary("new: batch", new_samples, batches);
+    free(chars);
+    free(old_samples);
+    free(new_samples);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// Cost of trace logging on the output path, when tracing is disabled at runtime (`--log` above trace). It's built
+// twice: `bench_output_path` (trace calls compiled in) and `bench_output_path_notrace` (compiled out), so the
+// difference between the two is the cost of the disabled call sites.
+// 1. Isolated: the trace calls done per output chunk (PTY read + pump write), in a tight loop.
+// 2. End-to-end: a shell producing output through `run`, in CPU time per PTY_BUFFER_SIZE chunk.
+// Usage: bench_output_path [megabytes] [isolated_chunks]
+
+#include "bench_helpers.h"
+
+#include "../helpers.h"
+#include "../io_processor.h"
+#include "../logging.h"
+
+#include <pthread.h>
+
+#define CHUNK_SIZE 4096
+
+struct run_arguments {
+    int pty_fd;
+    int slave_pid;
+    int out_fd;
+};
+
+static void* run_thread(void* arg) {
+    const auto& arguments = *(run_arguments*) arg;
+    run(arguments.pty_fd, arguments.slave_pid, -1, -1, arguments.out_fd, -1, -1);
+    close(arguments.out_fd);
+    return nullptr;
+}
+
+static void measure_isolated(int chunks) {
+    const auto start = monotonic_microseconds();
+    for (auto i = 0; i < chunks; ++i) {
+        // The same calls (and arguments) as the output path does per chunk.
+        log(LOG_TRACE, "[process_output] There's something to read from PTY or it's closed.");
+        logf(LOG_TRACE, "[process_output] 'read' returned %i bytes.", CHUNK_SIZE);
+        logf(LOG_TRACE, "[output_pump_thread] Trying to write %zu bytes.", (size_t) CHUNK_SIZE);
+        logf(LOG_TRACE, "[output_pump_thread] %zu bytes successfully written to output.", (size_t) CHUNK_SIZE);
+    }
+    const auto elapsed = monotonic_microseconds() - start;
+    printf("Isolated: %i chunks, %.2f ns per chunk.\n", chunks, elapsed * 1000.0 / chunks);
+}
+
+static void measure_end_to_end(int megabytes) {
+    int out_pipe[2];
+    if (pipe(out_pipe) != 0) {
+        printf("Failed to create the output pipe.\n");
+        return;
+    }
+    char command[128];
+    snprintf(command, sizeof(command), "stty raw -echo; head -c %lli /dev/zero", (long long) megabytes * 1024 * 1024);
+    winsize win_size{.ws_row = 25, .ws_col = 80, .ws_xpixel = 0, .ws_ypixel = 0};
+    int pty_fd{-1};
+    const auto slave_pid = forkpty(&pty_fd, nullptr, nullptr, &win_size);
+    if (slave_pid < 0) {
+        printf("'forkpty' failed.\n");
+        return;
+    }
+    if (slave_pid == 0) {
+        execlp("sh", "sh", "-c", command, nullptr);
+        _exit(1);
+    }
+    const auto wall_start = monotonic_microseconds();
+    const auto cpu_start = cpu_microseconds();
+    run_arguments arguments{.pty_fd = pty_fd, .slave_pid = slave_pid, .out_fd = out_pipe[1]};
+    pthread_t thread;
+    pthread_create(&thread, nullptr, run_thread, &arguments);
+    char buffer[65536];
+    long long total{0};
+    ssize_t count;
+    while ((count = read(out_pipe[0], buffer, sizeof(buffer))) > 0)
+        total += count;
+    pthread_join(thread, nullptr);
+    const auto wall = monotonic_microseconds() - wall_start;
+    const auto cpu = cpu_microseconds() - cpu_start;
+    close(out_pipe[0]);
+    close(pty_fd);
+    const auto chunks = (double) total / CHUNK_SIZE;
+    printf("End-to-end: %lli bytes in %.1f ms (%.1f MB/s), %.3f us CPU per chunk (including the reader).\n", total,
+           wall / 1000.0, total / (double) wall, cpu / chunks);
+}
+
+int main(int argc, char** argv) {
+    // Tracing is disabled at runtime, what's measured is the cost of the call sites that remain.
+    _min_log_level = LOG_INFO;
+    _debug_view = false;
+    const auto megabytes = read_int_arg(argc, argv, 1, 200);
+    const auto isolated_chunks = read_int_arg(argc, argv, 2, 10000000);
+    printf("Trace logging %s.\n", LOG_COMPILED_MIN_LEVEL > LOG_TRACE ? "compiled out" : "compiled in (disabled)");
+    measure_isolated(isolated_chunks);
+    measure_end_to_end(megabytes);
+    return 0;
+}
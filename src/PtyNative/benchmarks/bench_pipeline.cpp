@@ -0,0 +1,243 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// End-to-end throughput of the I/O core (`run`), with synthetic producers and consumers on plain pipes:
+// 1. Output, PTY: a shell writes to PTY -> process_output -> output pump -> output pipe (read by the benchmark).
+// 2. Output, pipe: the same, with a pipe in place of PTY (closer to Cygwin / MSYS2, where PTY is backed by pipes).
+// 3. Input: the benchmark writes to the input pipe -> process_input -> PTY -> a shell that discards it.
+// For each: MB/s, I/O syscalls (read / write / poll, made by `run` and the output pump) per MB, and CPU per MB (of
+// this process, so including the synthetic endpoint, which is the same for every build).
+// Usage: bench_pipeline [megabytes] [runs]
+
+#include "bench_helpers.h"
+
+#include "../helpers.h"
+#include "../io_processor.h"
+#include "../logging.h"
+
+#include <atomic>
+#include <pthread.h>
+
+// Threads of the synthetic endpoints don't count their own syscalls.
+static thread_local bool _endpoint_thread{false};
+static std::atomic<long long> _syscalls{0};
+
+#ifdef BENCH_COUNT_SYSCALLS
+// The target is linked with `--wrap=read,--wrap=write,--wrap=poll`, so these see every call made by the I/O core.
+extern "C" {
+ssize_t __real_read(int fd, void* buffer, size_t count);
+ssize_t __real_write(int fd, const void* buffer, size_t count);
+int __real_poll(pollfd* fds, nfds_t count, int timeout);
+
+ssize_t __wrap_read(int fd, void* buffer, size_t count) {
+    if (!_endpoint_thread)
+        _syscalls.fetch_add(1, std::memory_order_relaxed);
+    return __real_read(fd, buffer, count);
+}
+
+ssize_t __wrap_write(int fd, const void* buffer, size_t count) {
+    if (!_endpoint_thread)
+        _syscalls.fetch_add(1, std::memory_order_relaxed);
+    return __real_write(fd, buffer, count);
+}
+
+int __wrap_poll(pollfd* fds, nfds_t count, int timeout) {
+    if (!_endpoint_thread)
+        _syscalls.fetch_add(1, std::memory_order_relaxed);
+    return __real_poll(fds, count, timeout);
+}
+}
+#endif
+
+enum scenario {
+    SCENARIO_OUTPUT_PTY,
+    SCENARIO_OUTPUT_PIPE,
+    SCENARIO_INPUT
+};
+
+struct run_arguments {
+    int pty_fd;
+    int slave_pid;
+    int in_fd;
+    int out_fd;
+};
+
+struct result {
+    double wall_us;
+    double cpu_us;
+    long long syscalls;
+    long long bytes;
+};
+
+static void* run_thread(void* arg) {
+    const auto& arguments = *(run_arguments*) arg;
+    run(arguments.pty_fd, arguments.slave_pid, arguments.in_fd, -1, arguments.out_fd, -1, -1);
+    close(arguments.out_fd);
+    return nullptr;
+}
+
+struct sink_arguments {
+    int fd;
+    long long total;
+};
+
+static void* sink_thread(void* arg) {
+    _endpoint_thread = true;
+    auto& arguments = *(sink_arguments*) arg;
+    static char buffer[1024 * 1024];
+    ssize_t count;
+    while ((count = read(arguments.fd, buffer, sizeof(buffer))) > 0)
+        arguments.total += count;
+    return nullptr;
+}
+
+// Starts `command` on a new PTY, in raw mode (so neither output nor input is transformed, and input isn't echoed).
+static int start_pty_shell(const char* command, int& slave_pid) {
+    termios terminal{};
+    cfmakeraw(&terminal);
+    cfsetispeed(&terminal, B38400);
+    cfsetospeed(&terminal, B38400);
+    terminal.c_cflag |= CREAD; // NOLINT(hicpp-signed-bitwise)
+    terminal.c_cc[VMIN] = 1;
+    winsize win_size{.ws_row = 25, .ws_col = 80, .ws_xpixel = 0, .ws_ypixel = 0};
+    int pty_fd{-1};
+    slave_pid = forkpty(&pty_fd, nullptr, &terminal, &win_size);
+    if (slave_pid < 0) {
+        printf("'forkpty' failed.\n");
+        return -1;
+    }
+    if (slave_pid == 0) {
+        execlp("sh", "sh", "-c", command, nullptr);
+        _exit(1);
+    }
+    return pty_fd;
+}
+
+// Starts `head` writing to a pipe. Returns the read end of the pipe (in place of PTY), or -1 on failure.
+static int start_pipe_source(long long bytes, int& slave_pid) {
+    int source_pipe[2];
+    if (pipe2(source_pipe, O_CLOEXEC) != 0) {
+        printf("Failed to create the source pipe.\n");
+        return -1;
+    }
+#ifdef F_SETPIPE_SZ
+    fcntl(source_pipe[0], F_SETPIPE_SZ, PTY_READ_MAX_DEFAULT_SIZE);
+#endif
+    char size[32];
+    snprintf(size, sizeof(size), "%lli", bytes);
+    slave_pid = fork();
+    if (slave_pid < 0) {
+        printf("'fork' failed.\n");
+        return -1;
+    }
+    if (slave_pid == 0) {
+        dup2(source_pipe[1], STDOUT_FILENO);
+        execlp("head", "head", "-c", size, "/dev/zero", nullptr);
+        _exit(1);
+    }
+    close(source_pipe[1]);
+    return source_pipe[0];
+}
+
+// Writes `bytes` to fd, from the calling (endpoint) thread.
+static void write_input(int fd, long long bytes) {
+    static char buffer[64 * 1024];
+    memset(buffer, 'x', sizeof(buffer));
+    while (bytes > 0) {
+        const auto count = write(fd, buffer, bytes < (long long) sizeof(buffer) ? (size_t) bytes : sizeof(buffer));
+        if (count <= 0) {
+            printf("Failed to write input.\n");
+            return;
+        }
+        bytes -= count;
+    }
+}
+
+static bool measure(scenario kind, long long bytes, result& measured) {
+    // The shell must not inherit the pipes, or `run` (and the sink) wouldn't see the other end closed.
+    int out_pipe[2];
+    int in_pipe[2]{-1, -1};
+    if (pipe2(out_pipe, O_CLOEXEC) != 0 || (kind == SCENARIO_INPUT && pipe2(in_pipe, O_CLOEXEC) != 0)) {
+        printf("Failed to create the pipes.\n");
+        return false;
+    }
+    char command[128];
+    int slave_pid{-1};
+    int pty_fd;
+    if (kind == SCENARIO_OUTPUT_PIPE)
+        pty_fd = start_pipe_source(bytes, slave_pid);
+    else {
+        if (kind == SCENARIO_OUTPUT_PTY)
+            snprintf(command, sizeof(command), "head -c %lli /dev/zero", bytes);
+        else
+            snprintf(command, sizeof(command), "head -c %lli > /dev/null", bytes);
+        pty_fd = start_pty_shell(command, slave_pid);
+    }
+    if (pty_fd < 0)
+        return false;
+    _syscalls.store(0);
+    const auto wall_start = monotonic_microseconds();
+    const auto cpu_start = cpu_microseconds();
+    run_arguments arguments{.pty_fd = pty_fd, .slave_pid = slave_pid, .in_fd = in_pipe[0], .out_fd = out_pipe[1]};
+    pthread_t thread;
+    pthread_create(&thread, nullptr, run_thread, &arguments);
+    sink_arguments sink{.fd = out_pipe[0], .total = 0};
+    if (kind == SCENARIO_INPUT) {
+        pthread_t sink_id;
+        pthread_create(&sink_id, nullptr, sink_thread, &sink);
+        write_input(in_pipe[1], bytes);
+        // The input stays open until the shell has consumed all of it and exited.
+        pthread_join(thread, nullptr);
+        pthread_join(sink_id, nullptr);
+        close(in_pipe[1]);
+        close(in_pipe[0]);
+    } else {
+        sink_thread(&sink);
+        pthread_join(thread, nullptr);
+    }
+    measured.wall_us = (double) (monotonic_microseconds() - wall_start);
+    measured.cpu_us = (double) (cpu_microseconds() - cpu_start);
+    measured.syscalls = _syscalls.load();
+    measured.bytes = kind == SCENARIO_INPUT ? bytes : sink.total;
+    close(out_pipe[0]);
+    close(pty_fd);
+    return true;
+}
+
+static void measure_series(const char* name, scenario kind, int megabytes, int runs) {
+    result best{};
+    for (auto i = 0; i < runs; ++i) {
+        result measured{};
+        if (!measure(kind, (long long) megabytes * 1024 * 1024, measured))
+            return;
+        if (i == 0 || measured.wall_us < best.wall_us)
+            best = measured;
+    }
+    const auto megabytes_moved = best.bytes / (1024.0 * 1024.0);
+    printf("%-14s %9.1f MB/s", name, best.bytes / best.wall_us);
+#ifdef BENCH_COUNT_SYSCALLS
+    printf(" %10.1f syscalls/MB", best.syscalls / megabytes_moved);
+#else
+    printf(" %10s syscalls/MB", "n/a");
+#endif
+    printf(" %10.1f us CPU/MB\n", best.cpu_us / megabytes_moved);
+}
+
+int main(int argc, char** argv) {
+    _endpoint_thread = true;
+    _min_log_level = LOG_ERROR;
+    _debug_view = false;
+    const auto megabytes = read_int_arg(argc, argv, 1, 100);
+    const auto runs = read_int_arg(argc, argv, 2, 3);
+    printf("%i MB per run, best of %i runs.\n", megabytes, runs);
+    measure_series("Output, PTY", SCENARIO_OUTPUT_PTY, megabytes, runs);
+    measure_series("Output, pipe", SCENARIO_OUTPUT_PIPE, megabytes, runs);
+    measure_series("Input", SCENARIO_INPUT, megabytes, runs);
+    return 0;
+}
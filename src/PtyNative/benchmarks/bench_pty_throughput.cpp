@@ -0,0 +1,138 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// Bulk output throughput (a shell producing output through `run`), with PTY reads fixed at PTY_READ_MIN_SIZE (the
+// old behavior), and with adaptive read sizing up to the default ceiling. It's measured with a real PTY, and with a
+// pipe in place of PTY (a Linux PTY never returns more than a few KB per read, while Cygwin / MSYS2 PTY is backed by
+// pipes, so the pipe is closer to what `run` reads from there).
+// Usage: bench_pty_throughput [megabytes] [runs]
+
+#include "bench_helpers.h"
+
+#include "../helpers.h"
+#include "../io_processor.h"
+#include "../logging.h"
+
+#include <pthread.h>
+
+struct run_arguments {
+    int pty_fd;
+    int slave_pid;
+    int out_fd;
+};
+
+static void* run_thread(void* arg) {
+    const auto& arguments = *(run_arguments*) arg;
+    run(arguments.pty_fd, arguments.slave_pid, -1, -1, arguments.out_fd, -1, -1);
+    close(arguments.out_fd);
+    return nullptr;
+}
+
+// Starts `head` writing to a pipe. Returns the read end of the pipe (in place of PTY), or -1 on failure.
+static int start_pipe_source(int megabytes, int& slave_pid) {
+    int source_pipe[2];
+    if (pipe2(source_pipe, O_CLOEXEC) != 0) {
+        printf("Failed to create the source pipe.\n");
+        return -1;
+    }
+#ifdef F_SETPIPE_SZ
+    fcntl(source_pipe[0], F_SETPIPE_SZ, PTY_READ_MAX_DEFAULT_SIZE);
+#endif
+    char size[32];
+    snprintf(size, sizeof(size), "%lli", (long long) megabytes * 1024 * 1024);
+    slave_pid = fork();
+    if (slave_pid < 0) {
+        printf("'fork' failed.\n");
+        return -1;
+    }
+    if (slave_pid == 0) {
+        dup2(source_pipe[1], STDOUT_FILENO);
+        execlp("head", "head", "-c", size, "/dev/zero", nullptr);
+        _exit(1);
+    }
+    close(source_pipe[1]);
+    return source_pipe[0];
+}
+
+// Starts a shell writing to PTY. Returns the master end, or -1 on failure.
+static int start_pty_source(int megabytes, int& slave_pid) {
+    char command[128];
+    snprintf(command, sizeof(command), "stty raw -echo; head -c %lli /dev/zero", (long long) megabytes * 1024 * 1024);
+    winsize win_size{.ws_row = 25, .ws_col = 80, .ws_xpixel = 0, .ws_ypixel = 0};
+    int pty_fd{-1};
+    slave_pid = forkpty(&pty_fd, nullptr, nullptr, &win_size);
+    if (slave_pid < 0) {
+        printf("'forkpty' failed.\n");
+        return -1;
+    }
+    if (slave_pid == 0) {
+        execlp("sh", "sh", "-c", command, nullptr);
+        _exit(1);
+    }
+    return pty_fd;
+}
+
+// Returns throughput in MB/s, or a negative value on failure.
+static double measure(bool use_pipe, int megabytes) {
+    int out_pipe[2];
+    // The shell must not inherit the write end, or the reader wouldn't see EOF when `run` is done.
+    if (pipe2(out_pipe, O_CLOEXEC) != 0) {
+        printf("Failed to create the output pipe.\n");
+        return -1;
+    }
+    int slave_pid{-1};
+    const auto pty_fd = use_pipe ? start_pipe_source(megabytes, slave_pid) : start_pty_source(megabytes, slave_pid);
+    if (pty_fd < 0) {
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return -1;
+    }
+    const auto start = monotonic_microseconds();
+    run_arguments arguments{.pty_fd = pty_fd, .slave_pid = slave_pid, .out_fd = out_pipe[1]};
+    pthread_t thread;
+    pthread_create(&thread, nullptr, run_thread, &arguments);
+    static char buffer[1024 * 1024];
+    long long total{0};
+    ssize_t count;
+    while ((count = read(out_pipe[0], buffer, sizeof(buffer))) > 0)
+        total += count;
+    pthread_join(thread, nullptr);
+    const auto elapsed = monotonic_microseconds() - start;
+    close(out_pipe[0]);
+    close(pty_fd);
+    return total / (double) elapsed;
+}
+
+static void measure_series(const char* name, bool use_pipe, size_t read_max_size, int megabytes, int runs) {
+    _pty_read_max_size = read_max_size;
+    auto best{0.0};
+    auto sum{0.0};
+    for (auto i = 0; i < runs; ++i) {
+        const auto throughput = measure(use_pipe, megabytes);
+        if (throughput < 0)
+            return;
+        sum += throughput;
+        if (throughput > best)
+            best = throughput;
+    }
+    printf("%-15s (reads up to %7zu bytes): avg %8.1f MB/s, best %8.1f MB/s\n", name, read_max_size, sum / runs, best);
+}
+
+int main(int argc, char** argv) {
+    _min_log_level = LOG_ERROR;
+    _debug_view = false;
+    const auto megabytes = read_int_arg(argc, argv, 1, 200);
+    const auto runs = read_int_arg(argc, argv, 2, 3);
+    printf("%i MB of shell output, %i runs each.\n", megabytes, runs);
+    measure_series("PTY, fixed", false, PTY_READ_MIN_SIZE, megabytes, runs);
+    measure_series("PTY, adaptive", false, PTY_READ_MAX_DEFAULT_SIZE, megabytes, runs);
+    measure_series("Pipe, fixed", true, PTY_READ_MIN_SIZE, megabytes, runs);
+    measure_series("Pipe, adaptive", true, PTY_READ_MAX_DEFAULT_SIZE, megabytes, runs);
+    return 0;
+}
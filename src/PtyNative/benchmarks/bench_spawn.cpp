@@ -0,0 +1,86 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// Spawn latency: fork launch mode (`forkpty`) vs. spawn launch mode (`openpty` + `posix_spawn` of the helper).
+// Measures the time from the launch call until the slave is ready to `exec` the shell (end of the handshake),
+// and until the shell has exited.
+// Usage: bench_spawn [iterations] [ballast_mb] [shell]
+// ballast_mb makes the parent bigger (touched heap), to show how fork cost grows with the parent's size.
+
+#include "bench_helpers.h"
+
+#include "../helpers.h"
+#include "../logging.h"
+#include "../shell_launcher.h"
+
+static void measure(int mode, int iterations, char** shell_argv) {
+    long long ready_samples[iterations];
+    long long exit_samples[iterations];
+    auto count{0};
+    for (auto i = 0; i < iterations; ++i) {
+        sync_channel sync{};
+        if (!sync_channel_create(sync))
+            break;
+        winsize win_size{.ws_row = 25, .ws_col = 80, .ws_xpixel = 0, .ws_ypixel = 0};
+        int pty_fd{-1};
+        const auto start = monotonic_microseconds();
+        const auto slave_pid = mode == LAUNCH_MODE_SPAWN
+                               ? launch_shell_spawn(pty_fd, win_size, sync, shell_argv, nullptr)
+                               : launch_shell_forkpty(pty_fd, win_size, sync, shell_argv, nullptr);
+        if (slave_pid < 0) {
+            sync_channel_close(sync);
+            break;
+        }
+        sync_channel_use_as_master(sync);
+        long long waited_us{0};
+        const auto ready = sync_channel_notify(sync.to_slave[1])
+                           && sync_channel_wait(sync.to_master[0], SYNC_TIMEOUT_MS, waited_us);
+        const auto ready_at = monotonic_microseconds();
+        int status{0};
+        waitpid(slave_pid, &status, 0);
+        const auto exited_at = monotonic_microseconds();
+        sync_channel_close(sync);
+        close(pty_fd);
+        if (!ready) {
+            printf("Handshake failed in iteration %i.\n", i);
+            break;
+        }
+        ready_samples[count] = ready_at - start;
+        exit_samples[count] = exited_at - start;
+        ++count;
+    }
+    const auto mode_name = mode == LAUNCH_MODE_SPAWN ? "spawn" : "fork";
+    char name[64];
+    snprintf(name, sizeof(name), "%s: ready", mode_name);
+    print_latency_summary(name, ready_samples, count);
+    snprintf(name, sizeof(name), "%s: shell exited", mode_name);
+    print_latency_summary(name, exit_samples, count);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], SLAVE_HELPER_ARG) == 0) {
+        run_slave_helper(argc - 1, argv + 1);
+        return EXIT_CODE_UNEXPECTED_HAPPENED;
+    }
+    _min_log_level = LOG_ERROR + 1;
+    const auto iterations = read_int_arg(argc, argv, 1, 200);
+    const auto ballast_mb = argc > 2 ? atoi(argv[2]) : 0;
+    char default_shell[]{"/bin/true"};
+    char* shell_argv[]{argc > 3 ? argv[3] : default_shell, nullptr};
+    if (ballast_mb > 0) {
+        const auto size = (size_t) ballast_mb * 1024 * 1024;
+        auto ballast = (char*) malloc(size);
+        if (ballast != nullptr)
+            memset(ballast, 1, size);
+    }
+    printf("Spawn latency, %i iterations, shell `%s`, parent ballast %i MB\n", iterations, shell_argv[0], ballast_mb);
+    measure(LAUNCH_MODE_FORK, iterations, shell_argv);
+    measure(LAUNCH_MODE_SPAWN, iterations, shell_argv);
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// Input starvation: the slave floods its output as fast as it's taken, and while it does, Ctrl+C is sent through
+// `--ins` (byte 3) or `--inr` (a Ctrl+C key event record). The time until it reaches the slave is recorded (the slave
+// reports it through a pipe). Backing:
+// 1. PTY: in the default (cooked) mode, so Ctrl+C reaches the slave as SIGINT.
+// 2. Pipe: a socket pair in place of PTY (closer to Cygwin / MSYS2, where PTY is backed by pipes). The reads are kept
+//    at PTY_READ_MIN_SIZE, so every read fills the buffer while the output keeps coming. The slave looks for byte 3 in
+//    its input.
+// Consumers:
+// 1. Fast: the output is read as fast as `run` writes it.
+// 2. Stalled: the output isn't read at all (the output ring fills up), until Ctrl+C has reached the slave.
+// Usage: bench_starvation [trials] [flood_ms]
+
+#include "bench_helpers.h"
+
+#include "../file_helpers.h"
+#include "../helpers.h"
+#include "../io_processor.h"
+#include "../logging.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#define FLOOD_CHUNK_SIZE (64 * 1024)
+#define DELIVERY_TIMEOUT_MICROSECONDS 5000000
+#define CTRL_C '\x03'
+#define VK_C 0x43
+
+struct session {
+    int pty_fd;
+    int slave_pid;
+    int in_pipe[2];
+    int out_pipe[2];
+    // The slave writes the time it got Ctrl+C here.
+    int report_pipe[2];
+    bool pipe_backed;
+    bool records;
+    std::atomic<bool> stalled;
+    std::atomic<long long> output_bytes;
+};
+
+static int _report_fd{-1};
+static int _writer_pid{-1};
+static char _chunk[FLOOD_CHUNK_SIZE];
+
+[[noreturn]] static void report_interrupt() {
+    const auto now = monotonic_microseconds();
+    write(_report_fd, &now, sizeof(now));
+    if (_writer_pid > 0)
+        kill(_writer_pid, SIGKILL);
+    _exit(0);
+}
+
+static void on_interrupt(int) {
+    report_interrupt();
+}
+
+static void init_slave(int report_fd) {
+    _report_fd = report_fd;
+    memset(_chunk, 'y', sizeof(_chunk));
+    for (auto i = 79; i < FLOOD_CHUNK_SIZE; i += 80)
+        _chunk[i] = '\n';
+}
+
+// PTY slave: writes to PTY (its stdout) until it gets SIGINT.
+[[noreturn]] static void flood_pty(int report_fd) {
+    init_slave(report_fd);
+    signal(SIGINT, on_interrupt);
+    while (true)
+        write(STDOUT_FILENO, _chunk, sizeof(_chunk));
+}
+
+// Pipe slave: its own child keeps the socket full (with blocking writes), while it reads the socket until byte 3 shows
+// up.
+[[noreturn]] static void flood_socket(int fd, int report_fd) {
+    init_slave(report_fd);
+    _writer_pid = fork();
+    if (_writer_pid == 0)
+        while (write(fd, _chunk, sizeof(_chunk)) > 0) {
+        }
+    if (_writer_pid <= 0)
+        _exit(1);
+    char input[256];
+    while (true) {
+        const auto count = read(fd, input, sizeof(input));
+        if (count > 0 && memchr(input, CTRL_C, count) != nullptr)
+            report_interrupt();
+        if (count == 0 || (count < 0 && errno != EINTR)) {
+            kill(_writer_pid, SIGKILL);
+            _exit(1);
+        }
+    }
+}
+
+static void* run_thread(void* arg) {
+    auto& s = *(session*) arg;
+    run(s.pty_fd, s.slave_pid, s.records ? -1 : s.in_pipe[0], s.records ? s.in_pipe[0] : -1, s.out_pipe[1], -1, -1);
+    close(s.out_pipe[1]);
+    return nullptr;
+}
+
+static void* reader_thread(void* arg) {
+    auto& s = *(session*) arg;
+    static char buffer[256 * 1024];
+    ssize_t count{0};
+    while (true) {
+        if (s.stalled.load()) {
+            usleep(1000);
+            continue;
+        }
+        if ((count = read(s.out_pipe[0], buffer, sizeof(buffer))) <= 0)
+            break;
+        s.output_bytes.fetch_add(count, std::memory_order_relaxed);
+    }
+    return nullptr;
+}
+
+static bool send_ctrl_c(const session& s) {
+    if (!s.records) {
+        const char ctrl_c{CTRL_C};
+        return write_bytes(s.in_pipe[1], &ctrl_c, 1);
+    }
+    INPUT_RECORD record{};
+    record.EventType = KEY_EVENT;
+    record.Event.KeyEvent.bKeyDown = 1;
+    record.Event.KeyEvent.wRepeatCount = 1;
+    record.Event.KeyEvent.wVirtualKeyCode = VK_C;
+    record.Event.KeyEvent.dwControlKeyState = LEFT_CTRL_PRESSED;
+    record.Event.KeyEvent.uChar.UnicodeChar = CTRL_C;
+    return write_bytes(s.in_pipe[1], (char*) &record, (int) sizeof(record));
+}
+
+static bool start_session(session& s) {
+    // Nothing may be inherited by the slave (but the report pipe), or the pipes wouldn't be closed when `run` is done.
+    if (pipe2(s.in_pipe, O_CLOEXEC) != 0 || pipe2(s.out_pipe, O_CLOEXEC) != 0 || pipe(s.report_pipe) != 0) {
+        printf("Failed to create the pipes.\n");
+        return false;
+    }
+    if (s.pipe_backed) {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) { // NOLINT(hicpp-signed-bitwise)
+            printf("'socketpair' failed.\n");
+            return false;
+        }
+        s.slave_pid = fork();
+        if (s.slave_pid < 0) {
+            printf("'fork' failed.\n");
+            return false;
+        }
+        if (s.slave_pid == 0)
+            flood_socket(sockets[1], s.report_pipe[1]);
+        close(sockets[1]);
+        s.pty_fd = sockets[0];
+    } else {
+        // The default (cooked) mode, so that Ctrl+C is turned into SIGINT by the line discipline.
+        winsize win_size{.ws_row = 25, .ws_col = 80, .ws_xpixel = 0, .ws_ypixel = 0};
+        s.slave_pid = forkpty(&s.pty_fd, nullptr, nullptr, &win_size);
+        if (s.slave_pid < 0) {
+            printf("'forkpty' failed.\n");
+            return false;
+        }
+        if (s.slave_pid == 0)
+            flood_pty(s.report_pipe[1]);
+    }
+    close(s.report_pipe[1]);
+    return true;
+}
+
+// Returns the delivery latency (in microseconds), or -1 if Ctrl+C didn't reach the slave in time.
+static long long trial(bool pipe_backed, bool records, bool stalled, int flood_ms, long long& output_bytes) {
+    auto& s = *(session*) calloc(1, sizeof(session));
+    s.pipe_backed = pipe_backed;
+    s.records = records;
+    s.stalled.store(stalled);
+    _pty_read_max_size = pipe_backed ? PTY_READ_MIN_SIZE : PTY_READ_MAX_DEFAULT_SIZE;
+    long long latency{-1};
+    if (!start_session(s)) {
+        free(&s);
+        return -1;
+    }
+    pthread_t run_id;
+    pthread_t reader_id;
+    pthread_create(&run_id, nullptr, run_thread, &s);
+    pthread_create(&reader_id, nullptr, reader_thread, &s);
+    usleep((useconds_t) flood_ms * 1000);
+    const auto sent_at = monotonic_microseconds();
+    if (send_ctrl_c(s)) {
+        pollfd source{.fd = s.report_pipe[0], .events = POLLIN, .revents = 0};
+        long long received_at{0};
+        if (poll(&source, 1, DELIVERY_TIMEOUT_MICROSECONDS / 1000) > 0
+            && read_bytes_fixed(s.report_pipe[0], (char*) &received_at, sizeof(received_at)))
+            latency = received_at - sent_at;
+    } else
+        printf("Failed to send Ctrl+C.\n");
+    // The output is drained, so that `run` can finish.
+    s.stalled.store(false);
+    if (latency < 0)
+        kill(s.slave_pid, SIGKILL);
+    pthread_join(run_id, nullptr);
+    pthread_join(reader_id, nullptr);
+    output_bytes = s.output_bytes.load();
+    const int fds[]{s.in_pipe[0], s.in_pipe[1], s.out_pipe[0], s.report_pipe[0], s.pty_fd};
+    for (auto fd: fds)
+        close(fd);
+    free(&s);
+    return latency;
+}
+
+static void measure(const char* name, bool pipe_backed, bool records, bool stalled, int trials, int flood_ms) {
+    auto samples = (long long*) calloc(trials, sizeof(long long));
+    auto delivered{0};
+    long long output_bytes{0};
+    for (auto i = 0; i < trials; ++i) {
+        long long trial_bytes{0};
+        const auto latency = trial(pipe_backed, records, stalled, flood_ms, trial_bytes);
+        output_bytes += trial_bytes;
+        if (latency >= 0)
+            samples[delivered++] = latency;
+    }
+    if (delivered < trials)
+        printf("%-24s Ctrl+C not delivered within %i ms in %i of %i trials.\n", name,
+               DELIVERY_TIMEOUT_MICROSECONDS / 1000, trials - delivered, trials);
+    if (delivered > 0)
+        print_latency_summary(name, samples, delivered);
+    printf("%-24s %.1f MB of output per trial.\n", name, (double) output_bytes / trials / (1024 * 1024));
+    free(samples);
+}
+
+int main(int argc, char** argv) {
+    _min_log_level = LOG_ERROR;
+    _debug_view = false;
+    const auto trials = read_int_arg(argc, argv, 1, 20);
+    const auto flood_ms = read_int_arg(argc, argv, 2, 200);
+    printf("%i trials, Ctrl+C sent after %i ms of flood.\n", trials, flood_ms);
+    measure("PTY, --ins, fast", false, false, false, trials, flood_ms);
+    measure("PTY, --ins, stalled", false, false, true, trials, flood_ms);
+    measure("PTY, --inr, fast", false, true, false, trials, flood_ms);
+    measure("PTY, --inr, stalled", false, true, true, trials, flood_ms);
+    measure("pipe, --ins, fast", true, false, false, trials, flood_ms);
+    measure("pipe, --ins, stalled", true, false, true, trials, flood_ms);
+    measure("pipe, --inr, fast", true, true, false, trials, flood_ms);
+    measure("pipe, --inr, stalled", true, true, true, trials, flood_ms);
+    return 0;
+}
@@ -0,0 +1,282 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "binary_log.h"
+
+#include "helpers.h"
+
+#include <atomic>
+#include <sched.h>
+
+// Twice the number of formats, so that open addressing stays fast.
+#define FORMAT_TABLE_SIZE (2 * BINARY_LOG_MAX_FORMATS)
+#define EVENT_FIXED_SIZE 15
+#define TEXT_FIXED_SIZE 12
+#define FORMAT_FIXED_SIZE 5
+
+struct binary_log_format {
+    const char* format;
+    unsigned char kinds[BINARY_LOG_MAX_ARGUMENTS];
+    int kinds_count;
+};
+
+// Format address -> id + 1 (0 while the id is being assigned).
+static std::atomic<const char*> _format_keys[FORMAT_TABLE_SIZE];
+static std::atomic<int> _format_ids[FORMAT_TABLE_SIZE];
+static binary_log_format _formats[BINARY_LOG_MAX_FORMATS];
+static std::atomic<int> _formats_count{0};
+static std::atomic<bool> _formats_written[BINARY_LOG_MAX_FORMATS];
+
+int binary_log_parse_format(const char* format, unsigned char* kinds, int max_kinds) {
+    auto count{0};
+    auto pos = format;
+    while ((pos = strchr(pos, '%')) != nullptr) {
+        ++pos;
+        if (*pos == '%') {
+            ++pos;
+            continue;
+        }
+        // Flags
+        while (*pos && strchr("-+ #0'", *pos))
+            ++pos;
+        // Width and precision (`*` takes an argument)
+        for (auto part = 0; part < 2; ++part) {
+            if (part == 1) {
+                if (*pos != '.')
+                    break;
+                ++pos;
+            }
+            if (*pos == '*') {
+                if (count == max_kinds)
+                    return -1;
+                kinds[count++] = BINARY_LOG_ARGUMENT_INT;
+                ++pos;
+            } else
+                while (*pos >= '0' && *pos <= '9')
+                    ++pos;
+        }
+        // Length modifier
+        auto l_count{0};
+        auto is_long_long{false};
+        auto is_long{false};
+        while (*pos && strchr("hlLqjzt", *pos)) {
+            if (*pos == 'l')
+                ++l_count;
+            else if (*pos == 'z' || *pos == 't')
+                is_long = true;
+            else if (*pos != 'h')
+                is_long_long = true;
+            ++pos;
+        }
+        is_long_long = is_long_long || l_count > 1;
+        is_long = !is_long_long && (is_long || l_count == 1);
+        unsigned char kind;
+        switch (*pos) {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                kind = is_long_long ? BINARY_LOG_ARGUMENT_LONG_LONG
+                                    : is_long ? BINARY_LOG_ARGUMENT_LONG : BINARY_LOG_ARGUMENT_INT;
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                if (is_long_long)
+                    // long double
+                    return -1;
+                kind = BINARY_LOG_ARGUMENT_DOUBLE;
+                break;
+            case 's':
+                kind = BINARY_LOG_ARGUMENT_STRING;
+                break;
+            case 'p':
+                kind = BINARY_LOG_ARGUMENT_POINTER;
+                break;
+            default:
+                // `%n`, wide chars / strings, or malformed
+                return -1;
+        }
+        if (count == max_kinds)
+            return -1;
+        kinds[count++] = kind;
+        ++pos;
+    }
+    return count;
+}
+
+int binary_log_format_id(const char* format, const unsigned char** kinds, int& kinds_count) {
+    auto index = (size_t) (((uintptr_t) format >> 3U) * 2654435761U) & (FORMAT_TABLE_SIZE - 1);
+    for (auto probe = 0; probe < FORMAT_TABLE_SIZE; ++probe, index = (index + 1) & (FORMAT_TABLE_SIZE - 1)) {
+        auto key = _format_keys[index].load(std::memory_order_acquire);
+        if (key == nullptr) {
+            if (!_format_keys[index].compare_exchange_strong(key, format, std::memory_order_acq_rel)) {
+                if (key != format)
+                    continue;
+            } else {
+                // We own the slot, so the format is registered by us.
+                auto id = _formats_count.fetch_add(1);
+                if (id >= BINARY_LOG_MAX_FORMATS)
+                    id = -1;
+                else {
+                    auto& entry = _formats[id];
+                    entry.format = format;
+                    entry.kinds_count = binary_log_parse_format(format, entry.kinds, BINARY_LOG_MAX_ARGUMENTS);
+                    if (entry.kinds_count < 0)
+                        id = -1;
+                }
+                _format_ids[index].store(id < 0 ? -1 : id + 1, std::memory_order_release);
+                key = format;
+            }
+        }
+        if (key != format)
+            continue;
+        int stored;
+        while ((stored = _format_ids[index].load(std::memory_order_acquire)) == 0)
+            // Another thread is registering the same format right now.
+            sched_yield();
+        if (stored < 0)
+            return -1;
+        *kinds = _formats[stored - 1].kinds;
+        kinds_count = _formats[stored - 1].kinds_count;
+        return stored - 1;
+    }
+    return -1;
+}
+
+void binary_log_reset_formats_written() {
+    for (auto& written : _formats_written)
+        written.store(false, std::memory_order_relaxed);
+}
+
+template<typename T>
+static inline char* put(char* pos, T value) {
+    memcpy(pos, &value, sizeof(T));
+    return pos + sizeof(T);
+}
+
+int binary_log_encode_header(char* buffer, int size) {
+    if (size < BINARY_LOG_HEADER_SIZE)
+        return 0;
+    timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    auto pos = buffer;
+    memcpy(pos, BINARY_LOG_MAGIC, BINARY_LOG_MAGIC_LENGTH);
+    pos += BINARY_LOG_MAGIC_LENGTH;
+    pos = put<unsigned int>(pos, BINARY_LOG_VERSION);
+    pos = put<unsigned int>(pos, BINARY_LOG_HEADER_SIZE);
+    pos = put<long long>(pos, (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000);
+    pos = put<long long>(pos, monotonic_microseconds());
+    return (int) (pos - buffer);
+}
+
+int binary_log_encode_format_once(char* buffer, int size, int id) {
+    if (id < 0 || id >= BINARY_LOG_MAX_FORMATS || _formats_written[id].load(std::memory_order_relaxed))
+        return 0;
+    const auto length = (int) strlen(_formats[id].format);
+    if (size < FORMAT_FIXED_SIZE + length || _formats_written[id].exchange(true))
+        return 0;
+    auto pos = buffer;
+    pos = put<unsigned char>(pos, BINARY_LOG_RECORD_FORMAT);
+    pos = put<unsigned short>(pos, (unsigned short) id);
+    pos = put<unsigned short>(pos, (unsigned short) length);
+    memcpy(pos, _formats[id].format, length);
+    return (int) (pos + length - buffer);
+}
+
+static char* put_string(char* pos, const char* end, const char* value) {
+    if (value == nullptr)
+        value = "(null)";
+    auto length = (int) strlen(value);
+    const auto available = (int) (end - pos) - (int) sizeof(unsigned short);
+    if (available < 0)
+        return nullptr;
+    if (length > available)
+        // Truncating (the same as text log does with long messages)
+        length = available;
+    pos = put<unsigned short>(pos, (unsigned short) length);
+    memcpy(pos, value, length);
+    return pos + length;
+}
+
+static char* put_event_header(char* pos, int level, unsigned char flags, int id, long long time_us) {
+    pos = put<unsigned char>(pos, BINARY_LOG_RECORD_EVENT);
+    pos = put<unsigned char>(pos, (unsigned char) level);
+    pos = put<unsigned char>(pos, flags);
+    pos = put<unsigned short>(pos, (unsigned short) id);
+    return put<long long>(pos, time_us);
+}
+
+static int finish_event(char* buffer, char* arguments_length, char* pos) {
+    put<unsigned short>(arguments_length, (unsigned short) (pos - arguments_length - sizeof(unsigned short)));
+    return (int) (pos - buffer);
+}
+
+int binary_log_encode_event(char* buffer, int size, int level, unsigned char flags, int id, long long time_us,
+                            const unsigned char* kinds, int kinds_count, va_list args) {
+    if (size < EVENT_FIXED_SIZE)
+        return 0;
+    const auto end = buffer + size;
+    auto pos = put_event_header(buffer, level, flags, id, time_us);
+    const auto arguments_length = pos;
+    pos += sizeof(unsigned short);
+    for (auto i = 0; i < kinds_count; ++i) {
+        switch (kinds[i]) {
+            case BINARY_LOG_ARGUMENT_INT:
+                if (end - pos < (int) sizeof(int))
+                    return 0;
+                pos = put<int>(pos, va_arg(args, int));
+                break;
+            case BINARY_LOG_ARGUMENT_LONG:
+                if (end - pos < (int) sizeof(long long))
+                    return 0;
+                pos = put<long long>(pos, (long long) va_arg(args, long));
+                break;
+            case BINARY_LOG_ARGUMENT_LONG_LONG:
+                if (end - pos < (int) sizeof(long long))
+                    return 0;
+                pos = put<long long>(pos, va_arg(args, long long));
+                break;
+            case BINARY_LOG_ARGUMENT_DOUBLE:
+                if (end - pos < (int) sizeof(double))
+                    return 0;
+                pos = put<double>(pos, va_arg(args, double));
+                break;
+            case BINARY_LOG_ARGUMENT_POINTER:
+                if (end - pos < (int) sizeof(long long))
+                    return 0;
+                pos = put<long long>(pos, (long long) (uintptr_t) va_arg(args, void*));
+                break;
+            default: // BINARY_LOG_ARGUMENT_STRING
+                pos = put_string(pos, end, va_arg(args, const char*));
+                if (pos == nullptr)
+                    return 0;
+                break;
+        }
+    }
+    return finish_event(buffer, arguments_length, pos);
+}
+
+int binary_log_encode_error_event(char* buffer, int size, int level, int id, long long time_us, int error,
+                                  const char* description) {
+    if (size < EVENT_FIXED_SIZE + (int) sizeof(int))
+        return 0;
+    auto pos = put_event_header(buffer, level, BINARY_LOG_FLAG_ERROR_SUFFIX, id, time_us);
+    const auto arguments_length = pos;
+    pos += sizeof(unsigned short);
+    pos = put<int>(pos, error);
+    pos = put_string(pos, buffer + size, description);
+    return pos == nullptr ? 0 : finish_event(buffer, arguments_length, pos);
+}
+
+int binary_log_encode_text(char* buffer, int size, int level, long long time_us, const char* text) {
+    if (size < TEXT_FIXED_SIZE)
+        return 0;
+    auto pos = buffer;
+    pos = put<unsigned char>(pos, BINARY_LOG_RECORD_TEXT);
+    pos = put<unsigned char>(pos, (unsigned char) level);
+    pos = put<long long>(pos, time_us);
+    pos = put_string(pos, buffer + size, text);
+    return pos == nullptr ? 0 : (int) (pos - buffer);
+}
@@ -0,0 +1,71 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_BINARY_LOG_H
+#define PTYNATIVE_BINARY_LOG_H
+
+#include "includes.h"
+
+// Binary log file layout (native byte order, it's decoded on the same machine by tools/blog_decode):
+//   header: magic (8), version (4), header size (4), realtime at start in us (8), monotonic at start in us (8)
+//   records, each starting with the record type (1):
+//     FORMAT: id (2), length (2), format string (length bytes, no terminating zero)
+//     EVENT:  level (1), flags (1), id (2), monotonic time in us (8), arguments length (2), arguments
+//     TEXT:   level (1), monotonic time in us (8), length (2), text (length bytes)
+//   Each argument is stored as its raw value: 4 bytes for INT, 8 for LONG / LONG_LONG / DOUBLE / POINTER, and
+//   length (2) + bytes for STRING.
+// A FORMAT record is written (once) before the first EVENT that uses it, but with more than one thread logging
+// it may come after it, so the decoder has to read all the formats first.
+
+#define BINARY_LOG_MAGIC "PTYBLOG1"
+#define BINARY_LOG_MAGIC_LENGTH 8
+#define BINARY_LOG_VERSION 1
+#define BINARY_LOG_HEADER_SIZE 32
+
+#define BINARY_LOG_RECORD_FORMAT 1
+#define BINARY_LOG_RECORD_EVENT 2
+#define BINARY_LOG_RECORD_TEXT 3
+
+// The event is logged by log_lin_error / log_win_error: the last two arguments (INT and STRING) are the error
+// code and its description, rendered as " Error: %i (%s)" after the format.
+#define BINARY_LOG_FLAG_ERROR_SUFFIX 1
+
+#define BINARY_LOG_ARGUMENT_INT 1
+#define BINARY_LOG_ARGUMENT_LONG 2
+#define BINARY_LOG_ARGUMENT_DOUBLE 3
+#define BINARY_LOG_ARGUMENT_STRING 4
+#define BINARY_LOG_ARGUMENT_POINTER 5
+#define BINARY_LOG_ARGUMENT_LONG_LONG 6
+
+#define BINARY_LOG_MAX_ARGUMENTS 16
+#define BINARY_LOG_MAX_FORMATS 1024
+
+// Parses printf format, and stores the kinds of its arguments (BINARY_LOG_ARGUMENT_*). Returns the number of
+// arguments, or -1 if the format isn't supported (too many arguments, `%n`...).
+int binary_log_parse_format(const char* format, unsigned char* kinds, int max_kinds);
+
+// Returns the id of the format (registering it if it's seen for the first time), or -1 if it can't be registered.
+// The format has to be a string literal, since it's identified by its address.
+int binary_log_format_id(const char* format, const unsigned char** kinds, int& kinds_count);
+
+// All the encoders return the number of bytes written to buffer, or 0 if it doesn't fit.
+int binary_log_encode_header(char* buffer, int size);
+// Encodes the FORMAT record for the id, if it isn't already written (otherwise returns 0 too).
+int binary_log_encode_format_once(char* buffer, int size, int id);
+int binary_log_encode_event(char* buffer, int size, int level, unsigned char flags, int id, long long time_us,
+                            const unsigned char* kinds, int kinds_count, va_list args);
+// EVENT with BINARY_LOG_FLAG_ERROR_SUFFIX (the format must have no arguments of its own).
+int binary_log_encode_error_event(char* buffer, int size, int level, int id, long long time_us, int error,
+                                  const char* description);
+int binary_log_encode_text(char* buffer, int size, int level, long long time_us, const char* text);
+
+// Resets "FORMAT record written" state (for a new log file).
+void binary_log_reset_formats_written();
+
+#endif //PTYNATIVE_BINARY_LOG_H
@@ -0,0 +1,253 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "channel.h"
+
+#include "file_helpers.h"
+#include "logging.h"
+#include "stats.h"
+
+#include <cstdint>
+#include <sys/uio.h>
+
+// The client may have CHANNEL_WINDOW of flow-controlled payload in flight, and the rest is room for the frames that
+// aren't flow-controlled.
+#define CHANNEL_RECEIVE_BUFFER_SIZE (2 * CHANNEL_WINDOW)
+#define CHANNEL_QUEUE_BUFFER_SIZE (64 * 1024)
+// Type of the frames that are consumed, but can't be dropped yet (there are frames before them that aren't).
+#define CHANNEL_FRAME_CONSUMED 0
+
+static void write_header(char* header, char type, int length) {
+    const auto frame_length = (uint32_t) (CHANNEL_FRAME_HEADER_SIZE - CHANNEL_FRAME_LENGTH_SIZE + length);
+    memcpy(header, &frame_length, sizeof(frame_length));
+    header[CHANNEL_FRAME_HEADER_SIZE - 1] = type;
+}
+
+bool channel_open(channel& chan, int in_fd, int out_fd) {
+    chan.in_fd = in_fd;
+    chan.out_fd = out_fd;
+    chan.received_count = 0;
+    chan.received_position = 0;
+    chan.queued_count = 0;
+    chan.queue_waiting = false;
+    chan.sending_count = 0;
+    chan.sending_position = 0;
+    chan.consumed = 0;
+    chan.wait_writable = nullptr;
+    chan.wait_context = nullptr;
+    chan.received = (char*) malloc(CHANNEL_RECEIVE_BUFFER_SIZE);
+    chan.queued = (char*) malloc(CHANNEL_QUEUE_BUFFER_SIZE);
+    chan.sending = (char*) malloc(CHANNEL_QUEUE_BUFFER_SIZE);
+    if (chan.received == nullptr || chan.queued == nullptr || chan.sending == nullptr) {
+        log(LOG_ERROR, "[channel_open] Failed to allocate the channel buffers.");
+        free(chan.received);
+        free(chan.queued);
+        free(chan.sending);
+        return false;
+    }
+    pthread_mutex_init(&chan.queue_lock, nullptr);
+    logf(LOG_DEBUG, "[channel_open] Channel opened (fd %i for reading, fd %i for writing).", in_fd, out_fd);
+    return true;
+}
+
+void channel_close(channel& chan) {
+    pthread_mutex_destroy(&chan.queue_lock);
+    free(chan.received);
+    free(chan.queued);
+    free(chan.sending);
+    chan.received = nullptr;
+    chan.queued = nullptr;
+    chan.sending = nullptr;
+}
+
+bool channel_can_receive(const channel& chan) {
+    return chan.received_count - chan.received_position < CHANNEL_RECEIVE_BUFFER_SIZE;
+}
+
+bool channel_receive(channel& chan) {
+    if (chan.received_position > 0) {
+        // Moving the unprocessed frames to the beginning.
+        memmove(chan.received, chan.received + chan.received_position, chan.received_count - chan.received_position);
+        chan.received_count -= chan.received_position;
+        chan.received_position = 0;
+    }
+    int read{0};
+    // Not peeking first: a closed pipe is ready too, and then the read reports it.
+    if (!read_bytes(chan.in_fd, chan.received + chan.received_count, CHANNEL_RECEIVE_BUFFER_SIZE - chan.received_count,
+                    &read))
+        return false;
+    chan.received_count += read;
+    stats_add(STATS_CHANNEL_READS, 1);
+    logf(LOG_TRACE, "[channel_receive] %i bytes received, %i bytes unprocessed.", read, chan.received_count);
+    return true;
+}
+
+// Size of the complete frame at the offset, 0 if it isn't complete, or -1 if it's invalid.
+static int frame_size(const channel& chan, int offset) {
+    const auto available = chan.received_count - offset;
+    if (available < CHANNEL_FRAME_LENGTH_SIZE)
+        return 0;
+    uint32_t frame_length{0};
+    memcpy(&frame_length, chan.received + offset, sizeof(frame_length));
+    if (frame_length < CHANNEL_FRAME_HEADER_SIZE - CHANNEL_FRAME_LENGTH_SIZE
+        || frame_length > CHANNEL_FRAME_HEADER_SIZE - CHANNEL_FRAME_LENGTH_SIZE + CHANNEL_CLIENT_MAX_PAYLOAD) {
+        logf(LOG_ERROR, "[frame_size] Invalid frame length: %u.", frame_length);
+        return -1;
+    }
+    return available < CHANNEL_FRAME_LENGTH_SIZE + (int) frame_length ? 0 : CHANNEL_FRAME_LENGTH_SIZE + (int) frame_length;
+}
+
+int channel_next(const channel& chan, int& position, char& type, const char*& payload, int& length) {
+    while (true) {
+        const auto offset = chan.received_position + position;
+        const auto size = frame_size(chan, offset);
+        if (size <= 0)
+            return size;
+        position += size;
+        type = chan.received[offset + CHANNEL_FRAME_HEADER_SIZE - 1];
+        if (type == CHANNEL_FRAME_CONSUMED)
+            continue;
+        payload = chan.received + offset + CHANNEL_FRAME_HEADER_SIZE;
+        length = size - CHANNEL_FRAME_HEADER_SIZE;
+        return 1;
+    }
+}
+
+void channel_consume(channel& chan, const char* payload) {
+    const auto header = (char*) payload - CHANNEL_FRAME_HEADER_SIZE;
+    const auto type = header[CHANNEL_FRAME_HEADER_SIZE - 1];
+    if (type == CHANNEL_FRAME_INPUT || type == CHANNEL_FRAME_RECORDS) {
+        uint32_t frame_length{0};
+        memcpy(&frame_length, header, sizeof(frame_length));
+        chan.consumed += (int) frame_length - (CHANNEL_FRAME_HEADER_SIZE - CHANNEL_FRAME_LENGTH_SIZE);
+    }
+    header[CHANNEL_FRAME_HEADER_SIZE - 1] = CHANNEL_FRAME_CONSUMED;
+}
+
+void channel_compact(channel& chan) {
+    // Dropping the consumed frames from the beginning.
+    while (true) {
+        const auto size = frame_size(chan, chan.received_position);
+        if (size <= 0 || chan.received[chan.received_position + CHANNEL_FRAME_HEADER_SIZE - 1] != CHANNEL_FRAME_CONSUMED)
+            break;
+        chan.received_position += size;
+    }
+    if (chan.received_position == chan.received_count) {
+        chan.received_position = 0;
+        chan.received_count = 0;
+    }
+}
+
+bool channel_has_room(channel& chan, int length) {
+    pthread_mutex_lock(&chan.queue_lock);
+    const auto room = chan.queued_count + CHANNEL_FRAME_HEADER_SIZE + length <= CHANNEL_QUEUE_BUFFER_SIZE;
+    if (!room)
+        chan.queue_waiting = true;
+    pthread_mutex_unlock(&chan.queue_lock);
+    return room;
+}
+
+bool channel_queue(channel& chan, char type, const char* payload, int length) {
+    pthread_mutex_lock(&chan.queue_lock);
+    const auto room = chan.queued_count + CHANNEL_FRAME_HEADER_SIZE + length <= CHANNEL_QUEUE_BUFFER_SIZE;
+    if (room) {
+        write_header(chan.queued + chan.queued_count, type, length);
+        memcpy(chan.queued + chan.queued_count + CHANNEL_FRAME_HEADER_SIZE, payload, length);
+        chan.queued_count += CHANNEL_FRAME_HEADER_SIZE + length;
+    } else
+        chan.queue_waiting = true;
+    pthread_mutex_unlock(&chan.queue_lock);
+    if (!room)
+        logf(LOG_TRACE, "[channel_queue] No room for a frame of %i bytes.", length);
+    return room;
+}
+
+bool channel_queue_credit(channel& chan) {
+    if (chan.consumed < CHANNEL_CREDIT_BATCH)
+        return false;
+    const auto credit = (uint32_t) chan.consumed;
+    if (!channel_queue(chan, CHANNEL_FRAME_CREDIT, (const char*) &credit, (int) sizeof(credit)))
+        // It's granted once there's room.
+        return false;
+    chan.consumed = 0;
+    return true;
+}
+
+// Takes the queued frames to be written (if the ones taken before are written). Returns false if there are none.
+static bool take_queued(channel& chan, bool& room_freed) {
+    room_freed = false;
+    if (chan.sending_position < chan.sending_count)
+        return true;
+    pthread_mutex_lock(&chan.queue_lock);
+    const auto taken = chan.queued_count > 0;
+    if (taken) {
+        const auto sending = chan.sending;
+        chan.sending = chan.queued;
+        chan.sending_count = chan.queued_count;
+        chan.sending_position = 0;
+        chan.queued = sending;
+        chan.queued_count = 0;
+        room_freed = chan.queue_waiting;
+        chan.queue_waiting = false;
+    }
+    pthread_mutex_unlock(&chan.queue_lock);
+    return taken;
+}
+
+bool channel_write_queued(channel& chan, bool& room_freed) {
+    if (!take_queued(chan, room_freed))
+        return true;
+    const auto result = write_bytes(chan.out_fd, chan.sending, chan.sending_count, chan.wait_writable,
+                                    chan.wait_context);
+    stats_add_shared(STATS_CHANNEL_FLUSHES, 1);
+    chan.sending_count = chan.sending_position = 0;
+    return result;
+}
+
+bool channel_has_queued(channel& chan) {
+    pthread_mutex_lock(&chan.queue_lock);
+    const auto queued = chan.queued_count > 0;
+    pthread_mutex_unlock(&chan.queue_lock);
+    return queued;
+}
+
+bool channel_send_queued(channel& chan) {
+    auto room_freed{false};
+    while (take_queued(chan, room_freed)) {
+        const auto written = write(chan.out_fd, chan.sending + chan.sending_position,
+                                   chan.sending_count - chan.sending_position);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                // The rest is written once out_fd is writable.
+                return true;
+            log_lin_error(LOG_ERROR, "[channel_send_queued] 'write' call failed.");
+            return false;
+        }
+        chan.sending_position += (int) written;
+        if (chan.sending_position == chan.sending_count) {
+            chan.sending_count = chan.sending_position = 0;
+            stats_add(STATS_CHANNEL_FLUSHES, 1);
+        }
+    }
+    return true;
+}
+
+bool channel_has_unsent(const channel& chan) {
+    return chan.sending_position < chan.sending_count || chan.queued_count > 0;
+}
+
+bool channel_write(channel& chan, char type, const char* payload, int length) {
+    char header[CHANNEL_FRAME_HEADER_SIZE];
+    write_header(header, type, length);
+    // Header and payload are written with a single call (unless the pipe takes only a part of them).
+    iovec vectors[]{{header, CHANNEL_FRAME_HEADER_SIZE}, {(void*) payload, (size_t) length}};
+    return write_vectors(chan.out_fd, vectors, 2, chan.wait_writable, chan.wait_context);
+}
@@ -0,0 +1,106 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_CHANNEL_H
+#define PTYNATIVE_CHANNEL_H
+
+#include "includes.h"
+
+#include <pthread.h>
+
+// Multiplexed channel (`--chan`): a single duplex pipe carries all the streams, as frames:
+//   [length: uint32][type: uint8][payload]
+// where length counts everything after the length field.
+#define CHANNEL_FRAME_OUTPUT 1  // Shell output (mediator -> client).
+#define CHANNEL_FRAME_INPUT 2   // Input bytes, as on `--ins` (client -> mediator).
+#define CHANNEL_FRAME_RECORDS 3 // Whole INPUT_RECORDs, as on `--inr` (client -> mediator).
+#define CHANNEL_FRAME_COMMAND 4 // Protocol 2 command / response frame, without its length field (both ways).
+#define CHANNEL_FRAME_CREDIT 5  // uint32: payload bytes the receiver of this frame may send more (both ways).
+#define CHANNEL_FRAME_EXIT 6    // Host control channel only: a session is over (see session_host.h).
+
+#define CHANNEL_FRAME_LENGTH_SIZE 4
+#define CHANNEL_FRAME_HEADER_SIZE 5
+// Largest payload of a frame sent by the client (100 input records), and by the mediator.
+#define CHANNEL_CLIENT_MAX_PAYLOAD 2000
+#define CHANNEL_MAX_PAYLOAD (64 * 1024)
+// Flow control: each side starts with this much credit, and may send OUTPUT (mediator), or INPUT and RECORDS
+// (client) payload only while it has credit left. The receiver grants the credit back (with a CREDIT frame) as it
+// consumes the payload. COMMAND and CREDIT frames aren't flow-controlled, and they may overtake the data frames that
+// wait for credit (or for the receiver), so that credit can always be granted.
+#define CHANNEL_WINDOW (256 * 1024)
+// Credit is granted back in chunks of at least this size (the sender never runs out of it while we're consuming).
+#define CHANNEL_CREDIT_BATCH (CHANNEL_WINDOW / 4)
+
+struct channel {
+    int in_fd;
+    int out_fd;
+    // Received frames, starting at received_position (the last one may be incomplete).
+    char* received;
+    int received_count;
+    int received_position;
+    // Frames queued by the I/O loop, which never waits for the channel: they're written by the output pump (see
+    // channel_write_queued), or without blocking (see channel_send_queued) if there's no pump.
+    char* queued;
+    int queued_count;
+    // Whether the loop is waiting for room to queue more.
+    bool queue_waiting;
+    // The queued frames that are being written (swapped with the queued ones), and how much of them is written.
+    char* sending;
+    int sending_count;
+    int sending_position;
+    // Payload consumed, but not granted back yet (loop only).
+    int consumed;
+    // Guards the queue (queued, queued_count and queue_waiting) between the I/O loop and the output pump.
+    pthread_mutex_t queue_lock;
+    // Called by the output pump's writes when out_fd is non-blocking, and it can't take more (see write_bytes).
+    bool (*wait_writable)(int fd, void* context);
+    void* wait_context;
+};
+
+bool channel_open(channel& chan, int in_fd, int out_fd);
+void channel_close(channel& chan);
+
+// Whether there's room to receive more (if not, the channel shouldn't be waited on until some frames are consumed).
+bool channel_can_receive(const channel& chan);
+// Reads whatever is available. Should be called only when in_fd is ready (so that it doesn't block). Fails if the
+// other end is closed.
+bool channel_receive(channel& chan);
+
+// Iterates over the received frames that aren't consumed yet (position starts at 0): returns 1 and sets the type and
+// the payload of the next complete frame, 0 if there are no more complete frames, or -1 if the frame is invalid (the
+// channel can't be used any more).
+int channel_next(const channel& chan, int& position, char& type, const char*& payload, int& length);
+// Marks the frame (returned by channel_next) as consumed, and counts its payload to be granted back. Frames may be
+// consumed out of order. The positions returned by channel_next stay valid until channel_compact is called.
+void channel_consume(channel& chan, const char* payload);
+// Drops the consumed frames from the beginning (called once the iteration over the frames is done).
+void channel_compact(channel& chan);
+
+// Whether a frame with up to `length` bytes of payload can be queued now. If it can't, the loop has to wait until the
+// queued frames are taken (the output pump wakes it then, see channel_write_queued).
+bool channel_has_room(channel& chan, int length);
+// Queues a frame. Returns false if there's no room for it.
+bool channel_queue(channel& chan, char type, const char* payload, int length);
+// Queues the credit that's due (if there's room for it). Returns true if it's queued.
+bool channel_queue_credit(channel& chan);
+
+// Output pump thread: writes the frames the loop has queued (blocking until they're written). room_freed is set if
+// the loop was waiting for room in the queue.
+bool channel_write_queued(channel& chan, bool& room_freed);
+// Output pump thread: whether there are queued frames to write.
+bool channel_has_queued(channel& chan);
+// Writes the queued frames as far as out_fd (which has to be non-blocking) takes them. Used by the loop when there's
+// no output pump (the host's control channel): the rest is written once out_fd is writable (see channel_has_unsent).
+bool channel_send_queued(channel& chan);
+bool channel_has_unsent(const channel& chan);
+
+// Writes a frame immediately (used by the output pump thread, which is the only one writing to out_fd then).
+bool channel_write(channel& chan, char type, const char* payload, int length);
+
+#endif //PTYNATIVE_CHANNEL_H
@@ -0,0 +1,95 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "child_watcher.h"
+
+#include "logging.h"
+
+#define WAKE_DRAIN_BUFFER_SIZE 64
+
+static int _child_pipe[2]{-1, -1};
+static struct sigaction _previous_action{};
+
+static void child_signal(int) {
+    // Only async-signal-safe calls here. The pipe is non-blocking, so if it's full the loop is notified already.
+    const auto saved_errno = errno;
+    const char wake_byte{1};
+    write(_child_pipe[1], &wake_byte, 1);
+    errno = saved_errno;
+}
+
+int child_watcher_start() {
+    if (pipe2(_child_pipe, O_CLOEXEC | O_NONBLOCK) != 0) { // NOLINT(hicpp-signed-bitwise)
+        log_lin_error(LOG_ERROR, "[child_watcher_start] 'pipe2' call failed.");
+        return -1;
+    }
+    struct sigaction action{};
+    action.sa_handler = child_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP; // NOLINT(hicpp-signed-bitwise)
+    if (sigaction(SIGCHLD, &action, &_previous_action) != 0) {
+        log_lin_error(LOG_ERROR, "[child_watcher_start] 'sigaction' call failed.");
+        close(_child_pipe[0]);
+        close(_child_pipe[1]);
+        return -1;
+    }
+    // The child may have terminated before the handler was installed, so the first check shouldn't wait for a signal.
+    child_signal(SIGCHLD);
+    return _child_pipe[0];
+}
+
+void child_watcher_stop() {
+    sigaction(SIGCHLD, &_previous_action, nullptr);
+    close(_child_pipe[0]);
+    close(_child_pipe[1]);
+    _child_pipe[0] = _child_pipe[1] = -1;
+}
+
+static void log_exit_status(int child_pid, int status) {
+    if (WIFEXITED(status)) {
+        const auto exit_code = WEXITSTATUS(status);
+        logf(LOG_INFO, "[child_watcher_reap] Slave process (PID=%i) terminated. Exit code: %i", child_pid, exit_code);
+    }
+    else if (WIFSIGNALED(status)) {
+        const auto sig = WTERMSIG(status);
+        logf(LOG_WARN, "[child_watcher_reap] Slave process (PID=%i) terminated by signal (%i): %s", child_pid, sig,
+             strsignal(sig));
+    }
+    else
+        logf(LOG_WARN, "[child_watcher_reap] Slave process (PID=%i) terminated. Status: %i", child_pid, status);
+}
+
+bool child_watcher_check(int watcher_fd, int child_pid, int& status) {
+    child_watcher_clear(watcher_fd);
+    return child_watcher_reap(child_pid, status);
+}
+
+void child_watcher_clear(int watcher_fd) {
+    char buff[WAKE_DRAIN_BUFFER_SIZE];
+    while (read(watcher_fd, buff, WAKE_DRAIN_BUFFER_SIZE) == WAKE_DRAIN_BUFFER_SIZE) {
+    }
+}
+
+bool child_watcher_reap(int child_pid, int& status) {
+    status = 0;
+    while (true) {
+        const auto wait_rc = waitpid(child_pid, &status, WNOHANG);
+        if (wait_rc == child_pid) {
+            log_exit_status(child_pid, status);
+            return true;
+        }
+        if (wait_rc == 0)
+            // Some other child (or a stop / continue), the slave is still running.
+            return false;
+        if (errno == EINTR)
+            continue;
+        log_lin_error(LOG_WARN, "[child_watcher_reap] 'waitpid' call failed. Assuming the slave process is gone.");
+        return true;
+    }
+}
@@ -0,0 +1,29 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_CHILD_WATCHER_H
+#define PTYNATIVE_CHILD_WATCHER_H
+
+#include "includes.h"
+
+// Child process termination as an I/O event: SIGCHLD handler writes to a (self) pipe, and the returned fd becomes
+// readable. Returns -1 on failure.
+int child_watcher_start();
+void child_watcher_stop();
+
+// Consumes the pending notifications, and reaps the child if it has terminated. Returns true (once, with its exit
+// status logged and stored in `status`) if the child is gone.
+bool child_watcher_check(int watcher_fd, int child_pid, int& status);
+
+// The two parts of child_watcher_check, for watching many children: the notifications are consumed once, and then
+// each child is checked.
+void child_watcher_clear(int watcher_fd);
+bool child_watcher_reap(int child_pid, int& status);
+
+#endif //PTYNATIVE_CHILD_WATCHER_H
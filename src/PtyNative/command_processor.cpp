@@ -10,17 +10,52 @@
 #include "command_processor.h"
 
 #include "file_helpers.h"
+#include "helpers.h"
 #include "logging.h"
+#include "stats.h"
+
+#include <cstdint>
 
 #define PING_PONG_COMMAND 1
 #define GET_WINSIZE_COMMAND 2
 #define SET_WINSIZE_COMMAND 3
 #define GET_TERMIOS_COMMAND 4
 #define SET_TERMIOS_COMMAND 5
+#define GET_STATS_COMMAND 6
+#define PROTOCOL_COMMAND 7
+#define GET_SCROLLBACK_COMMAND 8
 
 #define SUCCESS_BYTE 0
 #define FAILURE_BYTE 1
 
+// Get-scrollback command arguments: where the page starts, the count (uint32), and the position (uint64). The
+// scrollback is returned in pages, so that a big one doesn't hold up the other streams: the first page starts at the
+// last count bytes or lines (all of them if count is 0), and the next ones (SCROLLBACK_FROM) at the position where
+// the previous one ended. The result is the position of the first byte returned, and the position after the newest
+// byte (both uint64), followed by up to SCROLLBACK_PAGE_MAX_SIZE bytes. Positions count all the output appended to the
+// scrollback, so they stay valid while more is appended (until the bytes are overwritten). Protocol 2 only.
+#define SCROLLBACK_BYTES 0
+#define SCROLLBACK_LINES 1
+#define SCROLLBACK_FROM 2
+
+// Protocol 1: a command is an opcode byte followed by its fixed-size arguments, and it's answered (before the next
+// one is read) by a status byte followed by the result (or the error message). The client can switch to protocol 2
+// with PROTOCOL_COMMAND (arguments: the highest version it supports, unsigned short; result: the version to use).
+// Protocol 2: both commands and responses are frames:
+//   [length: uint32][request id: uint32][opcode / status: uint8][arguments / result]
+// where length counts everything after the length field. A response carries the request id of its command.
+// In both protocols the commands are parsed from whatever bytes are available (nothing blocks waiting for the rest of
+// a command), all the complete ones are processed in one pass, and their responses are written together.
+#define PROTOCOL_VERSION_1 1
+#define PROTOCOL_VERSION_2 2
+
+#define FRAME_LENGTH_SIZE 4
+#define FRAME_HEADER_SIZE 9
+#define FRAME_MAX_SIZE COMMAND_FRAME_MAX_SIZE
+#define FRAME_RESPONSE_MAX_SIZE COMMAND_RESPONSE_MAX_SIZE
+#define FRAME_BUFFER_SIZE (16 * FRAME_MAX_SIZE)
+#define SCROLLBACK_PAGE_MAX_SIZE (FRAME_RESPONSE_MAX_SIZE - FRAME_HEADER_SIZE - 2 * (int) sizeof(uint64_t))
+
 // Static asserts, to assure that the structs aren't changed in the future
 #ifndef FROM_CLION_CMAKE
 #define termios_size 44
@@ -46,124 +81,403 @@ static_assert(sizeof(((winsize*)nullptr)->ws_row) == 2);
 static_assert(sizeof(((winsize*)nullptr)->ws_col) == 2);
 #endif
 
-static bool write_response(HANDLE h_cout, bool success, char* buff = nullptr, int length = 0) {
-    const char success_byte = success ? SUCCESS_BYTE : FAILURE_BYTE;
-    if (!write_bytes(h_cout, &success_byte, 1))
-        return false;
-    if (buff == nullptr) {
-        // If buff is nullptr, we ignore length
-        return true;
-    }
-    if (length <= 0) {
-        // If length isn't specified we'll assume that buff is string
-        length = strlen(buff);
-    }
-    return write_bytes(h_cout, buff, length);
+struct command_response {
+    bool success;
+    int length;
+    char result[FRAME_RESPONSE_MAX_SIZE - FRAME_HEADER_SIZE];
+};
+
+unsigned short _command_timeout_ms{COMMAND_TIMEOUT_DEFAULT_MS};
+
+static int _protocol_version{PROTOCOL_VERSION_1};
+// Bytes received that don't make a complete command yet, and when the first of them was received (0 if none).
+static char _command_bytes[FRAME_BUFFER_SIZE];
+static int _command_bytes_count{0};
+static long long _command_started_us{0};
+// Responses not written yet.
+static char _responses[FRAME_BUFFER_SIZE];
+static int _responses_count{0};
+
+static void set_success(command_response& response, const void* result = nullptr, int length = 0) {
+    response.success = true;
+    response.length = length;
+    if (length > 0)
+        memcpy(response.result, result, length);
+}
+
+// The message is a literal, or was formatted into a DEBUG_LOG_MAX_BUFFER buffer.
+static void set_failure(command_response& response, const char* message) {
+    response.success = false;
+    const auto length = strnlen(message, DEBUG_LOG_MAX_BUFFER);
+    response.length = (int) (length < sizeof(response.result) ? length : sizeof(response.result));
+    memcpy(response.result, message, response.length);
 }
 
-static bool process_ping_command(HANDLE h_cout) {
-    return write_response(h_cout, true);
+// Logs the failed call (with errno), and uses the message as the response.
+static void set_call_failure(command_response& response, const char* function_name, const char* call) {
+    char buff[DEBUG_LOG_MAX_BUFFER];
+    snprintf(buff, DEBUG_LOG_MAX_BUFFER, "[%s] '%s' call failed. Error: %i (%s)", function_name, call, errno,
+             strerror(errno));
+    log(LOG_ERROR, buff);
+    set_failure(response, buff);
 }
 
-static bool process_get_size_command(int pty_fd, HANDLE h_cout) {
+static void process_get_size_command(int pty_fd, command_response& response) {
     winsize win_size{};
     const auto result = ioctl(pty_fd, TIOCGWINSZ, &win_size); // NOLINT(hicpp-signed-bitwise)
     if (result == 0) {
         logf(LOG_DEBUG, "[process_get_size_command] 'ioctl' call succeeded (%i x %i)", win_size.ws_col,
                 win_size.ws_row);
-        return write_response(h_cout, true) && write_unsigned_short(h_cout, win_size.ws_col)
-               && write_unsigned_short(h_cout, win_size.ws_row);
+        const unsigned short size[]{win_size.ws_col, win_size.ws_row};
+        set_success(response, size, (int) sizeof(size));
+        return;
     }
-    char buff[DEBUG_LOG_MAX_BUFFER];
-    snprintf(buff, DEBUG_LOG_MAX_BUFFER, "[process_get_size_command] 'ioctl' call failed. Error: %i (%s)", errno,
-            strerror(errno));
-    log(LOG_ERROR, buff);
-    return write_response(h_cout, false, buff);
+    set_call_failure(response, "process_get_size_command", "ioctl");
 }
 
-static bool process_set_size_command(int pty_fd, HANDLE h_cin, HANDLE h_cout) {
-    unsigned short cols{0};
-    if (!read_unsigned_short(h_cin, cols))
-        return false;
-    unsigned short rows{0};
-    if (!read_unsigned_short(h_cin, rows))
-        return false;
+static void process_set_size_command(int pty_fd, const char* arguments, command_response& response) {
+    unsigned short size[2];
+    memcpy(size, arguments, sizeof(size));
     winsize win_size{};
-    win_size.ws_row = rows;
-    win_size.ws_col = cols;
+    win_size.ws_col = size[0];
+    win_size.ws_row = size[1];
     logf(LOG_TRACE, "[process_set_size_command] About to set size to (%i x %i)", win_size.ws_col, win_size.ws_row);
     const auto result = ioctl(pty_fd, TIOCSWINSZ, &win_size); // NOLINT(hicpp-signed-bitwise)
     if (result == 0) {
         logf(LOG_DEBUG, "[process_set_size_command] 'ioctl' call succeeded (%i x %i)", win_size.ws_col,
                          win_size.ws_row);
-        return write_response(h_cout, true);
+        set_success(response);
+        return;
     }
-    char buff[DEBUG_LOG_MAX_BUFFER];
-    snprintf(buff, DEBUG_LOG_MAX_BUFFER, "[process_set_size_command] 'ioctl' call failed. Error: %i (%s)", errno,
-            strerror(errno));
-    log(LOG_ERROR, buff);
-    return write_response(h_cout, false, buff);
+    set_call_failure(response, "process_set_size_command", "ioctl");
 }
 
-static bool process_get_termios_command(int pty_fd, HANDLE h_cout) {
+static void process_get_termios_command(int pty_fd, command_response& response) {
     termios t{};
     const auto result = tcgetattr(pty_fd, &t);
     if (result == 0) {
         log(LOG_DEBUG, "[process_get_termios_command] 'tcgetattr' call succeeded.");
-        return write_response(h_cout, true, (char*) &t, (int) sizeof(termios));
+        set_success(response, &t, (int) sizeof(termios));
+        return;
     }
-    char buff[DEBUG_LOG_MAX_BUFFER];
-    snprintf(buff, DEBUG_LOG_MAX_BUFFER, "[process_get_termios_command] 'tcgetattr' call failed. Error: %i (%s)", errno,
-            strerror(errno));
-    log(LOG_ERROR, buff);
-    return write_response(h_cout, false, buff);
+    set_call_failure(response, "process_get_termios_command", "tcgetattr");
 }
 
-static bool process_set_termios_command(int pty_fd, HANDLE h_cin, HANDLE h_cout) {
+static void process_set_termios_command(int pty_fd, const char* arguments, command_response& response) {
     termios t{};
-    if (!read_bytes_fixed(h_cin, (char*) &t, (int) sizeof(termios)))
-        return false;
+    memcpy(&t, arguments, sizeof(termios));
     const auto result = tcsetattr(pty_fd, TCSANOW, &t);
     if (result == 0) {
         log(LOG_DEBUG, "[process_set_termios_command] 'tcsetattr' call succeeded.");
-        return write_response(h_cout, true);
+        set_success(response);
+        return;
     }
-    char buff[DEBUG_LOG_MAX_BUFFER];
-    snprintf(buff, DEBUG_LOG_MAX_BUFFER, "[process_set_termios_command] 'tcsetattr' call failed. Error: %i (%s)", errno,
-            strerror(errno));
-    log(LOG_ERROR, buff);
-    return write_response(h_cout, false, buff);
+    set_call_failure(response, "process_set_termios_command", "tcsetattr");
 }
 
-bool process_commands(int pty_fd, HANDLE h_cin, HANDLE h_cout) {
-    if (h_cin == nullptr)
-        return true;
-    char single_byte[1];
-    DWORD read{0};
-    if (!try_read_bytes_fixed(h_cin, single_byte, 1, &read))
-        return false;
-    if (read < 1)
-        return true;
-    switch (single_byte[0]) {
+static void process_get_stats_command(command_response& response) {
+    response.success = true;
+    response.length = serialize_stats(response.result);
+}
+
+static void process_get_scrollback_command(const scrollback_ring& scrollback, const char* arguments,
+                                           command_response& response) {
+    if (scrollback.data == nullptr) {
+        set_failure(response, "[process_get_scrollback_command] Scrollback isn't enabled.");
+        return;
+    }
+    uint32_t count{0};
+    uint64_t position{0};
+    memcpy(&count, arguments + 1, sizeof(count));
+    memcpy(&position, arguments + 1 + sizeof(count), sizeof(position));
+    // Position of the oldest byte.
+    const uint64_t oldest = scrollback.appended - scrollback.used;
+    size_t offset{0};
+    switch (arguments[0]) {
+        case SCROLLBACK_BYTES:
+            offset = count == 0 || count >= scrollback.used ? 0 : scrollback.used - count;
+            break;
+        case SCROLLBACK_LINES:
+            offset = count == 0 ? scrollback_line_start(scrollback, 0) : scrollback_last_lines(scrollback, count);
+            break;
+        case SCROLLBACK_FROM:
+            if (position < oldest) {
+                set_failure(response, "[process_get_scrollback_command] Bytes at the position are overwritten.");
+                return;
+            }
+            if (position > scrollback.appended) {
+                set_failure(response, "[process_get_scrollback_command] Invalid position.");
+                return;
+            }
+            offset = (size_t) (position - oldest);
+            break;
+        default:
+            set_failure(response, "[process_get_scrollback_command] Unknown count type.");
+            return;
+    }
+    const uint64_t positions[]{oldest + offset, scrollback.appended};
+    response.success = true;
+    memcpy(response.result, positions, sizeof(positions));
+    const auto copied = scrollback_read(scrollback, offset, response.result + sizeof(positions),
+                                        SCROLLBACK_PAGE_MAX_SIZE);
+    response.length = (int) (sizeof(positions) + copied);
+    logf(LOG_DEBUG, "[process_get_scrollback_command] Returning %zu bytes of %zu (from %llu).", copied,
+         scrollback.used - offset, (unsigned long long) positions[0]);
+}
+
+static void process_protocol_command(const char* arguments, command_response& response) {
+    if (_protocol_version != PROTOCOL_VERSION_1) {
+        set_failure(response, "[process_protocol_command] Protocol version is already negotiated.");
+        return;
+    }
+    unsigned short version{0};
+    memcpy(&version, arguments, sizeof(version));
+    if (version > PROTOCOL_VERSION_2)
+        version = PROTOCOL_VERSION_2;
+    if (version < PROTOCOL_VERSION_1)
+        version = PROTOCOL_VERSION_1;
+    logf(LOG_INFO, "[process_protocol_command] Using command protocol version %i.", version);
+    set_success(response, &version, (int) sizeof(version));
+}
+
+// Size of the arguments that follow the opcode.
+static int command_arguments_size(char opcode) {
+    switch (opcode) {
+        case SET_WINSIZE_COMMAND:
+            return 2 * (int) sizeof(unsigned short);
+        case SET_TERMIOS_COMMAND:
+            return (int) sizeof(termios);
+        case PROTOCOL_COMMAND:
+            return (int) sizeof(unsigned short);
+        case GET_SCROLLBACK_COMMAND:
+            return 1 + (int) sizeof(uint32_t) + (int) sizeof(uint64_t);
+        default:
+            return 0;
+    }
+}
+
+static void execute_command(int pty_fd, const scrollback_ring& scrollback, char opcode, const char* arguments,
+                            command_response& response) {
+    switch (opcode) {
         case PING_PONG_COMMAND:
-            log(LOG_DEBUG, "[process_commands] Ping command received.");
-            return process_ping_command(h_cout);
+            log(LOG_DEBUG, "[execute_command] Ping command received.");
+            stats_add(STATS_PING_COMMANDS, 1);
+            set_success(response);
+            return;
         case GET_WINSIZE_COMMAND:
-            log(LOG_DEBUG, "[process_commands] Get-size command received.");
-            return process_get_size_command(pty_fd, h_cout);
+            log(LOG_DEBUG, "[execute_command] Get-size command received.");
+            stats_add(STATS_GET_WINSIZE_COMMANDS, 1);
+            process_get_size_command(pty_fd, response);
+            return;
         case SET_WINSIZE_COMMAND:
-            log(LOG_DEBUG, "[process_commands] Set-size command received.");
-            return process_set_size_command(pty_fd, h_cin, h_cout);
+            log(LOG_DEBUG, "[execute_command] Set-size command received.");
+            stats_add(STATS_SET_WINSIZE_COMMANDS, 1);
+            process_set_size_command(pty_fd, arguments, response);
+            return;
         case GET_TERMIOS_COMMAND:
-            log(LOG_DEBUG, "[process_commands] Get-termios command received.");
-            return process_get_termios_command(pty_fd, h_cout);
+            log(LOG_DEBUG, "[execute_command] Get-termios command received.");
+            stats_add(STATS_GET_TERMIOS_COMMANDS, 1);
+            process_get_termios_command(pty_fd, response);
+            return;
         case SET_TERMIOS_COMMAND:
-            log(LOG_DEBUG, "[process_commands] Set-termios command received.");
-            return process_set_termios_command(pty_fd, h_cin, h_cout);
+            log(LOG_DEBUG, "[execute_command] Set-termios command received.");
+            stats_add(STATS_SET_TERMIOS_COMMANDS, 1);
+            process_set_termios_command(pty_fd, arguments, response);
+            return;
+        case GET_STATS_COMMAND:
+            log(LOG_DEBUG, "[execute_command] Get-stats command received.");
+            stats_add(STATS_GET_STATS_COMMANDS, 1);
+            process_get_stats_command(response);
+            return;
+        case PROTOCOL_COMMAND:
+            log(LOG_DEBUG, "[execute_command] Protocol command received.");
+            process_protocol_command(arguments, response);
+            return;
+        case GET_SCROLLBACK_COMMAND:
+            log(LOG_DEBUG, "[execute_command] Get-scrollback command received.");
+            stats_add(STATS_GET_SCROLLBACK_COMMANDS, 1);
+            process_get_scrollback_command(scrollback, arguments, response);
+            return;
         default:
+            stats_add(STATS_UNKNOWN_COMMANDS, 1);
             char buff[DEBUG_LOG_MAX_BUFFER];
-            snprintf(buff, DEBUG_LOG_MAX_BUFFER, "[process_commands] Unknown command received: %i.", single_byte[0]);
+            snprintf(buff, DEBUG_LOG_MAX_BUFFER, "[execute_command] Unknown command received: %i.", opcode);
             log(LOG_DEBUG, buff);
-            return write_response(h_cout, false, buff);
+            set_failure(response, buff);
+            return;
+    }
+}
+
+static bool flush_responses(int cout_fd) {
+    if (_responses_count == 0)
+        return true;
+    const auto result = write_bytes(cout_fd, _responses, _responses_count);
+    _responses_count = 0;
+    return result;
+}
+
+// Protocol 1: status byte and the result; protocol 2: response frame.
+static bool add_response(int cout_fd, uint32_t request_id, command_response& response) {
+    const auto header_size = _protocol_version == PROTOCOL_VERSION_2 ? FRAME_HEADER_SIZE : 1;
+    const auto size = header_size + response.length;
+    if (_responses_count + size > FRAME_BUFFER_SIZE && !flush_responses(cout_fd))
+        return false;
+    auto destination = _responses + _responses_count;
+    if (_protocol_version == PROTOCOL_VERSION_2) {
+        const auto length = (uint32_t) (size - FRAME_LENGTH_SIZE);
+        memcpy(destination, &length, sizeof(length));
+        memcpy(destination + FRAME_LENGTH_SIZE, &request_id, sizeof(request_id));
+    }
+    destination[header_size - 1] = response.success ? SUCCESS_BYTE : FAILURE_BYTE;
+    memcpy(destination + header_size, response.result, response.length);
+    _responses_count += size;
+    return true;
+}
+
+// Size of the complete command at the beginning of the bytes, 0 if it isn't complete yet, or -1 if the bytes can't be
+// a command (protocol 2 frame length out of range).
+static int complete_command_size(const char* bytes, int count) {
+    if (_protocol_version != PROTOCOL_VERSION_2) {
+        if (count < 1)
+            return 0;
+        const auto size = 1 + command_arguments_size(bytes[0]);
+        return count < size ? 0 : size;
     }
+    if (count < FRAME_LENGTH_SIZE)
+        return 0;
+    uint32_t length{0};
+    memcpy(&length, bytes, sizeof(length));
+    if (length < FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE || length > FRAME_MAX_SIZE - FRAME_LENGTH_SIZE) {
+        logf(LOG_ERROR, "[complete_command_size] Invalid frame length: %u.", length);
+        return -1;
+    }
+    const auto size = FRAME_LENGTH_SIZE + (int) length;
+    return count < size ? 0 : size;
+}
+
+// Executes a protocol 2 frame without its length field. Returns the request id.
+static uint32_t execute_frame(int pty_fd, const scrollback_ring& scrollback, const char* frame, int size,
+                              command_response& response) {
+    uint32_t request_id{0};
+    memcpy(&request_id, frame, sizeof(request_id));
+    const auto opcode = frame[FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE - 1];
+    const auto arguments_size = size - (FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE);
+    if (arguments_size != command_arguments_size(opcode)) {
+        char buff[DEBUG_LOG_MAX_BUFFER];
+        snprintf(buff, DEBUG_LOG_MAX_BUFFER, "[execute_frame] Command %i has %i bytes of arguments.", opcode,
+                 arguments_size);
+        log(LOG_ERROR, buff);
+        set_failure(response, buff);
+    } else
+        execute_command(pty_fd, scrollback, opcode, frame + FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE, response);
+    return request_id;
+}
+
+static bool process_complete_command(int pty_fd, const scrollback_ring& scrollback, int cout_fd, const char* command,
+                                     int size) {
+    command_response response{};
+    if (_protocol_version != PROTOCOL_VERSION_2) {
+        if (command[0] == GET_SCROLLBACK_COMMAND)
+            set_failure(response, "[process_complete_command] Get-scrollback command requires protocol 2.");
+        else
+            execute_command(pty_fd, scrollback, command[0], command + 1, response);
+        if (!add_response(cout_fd, 0, response))
+            return false;
+        if (command[0] == PROTOCOL_COMMAND && response.success) {
+            // Switching only after the response is added (in the old protocol).
+            unsigned short version{0};
+            memcpy(&version, response.result, sizeof(version));
+            _protocol_version = version;
+        }
+        return true;
+    }
+    const auto request_id = execute_frame(pty_fd, scrollback, command + FRAME_LENGTH_SIZE, size - FRAME_LENGTH_SIZE,
+                                          response);
+    return add_response(cout_fd, request_id, response);
+}
+
+bool process_commands(int pty_fd, const scrollback_ring& scrollback, int cin_fd, int cout_fd, bool& closed) {
+    closed = false;
+    if (cin_fd < 0)
+        return true;
+    int read{0};
+    // Not peeking first: a closed pipe is ready too, and then the read reports it.
+    if (!read_bytes_or_eof(cin_fd, _command_bytes + _command_bytes_count, FRAME_BUFFER_SIZE - _command_bytes_count,
+                           &read, closed))
+        return false;
+    if (closed) {
+        logf(LOG_INFO, "[process_commands] Command stream is closed (%i bytes of an incomplete command dropped).",
+             _command_bytes_count);
+        _command_bytes_count = 0;
+        _command_started_us = 0;
+        return true;
+    }
+    _command_bytes_count += read;
+    auto position{0};
+    auto processed{0};
+    while (true) {
+        // The protocol can change after any command, so each one is parsed with the current version.
+        const auto size = complete_command_size(_command_bytes + position, _command_bytes_count - position);
+        if (size < 0)
+            // Can't find the next command any more.
+            return false;
+        if (size == 0)
+            break;
+        if (!process_complete_command(pty_fd, scrollback, cout_fd, _command_bytes + position, size))
+            return false;
+        position += size;
+        ++processed;
+    }
+    if (position > 0) {
+        // Moving the incomplete command to the beginning.
+        memmove(_command_bytes, _command_bytes + position, _command_bytes_count - position);
+        _command_bytes_count -= position;
+        _command_started_us = 0;
+    }
+    if (_command_bytes_count > 0 && _command_started_us == 0)
+        _command_started_us = monotonic_microseconds();
+    logf(LOG_TRACE, "[process_commands] %i commands processed, %i bytes carried over.", processed,
+         _command_bytes_count);
+    return flush_responses(cout_fd);
+}
+
+int process_command_frame(int pty_fd, const scrollback_ring& scrollback, const char* frame, int size,
+                          char* response_frame) {
+    if (size < FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE) {
+        logf(LOG_ERROR, "[process_command_frame] Command frame has only %i bytes.", size);
+        return -1;
+    }
+    command_response response{};
+    const auto request_id = execute_frame(pty_fd, scrollback, frame, size, response);
+    memcpy(response_frame, &request_id, sizeof(request_id));
+    response_frame[FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE - 1] = response.success ? SUCCESS_BYTE : FAILURE_BYTE;
+    memcpy(response_frame + FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE, response.result, response.length);
+    return FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE + response.length;
+}
+
+int command_timeout_ms() {
+    if (_command_bytes_count == 0 || _command_timeout_ms == 0)
+        return -1;
+    const auto remaining_us = _command_started_us + _command_timeout_ms * 1000LL - monotonic_microseconds();
+    return remaining_us > 0 ? (int) ((remaining_us + 999) / 1000) : 0;
+}
+
+bool process_command_timeout(int cout_fd, bool& expired) {
+    expired = command_timeout_ms() == 0;
+    if (!expired)
+        return true;
+    // The rest of the command may still arrive, and there's no telling where the next command starts after it (its
+    // bytes would be taken for commands, or for a frame length), so the stream can't be used any more.
+    char buff[DEBUG_LOG_MAX_BUFFER];
+    snprintf(buff, DEBUG_LOG_MAX_BUFFER, "[process_command_timeout] Command not completed in %i ms (%i bytes received). "
+                                         "No more commands are read.", _command_timeout_ms, _command_bytes_count);
+    log(LOG_WARN, buff);
+    uint32_t request_id{0};
+    if (_protocol_version == PROTOCOL_VERSION_2 && _command_bytes_count >= FRAME_HEADER_SIZE - 1)
+        memcpy(&request_id, _command_bytes + FRAME_LENGTH_SIZE, sizeof(request_id));
+    _command_bytes_count = 0;
+    _command_started_us = 0;
+    command_response response{};
+    set_failure(response, buff);
+    return add_response(cout_fd, request_id, response) && flush_responses(cout_fd);
 }
@@ -11,7 +11,34 @@
 #define PTYNATIVE_COMMAND_PROCESSOR_H
 
 #include "includes.h"
+#include "scrollback.h"
 
-bool process_commands(int pty_fd, HANDLE h_cin, HANDLE h_cout);
+#define COMMAND_TIMEOUT_DEFAULT_MS 5000
+// Largest protocol 2 command frame, including its length field.
+#define COMMAND_FRAME_MAX_SIZE 4096
+// Largest protocol 2 response frame, including its length field (a page of the scrollback, see the get-scrollback
+// command).
+#define COMMAND_RESPONSE_MAX_SIZE (32 * 1024)
+
+// An incomplete command is dropped (with a failure response) if its remaining bytes don't arrive within this time
+// (0 means no timeout). The command stream isn't read any more after that.
+extern unsigned short _command_timeout_ms;
+
+// Reads the available command bytes (cin_fd has to be ready), and processes the commands that are complete. If the other
+// end is closed, closed is set (and an incomplete command is dropped): the caller has to stop waiting on cin_fd then.
+bool process_commands(int pty_fd, const scrollback_ring& scrollback, int cin_fd, int cout_fd, bool& closed);
+
+// Executes a protocol 2 command frame that comes without its length field (from the multiplexed channel), and stores
+// the response frame (also without the length field) into response_frame (at least COMMAND_RESPONSE_MAX_SIZE bytes).
+// Returns the size of the response frame, or -1 if the command frame is invalid.
+int process_command_frame(int pty_fd, const scrollback_ring& scrollback, const char* frame, int size,
+                          char* response_frame);
+
+// Milliseconds until the incomplete command times out (0 if it already has), or -1 if there's none.
+int command_timeout_ms();
+
+// Drops the incomplete command, and responds with a failure, if it has timed out (expired is set then, and the caller
+// has to stop reading the commands). Returns false if the response can't be written.
+bool process_command_timeout(int cout_fd, bool& expired);
 
 #endif //PTYNATIVE_COMMAND_PROCESSOR_H
@@ -10,6 +10,8 @@ setlocal
 rem Build parameters
 if not defined sign_code set sign_code=YES
 set debug_log=NO
+rem Lowest log level compiled in (0 - Trace ... 4 - Error), lower levels compile to nothing
+if not defined log_min_level set log_min_level=0
 
 rem User may turn on Verbose output using "-v" switch
 set verbose=NO
@@ -97,8 +99,8 @@ if errorlevel 1 goto print_errors
 
 call cecho /green "Compiling code and linking"
 if %verbose%==YES which gcc.exe
-if %verbose%==YES echo gcc -fno-rtti %LOGGING% command_processor.cpp file_helpers.cpp helpers.cpp io_processor.cpp logging.cpp main.cpp stand_alone_io.cpp -o %exe_name% %USE_GCC_STATIC% -Xlinker main.res.o -mconsole -m%DIRBIT% %NO_DEBUG%
-gcc -fno-rtti %LOGGING% command_processor.cpp file_helpers.cpp helpers.cpp io_processor.cpp logging.cpp main.cpp stand_alone_io.cpp -o %exe_name% %USE_GCC_STATIC% -Xlinker main.res.o -mconsole -m%DIRBIT% %NO_DEBUG% 2> "%exe_name%.log"
+if %verbose%==YES echo gcc -fno-rtti %LOGGING% binary_log.cpp channel.cpp child_watcher.cpp command_processor.cpp event_loop.cpp file_helpers.cpp helpers.cpp io_processor.cpp key_translator.cpp logging.cpp main.cpp output_pump.cpp ring_buffer.cpp scrollback.cpp session_host.cpp session_socket.cpp shell_launcher.cpp shell_pool.cpp stand_alone_io.cpp stats.cpp sync_channel.cpp -o %exe_name% %USE_GCC_STATIC% -Xlinker main.res.o -mconsole -m%DIRBIT% %NO_DEBUG%
+gcc -fno-rtti %LOGGING% binary_log.cpp channel.cpp child_watcher.cpp command_processor.cpp event_loop.cpp file_helpers.cpp helpers.cpp io_processor.cpp key_translator.cpp logging.cpp main.cpp output_pump.cpp ring_buffer.cpp scrollback.cpp session_host.cpp session_socket.cpp shell_launcher.cpp shell_pool.cpp stand_alone_io.cpp stats.cpp sync_channel.cpp -o %exe_name% %USE_GCC_STATIC% -Xlinker main.res.o -mconsole -m%DIRBIT% %NO_DEBUG% 2> "%exe_name%.log"
 if errorlevel 1 goto print_errors
 
 if NOT "%sign_code%" == "YES" goto skip_sign
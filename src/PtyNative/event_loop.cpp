@@ -0,0 +1,67 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "event_loop.h"
+
+#include "logging.h"
+
+void event_loop_clear(event_loop& loop) {
+    loop.count = 0;
+}
+
+void event_loop_destroy(event_loop& loop) {
+    free(loop.fds);
+    loop.fds = nullptr;
+    loop.count = 0;
+    loop.capacity = 0;
+}
+
+int event_loop_add(event_loop& loop, int fd, short events) {
+    if (fd < 0)
+        return EVENT_LOOP_NO_SOURCE;
+    if (loop.count >= loop.capacity) {
+        const auto capacity = loop.capacity == 0 ? EVENT_LOOP_INITIAL_SOURCES : loop.capacity * 2;
+        const auto fds = (pollfd*) realloc(loop.fds, capacity * sizeof(pollfd));
+        if (fds == nullptr) {
+            logf(LOG_ERROR, "[event_loop_add] Failed to grow the sources to %i.", capacity);
+            return EVENT_LOOP_FAILED;
+        }
+        loop.fds = fds;
+        loop.capacity = capacity;
+    }
+    auto& source = loop.fds[loop.count];
+    source.fd = fd;
+    source.events = events;
+    source.revents = 0;
+    return loop.count++;
+}
+
+bool event_loop_wait(event_loop& loop, int timeout_ms, int& ready_count) {
+    ready_count = 0;
+    const auto result = poll(loop.fds, (nfds_t) loop.count, timeout_ms);
+    if (result < 0) {
+        if (errno == EINTR) {
+            // Interrupted by a signal; the caller will simply do another pass.
+            for (auto i = 0; i < loop.count; ++i)
+                loop.fds[i].revents = 0;
+            return true;
+        }
+        log_lin_error(LOG_ERROR, "[event_loop_wait] 'poll' call failed.");
+        return false;
+    }
+    ready_count = result;
+    return true;
+}
+
+bool event_loop_is_ready(const event_loop& loop, int source) {
+    if (source < 0 || source >= loop.count)
+        return false;
+    const auto& fd = loop.fds[source];
+    return (fd.revents & (fd.events | POLLHUP | POLLERR | POLLNVAL)) != 0; // NOLINT(hicpp-signed-bitwise)
+}
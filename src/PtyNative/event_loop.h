@@ -0,0 +1,42 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_EVENT_LOOP_H
+#define PTYNATIVE_EVENT_LOOP_H
+
+#include "includes.h"
+
+#define EVENT_LOOP_INITIAL_SOURCES 16
+#define EVENT_LOOP_NO_SOURCE (-1)
+// The source couldn't be added (the sources couldn't grow), so the loop can't wait for it.
+#define EVENT_LOOP_FAILED (-2)
+
+// The set of file descriptors the I/O loop is waiting on. Sources are (re)registered on every pass, and then
+// a single 'poll' call blocks until at least one of them becomes ready, or until the timeout expires. The array
+// grows as needed (the host waits on the sources of all its sessions), and it's kept between the passes.
+struct event_loop {
+    pollfd* fds;
+    int count;
+    int capacity;
+};
+
+void event_loop_clear(event_loop& loop);
+void event_loop_destroy(event_loop& loop);
+
+// Returns the source index, EVENT_LOOP_NO_SOURCE if fd is negative (i.e. the stream isn't used), or EVENT_LOOP_FAILED.
+// A source that failed is never ready, so whoever depends on it has to give up (or it would never be served).
+int event_loop_add(event_loop& loop, int fd, short events = POLLIN);
+
+bool event_loop_wait(event_loop& loop, int timeout_ms, int& ready_count);
+
+// Returns true if the source is ready for the requested operation, or if it's closed or failed (so that
+// the next read / write reports the actual error).
+bool event_loop_is_ready(const event_loop& loop, int source);
+
+#endif //PTYNATIVE_EVENT_LOOP_H
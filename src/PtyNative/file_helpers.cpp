@@ -16,84 +16,142 @@ union unsigned_short_serializer {
     char           bytes[2];
 };
 
-static bool peek_for_bytes(HANDLE h_pipe, DWORD bytes_needed, bool& has_enough) {
-    DWORD available{0};
-    if (!PeekNamedPipe(h_pipe, nullptr, 0, nullptr, &available, nullptr)) {
-        log_win_error(LOG_ERROR, "[peek_for_bytes] 'PeekNamedPipe' call failed.");
+static bool peek_for_bytes(int fd, int bytes_needed, bool& has_enough) {
+    int available{0};
+    if (ioctl(fd, FIONREAD, &available) != 0) { // NOLINT(hicpp-signed-bitwise)
+        log_lin_error(LOG_ERROR, "[peek_for_bytes] 'ioctl(FIONREAD)' call failed.");
         return false;
     }
     has_enough = available >= bytes_needed;
     return true;
 }
 
-bool read_bytes(HANDLE h_file, char* buff, DWORD bytes_to_read, DWORD* bytes_read) {
-    if (!ReadFile(h_file, buff, bytes_to_read, bytes_read, nullptr)) {
-        log_win_error(LOG_ERROR, "[read_bytes] 'ReadFile' call failed.");
+bool read_bytes(int fd, char* buff, int bytes_to_read, int* bytes_read) {
+    auto eof{false};
+    if (!read_bytes_or_eof(fd, buff, bytes_to_read, bytes_read, eof))
+        return false;
+    if (eof) {
+        log(LOG_WARN, "[read_bytes] End of file reached (the other end is closed).");
         return false;
     }
     return true;
 }
 
-bool try_read_bytes(HANDLE h_pipe, char* buff, DWORD bytes_to_read, DWORD* bytes_read) {
+bool read_bytes_or_eof(int fd, char* buff, int bytes_to_read, int* bytes_read, bool& eof) {
+    *bytes_read = 0;
+    eof = false;
+    while (true) {
+        const auto result = read(fd, buff, bytes_to_read);
+        if (result > 0) {
+            *bytes_read = (int) result;
+            return true;
+        }
+        if (result == 0) {
+            eof = true;
+            return true;
+        }
+        if (errno != EINTR) {
+            log_lin_error(LOG_ERROR, "[read_bytes_or_eof] 'read' call failed.");
+            return false;
+        }
+    }
+}
+
+bool try_read_bytes(int fd, char* buff, int bytes_to_read, int* bytes_read) {
     *bytes_read = 0;
     bool has_enough{false};
-    if (!peek_for_bytes(h_pipe, 1, has_enough))
+    if (!peek_for_bytes(fd, 1, has_enough))
         return false;
     if (!has_enough)
         return true;
-    return read_bytes(h_pipe, buff, bytes_to_read, bytes_read);
+    return read_bytes(fd, buff, bytes_to_read, bytes_read);
 }
 
-bool try_read_bytes_fixed(HANDLE h_pipe, char* buff, DWORD bytes_to_read, DWORD* bytes_read) {
+bool try_read_bytes_fixed(int fd, char* buff, int bytes_to_read, int* bytes_read) {
     *bytes_read = 0;
     bool has_enough{false};
-    if (!peek_for_bytes(h_pipe, bytes_to_read, has_enough))
+    if (!peek_for_bytes(fd, bytes_to_read, has_enough))
         return false;
     if (!has_enough)
         return true;
-    const auto result = read_bytes_fixed(h_pipe, buff, bytes_to_read);
+    const auto result = read_bytes_fixed(fd, buff, bytes_to_read);
     if (result)
         *bytes_read = bytes_to_read;
     return result;
 }
 
-bool read_bytes_fixed(HANDLE h_file, char* buff, int length) {
+bool read_bytes_fixed(int fd, char* buff, int length) {
     auto pos{0};
     while (pos < length) {
-        char bf[length - pos];
-        DWORD bytes_read{0};
-        if (!read_bytes(h_file, bf, length - pos, &bytes_read))
+        int bytes_read{0};
+        if (!read_bytes(fd, buff + pos, length - pos, &bytes_read))
             return false;
-        for (auto i = 0; i < bytes_read; ++i)
-            buff[pos++] = bf[i];
+        pos += bytes_read;
     }
     return true;
 }
 
-bool write_bytes(HANDLE h_file, const char* buff, int length) {
+// Whether a failed write can be retried once fd is writable.
+static bool can_wait(int fd, bool (*wait)(int fd, void* context), void* context) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) && wait != nullptr && wait(fd, context);
+}
+
+bool write_bytes(int fd, const char* buff, int length, bool (*wait)(int fd, void* context), void* context) {
     while (length > 0) {
-        DWORD bytes_written{0};
-        if (!WriteFile(h_file, buff, length, &bytes_written, nullptr)) {
-            log_win_error(LOG_ERROR, "[write_bytes] 'WriteFile' call failed.");
+        const auto bytes_written = write(fd, buff, length);
+        if (bytes_written < 0) {
+            if (errno == EINTR || can_wait(fd, wait, context))
+                continue;
+            log_lin_error(LOG_ERROR, "[write_bytes] 'write' call failed.");
             return false;
         }
-        if (bytes_written > 0) {
-            length -= (int)bytes_written;
-            buff += (int)bytes_written;
+        length -= (int)bytes_written;
+        buff += (int)bytes_written;
+    }
+    return true;
+}
+
+bool write_vectors(int fd, iovec* vectors, int count, bool (*wait)(int fd, void* context), void* context) {
+    auto index{0};
+    while (index < count) {
+        const auto written = writev(fd, vectors + index, count - index);
+        if (written < 0) {
+            if (errno == EINTR || can_wait(fd, wait, context))
+                continue;
+            log_lin_error(LOG_ERROR, "[write_vectors] 'writev' call failed.");
+            return false;
+        }
+        auto left = (size_t) written;
+        while (index < count && left >= vectors[index].iov_len) {
+            left -= vectors[index].iov_len;
+            ++index;
+        }
+        if (index < count) {
+            vectors[index].iov_base = (char*) vectors[index].iov_base + left;
+            vectors[index].iov_len -= left;
         }
     }
     return true;
 }
 
-bool read_unsigned_short(HANDLE h_file, unsigned short& value) {
+bool set_non_blocking(int fd) {
+    const auto flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) { // NOLINT(hicpp-signed-bitwise)
+        log_lin_error(LOG_ERROR, "[set_non_blocking] 'fcntl(O_NONBLOCK)' call failed.");
+        return false;
+    }
+    return true;
+}
+
+bool read_unsigned_short(int fd, unsigned short& value) {
     unsigned_short_serializer serializer{};
-    if (!read_bytes_fixed(h_file, serializer.bytes, (int) sizeof(serializer.bytes)))
+    if (!read_bytes_fixed(fd, serializer.bytes, (int) sizeof(serializer.bytes)))
         return false;
     value = serializer.value;
     return true;
 }
 
-bool write_unsigned_short(HANDLE h_file, unsigned short value) {
+bool write_unsigned_short(int fd, unsigned short value) {
     const unsigned_short_serializer serializer{.value = value};
-    return write_bytes(h_file, serializer.bytes, (int) sizeof(serializer.bytes));
+    return write_bytes(fd, serializer.bytes, (int) sizeof(serializer.bytes));
 }
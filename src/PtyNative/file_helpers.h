@@ -12,18 +12,33 @@
 
 #include "includes.h"
 
-bool read_bytes(HANDLE h_file, char* buff, DWORD bytes_to_read, DWORD* bytes_read);
+#include <sys/uio.h>
 
-bool try_read_bytes(HANDLE h_pipe, char* buff, DWORD bytes_to_read, DWORD* bytes_read);
+bool read_bytes(int fd, char* buff, int bytes_to_read, int* bytes_read);
 
-bool try_read_bytes_fixed(HANDLE h_pipe, char* buff, DWORD bytes_to_read, DWORD* bytes_read);
+// The same as read_bytes, but the end of file isn't a failure: it sets eof instead (with nothing read).
+bool read_bytes_or_eof(int fd, char* buff, int bytes_to_read, int* bytes_read, bool& eof);
 
-bool read_bytes_fixed(HANDLE h_file, char* buff, int length);
+bool try_read_bytes(int fd, char* buff, int bytes_to_read, int* bytes_read);
 
-bool write_bytes(HANDLE h_file, const char* buff, int length);
+bool try_read_bytes_fixed(int fd, char* buff, int bytes_to_read, int* bytes_read);
 
-bool read_unsigned_short(HANDLE h_file, unsigned short& value);
+bool read_bytes_fixed(int fd, char* buff, int length);
 
-bool write_unsigned_short(HANDLE h_file, unsigned short value);
+// If fd is non-blocking, wait is called whenever it can't take more: it returns once fd is writable, or false if the
+// write should fail instead (without wait a write that would block fails).
+bool write_bytes(int fd, const char* buff, int length, bool (*wait)(int fd, void* context) = nullptr,
+                 void* context = nullptr);
+
+// Writes all the vectors (with as few calls as possible). The vectors are modified. Non-blocking fd is waited for as
+// with write_bytes.
+bool write_vectors(int fd, iovec* vectors, int count, bool (*wait)(int fd, void* context) = nullptr,
+                   void* context = nullptr);
+
+bool set_non_blocking(int fd);
+
+bool read_unsigned_short(int fd, unsigned short& value);
+
+bool write_unsigned_short(int fd, unsigned short value);
 
 #endif //PTYNATIVE_FILE_HELPERS_H
@@ -34,6 +34,13 @@ bool write_exact(int fd, const char* buffer, int to_write, bool no_logs) {
     return true;
 }
 
+long long monotonic_microseconds() {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+#ifdef __CYGWIN__
 // Besides conversion, *char_string is also null-terminated!
 bool wchar_to_char_string(unsigned int code_page, LPCWCH lp_wide_char, char** char_string,
         int lp_wide_char_length) {
@@ -75,3 +82,59 @@ bool wchar_to_char_string(unsigned int code_page, LPCWCH lp_wide_char, char** ch
     *char_string = cs;
     return true;
 }
+#else
+// Outside of Cygwin/MSYS2 there's no WideCharToMultiByte, so only UTF-8 conversion is supported.
+bool wchar_to_char_string(unsigned int code_page, LPCWCH lp_wide_char, char** char_string,
+        int lp_wide_char_length) {
+    *char_string = nullptr;
+    if (code_page != CP_UTF8) {
+        logf(LOG_ERROR, "[wchar_to_char_string] Code page %u isn't supported.", code_page);
+        return false;
+    }
+    if (lp_wide_char_length <= 0) {
+        if (!lp_wide_char)
+            // Empty array
+            return true;
+        // We'll assume that lp_wide_char is null-terminated
+        lp_wide_char_length = 0;
+        while (lp_wide_char[lp_wide_char_length] != 0)
+            ++lp_wide_char_length;
+    }
+    if (lp_wide_char_length < 1)
+        // Empty string
+        return true;
+    // A UTF-16 code unit never takes more than 3 bytes in UTF-8 (a surrogate pair takes 4 bytes for 2 units).
+    char* cs{nullptr};
+    while (!cs)
+        cs = (char*) malloc(sizeof(char) * (lp_wide_char_length * 3 + 1));
+    auto pos{0};
+    for (auto i = 0; i < lp_wide_char_length; ++i) {
+        unsigned int code_point = lp_wide_char[i];
+        if (code_point >= 0xD800 && code_point <= 0xDBFF && i + 1 < lp_wide_char_length
+            && lp_wide_char[i + 1] >= 0xDC00 && lp_wide_char[i + 1] <= 0xDFFF)
+            code_point = 0x10000 + ((code_point - 0xD800) << 10) + (lp_wide_char[++i] - 0xDC00);
+        else if (code_point >= 0xD800 && code_point <= 0xDFFF)
+            // Lone surrogate
+            code_point = 0xFFFD;
+        if (code_point < 0x80)
+            cs[pos++] = (char) code_point;
+        else if (code_point < 0x800) {
+            cs[pos++] = (char) (0xC0 | (code_point >> 6));
+            cs[pos++] = (char) (0x80 | (code_point & 0x3F));
+        } else if (code_point < 0x10000) {
+            cs[pos++] = (char) (0xE0 | (code_point >> 12));
+            cs[pos++] = (char) (0x80 | ((code_point >> 6) & 0x3F));
+            cs[pos++] = (char) (0x80 | (code_point & 0x3F));
+        } else {
+            cs[pos++] = (char) (0xF0 | (code_point >> 18));
+            cs[pos++] = (char) (0x80 | ((code_point >> 12) & 0x3F));
+            cs[pos++] = (char) (0x80 | ((code_point >> 6) & 0x3F));
+            cs[pos++] = (char) (0x80 | (code_point & 0x3F));
+        }
+    }
+    // To ensure termination
+    cs[pos] = 0;
+    *char_string = cs;
+    return true;
+}
+#endif
@@ -17,4 +17,7 @@ bool write_exact(int fd, const char* buffer, int to_write = -1, bool no_logs = f
 bool wchar_to_char_string(unsigned int code_page, LPCWCH lp_wide_char_str, char** char_string,
         int lp_wide_char_length = -1);
 
+// Monotonic clock, in microseconds.
+long long monotonic_microseconds();
+
 #endif //PTYNATIVE_HELPERS_H
@@ -16,28 +16,47 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
 #include <errno.h>
-#include <process.h>
 #include <signal.h>
 #include <time.h>
 
+#ifdef __CYGWIN__
+#include <process.h>
+#endif
+
 #pragma clang diagnostic pop
 
 #include <sys/types.h>
 #include <sys/ioctl.h>
-#include <sys/fcntl.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/select.h>
 #include <sys/termios.h>
+
+#include <fcntl.h>
+#include <poll.h>
+
+#ifdef __CYGWIN__
 #include <sys/cygwin.h>
 
 #include <w32api/wtypes.h>
 #include <w32api/wincon.h>
 #include <w32api/winuser.h>
+#else
+// Outside of Cygwin/MSYS2 (i.e. when the I/O core is built on Linux) we need just the Win32 types.
+#include "win_types.h"
+#endif
 
 #include <unistd.h>
 #include <utmp.h>
 
 #include <pty.h>
 
+#ifndef CDEL
+// Cygwin's termios.h defines it, glibc's doesn't.
+#define CDEL 0x7f
+#endif
+
 #endif //PTYNATIVE_INCLUDES_H
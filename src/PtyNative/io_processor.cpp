@@ -9,21 +9,33 @@
 
 #include "io_processor.h"
 
+#include "child_watcher.h"
 #include "command_processor.h"
 #include "file_helpers.h"
 #include "helpers.h"
 #include "logging.h"
+#include "session_socket.h"
 #include "stand_alone_io.h"
+#include "stats.h"
+
+#include <cstdint>
+#include <sys/socket.h>
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunknown-pragmas"
 #pragma ide diagnostic ignored "hicpp-signed-bitwise"
 
-#define READ_LOOP_TIMEOUT 20000
-#define PTY_BUFFER_SIZE 4096
-#define INPUT_RECORDS_PER_CYCLE 100
+// After the slave process has terminated, we keep reading PTY until it's closed, or it's quiet for this long (the
+// slave's own children may keep it open).
+#define SLAVE_EXIT_DRAIN_TIMEOUT_MS 100
 #define IO_ERRCOUNT_IGNORE 2
-#define HEART_BEAT_CYCLES 500
+#define IO_ERROR_BACKOFF_MICROSECONDS 10000
+#define PTY_WRITE_BACKOFF_MIN_MS 1
+#define PTY_WRITE_BACKOFF_MAX_MS 32
+
+// Channel frames are copied into the same buffers the pipes are read into.
+static_assert(CHANNEL_CLIENT_MAX_PAYLOAD <= PTY_BUFFER_SIZE);
+static_assert(CHANNEL_CLIENT_MAX_PAYLOAD <= INPUT_RECORDS_PER_CYCLE * 20);
 
 // Static asserts, to assure that the structs aren't changed in the future
 #ifndef FROM_CLION_CMAKE
@@ -78,318 +90,825 @@ static_assert(sizeof(((INPUT_RECORD*)nullptr)->Event.MouseEvent) == MOUSE_EVENT_
 static_assert(sizeof(((INPUT_RECORD*)nullptr)->Event.WindowBufferSizeEvent) == WINDOW_BUFFER_SIZE_RECORD_size);
 #endif
 
-static bool _something_happened{false};
-static int _nothing_happened_count{0};
+size_t _output_ring_size{OUTPUT_RING_DEFAULT_SIZE};
+size_t _pty_read_max_size{PTY_READ_MAX_DEFAULT_SIZE};
+size_t _output_coalesce_bytes{OUTPUT_COALESCE_DEFAULT_BYTES};
+long long _output_coalesce_delay_us{0};
+size_t _output_high_water{0};
+size_t _output_low_water{0};
+int _output_policy{OUTPUT_POLICY_BLOCK};
+size_t _replay_buffer_size{REPLAY_BUFFER_DEFAULT_SIZE};
+size_t _scrollback_size{0};
 
-static bool process_active(int slave_pid) {
-    if (kill(slave_pid, 0) != 0) {
-        log_lin_error(LOG_WARN, "[process_active] 'kill' failed.");
-        return false;
-    }
-    return true;
-}
+// The session run by `run` (kept at root level, since it's too big for the stack).
+static io_session _session{};
 
-static bool slave_process_running(int slave_pid) {
-    int status{0};
-    const auto wait_rc = waitpid(slave_pid, &status, WNOHANG);
-    if (wait_rc != slave_pid)
-        return true;
-    if (_min_log_level <= LOG_INFO) {
-        if (WIFEXITED(status)) {
-            const auto exit_code = WEXITSTATUS(status);
-            logf(LOG_WARN, "[slave_process_running] Slave process (PID=%i) terminated. Exit code: %i (%s)",
-                 slave_pid, exit_code, strerror(exit_code));
-        }
-        else if (WIFSIGNALED(status)) {
-            const auto sig = WTERMSIG(status);
-            logf(LOG_WARN, "[slave_process_running] Slave process (PID=%i) terminated by signal (%i): %s",
-                 slave_pid, sig, strsignal(sig));
+// Once the output is resumed, reports the output that was dropped while it was throttled (with OUTPUT_POLICY_SUMMARY
+// a line with its size is written, which is cut if it doesn't fit).
+static void report_dropped_output(io_session& session) {
+    char* region{nullptr};
+    if (session.dropped_bytes == 0 || session.detached || output_pump_reserve(session.pump, &region) == 0)
+        return;
+    logf(LOG_DEBUG, "[report_dropped_output] Output resumed (%llu bytes dropped).", session.dropped_bytes);
+    if (_output_policy == OUTPUT_POLICY_SUMMARY) {
+        char line[64];
+        auto line_length = (size_t) snprintf(line, sizeof(line), "\r\n[%llu bytes of output dropped]\r\n",
+                                             session.dropped_bytes);
+        size_t written{0};
+        while (written < line_length) {
+            auto length = output_pump_reserve(session.pump, &region);
+            if (length == 0)
+                break;
+            if (length > line_length - written)
+                length = line_length - written;
+            memcpy(region, line + written, length);
+            output_pump_commit(session.pump, length);
+            written += length;
         }
-        else
-            logf(LOG_WARN, "[slave_process_running] Slave process (PID=%i) terminated. Status: %i", slave_pid,
-                 status);
     }
-    return false;
+    session.dropped_bytes = 0;
 }
 
-static bool write_output(HANDLE h_out, char* buff, int length) {
-    return h_out == nullptr
-           ? write_output_to_console(buff, length) // Stand-alone mode
-           : write_bytes(h_out, buff, length); // Managed mode
-}
-
-// Keeping output buffer at root level so that we can try again in the next cycle if the processing fails.
-static char output_buffer[PTY_BUFFER_SIZE];
-static int output_buffer_count{0};
-
-static bool process_output(HANDLE h_out, int pty_fd, bool& exhausted) {
-    exhausted = false;
-    const auto write_old = output_buffer_count > 0;
-    if (!write_old) {
-        fd_set fds{};
-        FD_ZERO(&fds);
-        FD_SET(pty_fd, &fds);
-        timeval timeout{.tv_sec=0, .tv_usec=READ_LOOP_TIMEOUT};
-        const auto result = select(pty_fd + 1, &fds, nullptr, nullptr, &timeout);
-        if (result < 0) {
-            log_lin_error(LOG_ERROR, "[process_output] 'select' call failed.");
-            return false;
-        }
-        if (result > 0 && FD_ISSET(pty_fd, &fds)) {
-            _something_happened = true;
-            log(LOG_TRACE, "[process_output] There's something to read from PTY or it's closed.");
-            int len = read(pty_fd, output_buffer, PTY_BUFFER_SIZE);
-            if (len < 0) {
-                log_lin_error(LOG_ERROR, "[process_output] 'read' call failed.");
-                return false;
-            }
-            output_buffer_count = len;
-            exhausted = len < PTY_BUFFER_SIZE;
-            if (len > 0)
-                logf(LOG_TRACE, "[process_output] 'read' returned %i bytes.", output_buffer_count);
-        } else
-            exhausted = true;
-    }
-    if (output_buffer_count > 0) {
-        _something_happened = true;
-        logf(LOG_TRACE, "[process_output] Trying to write %i bytes.", output_buffer_count);
-        if (!write_output(h_out, output_buffer, output_buffer_count)) {
-            logf(LOG_WARN, "[process_output] Failed to write %i bytes to output.", output_buffer_count);
-            return false;
-        }
-        logf(LOG_TRACE, "[process_output] %i bytes successfully written to output.", output_buffer_count);
+// Reads from PTY directly into the output ring. Writing to the output is done by the output pump thread. A detached
+// session reads into the scrollback only, and so does a throttled one, unless its policy is OUTPUT_POLICY_BLOCK.
+static bool process_output(io_session& session, bool readable, bool& exhausted) {
+    exhausted = true;
+    report_dropped_output(session);
+    if (!readable)
+        return true;
+    char spare_buffer[PTY_BUFFER_SIZE];
+    char* region{spare_buffer};
+    auto length = session.detached ? PTY_BUFFER_SIZE : output_pump_reserve(session.pump, &region);
+    if (length == 0 && _output_policy == OUTPUT_POLICY_BLOCK)
+        // Throttled. PTY will be waited on again when the pump drains the output down to the low watermark.
+        return true;
+    const auto dropping = length == 0;
+    if (dropping) {
+        region = spare_buffer;
+        length = PTY_BUFFER_SIZE;
+    }
+    if (length > session.pty_read_size)
+        length = session.pty_read_size;
+    log(LOG_TRACE, "[process_output] There's something to read from PTY or it's closed.");
+    const auto len = read(session.pty_fd, region, length);
+    if (len < 0 && (errno == EINTR || errno == EAGAIN))
+        return true;
+    if (len == 0 || (len < 0 && errno == EIO)) {
+        // All the slave ends are closed.
+        log(LOG_INFO, "[process_output] PTY is closed.");
+        session.pty_closed = true;
+        return true;
+    }
+    if (len < 0) {
+        log_lin_error(LOG_ERROR, "[process_output] 'read' call failed.");
+        return false;
+    }
+    logf(LOG_TRACE, "[process_output] 'read' returned %i bytes.", (int) len);
+    stats_add(STATS_PTY_READS, 1);
+    stats_add(STATS_PTY_BYTES_READ, len);
+    stats_max(STATS_PTY_READ_HIGH_WATER, len);
+    // Cursor keys depend on the mode the slave has set.
+    key_translator_scan_output(session.translator, region, (size_t) len);
+    if (session.scrollback.data != nullptr)
+        scrollback_append(session.scrollback, region, (size_t) len);
+    if (dropping) {
+        session.dropped_bytes += len;
+        stats_add(STATS_OUTPUT_BYTES_DROPPED, len);
+    } else if (!session.detached) {
+        output_pump_commit(session.pump, (size_t) len);
+        stats_max(STATS_OUTPUT_RING_HIGH_WATER, ring_buffer_used(session.pump.ring));
+    }
+    exhausted = (size_t) len < length;
+    if (!exhausted && length == session.pty_read_size && session.pty_read_size < _pty_read_max_size) {
+        session.pty_read_size = session.pty_read_size * 2 > _pty_read_max_size
+                                ? _pty_read_max_size : session.pty_read_size * 2;
+        logf(LOG_TRACE, "[process_output] PTY read size increased to %zu bytes.", session.pty_read_size);
+    } else if ((size_t) len < session.pty_read_size / 4 && session.pty_read_size > PTY_READ_MIN_SIZE) {
+        session.pty_read_size /= 2;
+        logf(LOG_TRACE, "[process_output] PTY read size decreased to %zu bytes.", session.pty_read_size);
     }
-    output_buffer_count = 0;
-    return write_old ? process_output(h_out, pty_fd, exhausted) : true;
+    return true;
 }
 
-// Used in managed mode.
-static bool read_input_records_from_pipe(HANDLE pipe, INPUT_RECORD* records, int count, int& records_read) {
+// Used in managed mode. Everything that's available (up to `count` records) is read with a single call, and a
+// trailing partial record is carried over to the next call.
+static bool read_input_records_from_pipe(io_session& session, int count, int& records_read) {
     records_read = 0;
-    auto pos = records;
-    while (records_read < count) {
-        DWORD bytes_read{0};
-        if (!try_read_bytes_fixed(pipe, reinterpret_cast<char *>(pos), sizeof(INPUT_RECORD), &bytes_read))
-            return false;
-        if (bytes_read < sizeof(INPUT_RECORD))
-            return true;
-        ++records_read;
-        ++pos;
-    }
+    auto buffer = reinterpret_cast<char *>(session.records);
+    int bytes_read{0};
+    if (!read_bytes(session.in_rec_fd, buffer + session.record_carry_bytes,
+                    count * (int) sizeof(INPUT_RECORD) - session.record_carry_bytes, &bytes_read))
+        return false;
+    const auto available = session.record_carry_bytes + bytes_read;
+    records_read = available / (int) sizeof(INPUT_RECORD);
+    session.record_carry_bytes = available % (int) sizeof(INPUT_RECORD);
+    logf(LOG_TRACE, "[read_input_records_from_pipe] %i bytes read: %i records, %i bytes carried over.", bytes_read,
+         records_read, session.record_carry_bytes);
     return true;
 }
 
-static bool read_input_records(HANDLE h_out, HANDLE h_in_rec, INPUT_RECORD* records, int count, int& records_read) {
-    if (h_out != nullptr) {
+static bool read_input_records(io_session& session, int count, int& records_read) {
+    stats_add(STATS_RECORD_READS, 1);
+    if (session.out_fd >= 0) {
         // Managed mode
-        if (h_in_rec == nullptr) {
+        if (session.in_rec_fd < 0) {
             // Record-by-record reading not used.
             records_read = 0;
             return true;
         }
-        return read_input_records_from_pipe(h_in_rec, records, count, records_read);
+        return read_input_records_from_pipe(session, count, records_read);
     }
-    return read_input_records_from_console(records, count, records_read);
+    return read_input_records_from_console(session.records, count, records_read);
 }
 
-static bool process_input_record(int pty_fd, HANDLE h_out, INPUT_RECORD& record) {
+static bool process_input_record(io_session& session, INPUT_RECORD& record) {
     switch (record.EventType) {
         case WINDOW_BUFFER_SIZE_EVENT: {
+            stats_add(STATS_RESIZE_RECORDS, 1);
             logf(LOG_DEBUG, "[process_input_record] WINDOW_BUFFER_SIZE_EVENT received: %i cols x %i rows.",
                  record.Event.WindowBufferSizeEvent.dwSize.X, record.Event.WindowBufferSizeEvent.dwSize.Y);
             winsize win_size{};
             win_size.ws_col = (unsigned short) record.Event.WindowBufferSizeEvent.dwSize.X;
             win_size.ws_row = (unsigned short) record.Event.WindowBufferSizeEvent.dwSize.Y;
-            if (h_out == nullptr)
+            if (session.out_fd < 0)
                 // We are in standalone mode, so we should better query actual window size than rely on the input
                 try_override_win_size(win_size);
-            if (ioctl(pty_fd, TIOCSWINSZ, &win_size) == 0)
+            if (ioctl(session.pty_fd, TIOCSWINSZ, &win_size) == 0)
                 return true;
             log_lin_error(LOG_ERROR, "[process_input_record] 'ioctl' call failed.");
             return false;
         }
         case KEY_EVENT: {
-            if (!record.Event.KeyEvent.bKeyDown) {
-                logf(LOG_DEBUG, "[process_input_record] KEY_EVENT received (%i), but bKeyDown is FALSE, so ignoring.",
-                     record.Event.KeyEvent.uChar.UnicodeChar);
-                return true;
+            // A record whose repeats didn't all fit into the translator's buffer is resumed with the rest of them.
+            auto& repeat_count = session.record_repeats_left;
+            if (repeat_count == 0) {
+                stats_add(STATS_KEY_RECORDS, 1);
+                if (!record.Event.KeyEvent.bKeyDown) {
+                    logf(LOG_DEBUG, "[process_input_record] KEY_EVENT received (%i), but bKeyDown is FALSE, so "
+                                    "ignoring.", record.Event.KeyEvent.uChar.UnicodeChar);
+                    return true;
+                }
+                repeat_count = record.Event.KeyEvent.wRepeatCount > 0 ? (int) record.Event.KeyEvent.wRepeatCount : 1;
+                if (repeat_count > KEY_REPEAT_MAX_COUNT) {
+                    logf(LOG_WARN, "[process_input_record] Repeat count %i limited to %i.", repeat_count,
+                         KEY_REPEAT_MAX_COUNT);
+                    repeat_count = KEY_REPEAT_MAX_COUNT;
+                }
             }
             // Special handling for Ctrl+Space
             if (record.Event.KeyEvent.wVirtualKeyCode == VK_SPACE &&
                 (record.Event.KeyEvent.dwControlKeyState & (RIGHT_CTRL_PRESSED | LEFT_CTRL_PRESSED))) {
                 static const char zero_byte{0};
-                const auto written = write(pty_fd, &zero_byte, 1);
-                if (written != 1) {
-                    log_lin_error(LOG_ERROR, "[process_input_record] 'write' call failed. Failed to write zero byte");
-                    return false;
-                }
-                return true;
+                return key_translator_put_bytes(session.translator, &zero_byte, 1, repeat_count);
             }
             if (record.Event.KeyEvent.uChar.UnicodeChar == 0) {
-                log(LOG_DEBUG,
-                    "[process_input_record] KEY_EVENT received, but will be ignored since UnicodeChar == 0.");
+                // Non-character key (arrows, F-keys...), translated into the escape sequence
+                bool known{false};
+                if (!key_translator_put_key(session.translator, record.Event.KeyEvent.wVirtualKeyCode,
+                                            record.Event.KeyEvent.dwControlKeyState, repeat_count, known))
+                    return false;
+                if (!known)
+                    logf(LOG_DEBUG, "[process_input_record] KEY_EVENT received, but will be ignored since "
+                                    "UnicodeChar == 0 and virtual key %i has no escape sequence.",
+                         record.Event.KeyEvent.wVirtualKeyCode);
                 return true;
             }
-            // Processing the key
-            char *char_string{nullptr};
-            bool success = wchar_to_char_string(CP_UTF8, &record.Event.KeyEvent.uChar.UnicodeChar, &char_string, 1);
-            if (success) {
-                success = write_exact(pty_fd, char_string);
-                if (!success)
-                    log(LOG_ERROR, "[process_input_record] Failed to write converted UnicodeChar.");
-            } else
-                logf(LOG_ERROR, "[process_input_record] Failed to convert UnicodeChar %i.",
-                     record.Event.KeyEvent.uChar.UnicodeChar);
-            if (char_string)
-                free(char_string);
-            return success;
+            // Processing the key (it's written to PTY together with the rest of the batch)
+            return key_translator_put_char(session.translator, record.Event.KeyEvent.uChar.UnicodeChar,
+                                           repeat_count);
         }
         default: {
+            stats_add(record.EventType == MOUSE_EVENT ? STATS_MOUSE_RECORDS : STATS_OTHER_RECORDS, 1);
             logf(LOG_WARN, "[process_input_record] Event of type %i received, and will be ignored.", record.EventType);
             return true;
         }
     }
 }
 
-// Keeping records at root level so that we can try again in the next cycle if the processing fails.
-static INPUT_RECORD records[INPUT_RECORDS_PER_CYCLE];
-static int record_index{0};
-static int record_count{0};
-
-static bool process_input_records(int pty_fd, HANDLE h_out, HANDLE h_in_rec, bool& exhausted) {
-    exhausted = false;
-    const auto write_old = record_count > 0;
-    if (!write_old) {
+// Records are processed in batches: a batch (of up to INPUT_RECORDS_PER_CYCLE records, read with a single read per
+// pass) is done once PTY has taken all its bytes. What PTY doesn't take right away is written once it's writable again,
+// and the next batch isn't read before that. If the translator's buffer gets full (and PTY doesn't take any of it),
+// the translation stops, and it's resumed (from the record, and the repeat, it has stopped at) once PTY is writable.
+static bool process_input_records(io_session& session, bool readable, bool& exhausted) {
+    exhausted = true;
+    while (true) {
+        while (session.record_index < session.record_count) {
+            auto& record = session.records[session.record_index];
+            if (record.EventType == WINDOW_BUFFER_SIZE_EVENT) {
+                // Keys that precede the resize should reach PTY before it.
+                if (!key_translator_flush(session.translator))
+                    return false;
+                if (key_translator_pending(session.translator))
+                    return true;
+            }
+            if (!process_input_record(session, record))
+                return false;
+            if (session.record_repeats_left > 0)
+                // The translator's buffer is full.
+                return true;
+            ++session.record_index;
+        }
+        // Whole batch is written at once. If it fails, the rest is retried in the next pass.
+        if (!key_translator_flush(session.translator))
+            return false;
+        if (key_translator_pending(session.translator))
+            return true;
+        if (session.record_carry_bytes > 0)
+            // Moving the partial record to the beginning, so that the next read completes it.
+            memmove(session.records, session.records + session.record_count, session.record_carry_bytes);
+        session.record_count = 0;
+        session.record_index = 0;
+        if (!readable)
+            return true;
+        readable = false;
         int records_read{0};
-        if (!read_input_records(h_out, h_in_rec, records, INPUT_RECORDS_PER_CYCLE, records_read))
+        if (!read_input_records(session, INPUT_RECORDS_PER_CYCLE, records_read))
             return false;
-        record_count = records_read;
-        record_index = 0;
+        session.record_count = records_read;
         exhausted = records_read < INPUT_RECORDS_PER_CYCLE;
     }
-    if (record_index < record_count)
-        _something_happened = true;
-    while (record_index < record_count) {
-        if (!process_input_record(pty_fd, h_out, records[record_index]))
-            return false;
-        ++record_index;
-    }
-    record_count = 0;
-    record_index = 0;
-    return write_old ? process_input_records(pty_fd, h_out, h_in_rec, exhausted) : true;
 }
 
-// Keeping output buffer at root level so that we can try again in the next cycle if the processing fails.
-static char input_buffer[PTY_BUFFER_SIZE];
-static int input_buffer_count{0};
-static int input_buffer_index{0};
-
-static bool process_input(int pty_fd, HANDLE h_in) {
-    const auto write_old = input_buffer_count > 0;
-    if (!write_old) {
-        DWORD read{0};
-        if (!try_read_bytes(h_in, input_buffer, PTY_BUFFER_SIZE, &read))
-            return false;
-        input_buffer_count = (int) read;
-        input_buffer_index = 0;
-        if (input_buffer_count > 0)
-            logf(LOG_TRACE, "[process_input] %i bytes read from the input stream.", input_buffer_count);
-    }
-    if (input_buffer_count > 0) {
-        _something_happened = true;
-        logf(LOG_TRACE, "[process_input] Attempt writing %i bytes to PTY.", input_buffer_count - input_buffer_index);
-        auto bytes_written = write(pty_fd, input_buffer + input_buffer_index,
-                                   input_buffer_count - input_buffer_index);
+// What's left from the previous pass is written first, and then (if the pipe is readable) one more buffer is read and
+// written. What PTY doesn't take right away is written once it's writable again.
+static bool process_input(io_session& session, bool readable) {
+    while (true) {
+        if (session.input_buffer_count == 0) {
+            if (!readable)
+                return true;
+            readable = false;
+            int read{0};
+            if (!read_bytes(session.in_fd, session.input_buffer, PTY_BUFFER_SIZE, &read))
+                return false;
+            session.input_buffer_count = read;
+            session.input_buffer_index = 0;
+            stats_add(STATS_INPUT_READS, 1);
+            stats_add(STATS_INPUT_BYTES_READ, read);
+            logf(LOG_TRACE, "[process_input] %i bytes read from the input stream.", session.input_buffer_count);
+        }
+        logf(LOG_TRACE, "[process_input] Attempt writing %i bytes to PTY.",
+             session.input_buffer_count - session.input_buffer_index);
+        const auto bytes_written = write(session.pty_fd, session.input_buffer + session.input_buffer_index,
+                                         session.input_buffer_count - session.input_buffer_index);
+        if (bytes_written < 0 && (errno == EAGAIN || errno == EINTR)) {
+            if (errno == EAGAIN)
+                // PTY's input queue is full.
+                stats_add(STATS_PTY_WRITE_STALLS, 1);
+            return true;
+        }
         if (bytes_written <= 0) {
             log_lin_error(LOG_ERROR, "[process_input] 'write' call failed.");
             return false;
         }
-        logf(LOG_TRACE, "process_input] %i bytes written to PTY.", bytes_written);
-        input_buffer_index += bytes_written;
-        if (input_buffer_index == input_buffer_count) {
-            // Everything written
-            input_buffer_index = 0;
-            input_buffer_count = 0;
+        logf(LOG_TRACE, "[process_input] %i bytes written to PTY.", (int) bytes_written);
+        session.input_written += bytes_written;
+        stats_add(STATS_PTY_WRITES, 1);
+        stats_add(STATS_PTY_BYTES_WRITTEN, bytes_written);
+        session.input_buffer_index += (int) bytes_written;
+        if (session.input_buffer_index < session.input_buffer_count)
+            // PTY has taken only a part of it.
+            return true;
+        // Everything written
+        session.input_buffer_index = 0;
+        session.input_buffer_count = 0;
+    }
+}
+
+// Input that was read, but PTY hasn't taken it yet (or writing it has failed). It's written once PTY is writable.
+static bool has_unwritten_input(const io_session& session) {
+    return session.record_count > 0 || session.input_buffer_count > 0 || key_translator_pending(session.translator);
+}
+
+static unsigned long long pty_written(const io_session& session) {
+    return session.input_written + session.translator.total_written;
+}
+
+// Whether the unwritten input should be retried now (PTY isn't waited on while backing off).
+static bool pty_write_due(const io_session& session) {
+    return session.pty_write_backoff_ms > 0 && has_unwritten_input(session)
+           && monotonic_microseconds() >= session.pty_write_retry_us;
+}
+
+// Called after the input is processed: written is what PTY had taken before, and woken whether PTY was reported
+// writable. If it was (or the backoff is over), but PTY hasn't taken anything, the backoff is doubled.
+static void update_pty_write_backoff(io_session& session, bool woken, unsigned long long written) {
+    if (pty_written(session) > written || !has_unwritten_input(session)) {
+        session.pty_write_backoff_ms = 0;
+        return;
+    }
+    if (!woken && !pty_write_due(session))
+        return;
+    session.pty_write_backoff_ms = session.pty_write_backoff_ms == 0 ? PTY_WRITE_BACKOFF_MIN_MS
+                                   : session.pty_write_backoff_ms * 2 > PTY_WRITE_BACKOFF_MAX_MS
+                                     ? PTY_WRITE_BACKOFF_MAX_MS : session.pty_write_backoff_ms * 2;
+    session.pty_write_retry_us = monotonic_microseconds() + session.pty_write_backoff_ms * 1000LL;
+    logf(LOG_TRACE, "[update_pty_write_backoff] PTY doesn't take the input. Retrying in %i ms.",
+         session.pty_write_backoff_ms);
+}
+
+// Channel mode: hands the received input frames over (in order) to the buffers the pipes are otherwise read into, as
+// long as those are free. Commands and credit are handled right away, even if they're behind input that has to wait
+// (the client may be waiting for output credit to be able to send more input). Command responses and the credit are
+// queued on the channel, for the pump to write them (commands wait while there's no room for their responses). Input
+// and records frames are handed over one kind at a time (the next one only once the input before it is
+// written), since records and input are written separately, but on the channel their order counts.
+static bool process_channel_frames(io_session& session) {
+    auto position{0};
+    auto input_blocked{false};
+    auto commands_blocked{false};
+    auto queued{false};
+    char type{0};
+    const char* payload{nullptr};
+    int length{0};
+    int result;
+    while ((result = channel_next(session.chan, position, type, payload, length)) > 0) {
+        switch (type) {
+            case CHANNEL_FRAME_INPUT:
+                if (input_blocked || has_unwritten_input(session)) {
+                    // The previous input (or records) isn't written yet.
+                    input_blocked = true;
+                    continue;
+                }
+                memcpy(session.input_buffer, payload, length);
+                session.input_buffer_count = length;
+                session.input_buffer_index = 0;
+                stats_add(STATS_INPUT_READS, 1);
+                stats_add(STATS_INPUT_BYTES_READ, length);
+                output_pump_input_received(session.pump);
+                break;
+            case CHANNEL_FRAME_RECORDS:
+                if (input_blocked || has_unwritten_input(session)) {
+                    input_blocked = true;
+                    continue;
+                }
+                if (length % (int) sizeof(INPUT_RECORD) != 0) {
+                    logf(LOG_ERROR, "[process_channel_frames] Records frame has %i bytes.", length);
+                    return false;
+                }
+                memcpy(session.records, payload, length);
+                session.record_count = length / (int) sizeof(INPUT_RECORD);
+                session.record_index = 0;
+                stats_add(STATS_RECORD_READS, 1);
+                output_pump_input_received(session.pump);
+                break;
+            case CHANNEL_FRAME_COMMAND: {
+                if (commands_blocked || !channel_has_room(session.chan, COMMAND_RESPONSE_MAX_SIZE)) {
+                    // The pump hasn't taken the queued frames yet (it wakes us once it does).
+                    commands_blocked = true;
+                    continue;
+                }
+                char response[COMMAND_RESPONSE_MAX_SIZE];
+                const auto response_length = process_command_frame(session.pty_fd, session.scrollback, payload,
+                                                                   length, response);
+                if (response_length < 0
+                    || !channel_queue(session.chan, CHANNEL_FRAME_COMMAND, response, response_length))
+                    return false;
+                queued = true;
+                break;
+            }
+            case CHANNEL_FRAME_CREDIT: {
+                uint32_t credit{0};
+                if (length != (int) sizeof(credit)) {
+                    logf(LOG_ERROR, "[process_channel_frames] Credit frame has %i bytes.", length);
+                    return false;
+                }
+                memcpy(&credit, payload, sizeof(credit));
+                output_pump_add_credit(session.pump, credit);
+                break;
+            }
+            default:
+                logf(LOG_ERROR, "[process_channel_frames] Unknown frame type: %i.", type);
+                return false;
         }
+        channel_consume(session.chan, payload);
     }
-    return write_old && input_buffer_index == 0 ? process_input(pty_fd, h_in) : true;
+    channel_compact(session.chan);
+    session.commands_waiting = commands_blocked;
+    if (channel_queue_credit(session.chan))
+        queued = true;
+    if (queued)
+        output_pump_frames_queued(session.pump);
+    return result == 0;
 }
 
-void run(int pty_fd, int slave_pid, HANDLE h_in, HANDLE h_in_rec, HANDLE h_out, HANDLE h_cin, HANDLE h_cout) {
-    log(LOG_INFO, "[run] Event loop started.");
-    if (h_out == nullptr)
+static bool is_attached(const io_session& session) {
+    return session.channel_mode && !session.detached;
+}
+
+// In channel mode, frames that were received but not handed over yet, have to be handed over as soon as the buffers
+// they go to are free (the frames that follow the first one that's waiting, wait too).
+static bool has_pending_io(const io_session& session) {
+    auto position{0};
+    char type{0};
+    const char* payload{nullptr};
+    int length{0};
+    if (!is_attached(session))
+        return false;
+    const auto result = channel_next(session.chan, position, type, payload, length);
+    if (result > 0 && (type == CHANNEL_FRAME_INPUT || type == CHANNEL_FRAME_RECORDS))
+        return !has_unwritten_input(session);
+    if (result > 0 && type == CHANNEL_FRAME_COMMAND)
+        return !session.commands_waiting;
+    return result != 0;
+}
+
+// The session is over once PTY is closed, but in channel mode only after the output that's waiting for credit is
+// written (the credit comes with the channel frames, which have to be processed until then).
+static bool is_over(const io_session& session) {
+    return session.pty_closed && !(is_attached(session) && ring_buffer_used(session.pump.ring) > 0);
+}
+
+// The client is gone (or it's being replaced by another one): the session keeps running without a channel.
+static void detach(io_session& session) {
+    // A client that's still there may be blocking the pump's write. Shutting its socket down releases it.
+    shutdown(session.out_fd, SHUT_RDWR);
+    output_pump_stop(session.pump);
+    channel_close(session.chan);
+    close(session.chan_fd);
+    if (session.out_fd != session.chan_fd)
+        close(session.out_fd);
+    session.chan_fd = session.out_fd = -1;
+    session.stall_started_us = 0;
+    session.detached = true;
+    log(LOG_INFO, "[detach] Client detached. The session keeps running.");
+}
+
+// A channel failure ends the session, unless it's detachable.
+static bool channel_failed(io_session& session, const char* message) {
+    if (!session.persistent) {
+        log(LOG_ERROR, message);
+        return false;
+    }
+    log(LOG_WARN, message);
+    detach(session);
+    return true;
+}
+
+static bool is_ready(const io_session& session, const event_loop& loop) {
+    return event_loop_is_ready(loop, session.commands_source) || event_loop_is_ready(loop, session.output_source)
+           || event_loop_is_ready(loop, session.pty_write_source) || event_loop_is_ready(loop, session.pump_source)
+           || event_loop_is_ready(loop, session.records_source) || event_loop_is_ready(loop, session.input_source)
+           || event_loop_is_ready(loop, session.channel_source);
+}
+
+bool io_session_start(io_session& session, int pty_fd, int slave_pid, int in_fd, int in_rec_fd, int out_fd,
+                      int cin_fd, int cout_fd, int chan_fd) {
+    session.pty_fd = pty_fd;
+    session.slave_pid = slave_pid;
+    session.in_fd = in_fd;
+    session.in_rec_fd = in_rec_fd;
+    session.out_fd = out_fd;
+    session.cin_fd = cin_fd;
+    session.cout_fd = cout_fd;
+    session.chan_fd = chan_fd;
+    session.records_fd = in_rec_fd;
+    session.channel_mode = chan_fd >= 0;
+    session.pty_closed = false;
+    session.pty_read_size = PTY_READ_MIN_SIZE;
+    session.record_index = session.record_count = session.record_carry_bytes = session.record_repeats_left = 0;
+    session.input_buffer_count = session.input_buffer_index = 0;
+    session.input_written = 0;
+    session.pty_write_backoff_ms = 0;
+    session.pty_write_retry_us = 0;
+    session.slave_exited = false;
+    session.slave_status = 0;
+    session.drain_deadline_us = 0;
+    session.stall_started_us = 0;
+    session.dropped_bytes = 0;
+    session.output_error_counter = session.records_error_counter = session.input_error_counter = 0;
+    session.persistent = session.detached = session.commands_waiting = false;
+    session.scrollback = scrollback_ring{};
+    // PTY writes mustn't block the loop: while the slave isn't reading its input, its output still has to be read.
+    const auto pty_flags = fcntl(pty_fd, F_GETFL);
+    if (pty_flags < 0 || fcntl(pty_fd, F_SETFL, pty_flags | O_NONBLOCK) != 0) {
+        log_lin_error(LOG_ERROR, "[io_session_start] 'fcntl(O_NONBLOCK)' call failed.");
+        return false;
+    }
+    if (session.channel_mode && !channel_open(session.chan, chan_fd, out_fd)) {
+        log(LOG_ERROR, "[io_session_start] Failed to open the channel.");
+        return false;
+    }
+    if (out_fd < 0) {
         // In stand-alone mode we need to do:
         disable_processed_input();
-    auto process_output_error_counter{0};
-    auto process_input_records_error_counter{0};
-    auto process_input_stream_error_counter{0};
-    while(true) {
-        if (!process_active(slave_pid)) {
-            log(LOG_WARN, "[run] 'process_active' returned false.");
-            break;
-        }
-        if (!slave_process_running(slave_pid)) {
-            log(LOG_WARN, "[run] 'slave_process_running' returned false.");
-            break;
+        session.records_fd = start_console_input_watcher();
+        if (session.records_fd < 0) {
+            log(LOG_ERROR, "[io_session_start] Failed to start console input watcher.");
+            return false;
         }
-#if (HEART_BEAT_CYCLES > 0)
-        if (_something_happened)
-            _nothing_happened_count = 0;
-        else if (++_nothing_happened_count > HEART_BEAT_CYCLES) {
-            logf(LOG_TRACE, "[run] Nothing happened in the last %i passes through I/O loop.", HEART_BEAT_CYCLES);
-            _nothing_happened_count = 0;
-            //test();
+    }
+    if (!output_pump_start(session.pump, out_fd, session.channel_mode ? &session.chan : nullptr, _output_ring_size,
+                           _output_high_water, _output_low_water, _output_coalesce_bytes, _output_coalesce_delay_us)) {
+        log(LOG_ERROR, "[io_session_start] Failed to start output pump.");
+        if (session.channel_mode)
+            channel_close(session.chan);
+        return false;
+    }
+    key_translator_init(session.translator, pty_fd);
+    if (_pty_read_max_size < PTY_READ_MIN_SIZE)
+        _pty_read_max_size = PTY_READ_MIN_SIZE;
+    if (_scrollback_size > 0 && !scrollback_init(session.scrollback, _scrollback_size)) {
+        log(LOG_ERROR, "[io_session_start] Failed to allocate the scrollback.");
+        io_session_stop(session);
+        return false;
+    }
+    return true;
+}
+
+bool io_session_add_sources(io_session& session, event_loop& loop) {
+    // With OUTPUT_POLICY_BLOCK PTY is waited on only while the output isn't throttled, otherwise we wait for the pump to
+    // drain it. With the other policies PTY is always read (the output is dropped while throttled).
+    char* region{nullptr};
+    session.output_space = session.detached || output_pump_reserve(session.pump, &region) > 0
+                           || _output_policy != OUTPUT_POLICY_BLOCK;
+    if (!session.output_space && session.stall_started_us == 0) {
+        session.stall_started_us = monotonic_microseconds();
+        stats_add(STATS_OUTPUT_STALLS, 1);
+    } else if (session.output_space && session.stall_started_us != 0) {
+        stats_add(STATS_OUTPUT_STALL_MICROSECONDS, monotonic_microseconds() - session.stall_started_us);
+        session.stall_started_us = 0;
+    }
+    session.commands_source = event_loop_add(loop, session.cin_fd);
+    session.output_source = event_loop_add(loop, session.output_space && !session.pty_closed ? session.pty_fd : -1);
+    session.pty_write_source = event_loop_add(loop, has_unwritten_input(session) && !session.pty_closed
+                                                    && session.pty_write_backoff_ms == 0 ? session.pty_fd : -1,
+                                              POLLOUT);
+    session.pump_source = event_loop_add(loop, session.detached ? -1 : output_pump_wake_fd(session.pump));
+    // A pipe whose previous read isn't written yet isn't read again (it would stay ready, and the loop would spin).
+    session.records_source = event_loop_add(loop, session.record_count > 0 ? -1 : session.records_fd);
+    session.input_source = event_loop_add(loop, session.input_buffer_count > 0 ? -1 : session.in_fd);
+    session.channel_source = event_loop_add(loop, is_attached(session) && channel_can_receive(session.chan)
+                                                  ? session.chan_fd : -1);
+    const int sources[]{session.commands_source, session.output_source, session.pty_write_source, session.pump_source,
+                        session.records_source, session.input_source, session.channel_source};
+    for (auto source: sources)
+        if (source == EVENT_LOOP_FAILED)
+            return false;
+    return true;
+}
+
+int io_session_timeout_ms(const io_session& session) {
+    auto timeout_ms = has_pending_io(session) ? 0 : session.slave_exited ? SLAVE_EXIT_DRAIN_TIMEOUT_MS : -1;
+    const auto command_timeout = session.cin_fd < 0 ? -1 : command_timeout_ms();
+    if (command_timeout >= 0 && (timeout_ms < 0 || command_timeout < timeout_ms))
+        // Waking up to drop the incomplete command, if the rest of it doesn't arrive in time.
+        timeout_ms = command_timeout;
+    if (session.pty_write_backoff_ms > 0 && has_unwritten_input(session)) {
+        // Waking up to retry writing PTY.
+        const auto retry_us = session.pty_write_retry_us - monotonic_microseconds();
+        const auto retry_ms = retry_us > 0 ? (int) ((retry_us + 999) / 1000) : 0;
+        if (timeout_ms < 0 || retry_ms < timeout_ms)
+            timeout_ms = retry_ms;
+    }
+    return timeout_ms;
+}
+
+void io_session_slave_exited(io_session& session, int status) {
+    logf(LOG_DEBUG, "[io_session_slave_exited] Slave process (PID=%i) terminated. Draining the rest of its output.",
+         session.slave_pid);
+    session.slave_exited = true;
+    session.slave_status = status;
+    session.drain_deadline_us = monotonic_microseconds() + SLAVE_EXIT_DRAIN_TIMEOUT_MS * 1000;
+}
+
+bool io_session_process(io_session& session, const event_loop& loop) {
+    if (is_over(session))
+        return false;
+    auto command_expired{false};
+    if (session.cin_fd >= 0 && !process_command_timeout(session.cout_fd, command_expired)) {
+        log(LOG_ERROR, "[io_session_process] Failed to respond to the timed out command.");
+        return false;
+    }
+    if (command_expired) {
+        // The command stream is out of sync. The session goes on without it (the pipe is closed by its owner).
+        log(LOG_WARN, "[io_session_process] Command stream dropped.");
+        session.cin_fd = -1;
+    }
+    if (session.slave_exited) {
+        if (event_loop_is_ready(loop, session.output_source) || !session.output_space
+            || (is_attached(session) && ring_buffer_used(session.pump.ring) > 0))
+            // Still getting output (or waiting for the pump to take it, or for the client to grant credit for it).
+            session.drain_deadline_us = monotonic_microseconds() + SLAVE_EXIT_DRAIN_TIMEOUT_MS * 1000;
+        else if (monotonic_microseconds() >= session.drain_deadline_us) {
+            logf(LOG_DEBUG, "[io_session_process] No slave output in the last %i ms.", SLAVE_EXIT_DRAIN_TIMEOUT_MS);
+            return false;
         }
-        _something_happened = false;
-#endif
-        // Processing commands:
-        if (!process_commands(pty_fd, h_cin, h_cout)) {
-            // Here we cannot ignore errors (command streams may be corrupted)
-            log(LOG_ERROR, "[run] Failed to process commands. Exiting.");
+    }
+    if (!is_ready(session, loop) && !has_pending_io(session) && !pty_write_due(session))
+        return true;
+    if (event_loop_is_ready(loop, session.records_source) || event_loop_is_ready(loop, session.input_source))
+        // What the slave writes next is most likely echo, so it shouldn't wait for coalescing.
+        output_pump_input_received(session.pump);
+    // Processing commands:
+    auto commands_closed{false};
+    if (event_loop_is_ready(loop, session.commands_source)
+        && !process_commands(session.pty_fd, session.scrollback, session.cin_fd, session.cout_fd, commands_closed)) {
+        // Here we cannot ignore errors (command streams may be corrupted)
+        log(LOG_ERROR, "[io_session_process] Failed to process commands.");
+        return false;
+    }
+    if (commands_closed) {
+        // A closed pipe is always ready, so it isn't waited on any more (it's still closed by its owner).
+        log(LOG_INFO, "[io_session_process] Command stream closed. The session goes on without it.");
+        session.cin_fd = -1;
+    }
+    // The pump's wakeups are cleared before anything is queued: a wakeup for the frames queued in this pass (or for
+    // the output committed in it) comes after it, and it's seen in the next one.
+    if (event_loop_is_ready(loop, session.pump_source)) {
+        output_pump_clear_wake(session.pump);
+        if (output_pump_failed(session.pump))
+            return channel_failed(session, "[io_session_process] Output pump failed.");
+    }
+    // Processing channel frames (the responses and granted credit are queued, and the pump writes them):
+    if (is_attached(session)) {
+        if (event_loop_is_ready(loop, session.channel_source) && !channel_receive(session.chan))
+            return channel_failed(session, "[io_session_process] Failed to read from the channel.");
+        if (!process_channel_frames(session))
+            // Here we cannot ignore errors either (the channel may be corrupted)
+            return channel_failed(session, "[io_session_process] Failed to process channel frames.");
+    }
+    // Input goes to PTY before any more output is read, so that keys (i.e. Ctrl+C) reach the slave in the pass they
+    // arrive in, however much output the slave is producing. Each source is served in every pass, within its budget:
+    // a single read of records, of input and of output (see process_input_records, process_input and process_output).
+    const auto written = pty_written(session);
+    // Processing slave process input records
+    bool slave_process_input_records_exhausted{true};
+    const auto records_ready = event_loop_is_ready(loop, session.records_source);
+    const auto records_ok = process_input_records(session, records_ready, slave_process_input_records_exhausted);
+    if (records_ready && session.out_fd < 0)
+        console_input_consumed(session.records_fd);
+    if (records_ok)
+        session.records_error_counter = 0;
+    else if (++session.records_error_counter > IO_ERRCOUNT_IGNORE) {
+        logf(LOG_WARN, "[io_session_process] Failed to process input records in %i attempts.", IO_ERRCOUNT_IGNORE);
+        return false;
+    } else {
+        usleep(IO_ERROR_BACKOFF_MICROSECONDS);
+        return true;
+    }
+    if (!slave_process_input_records_exhausted)
+        logf(LOG_TRACE, "[io_session_process] Input records still aren't exhausted.");
+    // Processing slave process input (`--ins` pipe, or the input frames in channel mode)
+    if (process_input(session, event_loop_is_ready(loop, session.input_source)))
+        session.input_error_counter = 0;
+    else if (++session.input_error_counter > IO_ERRCOUNT_IGNORE) {
+        logf(LOG_WARN, "[io_session_process] Failed to process input in %i attempts.", IO_ERRCOUNT_IGNORE);
+        return false;
+    } else {
+        usleep(IO_ERROR_BACKOFF_MICROSECONDS);
+        return true;
+    }
+    update_pty_write_backoff(session, event_loop_is_ready(loop, session.pty_write_source), written);
+    // Processing slave process output:
+    bool slave_output_exhausted{true};
+    if (process_output(session, event_loop_is_ready(loop, session.output_source), slave_output_exhausted))
+        session.output_error_counter = 0;
+    else if (++session.output_error_counter > IO_ERRCOUNT_IGNORE) {
+        logf(LOG_WARN, "[io_session_process] Failed to process output in %i attempts.", IO_ERRCOUNT_IGNORE);
+        return false;
+    } else
+        usleep(IO_ERROR_BACKOFF_MICROSECONDS);
+    if (!slave_output_exhausted)
+        logf(LOG_TRACE, "[io_session_process] Slave output still isn't exhausted.");
+    return !is_over(session);
+}
+
+void io_session_stop(io_session& session) {
+    if (!session.detached) {
+        // Whatever was read from PTY still has to reach the output.
+        output_pump_stop(session.pump);
+        if (session.channel_mode)
+            channel_close(session.chan);
+    }
+    scrollback_destroy(session.scrollback);
+}
+
+void io_session_request_stop(io_session& session) {
+    if (!session.detached)
+        output_pump_request_stop(session.pump);
+}
+
+int io_session_stop_fd(const io_session& session) {
+    return session.detached ? -1 : output_pump_wake_fd(session.pump);
+}
+
+bool io_session_stopped(io_session& session) {
+    if (session.detached)
+        return true;
+    output_pump_clear_wake(session.pump);
+    return output_pump_finished(session.pump);
+}
+
+// The replay has to fit into the output ring.
+static size_t replay_size() {
+    return _replay_buffer_size < _output_ring_size ? _replay_buffer_size : _output_ring_size;
+}
+
+bool io_session_persist(io_session& session) {
+    if (session.scrollback.data == nullptr && !scrollback_init(session.scrollback, replay_size()))
+        return false;
+    session.persistent = true;
+    return true;
+}
+
+bool io_session_attach(io_session& session, int chan_fd, int out_fd) {
+    if (!session.detached) {
+        log(LOG_INFO, "[io_session_attach] Another client is attaching.");
+        detach(session);
+    }
+    if (!channel_open(session.chan, chan_fd, out_fd)) {
+        log(LOG_ERROR, "[io_session_attach] Failed to open the channel.");
+        close(chan_fd);
+        close(out_fd);
+        return false;
+    }
+    if (!output_pump_start(session.pump, out_fd, &session.chan, _output_ring_size, _output_high_water,
+                           _output_low_water, _output_coalesce_bytes, _output_coalesce_delay_us)) {
+        log(LOG_ERROR, "[io_session_attach] Failed to start output pump.");
+        channel_close(session.chan);
+        close(chan_fd);
+        close(out_fd);
+        return false;
+    }
+    session.chan_fd = chan_fd;
+    session.out_fd = out_fd;
+    session.detached = session.commands_waiting = false;
+    // Replaying the recent output (from the first complete line), which is then sent as the client grants credit. It
+    // fits into the ring, regardless of the watermarks (the output is throttled right after it, if it's above them).
+    session.dropped_bytes = 0;
+    const auto used = session.scrollback.used;
+    const auto first = scrollback_line_start(session.scrollback, used > replay_size() ? used - replay_size() : 0);
+    auto offset = first;
+    while (offset < used) {
+        char* region{nullptr};
+        const auto length = ring_buffer_writable(session.pump.ring, &region);
+        if (length == 0)
             break;
-        }
-        // Processing slave process output:
-        bool slave_output_exhausted{true};
-        if (process_output(h_out, pty_fd, slave_output_exhausted))
-            process_output_error_counter = 0;
-        else if (++process_output_error_counter > IO_ERRCOUNT_IGNORE) {
-            logf(LOG_WARN, "[run] Failed to process output in %i attempts. Exiting.", IO_ERRCOUNT_IGNORE);
+        const auto copied = scrollback_read(session.scrollback, offset, region, length);
+        output_pump_commit(session.pump, copied);
+        offset += copied;
+    }
+    logf(LOG_INFO, "[io_session_attach] Client attached (%zu bytes of output replayed).", offset - first);
+    return true;
+}
+
+void run(int pty_fd, int slave_pid, int in_fd, int in_rec_fd, int out_fd, int cin_fd, int cout_fd, int chan_fd,
+         int listen_fd) {
+    log(LOG_INFO, "[run] Event loop started.");
+    if (!io_session_start(_session, pty_fd, slave_pid, in_fd, in_rec_fd, out_fd, cin_fd, cout_fd, chan_fd)) {
+        log(LOG_ERROR, "[run] Failed to start the session. Exiting.");
+        return;
+    }
+    if (listen_fd >= 0 && !io_session_persist(_session)) {
+        log(LOG_ERROR, "[run] Failed to make the session detachable. Exiting.");
+        io_session_stop(_session);
+        return;
+    }
+    const auto child_fd = child_watcher_start();
+    if (child_fd < 0) {
+        log(LOG_ERROR, "[run] Failed to start child watcher. Exiting.");
+        io_session_stop(_session);
+        return;
+    }
+    event_loop loop{};
+    while (true) {
+        // Waiting for any of the sources to become ready
+        stats_add(STATS_LOOP_ITERATIONS, 1);
+        event_loop_clear(loop);
+        const auto child_source = event_loop_add(loop, _session.slave_exited ? -1 : child_fd);
+        const auto listen_source = event_loop_add(loop, listen_fd);
+        if (!io_session_add_sources(_session, loop) || child_source == EVENT_LOOP_FAILED
+            || listen_source == EVENT_LOOP_FAILED) {
+            log(LOG_ERROR, "[run] Failed to add the event sources. Exiting.");
             break;
-        } else {
-            _something_happened = true;
-            usleep(10000);
-            continue;
         }
-        if (!slave_output_exhausted)
-            logf(LOG_TRACE, "[run] Slave output still isn't exhausted.");
-        // Processing slave process input records
-        bool slave_process_input_records_exhausted{true};
-        if (process_input_records(pty_fd, h_out, h_in_rec, slave_process_input_records_exhausted))
-            process_input_records_error_counter = 0;
-        else if (++process_input_records_error_counter > IO_ERRCOUNT_IGNORE) {
-            logf(LOG_WARN, "[run] Failed to process input records in %i attempts. Exiting.", IO_ERRCOUNT_IGNORE);
+        const auto timeout_ms = io_session_timeout_ms(_session);
+        int ready_count{0};
+        if (!event_loop_wait(loop, timeout_ms, ready_count)) {
+            log(LOG_ERROR, "[run] Failed to wait for I/O events. Exiting.");
             break;
-        } else {
-            _something_happened = true;
-            usleep(10000);
-            continue;
         }
-        if (!slave_process_input_records_exhausted)
-            logf(LOG_TRACE, "[run] Input records still aren't exhausted.");
-        // The remaining part of the loop is used only in managed mode (for reading from _h_input)
-        // Also currently we aren't dealing with input before finishing with output
-        if (h_in == nullptr || !slave_output_exhausted || !slave_process_input_records_exhausted)
-            continue;
-        // Processing slave process input
-        if (process_input(pty_fd, h_in))
-            process_input_stream_error_counter = 0;
-        else if (++process_input_stream_error_counter > IO_ERRCOUNT_IGNORE) {
-            logf(LOG_WARN, "[run] Failed to process input in %i attempts. Exiting.", IO_ERRCOUNT_IGNORE);
+        if (ready_count == 0 && timeout_ms != 0)
+            stats_add(STATS_IDLE_WAKEUPS, 1);
+        int slave_status{0};
+        if (event_loop_is_ready(loop, child_source) && child_watcher_check(child_fd, slave_pid, slave_status))
+            io_session_slave_exited(_session, slave_status);
+        int client_in_fd{-1}, client_out_fd{-1};
+        if (event_loop_is_ready(loop, listen_source) && session_socket_accept(listen_fd, client_in_fd, client_out_fd)
+            && !io_session_attach(_session, client_in_fd, client_out_fd))
+            log(LOG_WARN, "[run] Failed to attach the client.");
+        if (!io_session_process(_session, loop)) {
+            log(LOG_DEBUG, "[run] Session is over. Exiting.");
             break;
-        } else
-            usleep(10000);
+        }
     }
-    log(LOG_INFO, "[run] Event loop finished.");
+    child_watcher_stop();
+    io_session_stop(_session);
+    event_loop_destroy(loop);
+    if (_session.slave_exited)
+        logf(LOG_INFO, "[run] Event loop finished. Slave exit status: %i.", _session.slave_status);
+    else
+        log(LOG_INFO, "[run] Event loop finished.");
 }
 
 #pragma clang diagnostic pop
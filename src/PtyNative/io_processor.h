@@ -12,6 +12,170 @@
 
 #include "includes.h"
 
-void run(int pty_fd, int slave_pid, HANDLE h_in, HANDLE h_in_rec, HANDLE h_out, HANDLE h_cin, HANDLE h_cout);
+#include "channel.h"
+#include "event_loop.h"
+#include "key_translator.h"
+#include "output_pump.h"
+#include "scrollback.h"
+
+#define PTY_BUFFER_SIZE 4096
+#define INPUT_RECORDS_PER_CYCLE 100
+
+// Every session has its own ring (and the host runs many sessions), so the default is kept small. Reads larger than
+// the ring (see `_pty_read_max_size`) need a larger one (`--obuf`).
+#define OUTPUT_RING_DEFAULT_SIZE (256 * 1024)
+#define PTY_READ_MIN_SIZE 4096
+#define PTY_READ_MAX_DEFAULT_SIZE (1024 * 1024)
+#define OUTPUT_COALESCE_DEFAULT_BYTES (16 * 1024)
+#define REPLAY_BUFFER_DEFAULT_SIZE (64 * 1024)
+#define SCROLLBACK_MAX_SIZE_MB 1024
+
+// What's done with the shell output while the output is throttled (see `_output_policy`).
+#define OUTPUT_POLICY_BLOCK 0
+#define OUTPUT_POLICY_DROP 1
+#define OUTPUT_POLICY_SUMMARY 2
+
+// Size (in bytes) of the ring buffer between PTY and the output. It's rounded up to the next power of two.
+extern size_t _output_ring_size;
+// Upper limit (in bytes) of a single PTY read. Reads start at PTY_READ_MIN_SIZE, and grow while they keep filling the
+// buffer. A read is also limited by the contiguous free space in the output ring.
+extern size_t _pty_read_max_size;
+// Output coalescing: if _output_coalesce_delay_us isn't 0, output is held back until _output_coalesce_bytes are
+// buffered, or the oldest byte has waited _output_coalesce_delay_us (output that follows input isn't held back).
+extern size_t _output_coalesce_bytes;
+extern long long _output_coalesce_delay_us;
+// Output watermarks (in bytes): PTY reading is paused once this much output is pending (0 means the output ring size),
+// and it's resumed once the output is drained down to the low watermark (0 means half of the high one).
+extern size_t _output_high_water;
+extern size_t _output_low_water;
+// OUTPUT_POLICY_BLOCK (the default): PTY isn't read while the output is throttled, so the slave blocks on its writes.
+// OUTPUT_POLICY_DROP: PTY keeps being read, and the output is dropped (it's still appended to the scrollback).
+// OUTPUT_POLICY_SUMMARY: as with DROP, but a line with the number of bytes that were dropped is written on resume.
+extern int _output_policy;
+// Size (in bytes) of the recent output that's replayed to a client attaching to a detachable session. It's limited to
+// the size of the output ring.
+extern size_t _replay_buffer_size;
+// Size (in bytes) of each session's scrollback (0 if it isn't kept, which is the default). A detachable session keeps
+// at least the output to replay.
+extern size_t _scrollback_size;
+
+// A PTY with its slave process, its streams, and everything that's in flight between them. The mediator runs a
+// single session (see `run`), and the host (see session_host.h) runs many of them on the same event loop.
+struct io_session {
+    // Streams (see `run`).
+    int pty_fd;
+    int slave_pid;
+    int in_fd;
+    int in_rec_fd;
+    int out_fd;
+    int cin_fd;
+    int cout_fd;
+    int chan_fd;
+    // In stand-alone mode records are read from the console, and in managed mode from `--inr` pipe.
+    int records_fd;
+    bool channel_mode;
+    channel chan;
+    output_pump pump;
+    key_translator translator;
+    bool pty_closed;
+    // Current PTY read size: doubled (up to `_pty_read_max_size`) whenever a read fills it, and halved (down to
+    // PTY_READ_MIN_SIZE) whenever a read returns less than a quarter of it, so bulk output is read in large chunks,
+    // while interactive output stays with small reads.
+    size_t pty_read_size;
+    // Records and input that are read, but not written yet (written once PTY is writable, or retried in the next pass
+    // if the processing fails).
+    INPUT_RECORD records[INPUT_RECORDS_PER_CYCLE];
+    int record_index;
+    int record_count;
+    // Repeats of the record at record_index that aren't translated yet (0 if its translation hasn't started).
+    int record_repeats_left;
+    // Bytes of an incomplete record (the last one read from the pipe), kept at the beginning of the records buffer
+    // until the rest of the record arrives.
+    int record_carry_bytes;
+    char input_buffer[PTY_BUFFER_SIZE];
+    int input_buffer_count;
+    int input_buffer_index;
+    // All the input bytes written to PTY so far (the translated keys are counted by the translator).
+    unsigned long long input_written;
+    // PTY write backoff: if PTY reports that it's writable, but it doesn't take any of the input (its queue is still
+    // full), it isn't waited on for writing any more. The write is retried after pty_write_backoff_ms instead, which
+    // is doubled (up to PTY_WRITE_BACKOFF_MAX_MS) while PTY keeps not taking anything, and reset (0, waiting on PTY
+    // again) once it does.
+    int pty_write_backoff_ms;
+    long long pty_write_retry_us;
+    bool slave_exited;
+    int slave_status;
+    long long drain_deadline_us;
+    // When the output became throttled (0 if it isn't).
+    long long stall_started_us;
+    // Output dropped while throttled (with OUTPUT_POLICY_DROP / OUTPUT_POLICY_SUMMARY), not reported yet.
+    unsigned long long dropped_bytes;
+    int output_error_counter;
+    int records_error_counter;
+    int input_error_counter;
+    // Channel mode: command frames wait for room in the channel's queue (the pump wakes the loop once there's room).
+    bool commands_waiting;
+    // Registered by io_session_add_sources for the current pass.
+    bool output_space;
+    int commands_source;
+    int output_source;
+    int pty_write_source;
+    int pump_source;
+    int records_source;
+    int input_source;
+    int channel_source;
+    // Detachable session (channel mode only): when the channel is closed (or fails) the session keeps running
+    // detached, and the next client is attached with io_session_attach. The recent output is replayed to it from the
+    // scrollback.
+    bool persistent;
+    bool detached;
+    // All the output (data is null if it isn't kept) is appended to it right from the buffer PTY is read into.
+    scrollback_ring scrollback;
+};
+
+// Starts the session's I/O (the streams are as described for `run`). Only one session may use the command pipes
+// (cin_fd and cout_fd), since the state of their protocol is global.
+bool io_session_start(io_session& session, int pty_fd, int slave_pid, int in_fd, int in_rec_fd, int out_fd,
+                      int cin_fd, int cout_fd, int chan_fd);
+
+// Adds the sources the session has to wait on in this pass. Returns false if any of them couldn't be added (the session
+// can't go on then).
+bool io_session_add_sources(io_session& session, event_loop& loop);
+
+// The longest the next wait may take as far as the session is concerned (in ms, -1 for no limit).
+int io_session_timeout_ms(const io_session& session);
+
+// Called when the slave process has terminated: the rest of its output is drained before the session is over.
+void io_session_slave_exited(io_session& session, int status);
+
+// Processes whatever is ready after the wait. Returns false when the session is over: PTY is closed, the slave has
+// exited and its output is drained, or an error that can't be ignored.
+bool io_session_process(io_session& session, const event_loop& loop);
+
+// Stops the session's I/O. Whatever was read from PTY still reaches the output. The streams aren't closed.
+void io_session_stop(io_session& session);
+
+// Starts stopping the session's I/O without waiting for the output to be written: the loop waits on
+// io_session_stop_fd until io_session_stopped returns true, and then calls io_session_stop (which doesn't block then).
+void io_session_request_stop(io_session& session);
+int io_session_stop_fd(const io_session& session);
+bool io_session_stopped(io_session& session);
+
+// Makes a started channel mode session detachable. Returns false on failure.
+bool io_session_persist(io_session& session);
+
+// Attaches a client's channel (read from chan_fd, and written to out_fd) to a detachable session, after detaching the
+// client that's attached (if any). The recent output is replayed to the new client first. Returns false on failure
+// (chan_fd and out_fd are closed then). The session owns the channel's descriptors, and closes them when the client
+// is detached.
+bool io_session_attach(io_session& session, int chan_fd, int out_fd);
+
+// Runs a single session until it's over. All the streams are file descriptors (-1 if not used). If out_fd is -1, we
+// are in stand-alone mode, and the console is used for both input and output. If chan_fd isn't -1, all the streams
+// are multiplexed over a channel (read from chan_fd, and written to out_fd), and in_fd, in_rec_fd, cin_fd and cout_fd
+// aren't used. If listen_fd isn't -1 (channel mode only), the session is detachable, and the clients attach to it
+// through the listening socket (see session_socket.h).
+void run(int pty_fd, int slave_pid, int in_fd, int in_rec_fd, int out_fd, int cin_fd, int cout_fd, int chan_fd = -1,
+         int listen_fd = -1);
 
 #endif //PTYNATIVE_IO_PROCESSOR_H
@@ -0,0 +1,369 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "key_translator.h"
+
+#include "logging.h"
+#include "stats.h"
+
+#define REPLACEMENT_CHARACTER 0xFFFDU
+
+#define ESC '\x1b'
+#define VT_SEQUENCE_MAX_LENGTH 8
+// Shift, Alt and Ctrl (xterm modifier parameter is 1 + the combination index)
+#define VT_MODIFIER_SHIFT 1U
+#define VT_MODIFIER_ALT 2U
+#define VT_MODIFIER_CTRL 4U
+#define VT_MODIFIER_COMBINATIONS 8
+#define VT_CURSOR_MODES 2
+#define VT_VIRTUAL_KEYS 256
+
+#define SCAN_GROUND 0
+#define SCAN_ESCAPE 1
+#define SCAN_CSI_START 2
+#define SCAN_CSI_PRIVATE 3
+
+struct vt_sequence {
+    char bytes[VT_SEQUENCE_MAX_LENGTH];
+    unsigned char length;
+};
+
+struct vt_key_table {
+    // [cursor mode][modifiers][virtual key code]
+    vt_sequence sequences[VT_CURSOR_MODES][VT_MODIFIER_COMBINATIONS][VT_VIRTUAL_KEYS];
+};
+
+static constexpr void append(vt_sequence& sequence, char c) {
+    sequence.bytes[sequence.length++] = c;
+}
+
+static constexpr void append_number(vt_sequence& sequence, unsigned int number) {
+    if (number >= 10)
+        append(sequence, (char) ('0' + number / 10));
+    append(sequence, (char) ('0' + number % 10));
+}
+
+// Cursor keys, Home and End: `CSI x` (`SS3 x` in application cursor mode), or `CSI 1 ; m x` if modified.
+static constexpr void set_cursor_key(vt_key_table& table, unsigned int virtual_key_code, char final_char) {
+    for (auto mode = 0; mode < VT_CURSOR_MODES; ++mode)
+        for (auto modifiers = 0U; modifiers < VT_MODIFIER_COMBINATIONS; ++modifiers) {
+            auto& sequence = table.sequences[mode][modifiers][virtual_key_code];
+            append(sequence, ESC);
+            append(sequence, mode == 1 && modifiers == 0 ? 'O' : '[');
+            if (modifiers != 0) {
+                append(sequence, '1');
+                append(sequence, ';');
+                append_number(sequence, 1 + modifiers);
+            }
+            append(sequence, final_char);
+        }
+}
+
+// F1 - F4: `SS3 x`, or `CSI 1 ; m x` if modified.
+static constexpr void set_pf_key(vt_key_table& table, unsigned int virtual_key_code, char final_char) {
+    for (auto mode = 0; mode < VT_CURSOR_MODES; ++mode)
+        for (auto modifiers = 0U; modifiers < VT_MODIFIER_COMBINATIONS; ++modifiers) {
+            auto& sequence = table.sequences[mode][modifiers][virtual_key_code];
+            append(sequence, ESC);
+            append(sequence, modifiers == 0 ? 'O' : '[');
+            if (modifiers != 0) {
+                append(sequence, '1');
+                append(sequence, ';');
+                append_number(sequence, 1 + modifiers);
+            }
+            append(sequence, final_char);
+        }
+}
+
+// Editing keys and F5 - F12: `CSI n ~`, or `CSI n ; m ~` if modified.
+static constexpr void set_tilde_key(vt_key_table& table, unsigned int virtual_key_code, unsigned int number) {
+    for (auto mode = 0; mode < VT_CURSOR_MODES; ++mode)
+        for (auto modifiers = 0U; modifiers < VT_MODIFIER_COMBINATIONS; ++modifiers) {
+            auto& sequence = table.sequences[mode][modifiers][virtual_key_code];
+            append(sequence, ESC);
+            append(sequence, '[');
+            append_number(sequence, number);
+            if (modifiers != 0) {
+                append(sequence, ';');
+                append_number(sequence, 1 + modifiers);
+            }
+            append(sequence, '~');
+        }
+}
+
+static constexpr vt_key_table build_vt_key_table() {
+    vt_key_table table{};
+    set_cursor_key(table, VK_UP, 'A');
+    set_cursor_key(table, VK_DOWN, 'B');
+    set_cursor_key(table, VK_RIGHT, 'C');
+    set_cursor_key(table, VK_LEFT, 'D');
+    set_cursor_key(table, VK_HOME, 'H');
+    set_cursor_key(table, VK_END, 'F');
+    set_tilde_key(table, VK_INSERT, 2);
+    set_tilde_key(table, VK_DELETE, 3);
+    set_tilde_key(table, VK_PRIOR, 5);
+    set_tilde_key(table, VK_NEXT, 6);
+    set_pf_key(table, VK_F1, 'P');
+    set_pf_key(table, VK_F2, 'Q');
+    set_pf_key(table, VK_F3, 'R');
+    set_pf_key(table, VK_F4, 'S');
+    set_tilde_key(table, VK_F5, 15);
+    set_tilde_key(table, VK_F6, 17);
+    set_tilde_key(table, VK_F7, 18);
+    set_tilde_key(table, VK_F8, 19);
+    set_tilde_key(table, VK_F9, 20);
+    set_tilde_key(table, VK_F10, 21);
+    set_tilde_key(table, VK_F11, 23);
+    set_tilde_key(table, VK_F12, 24);
+    return table;
+}
+
+static constexpr vt_key_table _vt_key_table = build_vt_key_table();
+
+static_assert(KEY_REPEAT_MAX_COUNT * VT_SEQUENCE_MAX_LENGTH <= KEY_TRANSLATOR_BUFFER_SIZE);
+
+static_assert(_vt_key_table.sequences[1][0][VK_UP].bytes[1] == 'O');
+static_assert(_vt_key_table.sequences[0][VT_MODIFIER_CTRL][VK_F12].length == 7);
+
+static inline bool is_high_surrogate(unsigned int unit) {
+    return unit >= 0xD800U && unit <= 0xDBFFU;
+}
+
+static inline bool is_low_surrogate(unsigned int unit) {
+    return unit >= 0xDC00U && unit <= 0xDFFFU;
+}
+
+static inline int encode_utf8(unsigned int code_point, char* out) {
+    if (code_point < 0x80U) {
+        out[0] = (char) code_point;
+        return 1;
+    }
+    if (code_point < 0x800U) {
+        out[0] = (char) (0xC0U | (code_point >> 6U));
+        out[1] = (char) (0x80U | (code_point & 0x3FU));
+        return 2;
+    }
+    if (code_point < 0x10000U) {
+        out[0] = (char) (0xE0U | (code_point >> 12U));
+        out[1] = (char) (0x80U | ((code_point >> 6U) & 0x3FU));
+        out[2] = (char) (0x80U | (code_point & 0x3FU));
+        return 3;
+    }
+    out[0] = (char) (0xF0U | (code_point >> 18U));
+    out[1] = (char) (0x80U | ((code_point >> 12U) & 0x3FU));
+    out[2] = (char) (0x80U | ((code_point >> 6U) & 0x3FU));
+    out[3] = (char) (0x80U | (code_point & 0x3FU));
+    return 4;
+}
+
+static inline unsigned int modifiers_of(DWORD control_key_state) {
+    auto modifiers{0U};
+    if (control_key_state & SHIFT_PRESSED) // NOLINT(hicpp-signed-bitwise)
+        modifiers |= VT_MODIFIER_SHIFT;
+    if (control_key_state & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED)) // NOLINT(hicpp-signed-bitwise)
+        modifiers |= VT_MODIFIER_ALT;
+    if (control_key_state & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) // NOLINT(hicpp-signed-bitwise)
+        modifiers |= VT_MODIFIER_CTRL;
+    return modifiers;
+}
+
+void key_translator_init(key_translator& translator, int pty_fd) {
+    translator.pty_fd = pty_fd;
+    translator.count = 0;
+    translator.written = 0;
+    translator.total_written = 0;
+    translator.high_surrogate = 0;
+    translator.application_cursor = false;
+    translator.scan_state = SCAN_GROUND;
+    translator.scan_parameter = 0;
+    translator.scan_has_decckm = false;
+}
+
+void key_translator_scan_output(key_translator& translator, const char* data, size_t length) {
+    auto pos = data;
+    const auto end = data + length;
+    while (pos < end) {
+        if (translator.scan_state == SCAN_GROUND) {
+            // Most of the output has no escape sequences at all.
+            pos = (const char*) memchr(pos, ESC, end - pos);
+            if (pos == nullptr)
+                return;
+            translator.scan_state = SCAN_ESCAPE;
+            ++pos;
+            continue;
+        }
+        const auto c = *pos++;
+        switch (translator.scan_state) {
+            case SCAN_ESCAPE:
+                if (c == '[')
+                    translator.scan_state = SCAN_CSI_START;
+                else {
+                    if (c == 'c') {
+                        // RIS (full reset)
+                        translator.application_cursor = false;
+                        log(LOG_DEBUG, "[key_translator_scan_output] Terminal reset, DECCKM off.");
+                    }
+                    translator.scan_state = c == ESC ? SCAN_ESCAPE : SCAN_GROUND;
+                }
+                break;
+            case SCAN_CSI_START:
+                if (c == '?') {
+                    translator.scan_state = SCAN_CSI_PRIVATE;
+                    translator.scan_parameter = 0;
+                    translator.scan_has_decckm = false;
+                } else
+                    // Not a private mode sequence, so not interesting.
+                    translator.scan_state = c == ESC ? SCAN_ESCAPE : SCAN_GROUND;
+                break;
+            default: // SCAN_CSI_PRIVATE
+                if (c >= '0' && c <= '9') {
+                    if (translator.scan_parameter < 10000)
+                        translator.scan_parameter = translator.scan_parameter * 10 + (c - '0');
+                    break;
+                }
+                if (c == ';') {
+                    translator.scan_has_decckm = translator.scan_has_decckm || translator.scan_parameter == 1;
+                    translator.scan_parameter = 0;
+                    break;
+                }
+                if ((c == 'h' || c == 'l') && (translator.scan_has_decckm || translator.scan_parameter == 1)) {
+                    translator.application_cursor = c == 'h';
+                    logf(LOG_DEBUG, "[key_translator_scan_output] DECCKM %s.", c == 'h' ? "on" : "off");
+                }
+                translator.scan_state = c == ESC ? SCAN_ESCAPE : SCAN_GROUND;
+                break;
+        }
+    }
+}
+
+bool key_translator_put_key(key_translator& translator, WORD virtual_key_code, DWORD control_key_state,
+                            int& repeat_count, bool& known) {
+    const auto& sequence = _vt_key_table.sequences[translator.application_cursor ? 1 : 0]
+                                                  [modifiers_of(control_key_state)]
+                                                  [virtual_key_code & (VT_VIRTUAL_KEYS - 1U)];
+    known = sequence.length > 0 && virtual_key_code < VT_VIRTUAL_KEYS;
+    if (!known) {
+        repeat_count = 0;
+        return true;
+    }
+    return key_translator_put_bytes(translator, sequence.bytes, sequence.length, repeat_count);
+}
+
+bool key_translator_flush(key_translator& translator) {
+    if (translator.count == 0)
+        // Nothing collected (it's flushed on every pass).
+        return true;
+    stats_max(STATS_KEY_BATCH_HIGH_WATER, translator.count);
+    while (translator.written < translator.count) {
+        const auto result = write(translator.pty_fd, translator.buffer + translator.written,
+                                  translator.count - translator.written);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                // PTY's input queue is full. The rest is written once it's writable.
+                stats_add(STATS_PTY_WRITE_STALLS, 1);
+                return true;
+            }
+            log_lin_error(LOG_ERROR, "[key_translator_flush] 'write' call failed.");
+            return false;
+        }
+        translator.written += (int) result;
+        translator.total_written += result;
+        stats_add(STATS_PTY_WRITES, 1);
+        stats_add(STATS_PTY_BYTES_WRITTEN, result);
+    }
+    logf(LOG_TRACE, "[key_translator_flush] %i bytes written to PTY.", translator.count);
+    translator.count = 0;
+    translator.written = 0;
+    return true;
+}
+
+bool key_translator_pending(const key_translator& translator) {
+    return translator.written < translator.count;
+}
+
+// Makes room for `length` more bytes, by writing what's collected. Returns false in `room` if PTY doesn't take enough
+// of it (only a batch that doesn't fit into the buffer gets here).
+static bool make_room(key_translator& translator, int length, bool& room) {
+    room = KEY_TRANSLATOR_BUFFER_SIZE - translator.count >= length;
+    if (room)
+        return true;
+    if (!key_translator_flush(translator))
+        return false;
+    if (translator.written > 0) {
+        translator.count -= translator.written;
+        memmove(translator.buffer, translator.buffer + translator.written, translator.count);
+        translator.written = 0;
+    }
+    room = KEY_TRANSLATOR_BUFFER_SIZE - translator.count >= length;
+    return true;
+}
+
+bool key_translator_put_bytes(key_translator& translator, const char* bytes, int length, int& repeat_count) {
+    while (repeat_count > 0) {
+        auto room{false};
+        if (!make_room(translator, length, room))
+            return false;
+        if (!room)
+            return true;
+        memcpy(translator.buffer + translator.count, bytes, length);
+        translator.count += length;
+        --repeat_count;
+    }
+    return true;
+}
+
+// The replacement character for an unpaired surrogate. Returns false in `appended` if it doesn't fit.
+static bool put_replacement(key_translator& translator, bool& appended) {
+    log(LOG_WARN, "[put_replacement] Unpaired surrogate replaced.");
+    char encoded[4];
+    auto repeat_count{1};
+    const auto result = key_translator_put_bytes(translator, encoded, encode_utf8(REPLACEMENT_CHARACTER, encoded),
+                                                 repeat_count);
+    appended = repeat_count == 0;
+    return result;
+}
+
+bool key_translator_put_char(key_translator& translator, WCHAR unicode_char, int& repeat_count) {
+    const auto unit = (unsigned int) unicode_char;
+    auto appended{true};
+    if (is_high_surrogate(unit)) {
+        if (translator.high_surrogate != 0 && !put_replacement(translator, appended))
+            return false;
+        if (!appended)
+            return true;
+        // The low surrogate (and its repeat count) completes the character.
+        translator.high_surrogate = unicode_char;
+        repeat_count = 0;
+        return true;
+    }
+    unsigned int code_point{unit};
+    if (is_low_surrogate(unit)) {
+        if (translator.high_surrogate != 0)
+            code_point = 0x10000U + ((((unsigned int) translator.high_surrogate) - 0xD800U) << 10U) + (unit - 0xDC00U);
+        else {
+            log(LOG_WARN, "[key_translator_put_char] Unpaired low surrogate replaced.");
+            code_point = REPLACEMENT_CHARACTER;
+        }
+    } else if (translator.high_surrogate != 0) {
+        if (!put_replacement(translator, appended))
+            return false;
+        if (!appended)
+            return true;
+        translator.high_surrogate = 0;
+    }
+    char encoded[4];
+    if (!key_translator_put_bytes(translator, encoded, encode_utf8(code_point, encoded), repeat_count))
+        return false;
+    // The high surrogate is kept until all the repeats are appended (the rest of them are appended with it).
+    if (repeat_count == 0)
+        translator.high_surrogate = 0;
+    return true;
+}
@@ -0,0 +1,67 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_KEY_TRANSLATOR_H
+#define PTYNATIVE_KEY_TRANSLATOR_H
+
+#include "includes.h"
+
+#define KEY_TRANSLATOR_BUFFER_SIZE 4096
+// Upper limit of a key event's repeat count, so that a single record can't turn into an unbounded amount of input
+// (the longest sequence repeated this many times still fits into the buffer).
+#define KEY_REPEAT_MAX_COUNT 256
+
+// Translates key events into the bytes that are sent to PTY. The bytes of a whole batch of records are collected
+// in the buffer, and written with a single `write` (or more, only if the buffer gets full). PTY is non-blocking: what
+// it doesn't take right away is kept, and written once it's writable again. Nothing here waits for PTY: if the buffer
+// is full and PTY doesn't take any of it, the repeats that don't fit are left to the caller (see `repeat_count`).
+struct key_translator {
+    int pty_fd;
+    char buffer[KEY_TRANSLATOR_BUFFER_SIZE];
+    int count;
+    // Bytes at the beginning of the buffer that are already written (if the last flush was partial).
+    int written;
+    // All the bytes written to PTY so far.
+    unsigned long long total_written;
+    // High surrogate waiting for its pair (0 if none), since the halves of a pair may come in two records.
+    WCHAR high_surrogate;
+    // DECCKM (application cursor keys) mode, as last set by the slave in its output.
+    bool application_cursor;
+    // State of the output scanner that tracks DECCKM (escape sequences may be split between reads).
+    unsigned char scan_state;
+    unsigned int scan_parameter;
+    bool scan_has_decckm;
+};
+
+void key_translator_init(key_translator& translator, int pty_fd);
+
+// The functions that append take repeat_count by reference, and decrease it by the repeats that are appended. If it
+// isn't 0 when they return, the buffer is full (and PTY hasn't taken enough of it): the rest of the repeats should be
+// appended once PTY is writable again. They return false only if writing to PTY fails.
+
+// Appends UTF-8 encoding of the UTF-16 code unit, repeat_count times.
+bool key_translator_put_char(key_translator& translator, WCHAR unicode_char, int& repeat_count);
+
+// Appends the xterm escape sequence for a non-character key (arrows, Home / End, PgUp / PgDn, Insert / Delete,
+// F1 - F12), with Shift / Alt / Ctrl modifiers. Returns false in `known` if there's no sequence for the key.
+bool key_translator_put_key(key_translator& translator, WORD virtual_key_code, DWORD control_key_state,
+                            int& repeat_count, bool& known);
+
+// Appends the raw bytes, repeat_count times.
+bool key_translator_put_bytes(key_translator& translator, const char* bytes, int length, int& repeat_count);
+
+// Scans the slave output for DECCKM set / reset sequences (`ESC [ ? 1 h` / `ESC [ ? 1 l`).
+void key_translator_scan_output(key_translator& translator, const char* data, size_t length);
+
+// Writes what's collected to PTY, as much as it takes. The rest is kept for the next attempt (also if it fails).
+bool key_translator_flush(key_translator& translator);
+// Whether there are bytes that PTY hasn't taken yet.
+bool key_translator_pending(const key_translator& translator);
+
+#endif //PTYNATIVE_KEY_TRANSLATOR_H
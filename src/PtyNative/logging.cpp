@@ -9,48 +9,106 @@
 
 #include "logging.h"
 
+#include "binary_log.h"
 #include "helpers.h"
 
+#include <atomic>
+#include <pthread.h>
+
 #define MAX_WIN_ERROR_MESSAGE_LENGTH 256
-#define LOG_FILE_NAME_LENGTH 50
+// Room for any value of the fields (the compiler checks the formats against it).
+#define LOG_FILE_NAME_LENGTH 128
+#define LOG_BATCH_BUFFER_SIZE (64 * 1024)
+// "[hh:mm:ss.mmm]"
+#define LOG_TIME_LENGTH 14
+// The same as LOG_FILE_NAME_LENGTH: only LOG_TIME_LENGTH of it is ever used.
+#define LOG_TIME_BUFFER_SIZE 64
+// "FD:[TRC]"
+#define LOG_TAG_LENGTH 8
+#define WAKE_DRAIN_BUFFER_SIZE 64
 
 int _min_log_level{0};//{LOG_ERROR + 1};//Turned off by default.
 bool _debug_view{true};//{false};
+bool _binary_log{false};
 static volatile int _log_fd{0};
 static int _parent_pid{0};
 
+// Bounded multi-producer queue (each slot carries a sequence number, so producers don't need locks), consumed by
+// the log writer thread.
+struct log_record {
+    std::atomic<size_t> sequence;
+    int level;
+    timespec time;
+    // Binary log records (see binary_log.h) are kept as they are going to be written, and `length` is their size.
+    bool binary;
+    int length;
+    char message[DEBUG_LOG_MAX_BUFFER];
+};
+
+static log_record _log_queue[LOG_QUEUE_SIZE];
+static std::atomic<size_t> _log_enqueue_position{0};
+static size_t _log_dequeue_position{0};
+static std::atomic<unsigned int> _log_dropped{0};
+static std::atomic<bool> _log_writer_running{false};
+static std::atomic<bool> _log_writer_stopping{false};
+static std::atomic<bool> _log_writer_idle{false};
+static int _log_wake[2]{-1, -1};
+static pthread_t _log_writer_thread;
+// Used by the writer thread only (+1 for the terminating zero of the last line, needed by OutputDebugStringA).
+static char _log_batch[LOG_BATCH_BUFFER_SIZE + 1];
+
+static_assert((LOG_QUEUE_SIZE & (LOG_QUEUE_SIZE - 1)) == 0, "LOG_QUEUE_SIZE must be a power of two.");
+
+// Writes a line that isn't a log message (no time and level) to the log file.
+static void write_file_line(int log_fd, const char* line) {
+    if (!_binary_log) {
+        if (write_exact(log_fd, line))
+            write(log_fd, "\n", 1);
+        return;
+    }
+    char record[DEBUG_LOG_MAX_BUFFER];
+    const auto length = binary_log_encode_text(record, sizeof(record), LOG_INFO, monotonic_microseconds(), line);
+    if (length > 0)
+        write_exact(log_fd, record, length, true);
+}
+
 static void log_args(int log_fd) {
+#ifndef __CYGWIN__
+    (void) log_fd;
+#else
     const auto cmd_line = GetCommandLineW();
     if (!cmd_line)
         return;
     char* str_ptr{nullptr};
-    if (wchar_to_char_string(CP_UTF8, cmd_line, &str_ptr) && write_exact(log_fd, str_ptr))
-        write(log_fd, "\n", 1);
+    if (wchar_to_char_string(CP_UTF8, cmd_line, &str_ptr))
+        write_file_line(log_fd, str_ptr);
     if (str_ptr)
         free(str_ptr);
+#endif
 }
 
 static int get_log_file() {
     if (_log_fd > 0)
         return _log_fd;
     // Creating the log file
+    const auto extension = _binary_log ? "blog" : "log";
     auto raw_time = time(nullptr);
     auto time_info = localtime(&raw_time);
     char log_file_name[LOG_FILE_NAME_LENGTH]{0};
     if (time_info == nullptr) {
         if (_parent_pid > 0)
-            snprintf(log_file_name, LOG_FILE_NAME_LENGTH, "./pty-%i-%i.log", _parent_pid, getpid());
+            snprintf(log_file_name, LOG_FILE_NAME_LENGTH, "./pty-%i-%i.%s", _parent_pid, getpid(), extension);
         else
-            snprintf(log_file_name, LOG_FILE_NAME_LENGTH, "./pty-%i.log", getpid());
+            snprintf(log_file_name, LOG_FILE_NAME_LENGTH, "./pty-%i.%s", getpid(), extension);
     } else {
         if (_parent_pid > 0)
-            snprintf(log_file_name, LOG_FILE_NAME_LENGTH, "./pty-%04i%02i%02i-%02i%02i%02i-%i-%i.log",
+            snprintf(log_file_name, LOG_FILE_NAME_LENGTH, "./pty-%04i%02i%02i-%02i%02i%02i-%i-%i.%s",
                     time_info->tm_year + 1900, time_info->tm_mon + 1, time_info->tm_mday + 1, time_info->tm_hour,
-                    time_info->tm_min, time_info->tm_sec, _parent_pid, getpid());
+                    time_info->tm_min, time_info->tm_sec, _parent_pid, getpid(), extension);
         else
-            snprintf(log_file_name, LOG_FILE_NAME_LENGTH, "./pty-%04i%02i%02i-%02i%02i%02i-%i.log",
+            snprintf(log_file_name, LOG_FILE_NAME_LENGTH, "./pty-%04i%02i%02i-%02i%02i%02i-%i.%s",
                      time_info->tm_year + 1900, time_info->tm_mon + 1, time_info->tm_mday + 1, time_info->tm_hour,
-                     time_info->tm_min, time_info->tm_sec, getpid());
+                     time_info->tm_min, time_info->tm_sec, getpid(), extension);
     }
     _log_fd = open(log_file_name, O_WRONLY|O_CREAT|O_TRUNC, 0600); // NOLINT(hicpp-signed-bitwise)
     if (_log_fd <= 0) {
@@ -58,9 +116,15 @@ static int get_log_file() {
         return 0;
     }
     fchmod(_log_fd, 0600);
+    if (_binary_log) {
+        char header[BINARY_LOG_HEADER_SIZE];
+        write_exact(_log_fd, header, binary_log_encode_header(header, sizeof(header)), true);
+        // The new file needs its own format records.
+        binary_log_reset_formats_written();
+    }
     log_args(_log_fd);
     if (_parent_pid > 0)
-        write_exact(_log_fd, "---SLAVE PROCESS---\n");
+        write_file_line(_log_fd, "---SLAVE PROCESS---");
     return _log_fd;
 }
 
@@ -101,7 +165,9 @@ static void log_to_dbg(char* message) {
         // I can write at len because I know that the buffer is big enough - it's created in log method below.
         message[len + 1] = 0;
     }
+#ifdef __CYGWIN__
     OutputDebugStringA(message);
+#endif
 }
 
 static void log_terminal_info(int log_level, int fd, const char* fd_name) {
@@ -126,49 +192,341 @@ static void log_terminal_info(int log_level, int fd, const char* fd_name) {
          fd_name, name == nullptr ? "<N/A>" : name, pgrp);
 }
 
+static const char* level_tag(int level) {
+    switch (level) {
+        case LOG_TRACE:
+            return "[TRC]";
+        case LOG_DEBUG:
+            return "[DBG]";
+        case LOG_INFO:
+            return "[INF]";
+        case LOG_WARN:
+            return "[WRN]";
+        case LOG_ERROR:
+            return "[ERR]";
+        default:
+            return "[???]";
+    }
+}
+
+// Returns nullptr (and counts the record as dropped) if the queue is full.
+static log_record* claim_log_record(size_t& position) {
+    position = _log_enqueue_position.load(std::memory_order_relaxed);
+    while (true) {
+        auto& record = _log_queue[position & (LOG_QUEUE_SIZE - 1)];
+        const auto sequence = record.sequence.load(std::memory_order_acquire);
+        const auto difference = (long long) (sequence - position);
+        if (difference == 0) {
+            if (_log_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                record.time = timespec{};
+                clock_gettime(CLOCK_REALTIME, &record.time);
+                return &record;
+            }
+        } else if (difference < 0) {
+            _log_dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        } else
+            position = _log_enqueue_position.load(std::memory_order_relaxed);
+    }
+}
+
+static void publish_log_record(log_record* record, size_t position) {
+    record->sequence.store(position + 1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_log_writer_idle.exchange(false)) {
+        const char wake_byte{1};
+        while (write(_log_wake[1], &wake_byte, 1) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+// The formatted time is reused for all the records logged in the same millisecond.
+static int format_log_time(const timespec& time, char* buffer) {
+    static long long cached_milliseconds{-1};
+    static time_t cached_second{-1};
+    static tm cached_tm{};
+    static bool cached_tm_valid{false};
+    static char cached_time[LOG_TIME_BUFFER_SIZE];
+    const auto milliseconds = (long long) time.tv_sec * 1000 + time.tv_nsec / 1000000;
+    if (milliseconds != cached_milliseconds) {
+        if (time.tv_sec != cached_second) {
+            cached_tm_valid = localtime_r(&time.tv_sec, &cached_tm) != nullptr;
+            cached_second = time.tv_sec;
+        }
+        if (cached_tm_valid)
+            snprintf(cached_time, sizeof(cached_time), "[%02i:%02i:%02i.%03i]", cached_tm.tm_hour, cached_tm.tm_min,
+                     cached_tm.tm_sec, (int) time.tv_nsec / 1000000);
+        cached_milliseconds = milliseconds;
+    }
+    if (!cached_tm_valid)
+        return 0;
+    memcpy(buffer, cached_time, LOG_TIME_LENGTH);
+    return LOG_TIME_LENGTH;
+}
+
+static void flush_log_batch(int& batch_length) {
+    const auto log_fd = get_log_file();
+    if (log_fd > 0 && batch_length > 0)
+        write_exact(log_fd, _log_batch, batch_length, true);
+    batch_length = 0;
+}
+
+static void append_log_line(int& batch_length, int level, const timespec& time, const char* message) {
+    const auto message_length = (int) strlen(message);
+    const auto line_length = LOG_TIME_LENGTH + LOG_TAG_LENGTH + message_length + 1;
+    if (LOG_BATCH_BUFFER_SIZE - batch_length < line_length)
+        flush_log_batch(batch_length);
+    auto line = _log_batch + batch_length;
+    line += format_log_time(time, line);
+    const auto tagged = line;
+    memcpy(line, "FD:", 3);
+    memcpy(line + 3, level_tag(level), 5);
+    line += LOG_TAG_LENGTH;
+    memcpy(line, message, message_length);
+    line += message_length;
+    if (message_length == 0 || message[message_length - 1] != '\n')
+        *(line++) = '\n';
+#ifdef __CYGWIN__
+    if (_debug_view) {
+        // The next line (if any) will overwrite the terminating zero.
+        *line = 0;
+        OutputDebugStringA(tagged);
+    }
+#else
+    (void) tagged;
+#endif
+    batch_length = (int) (line - _log_batch);
+}
+
+// Encodes the FORMAT record for the event (if it's the first one using it) followed by the event itself. Returns the
+// size written to buffer (it has to be big enough for the both).
+static int prepare_binary_record(char* buffer, int size, const char* record, int length) {
+    auto written{0};
+    if (record[0] == BINARY_LOG_RECORD_EVENT) {
+        unsigned short id;
+        memcpy(&id, record + 3, sizeof(id));
+        written = binary_log_encode_format_once(buffer, size - length, id);
+    }
+    memcpy(buffer + written, record, length);
+    return written + length;
+}
+
+static void append_binary_record(int& batch_length, const char* record, int length) {
+    // Leaving enough space for the FORMAT record too
+    if (LOG_BATCH_BUFFER_SIZE - batch_length < length + DEBUG_LOG_MAX_BUFFER)
+        flush_log_batch(batch_length);
+    batch_length += prepare_binary_record(_log_batch + batch_length, LOG_BATCH_BUFFER_SIZE - batch_length, record,
+                                          length);
+}
+
+// Formats and writes all the queued records, in as few writes as possible. Returns the number of records written.
+static int drain_log_queue() {
+    auto batch_length{0};
+    auto count{0};
+    const auto dropped = _log_dropped.exchange(0);
+    if (dropped > 0) {
+        char message[DEBUG_LOG_MAX_BUFFER];
+        snprintf(message, sizeof(message), "[drain_log_queue] %u log records dropped (the queue was full).", dropped);
+        if (_binary_log) {
+            char record[DEBUG_LOG_MAX_BUFFER];
+            const auto length = binary_log_encode_text(record, sizeof(record), LOG_WARN, monotonic_microseconds(),
+                                                       message);
+            append_binary_record(batch_length, record, length);
+        } else {
+            timespec now{};
+            clock_gettime(CLOCK_REALTIME, &now);
+            append_log_line(batch_length, LOG_WARN, now, message);
+        }
+    }
+    while (true) {
+        auto& record = _log_queue[_log_dequeue_position & (LOG_QUEUE_SIZE - 1)];
+        if (record.sequence.load(std::memory_order_acquire) != _log_dequeue_position + 1)
+            break;
+        if (record.binary)
+            append_binary_record(batch_length, record.message, record.length);
+        else
+            append_log_line(batch_length, record.level, record.time, record.message);
+        record.sequence.store(_log_dequeue_position + LOG_QUEUE_SIZE, std::memory_order_release);
+        ++_log_dequeue_position;
+        ++count;
+    }
+    flush_log_batch(batch_length);
+    return count;
+}
+
+static void* log_writer_thread(void*) {
+    char wake_buffer[WAKE_DRAIN_BUFFER_SIZE];
+    while (true) {
+        if (drain_log_queue() > 0)
+            continue;
+        if (_log_writer_stopping.load())
+            break;
+        // Announce that we're going to sleep, and check again, so that a record can't slip in unnoticed.
+        _log_writer_idle.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto& next = _log_queue[_log_dequeue_position & (LOG_QUEUE_SIZE - 1)];
+        if (next.sequence.load(std::memory_order_acquire) == _log_dequeue_position + 1
+            || _log_writer_stopping.load()) {
+            _log_writer_idle.store(false);
+            continue;
+        }
+        pollfd source{.fd = _log_wake[0], .events = POLLIN, .revents = 0};
+        if (poll(&source, 1, -1) > 0)
+            while (read(_log_wake[0], wake_buffer, WAKE_DRAIN_BUFFER_SIZE) == WAKE_DRAIN_BUFFER_SIZE) {
+            }
+        _log_writer_idle.store(false);
+    }
+    return nullptr;
+}
+
+bool start_log_writer() {
+    if (_log_writer_running.load())
+        return true;
+    for (size_t i = 0; i < LOG_QUEUE_SIZE; ++i)
+        _log_queue[i].sequence.store(i, std::memory_order_relaxed);
+    _log_enqueue_position.store(0);
+    _log_dequeue_position = 0;
+    _log_writer_stopping.store(false);
+    _log_writer_idle.store(false);
+    if (pipe2(_log_wake, O_CLOEXEC | O_NONBLOCK) != 0) { // NOLINT(hicpp-signed-bitwise)
+        log_lin_error(LOG_ERROR, "[start_log_writer] 'pipe2' call failed.");
+        return false;
+    }
+    const auto result = pthread_create(&_log_writer_thread, nullptr, log_writer_thread, nullptr);
+    if (result != 0) {
+        logf(LOG_ERROR, "[start_log_writer] 'pthread_create' call failed. Error: %i (%s)", result, strerror(result));
+        close(_log_wake[0]);
+        close(_log_wake[1]);
+        return false;
+    }
+    static bool at_exit_registered{false};
+    if (!at_exit_registered)
+        at_exit_registered = atexit(stop_log_writer) == 0;
+    _log_writer_running.store(true);
+    return true;
+}
+
+void stop_log_writer() {
+    if (!_log_writer_running.exchange(false))
+        return;
+    _log_writer_stopping.store(true);
+    const char wake_byte{1};
+    while (write(_log_wake[1], &wake_byte, 1) < 0 && errno == EINTR) {
+    }
+    pthread_join(_log_writer_thread, nullptr);
+    // Records that were queued while the writer was exiting.
+    drain_log_queue();
+    close(_log_wake[0]);
+    close(_log_wake[1]);
+}
+
 void reset_log_file(int parent_pid) {
     if (_log_fd > 0)
         close(_log_fd);
     _log_fd = 0;
     _parent_pid = parent_pid;
+    // In a forked child there's no writer thread, so logging is synchronous again.
+    _log_writer_running.store(false);
+}
+
+// Queues the binary record, or writes it right away if the writer isn't running.
+static void log_binary(int level, const char* record, int length) {
+    if (_log_writer_running.load(std::memory_order_relaxed)) {
+        size_t position{0};
+        const auto queued = claim_log_record(position);
+        if (queued == nullptr)
+            return;
+        memcpy(queued->message, record, length);
+        queued->level = level;
+        queued->binary = true;
+        queued->length = length;
+        publish_log_record(queued, position);
+        return;
+    }
+    const auto log_fd = get_log_file();
+    if (log_fd <= 0)
+        return;
+    char buffer[2 * DEBUG_LOG_MAX_BUFFER];
+    write_exact(log_fd, buffer, prepare_binary_record(buffer, sizeof(buffer), record, length), true);
+}
+
+void use_binary_log() {
+    if (_binary_log)
+        return;
+    if (_log_fd > 0)
+        close(_log_fd);
+    _log_fd = 0;
+    _binary_log = true;
 }
 
-void log(int level, const char* message) {
+void log_message(int level, const char* message) {
     if (_min_log_level > level || !message)
         return;
+    if (_binary_log) {
+        char record[DEBUG_LOG_MAX_BUFFER];
+        const auto length = binary_log_encode_text(record, sizeof(record), level, monotonic_microseconds(), message);
+        if (length > 0)
+            log_binary(level, record, length);
+        return;
+    }
+    if (_log_writer_running.load(std::memory_order_relaxed)) {
+        size_t position{0};
+        const auto record = claim_log_record(position);
+        if (record == nullptr)
+            return;
+        const auto length = strnlen(message, DEBUG_LOG_MAX_BUFFER - 1);
+        memcpy(record->message, message, length);
+        record->message[length] = 0;
+        record->level = level;
+        record->binary = false;
+        publish_log_record(record, position);
+        return;
+    }
     const auto buff_size = strlen(message) + 20;
     char buffer[buff_size];
     memset(buffer, 0, buff_size);
     strcat(buffer, "FD:");
-    switch (level) {
-        case LOG_TRACE:
-            strcat(buffer, "[TRC]");
-            break;
-        case LOG_DEBUG:
-            strcat(buffer, "[DBG]");
-            break;
-        case LOG_INFO:
-            strcat(buffer, "[INF]");
-            break;
-        case LOG_WARN:
-            strcat(buffer, "[WRN]");
-            break;
-        case LOG_ERROR:
-            strcat(buffer, "[ERR]");
-            break;
-        default:
-            strcat(buffer, "[???]");
-            break;
-    }
+    strcat(buffer, level_tag(level));
     strcat(buffer, message);
     log_to_file(buffer);
     log_to_dbg(buffer);
 }
 
-void logf(int level, const char* format,...) {
+void log_format(int level, const char* format,...) {
     if (_min_log_level > level || !format)
         return;
     va_list ap;
+    if (_binary_log) {
+        // Only the format id and the raw arguments are stored, formatting is done by the decoder.
+        const unsigned char* kinds{nullptr};
+        auto kinds_count{0};
+        const auto id = binary_log_format_id(format, &kinds, kinds_count);
+        if (id >= 0) {
+            char record[DEBUG_LOG_MAX_BUFFER];
+            va_start(ap, format);
+            const auto length = binary_log_encode_event(record, sizeof(record), level, 0, id, monotonic_microseconds(),
+                                                        kinds, kinds_count, ap);
+            va_end(ap);
+            if (length > 0) {
+                log_binary(level, record, length);
+                return;
+            }
+        }
+        // Not supported by the binary format, so it's formatted here, and logged as text.
+    } else if (_log_writer_running.load(std::memory_order_relaxed)) {
+        // Formatting directly into the queued record
+        size_t position{0};
+        const auto record = claim_log_record(position);
+        if (record == nullptr)
+            return;
+        va_start(ap, format);
+        vsnprintf(record->message, DEBUG_LOG_MAX_BUFFER, format, ap);
+        va_end(ap);
+        record->level = level;
+        record->binary = false;
+        publish_log_record(record, position);
+        return;
+    }
     char buf[DEBUG_LOG_MAX_BUFFER]{0};
     va_start(ap, format);
     vsnprintf(buf, sizeof buf, format, ap);
@@ -177,7 +535,7 @@ void logf(int level, const char* format,...) {
 }
 
 void log_env() {
-    if (_min_log_level > LOG_DEBUG)
+    if (!LOG_ENABLED(LOG_DEBUG))
         return;
     char** envs = environ;
     if (envs == nullptr) {
@@ -191,13 +549,37 @@ void log_env() {
 }
 
 void log_terminal_info() {
-    if (_min_log_level > LOG_DEBUG)
+    if (!LOG_ENABLED(LOG_DEBUG))
         return;
     log_terminal_info(LOG_DEBUG, STDIN_FILENO, "STDIN");
     log_terminal_info(LOG_DEBUG, STDOUT_FILENO, "STDOUT");
     log_terminal_info(LOG_DEBUG, STDERR_FILENO, "STDERR");
 }
 
+// In binary mode the format (a string literal, unlike the combined format below) and the error are stored
+// separately. Returns false if not in binary mode.
+static bool log_binary_error(int level, const char* format, int error, const char* description) {
+    if (!_binary_log)
+        return false;
+    const unsigned char* kinds{nullptr};
+    auto kinds_count{0};
+    const auto id = binary_log_format_id(format, &kinds, kinds_count);
+    if (id >= 0 && kinds_count == 0) {
+        char record[DEBUG_LOG_MAX_BUFFER];
+        const auto length = binary_log_encode_error_event(record, sizeof(record), level, id, monotonic_microseconds(),
+                                                          error, description);
+        if (length > 0) {
+            log_binary(level, record, length);
+            return true;
+        }
+    }
+    char message[DEBUG_LOG_MAX_BUFFER];
+    snprintf(message, sizeof(message), "%s Error: %i (%s)", format, error, description);
+    log(level, message);
+    return true;
+}
+
+#ifdef __CYGWIN__
 bool get_windows_error(int& err, char* buffer, int buff_size) {
     err = GetLastError();
     const auto size = FormatMessageA(
@@ -217,7 +599,7 @@ bool get_windows_error(int& err, char* buffer, int buff_size) {
     return true;
 }
 
-void log_win_error(int level, const char* format) {
+void log_win_error_message(int level, const char* format) {
     if (_min_log_level > level)
         return;
     int err{0};
@@ -226,6 +608,8 @@ void log_win_error(int level, const char* format) {
         log(level, format);
         return;
     }
+    if (log_binary_error(level, format, err, buff))
+        return;
     // Create the new format, and log
     const auto new_count = strlen(format) + 20;
     char new_format[new_count];
@@ -234,15 +618,19 @@ void log_win_error(int level, const char* format) {
     strcat(new_format, " Error: %i (%s)");
     logf(level, new_format, err, buff);
 }
+#endif
 
-void log_lin_error(int level, const char* format) {
+void log_lin_error_message(int level, const char* format) {
     if (_min_log_level > level)
         return;
+    const auto error = errno;
+    if (log_binary_error(level, format, error, strerror(error)))
+        return;
     // Create the new format, and log
     const auto new_count = strlen(format) + 20;
     char new_format[new_count];
     memset(new_format, 0, new_count);
     strcat(new_format, format);
     strcat(new_format, " Error: %i (%s)");
-    logf(level, new_format, errno, strerror(errno));
+    logf(level, new_format, error, strerror(error));
 }
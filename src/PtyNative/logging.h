@@ -23,18 +23,49 @@
 
 #pragma clang diagnostic pop
 
+// Lowest level that is compiled in. Calls below it compile to nothing (the arguments aren't even evaluated), and
+// calls at or above it are filtered by `_min_log_level` at runtime. Set by the build (CMake cache variable
+// PTY_LOG_COMPILED_MIN_LEVEL, or `log_min_level` in do_build.cmd).
+#ifndef LOG_COMPILED_MIN_LEVEL
+#define LOG_COMPILED_MIN_LEVEL LOG_TRACE
+#endif
+
 #define DEBUG_LOG_MAX_BUFFER 1024
+// Number of records the asynchronous log writer can hold (must be a power of two).
+#define LOG_QUEUE_SIZE 1024
 
 extern int _min_log_level;
 extern bool _debug_view;
+// Log in binary format (see binary_log.h), decoded by tools/blog_decode. Set it with use_binary_log().
+extern bool _binary_log;
 
 void reset_log_file(int parent_pid);
-void log(int level, const char* message);
-void logf(int level, const char* format,...);
+// Switches to the binary log (a new log file is started if it's already created).
+void use_binary_log();
+// Once started, log records are queued, and formatted / written to the log file by a background thread. Until
+// then (and in a forked child) logging is synchronous. The writer is stopped (and the queue flushed) at exit.
+bool start_log_writer();
+void stop_log_writer();
+void log_message(int level, const char* message);
+void log_format(int level, const char* format,...);
 void log_env();
 void log_terminal_info();
+#ifdef __CYGWIN__
 bool get_windows_error(int& err, char* buffer, int buff_size);
-void log_win_error(int level, const char* format);
-void log_lin_error(int level, const char* format);
+void log_win_error_message(int level, const char* format);
+#endif
+void log_lin_error_message(int level, const char* format);
+
+// <cmath> declares `log` and `logf` too, so it has to be seen before the macros below.
+#include <cmath>
+
+#define LOG_ENABLED(level) ((level) >= LOG_COMPILED_MIN_LEVEL && (level) >= _min_log_level)
+
+#define log(level, message) (LOG_ENABLED(level) ? log_message((level), (message)) : (void) 0)
+#define logf(level, ...) (LOG_ENABLED(level) ? log_format((level), __VA_ARGS__) : (void) 0)
+#ifdef __CYGWIN__
+#define log_win_error(level, format) (LOG_ENABLED(level) ? log_win_error_message((level), (format)) : (void) 0)
+#endif
+#define log_lin_error(level, format) (LOG_ENABLED(level) ? log_lin_error_message((level), (format)) : (void) 0)
 
 #endif //PTYNATIVE_LOGGING_H
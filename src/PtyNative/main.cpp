@@ -13,8 +13,14 @@
 
 #include "includes.h"
 
+#include "command_processor.h"
+#include "helpers.h"
 #include "io_processor.h"
 #include "logging.h"
+#include "session_host.h"
+#include "session_socket.h"
+#include "shell_pool.h"
+#include "shell_launcher.h"
 #include "stand_alone_io.h"
 #include "version.h"
 
@@ -34,30 +40,17 @@ static_assert(false, "GCC/Cygwin versions check failed.");
 static_assert(false, "__CYGWIN__ isn't defined.")
 #endif
 
-//#define USE_MINTTY_CONF
-
-#ifdef USE_MINTTY_CONF
-#include <langinfo.h>
-#endif
-
 #pragma clang diagnostic pop
 
-#define EXIT_CODE_ARGUMENTS 1
-#define EXIT_CODE_API_CALL_FAILED 2
-#define EXIT_CODE_SHELL_LAUNCH_FAILED 3
-#define EXIT_CODE_UNEXPECTED_HAPPENED -1
-
 #define DEFAULT_ROWS 25
 #define DEFAULT_COLUMNS 80
 
 #define MAX_USERNAME_LENGTH 100
 #define MAX_PTYNAME_LENGTH 256
-
-#define SYNC_SLEEP_PERIOD_MICROSECONDS 3000000
+#define MAX_PIPE_PATH_LENGTH 256
 
 static int _pty_fd2{0};
 static int _slave_pid2{0};
-static bool _sigusr1_received{false};
 
 static void print_help() {
     printf("Usage: <executable.exe> [args] [-] <shell.exe> [shell_args]\n");
@@ -86,6 +79,38 @@ static void print_help() {
     printf("                 (i.e. `--hcmd 789;987`). It must contain exactly two pipe handles,\n");
     printf("                 in the following order: `--hcmd <cmdin>;<cmdout>`. This argument is\n");
     printf("                 ignored in \"stand-alone mode\".\n");
+    printf("  --chan <hchan> Duplex pipe handle (i.e. `--chan 123`) that carries the output, the\n");
+    printf("                 input, the input records and the commands, all multiplexed as\n");
+    printf("                 frames (see `channel.h`). It can be used instead of `--out`,\n");
+    printf("                 `--ins`, `--inr` and `--cmd`, which are ignored if it's specified.\n");
+    printf("  --host <hctl>  Host mode: duplex pipe handle (i.e. `--host 123`) of the control\n");
+    printf("                 channel, over which any number of sessions (shells) are created\n");
+    printf("                 and closed (see `session_host.h`). All the sessions are served by\n");
+    printf("                 this process, and each of them has its own multiplexed channel.\n");
+    printf("                 The shell isn't specified on the command line in this mode\n");
+    printf("                 (unless `--pool` is), and the stream and terminal options are\n");
+    printf("                 ignored. The shells are always launched as with `--spawn`.\n");
+    printf("  --pool <n>     With `--host`: keeps <n> warm shells (the shell and the shell args\n");
+    printf("                 from the command line), each with its PTY and its process already\n");
+    printf("                 created, so that a session of that shell starts without waiting\n");
+    printf("                 for them. The pool is refilled in the background.\n");
+    printf("  --persist <path>\n");
+    printf("                 With `--chan`: the session outlives its client. When the channel is\n");
+    printf("                 closed the session keeps running detached, and a client can attach\n");
+    printf("                 to it (again) through the Unix-domain socket <path>, with `--attach`.\n");
+    printf("                 The output that's written while detached is kept for replay.\n");
+    printf("  --attach <path>\n");
+    printf("                 With `--chan`: attaches the channel to the session that persists on\n");
+    printf("                 <path> (see `--persist`), instead of launching a shell. The client\n");
+    printf("                 that was attached to it (if any) is detached.\n");
+    printf("  --replay <kb>  With `--persist`: the size (in KB) of the recent output that's\n");
+    printf("                 replayed to a client that attaches (defaults to %i, and it's\n", REPLAY_BUFFER_DEFAULT_SIZE / 1024);
+    printf("                 limited to `--obuf`).\n");
+    printf("  --scrollback <mb>\n");
+    printf("                 Keeps the last <mb> MB (up to %i) of the output, which a client\n", SCROLLBACK_MAX_SIZE_MB);
+    printf("                 can get at any time (i.e. when it opens a view late) with the\n");
+    printf("                 get-scrollback command (protocol 2 / `--chan` only). In host mode\n");
+    printf("                 each session keeps its own. It isn't kept by default.\n");
     printf("  --rows <rows>  Terminal height in rows (defaults to %i). This argument is ignored\n", DEFAULT_ROWS);
     printf("                 in \"stand-alone mode\".\n");
     printf("  --cols <cols>  Terminal width in columns (defaults to %i). Also ignored in\n", DEFAULT_COLUMNS);
@@ -96,7 +121,37 @@ static void print_help() {
     printf("                 %i - Trace, %i - Debug, %i - Info, %i - Warning, and %i - Error.\n", LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR);
     printf("                 The log files can be found in the current working directory.\n");
     printf("  --syslog       If specified, the logs will also be sent to system debug log, for\n");
-    printf("                 real-time tracking in DebugView or similar tool.\n\n");
+    printf("                 real-time tracking in DebugView or similar tool.\n");
+    printf("  --blog         Write the log in compact binary format (`.blog` file) instead of\n");
+    printf("                 text. Use `blog_decode` tool to read it. The logs aren't sent to\n");
+    printf("                 system debug log in this mode.\n");
+    printf("  --spawn        Launch the shell through `openpty` and `posix_spawn` (of a small\n");
+    printf("                 helper process) instead of `forkpty`, which avoids duplicating\n");
+    printf("                 this process (expensive on Cygwin / MSYS2).\n");
+    printf("  --obuf <kb>    Size (in KB) of the buffer between the shell output and the output\n");
+    printf("                 pipe / console (defaults to %i). The shell can keep producing\n", OUTPUT_RING_DEFAULT_SIZE / 1024);
+    printf("                 output until this buffer is full, even if the output isn't read.\n");
+    printf("  --ohigh <kb>   High watermark (in KB): the shell output stops being read once this\n");
+    printf("                 much of it is waiting to be written (defaults to `--obuf`).\n");
+    printf("  --olow <kb>    Low watermark (in KB): the shell output is read again once the\n");
+    printf("                 output is drained down to it (defaults to half of `--ohigh`).\n");
+    printf("  --opolicy <p>  What's done while the output is above the watermarks: `block` (the\n");
+    printf("                 default) stops reading the shell output, so the shell blocks on its\n");
+    printf("                 writes, `drop` keeps reading it and drops it (it's still kept in\n");
+    printf("                 the scrollback), and `summary` drops it too, but then writes a line\n");
+    printf("                 with the number of bytes that were dropped. Applies to all sessions.\n");
+    printf("  --rmax <kb>    Maximum size (in KB) of a single read of the shell output (defaults\n");
+    printf("                 to %i). Reads grow up to this size while the output keeps coming.\n", PTY_READ_MAX_DEFAULT_SIZE / 1024);
+    printf("                 A read is also limited by the free space in `--obuf`.\n");
+    printf("  --cdelay <us>  Enables output coalescing: the output is held back for up to <us>\n");
+    printf("                 microseconds (i.e. 2000), to be written together with the output\n");
+    printf("                 that follows. The output that follows input isn't held back.\n");
+    printf("  --cbytes <n>   With `--cdelay`, the output is written as soon as <n> bytes are\n");
+    printf("                 buffered (defaults to %i).\n", OUTPUT_COALESCE_DEFAULT_BYTES);
+    printf("  --ctimeout <ms>\n");
+    printf("                 A command whose bytes don't all arrive within <ms> milliseconds is\n");
+    printf("                 dropped with a failure response (defaults to %i, 0 disables it),\n", COMMAND_TIMEOUT_DEFAULT_MS);
+    printf("                 and no more commands are read (the command stream is out of sync).\n\n");
     printf("  <shell.exe>    Shell executable to launch (i.e. `C:\\cygwin64\\bin\\bash.exe`)\n");
     printf("  [shell_args]   Additional arguments to use when starting the shell.\n");
     printf("                 (i.e. `-i --login` which are often used with `bash`).\n\n");
@@ -137,8 +192,98 @@ static unsigned short read_ushort(char* value) {
     return static_cast<unsigned short>(val);
 }
 
+// Wraps a Win32 pipe handle into a Cygwin file descriptor, so that it can be waited on by the I/O loop (together
+// with the PTY). Returns -1 on failure.
+static int try_attach_pipe_handle(HANDLE handle, bool for_writing) {
+    char device_name[]{"/dev/pipew"};
+    if (!for_writing)
+        device_name[sizeof(device_name) - 2] = 'r';
+    const auto fd = cygwin_attach_handle_to_fd(device_name, -1, handle, true,
+                                               for_writing ? GENERIC_WRITE : GENERIC_READ);
+    if (fd < 0) {
+        logf(LOG_ERROR, "[try_attach_pipe_handle] 'cygwin_attach_handle_to_fd' call failed for handle %i. Error: %i "
+                        "(%s)", handle, errno, strerror(errno));
+        return -1;
+    }
+    // The slave process must not inherit our pipes
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) != 0)
+        log_lin_error(LOG_WARN, "[try_attach_pipe_handle] 'fcntl(FD_CLOEXEC)' call failed.");
+    logf(LOG_DEBUG, "[try_attach_pipe_handle] Handle %i attached to fd %i.", handle, fd);
+    return fd;
+}
+
+// The same as try_attach_pipe_handle, but exits on failure. Returns -1 if the handle isn't specified.
+static int attach_pipe_handle(HANDLE handle, bool for_writing) {
+    if (handle == nullptr)
+        return -1;
+    const auto fd = try_attach_pipe_handle(handle, for_writing);
+    if (fd < 0) {
+        printf("Failed to attach pipe handle.");
+        exit(EXIT_CODE_API_CALL_FAILED);
+    }
+    return fd;
+}
+
+// Wraps a duplex pipe handle into two Cygwin file descriptors: the handle itself for reading, and its duplicate for
+// writing, so that the I/O loop and the output pump use the channel the same way as separate pipes. The handle is
+// closed on failure.
+static bool try_attach_channel_handle(HANDLE handle, int& read_fd, int& write_fd) {
+    read_fd = -1;
+    write_fd = -1;
+    HANDLE write_handle{nullptr};
+    if (!DuplicateHandle(GetCurrentProcess(), handle, GetCurrentProcess(), &write_handle, 0, false,
+                         DUPLICATE_SAME_ACCESS)) {
+        log_win_error(LOG_ERROR, "[try_attach_channel_handle] 'DuplicateHandle' call failed.");
+        CloseHandle(handle);
+        return false;
+    }
+    read_fd = try_attach_pipe_handle(handle, false);
+    if (read_fd < 0) {
+        CloseHandle(handle);
+        CloseHandle(write_handle);
+        return false;
+    }
+    write_fd = try_attach_pipe_handle(write_handle, true);
+    if (write_fd < 0) {
+        close(read_fd);
+        CloseHandle(write_handle);
+        read_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// The same as try_attach_channel_handle, but exits on failure.
+static void attach_channel_handle(HANDLE handle, int& read_fd, int& write_fd) {
+    if (!try_attach_channel_handle(handle, read_fd, write_fd)) {
+        printf("Failed to attach channel handle.");
+        exit(EXIT_CODE_API_CALL_FAILED);
+    }
+}
+
+// Host mode: connects to the pipe the client has created for a session's channel.
+static bool connect_channel_pipe(const char* name, int& read_fd, int& write_fd) {
+    char path[MAX_PIPE_PATH_LENGTH];
+    if (snprintf(path, MAX_PIPE_PATH_LENGTH, "\\\\.\\pipe\\%s", name) >= MAX_PIPE_PATH_LENGTH) {
+        logf(LOG_ERROR, "[connect_channel_pipe] Pipe name is too long: %s", name);
+        return false;
+    }
+    const auto handle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        log_win_error(LOG_ERROR, "[connect_channel_pipe] 'CreateFileA' call failed.");
+        return false;
+    }
+    logf(LOG_DEBUG, "[connect_channel_pipe] Connected to %s.", path);
+    return try_attach_channel_handle(handle, read_fd, write_fd);
+}
+
 static void exit_signal(int sig) {
     if (sig == SIGINT) {
+        if (_pty_fd2 <= 0) {
+            // Host mode (or the slave isn't launched yet).
+            log(LOG_WARN, "[exit_signal] Unexpected SIGINT signal. Ignoring it.");
+            return;
+        }
         log(LOG_WARN, "[exit_signal] Unexpected SIGINT signal. Sending Ctrl+C to slave through PTY.");
         if (write(_pty_fd2, "\3", 1) < 1)
             log_lin_error(LOG_WARN, "[exit_signal] 'write' call failed.");
@@ -152,13 +297,6 @@ static void exit_signal(int sig) {
     kill(getpid(), sig);
 }
 
-static void sigusr1_signal(int sig) {
-    if (sig == SIGUSR1) {
-        _sigusr1_received = true;
-        log(LOG_DEBUG, "[sigusr1_signal] SIGUSR1 signal received.");
-    }
-}
-
 static BOOL WINAPI ctrl_handler_routine(DWORD ctrl_type) {
     // We do not expect to receive CTRL_C_EVENT/CTRL_BREAK_EVENT because of ProtectCtrlBreakTrap
     switch (ctrl_type)
@@ -187,6 +325,23 @@ static BOOL WINAPI ctrl_handler_routine(DWORD ctrl_type) {
     return FALSE;
 }
 
+static void set_signal_handlers() {
+    if (signal(SIGHUP, SIG_IGN) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[set_signal_handlers] 'signal' call for SIGHUP signal failed.");
+    if (signal(SIGINT, exit_signal) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[set_signal_handlers] 'signal' call for SIGINT signal failed.");
+    if (signal(SIGTERM, exit_signal) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[set_signal_handlers] 'signal' call for SIGTERM signal failed.");
+    if (signal(SIGQUIT, exit_signal) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[set_signal_handlers] 'signal' call for SIGQUIT signal failed.");
+    log(LOG_DEBUG, "[set_signal_handlers] Signal handlers set.");
+    if (!SetConsoleCtrlHandler(ctrl_handler_routine, true)) {
+        log_win_error(LOG_ERROR, "[set_signal_handlers] 'SetConsoleCtrlHandler' call failed.");
+        exit(EXIT_CODE_API_CALL_FAILED);
+    }
+    log(LOG_DEBUG, "[set_signal_handlers] 'SetConsoleCtrlHandler' call succeeded.");
+}
+
 //static void ensure_terminal() {
 //    auto hwnd = GetConsoleWindow();
 //    if (hwnd) {
@@ -210,150 +365,20 @@ static BOOL WINAPI ctrl_handler_routine(DWORD ctrl_type) {
 //        log(LOG_DEBUG, "[ensure_terminal] Console window was hidden, and remained hidden.");
 //}
 
-#ifdef USE_MINTTY_CONF
-static void slave_term_config(termios& attr) {
-    log(LOG_DEBUG, "[slave_term_config1] Using Mintty terminal configuration.");
-    attr.c_cc[VERASE] = CDEL;
-    attr.c_iflag |= IXANY | IMAXBEL; // NOLINT(hicpp-signed-bitwise)
-#ifdef IUTF8
-    bool utf8 = strcmp(nl_langinfo(CODESET), "UTF-8") == 0;
-    if (utf8)
-        attr.c_iflag |= IUTF8; // NOLINT(hicpp-signed-bitwise)
-    else
-        attr.c_iflag &= ~IUTF8; // NOLINT(hicpp-signed-bitwise)
-#endif
-    attr.c_lflag |= ECHOE | ECHOK | ECHOCTL | ECHOKE; // NOLINT(hicpp-signed-bitwise)
-}
-#else
-static void slave_term_config(termios& attr) {
-    log(LOG_DEBUG, "[slave_term_config1] Using ConEmu terminal configuration.");
-    attr.c_cc[VERASE] = CDEL;
-    attr.c_iflag |= IXANY | IMAXBEL; // NOLINT(hicpp-signed-bitwise)
-    attr.c_lflag |= ECHOE | ECHOK | ECHOCTL | ECHOKE; // NOLINT(hicpp-signed-bitwise)
-}
-#endif
-
-static void do_slave(int parent_pid, char** argv, char* dir) {
-    // Slave process. Let's first destroy things we shouldn't use anyway
-    reset_log_file(parent_pid);
-    logf(LOG_INFO, "[do_slave] Hello from the slave process (PID=%i)!", getpid());
-    log_env();
-    log_terminal_info();
-    const auto reported_parent_pid = getppid();
-    if (reported_parent_pid != parent_pid)
-        logf(LOG_WARN, "[do_slave] getppid() returns %i although parent PID is %i.", reported_parent_pid, parent_pid);
-    // Wait for a signal from the parent process
-    if (_sigusr1_received)
-        log(LOG_DEBUG, "[do_slave] We're already signaled to continue.");
-    else {
-        auto ms = GetTickCount();
-        usleep(SYNC_SLEEP_PERIOD_MICROSECONDS);
-        ms = GetTickCount() - ms;
-        if (!_sigusr1_received) {
-            logf(LOG_ERROR, "[do_slave] After %i ms we still haven't got SIGUSR1 signal from the parent. Exiting.", ms);
-            exit(EXIT_CODE_UNEXPECTED_HAPPENED);
-        }
-        logf(LOG_DEBUG, "[do_slave] SIGUSR1 signal from the parent received after %i ms.", ms);
-    }
-    // Reset signals
-    if (signal(SIGUSR1, SIG_DFL) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[do_slave] Failed to reset signal handler for SIGUSR1 signal to SIG_DFL.");
-    if (signal(SIGHUP, SIG_DFL) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[do_slave] Failed to reset signal handler for SIGHUP signal to SIG_DFL.");
-    if (signal(SIGINT, SIG_DFL) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[do_slave] Failed to reset signal handler for SIGINT signal to SIG_DFL.");
-    if (signal(SIGQUIT, SIG_DFL) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[do_slave] Failed to reset signal handler for SIGQUIT signal to SIG_DFL.");
-    if (signal(SIGTERM, SIG_DFL) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[do_slave] Failed to reset signal handler for SIGTERM signal to SIG_DFL.");
-    if (signal(SIGCHLD, SIG_DFL) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[do_slave] Failed to reset signal handler for SIGCHLD signal to SIG_DFL.");
-    // Mimic login's behavior by disabling the job control signals
-    if (signal(SIGTSTP, SIG_IGN) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[do_slave] Failed to set signal handler for SIGTSTP signal to SIG_IGN.");
-    if (signal(SIGTTIN, SIG_IGN) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[do_slave] Failed to set signal handler for SIGTTIN signal to SIG_IGN.");
-    if (signal(SIGTTOU, SIG_IGN) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[do_slave] Failed to set signal handler for SIGTTOU signal to SIG_IGN.");
-    log(LOG_TRACE, "[do_slave] Signal handlers reset successfully.");
-    // Terminal line settings
-    termios attr{};
-    if (tcgetattr(0, &attr) < 0) {
-        log_lin_error(LOG_ERROR, "[do_slave] 'tcgetattr' call failed.");
-        exit(EXIT_CODE_API_CALL_FAILED);
-    }
-    log(LOG_DEBUG, "[do_slave] 'tcgetattr' succeeded.");
-    slave_term_config(attr);
-    if (tcsetattr(0, TCSANOW, &attr) < 0) {
-        log_lin_error(LOG_ERROR, "[do_slave] 'tcsetattr' call failed.");
-        exit(EXIT_CODE_API_CALL_FAILED);
-    }
-    log(LOG_DEBUG, "[do_slave] 'tcsetattr' succeeded.");
-    // Change working directory (if required)
-    if (dir != nullptr) {
-        if (chdir(dir) < 0)
-            logf(LOG_ERROR, "[do_slave] 'chdir(\"%s\")' call failed. Error: %i (%s)", dir, errno, strerror(errno));
-        else {
-            logf(LOG_DEBUG, "[do_slave] 'chdir(\"%s\")' succeeded.", dir);
-            if (setenv("CHERE_INVOKING", "1", true) == 0)
-                log(LOG_DEBUG, R"([do_slave] 'setenv("CHERE_INVOKING", "1", true)' call succeeded.)");
-            else
-                log_lin_error(LOG_ERROR, R"([do_slave] 'setenv("CHERE_INVOKING", "1", true)' call failed.)");
-        }
-    }
-    if (_min_log_level <= LOG_DEBUG) {
-        char cwd[1000];
-        if (getcwd(cwd, 1000) == nullptr)
-            log_lin_error(LOG_ERROR, "[do_slave] 'getcwd' call failed.");
-        else
-            logf(LOG_DEBUG, "[do_slave] Current working directory: %s", cwd);
-        if (FILE *shell_file = fopen(argv[0], "r")) {
-            fclose(shell_file);
-            logf(LOG_DEBUG, "[do_slave] Shell found: %s", argv[0]);
-        } else
-            logf(LOG_ERROR, "[do_slave] Shell not found: %s", argv[0]);
-        if (argv[1] == nullptr)
-            logf(LOG_DEBUG, "[do_slave] No shell args.");
-        else
-            logf(LOG_DEBUG, "[do_slave] First shell argument: %s", argv[1]);
-    }
-    auto parent_notified{false};
-    for (auto i{0}; i < 5; ++i){
-        if (kill(parent_pid, SIGUSR1) == 0) {
-            log(LOG_DEBUG, "[do_slave] Parent process notified that we're ready.");
-            parent_notified = true;
-            break;
-        }
-        logf(LOG_ERROR, "[do_slave] 'kill' call failed for parent PID = %i, attempt %i. Error: %i (%s)",
-                parent_pid, i + 1, errno, strerror(errno));
-        usleep(20000);
-    }
-    if (!parent_notified) {
-        log(LOG_ERROR, "[do_slave] Failed to notify parent (in 5 attempts) that we're ready. Exiting.");
-        exit(EXIT_CODE_API_CALL_FAILED);
-    }
-    logf(LOG_DEBUG,"[do_slave] About to call 'execvp'. Shell: %s", argv[0]);
-    execvp(argv[0], argv);
-    // If we're here 'execvp' has failed.
-    log_lin_error(LOG_ERROR, "[do_slave] 'execvp' call failed.");
-    exit(EXIT_CODE_SHELL_LAUNCH_FAILED);
-}
-
-static void do_master(int pty_fd, int slave_pid, HANDLE h_in, HANDLE h_in_rec, HANDLE h_out, HANDLE h_cin, HANDLE h_cout) {
-    _pty_fd2 = pty_fd;
-    _slave_pid2 = slave_pid;
+// Registers the terminal session (utmp).
+static void register_terminal(int pty_fd, int slave_pid) {
     char pty_name_buff[MAX_PTYNAME_LENGTH];
     if (ttyname_r(pty_fd, pty_name_buff, MAX_PTYNAME_LENGTH) != 0)
-        log_lin_error(LOG_ERROR, "[do_master] 'ptsname' call failed.");
+        log_lin_error(LOG_ERROR, "[register_terminal] 'ptsname' call failed.");
     else {
-        logf(LOG_DEBUG, "[do_master] PTY created. Name: %s", pty_name_buff);
+        logf(LOG_DEBUG, "[register_terminal] PTY created. Name: %s", pty_name_buff);
         char username[MAX_USERNAME_LENGTH];
         if (getlogin_r(username, MAX_USERNAME_LENGTH) != 0) {
-            log_lin_error(LOG_ERROR, "[do_master] 'getlogin_r' call failed.");
+            log_lin_error(LOG_ERROR, "[register_terminal] 'getlogin_r' call failed.");
             username[0] = 0;
             strcat(username, "?");
         } else
-            logf(LOG_DEBUG, "[do_master] Username: %s", username);
+            logf(LOG_DEBUG, "[register_terminal] Username: %s", username);
         char* pty_name = pty_name_buff;
         utmp ut{};
         memset(&ut, 0, sizeof(ut));
@@ -370,34 +395,50 @@ static void do_master(int pty_fd, int slave_pid, HANDLE h_in, HANDLE h_in_rec, H
         ut.ut_time = time(nullptr);
         lstrcpyn(ut.ut_user, username, sizeof(ut.ut_user));
         if (gethostname(ut.ut_host, sizeof(ut.ut_host)) == 0)
-            logf(LOG_DEBUG, "[do_master] Hostname: %s", ut.ut_host);
+            logf(LOG_DEBUG, "[register_terminal] Hostname: %s", ut.ut_host);
         else
-            log_lin_error(LOG_ERROR, "[do_master] 'gethostname' call failed.");
+            log_lin_error(LOG_ERROR, "[register_terminal] 'gethostname' call failed.");
         errno = 0;
         login(&ut);
         if (errno != 0)
-            logf(LOG_WARN, "[do_master] 'login' function has set errno to %i (%s)", errno, strerror(errno));
+            logf(LOG_WARN, "[register_terminal] 'login' function has set errno to %i (%s)", errno, strerror(errno));
         else
-            log(LOG_DEBUG, "[do_master] Terminal login succeeded.");
+            log(LOG_DEBUG, "[register_terminal] Terminal login succeeded.");
     }
+}
+
+static void do_master(int pty_fd, int slave_pid, sync_channel& sync, long long launch_start_us, int in_fd, int in_rec_fd, int out_fd, int cin_fd, int cout_fd, int chan_fd, int listen_fd) {
+    _pty_fd2 = pty_fd;
+    _slave_pid2 = slave_pid;
+    // The slave is already launched (forking with the writer thread running isn't safe), so from now on the logs are
+    // written by a background thread.
+    if (!start_log_writer())
+        log(LOG_WARN, "[do_master] Failed to start the log writer. Logging synchronously.");
+    register_terminal(pty_fd, slave_pid);
     // Notify child process to continue:
-    if (kill(slave_pid, SIGUSR1) != 0)
-        log_lin_error(LOG_ERROR, "[do_master] 'kill' call failed.");
-    else
+    sync_channel_use_as_master(sync);
+    if (sync_channel_notify(sync.to_slave[1]))
         log(LOG_DEBUG, "[do_master] Child process notified to continue.");
-    // Wait for a signal from the slave process
-    auto ms = GetTickCount();
-    usleep(SYNC_SLEEP_PERIOD_MICROSECONDS);
-    ms = GetTickCount() - ms;
-    if (!_sigusr1_received) {
-        logf(LOG_ERROR, "[do_master] After %i ms we still haven't got SIGUSR1 signal from the slave. Exiting.", ms);
+    // Wait for the slave process to become ready
+    long long waited_us{0};
+    if (!sync_channel_wait(sync.to_master[0], SYNC_TIMEOUT_MS, waited_us)) {
+        logf(LOG_ERROR, "[do_master] Slave process isn't ready after %lli us. Exiting.", waited_us);
+        kill(slave_pid, SIGKILL);
         exit(EXIT_CODE_UNEXPECTED_HAPPENED);
     }
-    logf(LOG_DEBUG, "[do_master] SIGUSR1 signal from the slave received after %i ms.", ms);
-    run(pty_fd, slave_pid, h_in, h_in_rec, h_out, h_cin, h_cout);
+    sync_channel_close(sync);
+    logf(LOG_INFO, "[do_master] Slave process ready after %lli us (handshake), %lli us since launch.", waited_us,
+         monotonic_microseconds() - launch_start_us);
+    run(pty_fd, slave_pid, in_fd, in_rec_fd, out_fd, cin_fd, cout_fd, chan_fd, listen_fd);
 }
 
 int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], SLAVE_HELPER_ARG) == 0) {
+        // We are the slave helper started in spawn launch mode.
+        run_slave_helper(argc - 1, argv + 1);
+        // This line will never be reached.
+        exit(EXIT_CODE_UNEXPECTED_HAPPENED);
+    }
     if (argc < 2){
         printf("Invalid arguments.\n\n");
         print_help();
@@ -407,11 +448,17 @@ int main(int argc, char** argv) {
     unsigned short rows{DEFAULT_ROWS};
     unsigned short cols{DEFAULT_COLUMNS};
     char* dir{nullptr};
+    auto launch_mode{LAUNCH_MODE_FORK};
     HANDLE h_in{nullptr};
     HANDLE h_in_rec{nullptr};
     HANDLE h_out{nullptr};
     HANDLE h_cin{nullptr};
     HANDLE h_cout{nullptr};
+    HANDLE h_chan{nullptr};
+    HANDLE h_host{nullptr};
+    auto pool_size{0};
+    char* persist_path{nullptr};
+    char* attach_path{nullptr};
     // Skipping the first argument (executable name):
     ++argv;
     --argc;
@@ -434,6 +481,14 @@ int main(int argc, char** argv) {
             _debug_view = true;
             continue;
         }
+        if (strcmp(arg, "--blog") == 0) {
+            use_binary_log();
+            continue;
+        }
+        if (strcmp(arg, "--spawn") == 0) {
+            launch_mode = LAUNCH_MODE_SPAWN;
+            continue;
+        }
         if (strcmp(arg, "--out") == 0) {
             if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
                 printf("Invalid arguments. `--out` requires a value.\n\n");
@@ -493,6 +548,89 @@ int main(int argc, char** argv) {
             }
             continue;
         }
+        if (strcmp(arg, "--chan") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--chan` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            h_chan = read_handle(argv[0]);
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--host") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--host` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            h_host = read_handle(argv[0]);
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--pool") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--pool` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            pool_size = strcmp(argv[0], "0") == 0 ? 0 : read_ushort(argv[0]);
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--persist") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--persist` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            persist_path = argv[0];
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--attach") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--attach` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            attach_path = argv[0];
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--replay") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--replay` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            _replay_buffer_size = strcmp(argv[0], "0") == 0 ? 0 : (size_t) read_ushort(argv[0]) * 1024;
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--scrollback") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--scrollback` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            const auto scrollback_mb = strcmp(argv[0], "0") == 0 ? 0 : read_ushort(argv[0]);
+            if (scrollback_mb > SCROLLBACK_MAX_SIZE_MB) {
+                printf("Invalid arguments. `--scrollback` can't be more than %i.\n\n", SCROLLBACK_MAX_SIZE_MB);
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            _scrollback_size = (size_t) scrollback_mb * 1024 * 1024;
+            ++argv;
+            --argc;
+            continue;
+        }
         if (strcmp(arg, "--rows") == 0) {
             if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
                 printf("Invalid arguments. `--rows` requires a value.\n\n");
@@ -526,6 +664,97 @@ int main(int argc, char** argv) {
             --argc;
             continue;
         }
+        if (strcmp(arg, "--obuf") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--obuf` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            _output_ring_size = (size_t) read_ushort(argv[0]) * 1024;
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--ohigh") == 0 || strcmp(arg, "--olow") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `%s` requires a value.\n\n", arg);
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            const auto water = (size_t) read_ushort(argv[0]) * 1024;
+            if (strcmp(arg, "--ohigh") == 0)
+                _output_high_water = water;
+            else
+                _output_low_water = water;
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--opolicy") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--opolicy` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            if (strcmp(argv[0], "block") == 0)
+                _output_policy = OUTPUT_POLICY_BLOCK;
+            else if (strcmp(argv[0], "drop") == 0)
+                _output_policy = OUTPUT_POLICY_DROP;
+            else if (strcmp(argv[0], "summary") == 0)
+                _output_policy = OUTPUT_POLICY_SUMMARY;
+            else {
+                printf("Invalid arguments. Unknown `--opolicy`: %s\n\n", argv[0]);
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--cdelay") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--cdelay` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            _output_coalesce_delay_us = read_ushort(argv[0]);
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--cbytes") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--cbytes` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            _output_coalesce_bytes = read_ushort(argv[0]);
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--ctimeout") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--ctimeout` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            _command_timeout_ms = strcmp(argv[0], "0") == 0 ? 0 : read_ushort(argv[0]);
+            ++argv;
+            --argc;
+            continue;
+        }
+        if (strcmp(arg, "--rmax") == 0) {
+            if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
+                printf("Invalid arguments. `--rmax` requires a value.\n\n");
+                print_help();
+                exit(EXIT_CODE_ARGUMENTS);
+            }
+            _pty_read_max_size = (size_t) read_ushort(argv[0]) * 1024;
+            ++argv;
+            --argc;
+            continue;
+        }
         if (strcmp(arg, "--log") == 0) {
             if (argc < 1 || argv[0] == nullptr || argv[0][0] == '-') {
                 printf("Invalid arguments. `--log` requires a value.\n\n");
@@ -541,7 +770,64 @@ int main(int argc, char** argv) {
         print_help();
         exit(EXIT_CODE_ARGUMENTS);
     }
-    if (h_out == nullptr) {
+    if (h_host != nullptr) {
+        // The sessions are created over the control channel, each with its own shell.
+        logf(LOG_DEBUG, "[main] Launched in host mode. h_host = %i.", h_host);
+        if (pool_size > 0 && argc < 1) {
+            printf("Malformed arguments. `--pool` requires the shell executable name.\n\n");
+            print_help();
+            exit(EXIT_CODE_ARGUMENTS);
+        }
+        log_env();
+        set_signal_handlers();
+        // A session's client (or a warm shell) may be gone by the time it's written to, which mustn't end the host.
+        if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+            log_lin_error(LOG_ERROR, "[main] 'signal' call for SIGPIPE signal failed.");
+        int ctl_in_fd{-1};
+        int ctl_out_fd{-1};
+        attach_channel_handle(h_host, ctl_in_fd, ctl_out_fd);
+        // Nothing is forked in this mode, so the logs can be written by a background thread right away.
+        if (!start_log_writer())
+            log(LOG_WARN, "[main] Failed to start the log writer. Logging synchronously.");
+        if (pool_size > 0 && !shell_pool_start(pool_size, argv))
+            log(LOG_WARN, "[main] Failed to start the shell pool. Continuing without it.");
+        const host_platform platform{.connect_channel = connect_channel_pipe, .register_terminal = register_terminal};
+        host_run(ctl_in_fd, ctl_out_fd, platform);
+        shell_pool_stop();
+        log(LOG_INFO, "[main] Bye-bye...");
+        exit(0);
+    }
+    if ((persist_path != nullptr || attach_path != nullptr) && h_chan == nullptr) {
+        printf("Invalid arguments. `--persist` and `--attach` require `--chan`.\n\n");
+        print_help();
+        exit(EXIT_CODE_ARGUMENTS);
+    }
+    if (attach_path != nullptr) {
+        // No shell in this mode: the channel is relayed to the session that's already running.
+        logf(LOG_DEBUG, "[main] Launched in attach mode. h_chan = %i, session: %s.", h_chan, attach_path);
+        log_env();
+        set_signal_handlers();
+        if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+            log_lin_error(LOG_ERROR, "[main] 'signal' call for SIGPIPE signal failed.");
+        int relay_in_fd{-1};
+        int relay_out_fd{-1};
+        attach_channel_handle(h_chan, relay_in_fd, relay_out_fd);
+        if (!session_socket_relay(attach_path, relay_in_fd, relay_out_fd)) {
+            printf("Failed to attach to the session.");
+            exit(EXIT_CODE_API_CALL_FAILED);
+        }
+        log(LOG_INFO, "[main] Bye-bye...");
+        exit(0);
+    }
+    if (h_chan != nullptr) {
+        // Everything goes through the channel
+        h_in = nullptr;
+        h_in_rec = nullptr;
+        h_out = nullptr;
+        h_cin = nullptr;
+        h_cout = nullptr;
+        logf(LOG_DEBUG, "[main] Launched in managed mode, with multiplexed channel. h_chan = %i.", h_chan);
+    } else if (h_out == nullptr) {
         // Without --out we are ignoring all other handles
         h_in = nullptr;
         h_in_rec = nullptr;
@@ -575,7 +861,7 @@ int main(int argc, char** argv) {
         slave_argv[i] = argv[i];
     log(LOG_TRACE, "[main] Slave process args prepared.");
     winsize win_size{.ws_row = rows, .ws_col = cols};
-    if (h_out == nullptr) {
+    if (h_out == nullptr && h_chan == nullptr) {
         // Stand-alone mode - let's try to get actual window size
         try_override_win_size(win_size);
         // Set master's terminal info
@@ -595,43 +881,49 @@ int main(int argc, char** argv) {
         }
         log(LOG_DEBUG, "[main] Terminal attributes set successfully.");
     }
-    // Setting signal handlers
-    if (signal(SIGHUP, SIG_IGN) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[main] 'signal' call for SIGHUP signal failed.");
-    if (signal(SIGINT, exit_signal) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[main] 'signal' call for SIGINT signal failed.");
-    if (signal(SIGTERM, exit_signal) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[main] 'signal' call for SIGTERM signal failed.");
-    if (signal(SIGQUIT, exit_signal) == SIG_ERR)
-        log_lin_error(LOG_ERROR, "[main] 'signal' call for SIGQUIT signal failed.");
-    if (signal(SIGUSR1, sigusr1_signal) == SIG_ERR) {
-        log_lin_error(LOG_ERROR, "[main] 'signal' call for SIGUSR1 signal failed.");
-        // This handler is crucial for synchronization, so in this case we'll exit.
-        exit(EXIT_CODE_API_CALL_FAILED);
+    set_signal_handlers();
+    // From now on the I/O is done through file descriptors only
+    const auto in_fd = attach_pipe_handle(h_in, false);
+    const auto in_rec_fd = attach_pipe_handle(h_in_rec, false);
+    auto out_fd = attach_pipe_handle(h_out, true);
+    const auto cin_fd = attach_pipe_handle(h_cin, false);
+    const auto cout_fd = attach_pipe_handle(h_cout, true);
+    int chan_fd{-1};
+    if (h_chan != nullptr)
+        // The channel is written the same way as the output pipe.
+        attach_channel_handle(h_chan, chan_fd, out_fd);
+    int listen_fd{-1};
+    if (persist_path != nullptr) {
+        // Bound before the shell is launched, so that a session that's already there is reported right away.
+        listen_fd = session_socket_listen(persist_path);
+        if (listen_fd < 0) {
+            printf("Failed to listen on %s.", persist_path);
+            exit(EXIT_CODE_API_CALL_FAILED);
+        }
+        // A client may be gone by the time it's written to, which mustn't end the session.
+        if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+            log_lin_error(LOG_ERROR, "[main] 'signal' call for SIGPIPE signal failed.");
     }
-    log(LOG_DEBUG, "[main] Signal handlers set.");
-    if (!SetConsoleCtrlHandler(ctrl_handler_routine, true)) {
-        log_win_error(LOG_ERROR, "[main] 'SetConsoleCtrlHandler' call failed.");
+    logf(LOG_DEBUG, "[main] Initial winsize: ws_col = %i ws_row = %i.", win_size.ws_col, win_size.ws_row);
+    sync_channel sync{};
+    if (!sync_channel_create(sync)) {
+        printf("Failed to create synchronization pipes.");
         exit(EXIT_CODE_API_CALL_FAILED);
     }
-    log(LOG_DEBUG, "[main] 'SetConsoleCtrlHandler' call succeeded.");
-    const auto parent_pid = getpid();
-    logf(LOG_DEBUG, "[main] Initial winsize: ws_col = %i ws_row = %i.", win_size.ws_col, win_size.ws_row);
-    logf(LOG_DEBUG, "[main] About to fork...");
+    logf(LOG_DEBUG, "[main] About to launch the shell (%s)...", launch_mode == LAUNCH_MODE_SPAWN ? "spawn" : "fork");
+    const auto launch_start_us = monotonic_microseconds();
     int pty_fd{0};
-    const int slave_pid = forkpty(&pty_fd, nullptr, nullptr, &win_size);
+    const int slave_pid = launch_mode == LAUNCH_MODE_SPAWN
+                          ? launch_shell_spawn(pty_fd, win_size, sync, argv, dir)
+                          : launch_shell_forkpty(pty_fd, win_size, sync, argv, dir);
     if (slave_pid < 0) {
-        log_lin_error(LOG_ERROR, "[main] 'forkpty' call failed.");
-        printf("Failed to fork.");
+        printf("Failed to launch the shell.");
         exit(EXIT_CODE_API_CALL_FAILED);
     }
-    if (slave_pid == 0) {
-        do_slave(parent_pid, argv, dir);
-        // This line will never be reached.
-        exit(EXIT_CODE_UNEXPECTED_HAPPENED);
-    }
-    // The rest is master process only.
-    do_master(pty_fd, slave_pid, h_in, h_in_rec, h_out, h_cin, h_cout);
+    // The rest is master process only (the slave never returns from launch).
+    do_master(pty_fd, slave_pid, sync, launch_start_us, in_fd, in_rec_fd, out_fd, cin_fd, cout_fd, chan_fd, listen_fd);
+    if (listen_fd >= 0)
+        session_socket_remove(listen_fd, persist_path);
     log(LOG_INFO, "[main] Bye-bye...");
     exit(0);
 }
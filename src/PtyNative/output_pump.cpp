@@ -0,0 +1,369 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "output_pump.h"
+
+#include "file_helpers.h"
+#include "helpers.h"
+#include "logging.h"
+#include "stand_alone_io.h"
+#include "stats.h"
+
+#define PUMP_ERRCOUNT_IGNORE 2
+#define PUMP_ERROR_BACKOFF_MICROSECONDS 10000
+#define WAKE_DRAIN_BUFFER_SIZE 64
+
+static void drain_wake(int fd) {
+    char buff[WAKE_DRAIN_BUFFER_SIZE];
+    while (read(fd, buff, WAKE_DRAIN_BUFFER_SIZE) == WAKE_DRAIN_BUFFER_SIZE) {
+    }
+}
+
+// Waits until the non-blocking output takes more. Once the pump is stopping (which wakes it), it waits only until the
+// stop deadline, so that an output that isn't drained can't hold the stop up.
+static bool wait_writable(int fd, void* context) {
+    auto& pump = *(output_pump*) context;
+    while (true) {
+        auto timeout_ms{-1};
+        if (pump.stopping.load()) {
+            const auto remaining_us = pump.stop_deadline_us.load() - monotonic_microseconds();
+            if (remaining_us <= 0) {
+                logf(LOG_WARN, "[wait_writable] Output isn't writable %i ms after the stop. Giving up.",
+                     OUTPUT_PUMP_STOP_TIMEOUT_MS);
+                return false;
+            }
+            timeout_ms = (int) ((remaining_us + 999) / 1000);
+        }
+        pollfd sources[]{{.fd = fd, .events = POLLOUT, .revents = 0},
+                         {.fd = pump.data_wake[0], .events = POLLIN, .revents = 0}};
+        if (poll(sources, 2, timeout_ms) < 0 && errno != EINTR) {
+            log_lin_error(LOG_ERROR, "[wait_writable] 'poll' call failed.");
+            return false;
+        }
+        if (sources[1].revents != 0)
+            drain_wake(pump.data_wake[0]);
+        // Errors are reported by the write.
+        if (sources[0].revents != 0)
+            return true;
+    }
+}
+
+static bool write_output(output_pump& pump, char* buff, int length) {
+    if (pump.chan != nullptr)
+        return channel_write(*pump.chan, CHANNEL_FRAME_OUTPUT, buff, length);
+    return pump.out_fd < 0
+           ? write_output_to_console(buff, length) // Stand-alone mode
+           : write_bytes(pump.out_fd, buff, length, wait_writable, &pump); // Managed mode
+}
+
+static void wake(int fd) {
+    const char wake_byte{1};
+    while (write(fd, &wake_byte, 1) < 0 && errno == EINTR) {
+    }
+}
+
+// Writes the frames the I/O loop has queued on the channel (responses and credit), ahead of the output.
+static bool write_queued_frames(output_pump& pump) {
+    if (pump.chan == nullptr)
+        return true;
+    auto room_freed{false};
+    const auto result = channel_write_queued(*pump.chan, room_freed);
+    if (room_freed)
+        wake(pump.space_wake[1]);
+    return result;
+}
+
+static bool has_queued_frames(const output_pump& pump) {
+    return pump.chan != nullptr && channel_has_queued(*pump.chan);
+}
+
+static void wait_for_wake(int fd, int timeout_ms) {
+    pollfd source{.fd = fd, .events = POLLIN, .revents = 0};
+    if (poll(&source, 1, timeout_ms) > 0)
+        drain_wake(fd);
+}
+
+// Returns the number of microseconds to keep holding the buffered output back, or 0 if it should be written now.
+static long long coalesce_wait(output_pump& pump, long long pending_since_us, size_t used) {
+    if (pump.coalesce_delay_us <= 0 || used >= pump.coalesce_bytes || pump.stopping.load())
+        return 0;
+    const auto now = monotonic_microseconds();
+    if (now < pump.echo_until_us.load(std::memory_order_relaxed))
+        return 0;
+    const auto wait_us = pending_since_us + pump.coalesce_delay_us - now;
+    return wait_us > 0 ? wait_us : 0;
+}
+
+static void* output_pump_thread(void* arg) {
+    auto& pump = *(output_pump*) arg;
+    log(LOG_DEBUG, "[output_pump_thread] Output pump started.");
+    auto error_counter{0};
+    // When the oldest buffered byte was seen, and whether we're writing out everything that's buffered.
+    long long pending_since_us{0};
+    auto flushing{false};
+    while (true) {
+        if (!write_queued_frames(pump)) {
+            log(LOG_ERROR, "[output_pump_thread] Failed to write the queued frames. Exiting.");
+            pump.failed.store(true);
+            wake(pump.space_wake[1]);
+            break;
+        }
+        char* region{nullptr};
+        auto length = ring_buffer_readable(pump.ring, &region);
+        if (length == 0) {
+            pending_since_us = 0;
+            flushing = false;
+            if (pump.stopping.load())
+                break;
+            // Announce that we're going to sleep, and check again, so that a commit can't slip in unnoticed.
+            pump.pump_idle.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ring_buffer_used(pump.ring) > 0 || pump.stopping.load() || has_queued_frames(pump)) {
+                pump.pump_idle.store(false);
+                continue;
+            }
+            wait_for_wake(pump.data_wake[0], -1);
+            pump.pump_idle.store(false);
+            continue;
+        }
+        if (!flushing) {
+            if (pending_since_us == 0)
+                pending_since_us = monotonic_microseconds();
+            const auto used = ring_buffer_used(pump.ring);
+            const auto wait_us = coalesce_wait(pump, pending_since_us, used);
+            if (wait_us > 0) {
+                // Holding the output back; a commit (or input) wakes us to check again.
+                pump.pump_idle.store(true);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (ring_buffer_used(pump.ring) == used && !pump.stopping.load() && !has_queued_frames(pump))
+                    wait_for_wake(pump.data_wake[0], (int) ((wait_us + 999) / 1000));
+                pump.pump_idle.store(false);
+                continue;
+            }
+            flushing = true;
+        }
+        if (pump.chan != nullptr) {
+            const auto credit = pump.credit.load();
+            if (credit <= 0) {
+                if (pump.stopping.load()) {
+                    logf(LOG_WARN, "[output_pump_thread] No credit left for the remaining %zu bytes.",
+                         ring_buffer_used(pump.ring));
+                    break;
+                }
+                // Waiting for the client to grant more credit (output_pump_add_credit wakes us).
+                stats_add_shared(STATS_CHANNEL_CREDIT_WAITS, 1);
+                pump.pump_idle.store(true);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (pump.credit.load() <= 0 && !pump.stopping.load() && !has_queued_frames(pump))
+                    wait_for_wake(pump.data_wake[0], -1);
+                pump.pump_idle.store(false);
+                continue;
+            }
+            if (length > (size_t) credit)
+                length = (size_t) credit;
+            if (length > CHANNEL_MAX_PAYLOAD)
+                length = CHANNEL_MAX_PAYLOAD;
+        }
+        logf(LOG_TRACE, "[output_pump_thread] Trying to write %zu bytes.", length);
+        if (!write_output(pump, region, (int) length)) {
+            logf(LOG_WARN, "[output_pump_thread] Failed to write %zu bytes to output.", length);
+            if (++error_counter > PUMP_ERRCOUNT_IGNORE) {
+                logf(LOG_ERROR, "[output_pump_thread] Failed to write output in %i attempts. Exiting.",
+                     PUMP_ERRCOUNT_IGNORE);
+                pump.failed.store(true);
+                wake(pump.space_wake[1]);
+                break;
+            }
+            usleep(PUMP_ERROR_BACKOFF_MICROSECONDS);
+            continue;
+        }
+        error_counter = 0;
+        if (pump.chan != nullptr)
+            pump.credit.fetch_sub((long long) length);
+        stats_add_shared(STATS_OUTPUT_WRITES, 1);
+        stats_add_shared(STATS_OUTPUT_BYTES_WRITTEN, length);
+        ++pump.writes;
+        pump.bytes_written += length;
+        logf(LOG_TRACE, "[output_pump_thread] %zu bytes successfully written to output.", length);
+        ring_buffer_commit_read(pump.ring, length);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // The loop resumes reading PTY only once the output is drained down to the low watermark.
+        if (ring_buffer_used(pump.ring) <= pump.low_water && pump.loop_waiting.exchange(false))
+            wake(pump.space_wake[1]);
+    }
+    // The responses queued last (i.e. before the session ended) still go out.
+    if (!pump.failed.load() && !write_queued_frames(pump))
+        log(LOG_WARN, "[output_pump_thread] Failed to write the queued frames.");
+    log(LOG_DEBUG, "[output_pump_thread] Output pump finished.");
+    pump.finished.store(true);
+    wake(pump.space_wake[1]);
+    return nullptr;
+}
+
+// Closes the wake pipes that are open (the ones that aren't are -1).
+static void close_wake_pipes(output_pump& pump) {
+    const int fds[]{pump.data_wake[0], pump.data_wake[1], pump.space_wake[0], pump.space_wake[1]};
+    for (auto fd: fds)
+        if (fd >= 0)
+            close(fd);
+}
+
+bool output_pump_start(output_pump& pump, int out_fd, channel* chan, size_t capacity, size_t high_water,
+                       size_t low_water, size_t coalesce_bytes, long long coalesce_delay_us) {
+    pump.out_fd = out_fd;
+    pump.chan = chan;
+    pump.credit.store(CHANNEL_WINDOW);
+    pump.coalesce_bytes = coalesce_bytes;
+    pump.coalesce_delay_us = coalesce_delay_us;
+    pump.echo_until_us.store(0);
+    pump.commits = 0;
+    pump.writes = 0;
+    pump.bytes_written = 0;
+    pump.started_us = monotonic_microseconds();
+    pump.pump_idle.store(false);
+    pump.loop_waiting.store(false);
+    pump.stopping.store(false);
+    pump.failed.store(false);
+    pump.finished.store(false);
+    pump.stop_deadline_us.store(0);
+    if (chan != nullptr) {
+        chan->wait_writable = wait_writable;
+        chan->wait_context = &pump;
+    }
+    if (!ring_buffer_init(pump.ring, capacity))
+        return false;
+    pump.high_water = high_water == 0 || high_water > pump.ring.capacity ? pump.ring.capacity : high_water;
+    pump.low_water = low_water == 0 || low_water >= pump.high_water ? pump.high_water / 2 : low_water;
+    pump.throttled = false;
+    pump.data_wake[0] = pump.data_wake[1] = pump.space_wake[0] = pump.space_wake[1] = -1;
+    if (pipe2(pump.data_wake, O_CLOEXEC | O_NONBLOCK) != 0 // NOLINT(hicpp-signed-bitwise)
+        || pipe2(pump.space_wake, O_CLOEXEC | O_NONBLOCK) != 0) { // NOLINT(hicpp-signed-bitwise)
+        log_lin_error(LOG_ERROR, "[output_pump_start] 'pipe2' call failed.");
+        close_wake_pipes(pump);
+        ring_buffer_destroy(pump.ring);
+        return false;
+    }
+    const auto result = pthread_create(&pump.thread, nullptr, output_pump_thread, &pump);
+    if (result != 0) {
+        logf(LOG_ERROR, "[output_pump_start] 'pthread_create' call failed. Error: %i (%s)", result, strerror(result));
+        close_wake_pipes(pump);
+        ring_buffer_destroy(pump.ring);
+        return false;
+    }
+    logf(LOG_DEBUG, "[output_pump_start] Output pump ring size: %zu bytes (watermarks: %zu / %zu).",
+         pump.ring.capacity, pump.high_water, pump.low_water);
+    if (coalesce_delay_us > 0)
+        logf(LOG_DEBUG, "[output_pump_start] Coalescing output up to %zu bytes or %lli us.", coalesce_bytes,
+             coalesce_delay_us);
+    return true;
+}
+
+void output_pump_request_stop(output_pump& pump) {
+    if (pump.stopping.load())
+        return;
+    logf(LOG_DEBUG, "[output_pump_request_stop] Stopping output pump (%zu bytes still buffered).",
+         ring_buffer_used(pump.ring));
+    pump.stop_deadline_us.store(monotonic_microseconds() + OUTPUT_PUMP_STOP_TIMEOUT_MS * 1000LL);
+    pump.stopping.store(true);
+    wake(pump.data_wake[1]);
+}
+
+bool output_pump_finished(const output_pump& pump) {
+    return pump.finished.load();
+}
+
+void output_pump_stop(output_pump& pump) {
+    output_pump_request_stop(pump);
+    pthread_join(pump.thread, nullptr);
+    close_wake_pipes(pump);
+    ring_buffer_destroy(pump.ring);
+    const auto commits = pump.commits;
+    const auto writes = pump.writes;
+    auto seconds = (double) (monotonic_microseconds() - pump.started_us) / 1000000;
+    if (seconds <= 0)
+        seconds = 1;
+    // Without coalescing there would be (at least) a write per chunk read from PTY.
+    logf(LOG_INFO, "[output_pump_stop] %llu bytes read in %llu chunks, written in %llu writes (%.1f writes/s instead "
+                   "of %.1f, %.1f%% fewer).", pump.bytes_written, commits, writes,
+         writes / seconds, commits / seconds, commits > 0 ? 100.0 - writes * 100.0 / commits : 0.0);
+}
+
+// Whether the output is (still) above the watermarks. Crossing them is counted.
+static bool is_throttled(output_pump& pump) {
+    const auto used = ring_buffer_used(pump.ring);
+    if (!pump.throttled && used >= pump.high_water) {
+        pump.throttled = true;
+        stats_add(STATS_OUTPUT_HIGH_WATER_CROSSINGS, 1);
+        logf(LOG_TRACE, "[is_throttled] %zu bytes pending. PTY reading paused.", used);
+    } else if (pump.throttled && used <= pump.low_water) {
+        pump.throttled = false;
+        stats_add(STATS_OUTPUT_LOW_WATER_CROSSINGS, 1);
+        logf(LOG_TRACE, "[is_throttled] %zu bytes pending. PTY reading resumed.", used);
+    }
+    return pump.throttled;
+}
+
+size_t output_pump_reserve(output_pump& pump, char** region) {
+    if (is_throttled(pump)) {
+        // Announce that we're waiting for space, and check again (the pump may have freed it in the meantime).
+        pump.loop_waiting.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (is_throttled(pump))
+            return 0;
+        pump.loop_waiting.store(false);
+    }
+    // The pending output doesn't grow beyond the high watermark.
+    const auto length = ring_buffer_writable(pump.ring, region);
+    const auto below_high = pump.high_water - ring_buffer_used(pump.ring);
+    return length < below_high ? length : below_high;
+}
+
+void output_pump_commit(output_pump& pump, size_t length) {
+    ring_buffer_commit_write(pump.ring, length);
+    ++pump.commits;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pump.pump_idle.exchange(false))
+        wake(pump.data_wake[1]);
+}
+
+int output_pump_wake_fd(const output_pump& pump) {
+    return pump.space_wake[0];
+}
+
+void output_pump_clear_wake(output_pump& pump) {
+    drain_wake(pump.space_wake[0]);
+}
+
+bool output_pump_failed(const output_pump& pump) {
+    return pump.failed.load();
+}
+
+void output_pump_input_received(output_pump& pump) {
+    if (pump.coalesce_delay_us <= 0)
+        return;
+    pump.echo_until_us.store(monotonic_microseconds() + OUTPUT_ECHO_WINDOW_MICROSECONDS, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // If the pump is holding output back, it has to write it now.
+    if (ring_buffer_used(pump.ring) > 0 && pump.pump_idle.exchange(false))
+        wake(pump.data_wake[1]);
+}
+
+void output_pump_frames_queued(output_pump& pump) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pump.pump_idle.exchange(false))
+        wake(pump.data_wake[1]);
+}
+
+void output_pump_add_credit(output_pump& pump, long long credit) {
+    pump.credit.fetch_add(credit);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // If the pump is waiting for credit, it can write now.
+    if (pump.pump_idle.exchange(false))
+        wake(pump.data_wake[1]);
+}
@@ -0,0 +1,103 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_OUTPUT_PUMP_H
+#define PTYNATIVE_OUTPUT_PUMP_H
+
+#include "includes.h"
+
+#include "channel.h"
+#include "ring_buffer.h"
+
+#include <pthread.h>
+
+// Output that follows input this soon is written immediately, even if coalescing is enabled (it's most likely echo).
+#define OUTPUT_ECHO_WINDOW_MICROSECONDS 50000
+// How long a stopping pump keeps trying to write to a non-blocking output that doesn't take more (e.g. a client that
+// doesn't read its channel). A blocking output is waited for as long as it takes.
+#define OUTPUT_PUMP_STOP_TIMEOUT_MS 2000
+
+// Decouples reading from PTY (the I/O loop, producer) from writing to the output (the pump thread, consumer).
+// Each side blocks only on its own endpoint: the pump blocks in write while the output isn't drained, and the
+// I/O loop stops reading PTY (but keeps serving everything else) once the pending output reaches the high watermark,
+// until the pump drains it down to the low watermark. Meanwhile the slave blocks on its writes to PTY. In channel
+// mode the pump also writes the frames the loop queues on the channel (see channel_queue), so the loop never waits
+// for the client.
+struct output_pump {
+    ring_buffer ring;
+    int out_fd; // -1 in stand-alone mode (console)
+    // If set, the output is written as OUTPUT frames, and only as much as the client has granted credit for.
+    channel* chan;
+    std::atomic<long long> credit;
+    pthread_t thread;
+    // Wakes the pump when data is added (written only if the pump is idle).
+    int data_wake[2];
+    // Wakes the I/O loop when space is freed in the ring or in the channel's queue (written only if the loop is waiting
+    // for it), or the pump failed.
+    int space_wake[2];
+    std::atomic<bool> pump_idle;
+    std::atomic<bool> loop_waiting;
+    std::atomic<bool> stopping;
+    std::atomic<bool> failed;
+    // Set when the pump thread is done (space_wake is written then), so that it can be joined without waiting.
+    std::atomic<bool> finished;
+    std::atomic<long long> stop_deadline_us;
+    // Watermarks (in bytes of pending output), and whether the loop is above the high one (loop only).
+    size_t high_water;
+    size_t low_water;
+    bool throttled;
+    // Coalescing (disabled if coalesce_delay_us is 0): output is held back until coalesce_bytes are buffered, or the
+    // oldest buffered byte is coalesce_delay_us old, whichever comes first.
+    size_t coalesce_bytes;
+    long long coalesce_delay_us;
+    // Coalescing is suspended until this time (set when input is received).
+    std::atomic<long long> echo_until_us;
+    // The pump's own counters (for the summary logged when it's stopped): commits are counted by the I/O loop, and
+    // writes by the pump thread.
+    unsigned long long commits;
+    unsigned long long writes;
+    unsigned long long bytes_written;
+    long long started_us;
+};
+
+// The watermarks are limited to the capacity (high_water 0 means the capacity, and low_water 0 half of high_water).
+bool output_pump_start(output_pump& pump, int out_fd, channel* chan, size_t capacity, size_t high_water,
+                       size_t low_water, size_t coalesce_bytes, long long coalesce_delay_us);
+
+// Asks the pump thread to drain everything that's buffered, and to finish, without waiting for it (see
+// output_pump_finished).
+void output_pump_request_stop(output_pump& pump);
+bool output_pump_finished(const output_pump& pump);
+
+// Drains everything that's buffered, and stops the pump thread (waiting for it, unless it has finished already).
+void output_pump_stop(output_pump& pump);
+
+// Returns the size of the contiguous free region starting at *region (up to the high watermark). If it returns 0 (the
+// output is throttled) the I/O loop should wait on output_pump_wake_fd before trying again.
+size_t output_pump_reserve(output_pump& pump, char** region);
+void output_pump_commit(output_pump& pump, size_t length);
+
+// The fd the I/O loop waits on (readable when space is freed, also in the channel's queue, or the pump has failed or
+// finished).
+int output_pump_wake_fd(const output_pump& pump);
+void output_pump_clear_wake(output_pump& pump);
+
+bool output_pump_failed(const output_pump& pump);
+
+// Called by the I/O loop when input is received: buffered output is written at once, and so is the output that
+// follows within OUTPUT_ECHO_WINDOW_MICROSECONDS.
+void output_pump_input_received(output_pump& pump);
+
+// Called by the I/O loop when it has queued frames on the channel (the pump writes them).
+void output_pump_frames_queued(output_pump& pump);
+
+// Called by the I/O loop when the client grants more credit (multiplexed channel).
+void output_pump_add_credit(output_pump& pump, long long credit);
+
+#endif //PTYNATIVE_OUTPUT_PUMP_H
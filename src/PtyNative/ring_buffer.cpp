@@ -0,0 +1,65 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "ring_buffer.h"
+
+#include "logging.h"
+
+bool ring_buffer_init(ring_buffer& ring, size_t capacity) {
+    size_t rounded{1};
+    while (rounded < capacity)
+        rounded <<= 1U;
+    ring.data = (char*) malloc(rounded);
+    if (ring.data == nullptr) {
+        logf(LOG_ERROR, "[ring_buffer_init] Failed to allocate %zu bytes.", rounded);
+        ring.capacity = 0;
+        return false;
+    }
+    ring.capacity = rounded;
+    ring.write_position.store(0);
+    ring.read_position.store(0);
+    return true;
+}
+
+void ring_buffer_destroy(ring_buffer& ring) {
+    if (ring.data)
+        free(ring.data);
+    ring.data = nullptr;
+    ring.capacity = 0;
+}
+
+size_t ring_buffer_used(const ring_buffer& ring) {
+    return ring.write_position.load(std::memory_order_acquire) - ring.read_position.load(std::memory_order_acquire);
+}
+
+size_t ring_buffer_writable(ring_buffer& ring, char** region) {
+    const auto write_position = ring.write_position.load(std::memory_order_relaxed);
+    const auto free_space = ring.capacity - (write_position - ring.read_position.load(std::memory_order_acquire));
+    const auto index = write_position & (ring.capacity - 1);
+    *region = ring.data + index;
+    return free_space < ring.capacity - index ? free_space : ring.capacity - index;
+}
+
+void ring_buffer_commit_write(ring_buffer& ring, size_t length) {
+    ring.write_position.store(ring.write_position.load(std::memory_order_relaxed) + length,
+                              std::memory_order_release);
+}
+
+size_t ring_buffer_readable(ring_buffer& ring, char** region) {
+    const auto read_position = ring.read_position.load(std::memory_order_relaxed);
+    const auto used = ring.write_position.load(std::memory_order_acquire) - read_position;
+    const auto index = read_position & (ring.capacity - 1);
+    *region = ring.data + index;
+    return used < ring.capacity - index ? used : ring.capacity - index;
+}
+
+void ring_buffer_commit_read(ring_buffer& ring, size_t length) {
+    ring.read_position.store(ring.read_position.load(std::memory_order_relaxed) + length,
+                             std::memory_order_release);
+}
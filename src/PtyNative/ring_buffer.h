@@ -0,0 +1,41 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_RING_BUFFER_H
+#define PTYNATIVE_RING_BUFFER_H
+
+#include "includes.h"
+
+#include <atomic>
+
+// Lock-free single-producer / single-consumer byte ring. Capacity is a power of two, and the positions are
+// free-running counters (the index is `position & (capacity - 1)`). Both sides access the data in place: the
+// producer gets a contiguous free region to read into, and the consumer gets a contiguous region to write from.
+struct ring_buffer {
+    char* data;
+    size_t capacity;
+    std::atomic<size_t> write_position;
+    std::atomic<size_t> read_position;
+};
+
+// capacity is rounded up to the next power of two.
+bool ring_buffer_init(ring_buffer& ring, size_t capacity);
+void ring_buffer_destroy(ring_buffer& ring);
+
+size_t ring_buffer_used(const ring_buffer& ring);
+
+// Producer side: returns the size of the contiguous free region starting at *region.
+size_t ring_buffer_writable(ring_buffer& ring, char** region);
+void ring_buffer_commit_write(ring_buffer& ring, size_t length);
+
+// Consumer side: returns the size of the contiguous data region starting at *region.
+size_t ring_buffer_readable(ring_buffer& ring, char** region);
+void ring_buffer_commit_read(ring_buffer& ring, size_t length);
+
+#endif //PTYNATIVE_RING_BUFFER_H
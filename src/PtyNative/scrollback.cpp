@@ -0,0 +1,109 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "scrollback.h"
+
+#include "logging.h"
+
+// The byte `offset` bytes after the oldest one.
+static char byte_at(const scrollback_ring& scrollback, size_t offset) {
+    const auto position = scrollback.start + offset;
+    return scrollback.data[position < scrollback.capacity ? position : position - scrollback.capacity];
+}
+
+bool scrollback_init(scrollback_ring& scrollback, size_t capacity) {
+    scrollback.data = (char*) malloc(capacity);
+    if (scrollback.data == nullptr) {
+        logf(LOG_ERROR, "[scrollback_init] Failed to allocate %zu bytes.", capacity);
+        return false;
+    }
+    scrollback.capacity = capacity;
+    scrollback.start = 0;
+    scrollback.used = 0;
+    scrollback.wrapped = false;
+    scrollback.appended = 0;
+    return true;
+}
+
+void scrollback_destroy(scrollback_ring& scrollback) {
+    free(scrollback.data);
+    scrollback.data = nullptr;
+    scrollback.capacity = 0;
+    scrollback.start = 0;
+    scrollback.used = 0;
+}
+
+void scrollback_append(scrollback_ring& scrollback, const char* data, size_t length) {
+    scrollback.appended += length;
+    if (length >= scrollback.capacity) {
+        // Only the last `capacity` bytes are kept.
+        memcpy(scrollback.data, data + length - scrollback.capacity, scrollback.capacity);
+        scrollback.wrapped = scrollback.wrapped || scrollback.used > 0 || length > scrollback.capacity;
+        scrollback.start = 0;
+        scrollback.used = scrollback.capacity;
+        return;
+    }
+    const auto free_space = scrollback.capacity - scrollback.used;
+    if (length > free_space) {
+        // Dropping the oldest bytes.
+        scrollback.start = (scrollback.start + length - free_space) % scrollback.capacity;
+        scrollback.used -= length - free_space;
+        scrollback.wrapped = true;
+    }
+    const auto end = (scrollback.start + scrollback.used) % scrollback.capacity;
+    const auto first = length < scrollback.capacity - end ? length : scrollback.capacity - end;
+    memcpy(scrollback.data + end, data, first);
+    memcpy(scrollback.data, data + first, length - first);
+    scrollback.used += length;
+}
+
+size_t scrollback_read(const scrollback_ring& scrollback, size_t offset, char* destination, size_t length) {
+    iovec segments[2];
+    const auto count = scrollback_segments(scrollback, offset, segments);
+    size_t copied{0};
+    for (auto i = 0; i < count && copied < length; ++i) {
+        const auto part = segments[i].iov_len < length - copied ? segments[i].iov_len : length - copied;
+        memcpy(destination + copied, segments[i].iov_base, part);
+        copied += part;
+    }
+    return copied;
+}
+
+int scrollback_segments(const scrollback_ring& scrollback, size_t offset, iovec* segments) {
+    if (offset >= scrollback.used)
+        return 0;
+    const auto length = scrollback.used - offset;
+    const auto begin = (scrollback.start + offset) % scrollback.capacity;
+    const auto first = length < scrollback.capacity - begin ? length : scrollback.capacity - begin;
+    segments[0] = {scrollback.data + begin, first};
+    if (first == length)
+        return 1;
+    segments[1] = {scrollback.data, length - first};
+    return 2;
+}
+
+size_t scrollback_line_start(const scrollback_ring& scrollback, size_t offset) {
+    if (offset == 0 && !scrollback.wrapped)
+        return 0;
+    for (auto position = offset > 0 ? offset - 1 : 0; position < scrollback.used; ++position)
+        if (byte_at(scrollback, position) == '\n')
+            return position + 1;
+    // A single (partial) line: replaying it is better than nothing.
+    return offset;
+}
+
+size_t scrollback_last_lines(const scrollback_ring& scrollback, size_t count) {
+    if (scrollback.used == 0 || count == 0)
+        return scrollback.used;
+    // The newline that ends the last line doesn't start another one.
+    for (auto offset = scrollback.used - 1; offset > 0; --offset)
+        if (byte_at(scrollback, offset - 1) == '\n' && --count == 0)
+            return offset;
+    return scrollback_line_start(scrollback, 0);
+}
@@ -0,0 +1,54 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_SCROLLBACK_H
+#define PTYNATIVE_SCROLLBACK_H
+
+#include "includes.h"
+
+#include <sys/uio.h>
+
+// The most recent output of a session: returned by the get-scrollback command (`--scrollback`), and replayed to a
+// client that attaches to a detachable session (`--persist`). It's a fixed-size ring: appending to a full one
+// overwrites the oldest bytes. Used by the I/O loop only.
+struct scrollback_ring {
+    char* data;
+    size_t capacity;
+    // Position of the oldest byte, and the number of bytes.
+    size_t start;
+    size_t used;
+    // Whether some bytes were overwritten (the oldest line is then most likely incomplete).
+    bool wrapped;
+    // Bytes appended since the ring was created: the position after the newest byte (positions don't change as the
+    // ring wraps).
+    unsigned long long appended;
+};
+
+bool scrollback_init(scrollback_ring& scrollback, size_t capacity);
+void scrollback_destroy(scrollback_ring& scrollback);
+
+void scrollback_append(scrollback_ring& scrollback, const char* data, size_t length);
+
+// Copies up to `length` bytes, starting `offset` bytes after the oldest one, into destination. Returns the number of
+// bytes copied.
+size_t scrollback_read(const scrollback_ring& scrollback, size_t offset, char* destination, size_t length);
+
+// The bytes from `offset` to the newest one, as (up to two) contiguous segments, so that they can be written without
+// copying them. Returns the number of segments.
+int scrollback_segments(const scrollback_ring& scrollback, size_t offset, iovec* segments);
+
+// Offset of the first line that starts at (or after) `offset`, so that a replay doesn't start in the middle of a line,
+// or of an escape sequence. The oldest line doesn't count if the buffer has wrapped. Returns `offset` if there's none.
+size_t scrollback_line_start(const scrollback_ring& scrollback, size_t offset);
+
+// Offset of the last `count` lines (a trailing incomplete line counts too). Only the complete lines are returned if
+// there are fewer of them.
+size_t scrollback_last_lines(const scrollback_ring& scrollback, size_t count);
+
+#endif //PTYNATIVE_SCROLLBACK_H
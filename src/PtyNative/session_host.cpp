@@ -0,0 +1,516 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "session_host.h"
+
+#include "channel.h"
+#include "child_watcher.h"
+#include "event_loop.h"
+#include "file_helpers.h"
+#include "helpers.h"
+#include "io_processor.h"
+#include "logging.h"
+#include "shell_launcher.h"
+#include "shell_pool.h"
+#include "stats.h"
+#include "sync_channel.h"
+
+#include <cstdint>
+
+// Session states:
+#define HOST_SESSION_STARTING 0 // Waiting for the slave process to become ready.
+#define HOST_SESSION_RUNNING 1
+#define HOST_SESSION_EXITING 2  // The I/O is over, waiting for the slave process to be reaped (and the output pump).
+
+#define HOST_SUCCESS_BYTE 0
+#define HOST_FAILURE_BYTE 1
+#define HOST_REQUEST_HEADER_SIZE 5
+// The largest response (to the get-stats command).
+#define HOST_RESPONSE_MAX_SIZE (HOST_REQUEST_HEADER_SIZE + STATS_SERIALIZED_SIZE)
+#define HOST_MAX_SHELL_ARGS 64
+#define HOST_MAX_ENV_VARS 64
+// Channel name, dir, environment variables, the empty string after them, and the shell with its arguments.
+#define HOST_MAX_CREATE_STRINGS (HOST_MAX_ENV_VARS + HOST_MAX_SHELL_ARGS + 3)
+#define HOST_UNKNOWN_EXIT_CODE (-1)
+// How often an exiting session's output pump is checked if its wake fd can't be waited on.
+#define HOST_STOP_POLL_MS 100
+
+struct host_session {
+    uint32_t id;
+    int state;
+    int slave_pid;
+    int pty_fd;
+    // The session's channel.
+    int read_fd;
+    int write_fd;
+    // Startup handshake (while starting).
+    sync_channel sync;
+    long long sync_deadline_us;
+    long long launch_start_us;
+    // The counter the startup time is added to (STATS_POOL_HIT_MICROSECONDS or STATS_POOL_MISS_MICROSECONDS), or -1
+    // if the shell isn't the pooled one.
+    int start_counter;
+    int sync_source;
+    // While exiting: the output pump is still writing the rest of the output (the channel stays open until it's done).
+    bool io_stopping;
+    int stop_source;
+    bool reaped;
+    int exit_code;
+    io_session io;
+    host_session* next;
+};
+
+static channel _control{};
+static host_session* _sessions{nullptr};
+static uint32_t _next_session_id{1};
+static int _session_count{0};
+// Whether control frames (or EXIT frames) wait for room in the control channel's queue. The loop never waits for the
+// client: the queued frames are written as far as the channel takes them, and the rest once it's writable.
+static bool _control_blocked{false};
+
+static host_session* find_session(uint32_t id) {
+    for (auto session = _sessions; session != nullptr; session = session->next)
+        if (session->id == id)
+            return session;
+    return nullptr;
+}
+
+static int exit_code(int status) {
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return HOST_UNKNOWN_EXIT_CODE;
+}
+
+static bool respond(uint32_t request_id, bool success, const void* result, int length) {
+    char response[HOST_RESPONSE_MAX_SIZE];
+    if (length > (int) sizeof(response) - HOST_REQUEST_HEADER_SIZE)
+        length = (int) sizeof(response) - HOST_REQUEST_HEADER_SIZE;
+    memcpy(response, &request_id, sizeof(request_id));
+    response[HOST_REQUEST_HEADER_SIZE - 1] = success ? HOST_SUCCESS_BYTE : HOST_FAILURE_BYTE;
+    if (length > 0)
+        memcpy(response + HOST_REQUEST_HEADER_SIZE, result, length);
+    return channel_queue(_control, CHANNEL_FRAME_COMMAND, response, HOST_REQUEST_HEADER_SIZE + length);
+}
+
+static bool respond_failure(uint32_t request_id, const char* message) {
+    log(LOG_ERROR, message);
+    return respond(request_id, false, message, (int) strlen(message));
+}
+
+// The output pump is done: the session's channel is closed.
+static void finish_session_io(host_session& session) {
+    io_session_stop(session.io);
+    close(session.read_fd);
+    close(session.write_fd);
+    session.io_stopping = false;
+    logf(LOG_DEBUG, "[finish_session_io] Session %u output is written.", session.id);
+}
+
+// The I/O is over (or it never started): the session's streams are closed, and its process group is hung up (if it's
+// still there). The loop doesn't wait for the output pump (the client may not be reading): the channel is closed once
+// the pump is done (see finish_session_io). The session is dropped once that's done, and its slave process is reaped.
+static void end_session_io(host_session& session) {
+    if (session.state == HOST_SESSION_RUNNING) {
+        io_session_request_stop(session.io);
+        session.io_stopping = true;
+    } else {
+        sync_channel_close(session.sync);
+        close(session.read_fd);
+        close(session.write_fd);
+    }
+    close(session.pty_fd);
+    if (!session.reaped)
+        kill(-session.slave_pid, SIGHUP);
+    session.state = HOST_SESSION_EXITING;
+    session.stop_source = EVENT_LOOP_NO_SOURCE;
+    logf(LOG_DEBUG, "[end_session_io] Session %u I/O is over.", session.id);
+}
+
+// Parses the strings that follow the winsize: channel name, dir, environment variables, shell and its arguments.
+static bool parse_create_strings(char* strings, int length, char*& channel_name, char*& dir, char** env,
+                                 char** argv) {
+    // The strings are NUL-terminated, so the last byte has to be NUL.
+    if (length < 1 || strings[length - 1] != 0)
+        return false;
+    char* fields[HOST_MAX_CREATE_STRINGS];
+    auto count{0};
+    for (auto position = 0; position < length; position += (int) strlen(strings + position) + 1) {
+        if (count == HOST_MAX_CREATE_STRINGS)
+            return false;
+        fields[count++] = strings + position;
+    }
+    if (count < 2)
+        return false;
+    channel_name = fields[0];
+    dir = fields[1][0] == 0 ? nullptr : fields[1];
+    auto index{2};
+    auto env_count{0};
+    for (; index < count && fields[index][0] != 0; ++index) {
+        if (env_count == HOST_MAX_ENV_VARS || strchr(fields[index], '=') == nullptr)
+            return false;
+        env[env_count++] = fields[index];
+    }
+    env[env_count] = nullptr;
+    // Skipping the empty string that ends the environment variables.
+    ++index;
+    if (index >= count || fields[index][0] == 0 || count - index > HOST_MAX_SHELL_ARGS)
+        // The shell is missing (or there are too many arguments).
+        return false;
+    for (auto i = index; i < count; ++i)
+        argv[i - index] = fields[i];
+    argv[count - index] = nullptr;
+    return true;
+}
+
+// Launches a warm shell for a session whose shell isn't in the pool (it's claimed right away).
+static bool launch_session_shell(host_session& session, winsize& win_size, char** argv) {
+    if (!sync_channel_create(session.sync)) {
+        log(LOG_ERROR, "[launch_session_shell] Failed to create synchronization pipes.");
+        return false;
+    }
+    session.slave_pid = launch_shell_pooled(session.pty_fd, win_size, session.sync, argv);
+    if (session.slave_pid < 0) {
+        sync_channel_close(session.sync);
+        return false;
+    }
+    sync_channel_use_as_master(session.sync);
+    return true;
+}
+
+static bool create_session(uint32_t request_id, const char* arguments, int length, const host_platform& platform) {
+    unsigned short size[2];
+    // A copy, since the strings are passed on as `char*`.
+    char strings[CHANNEL_CLIENT_MAX_PAYLOAD];
+    const auto strings_length = length - (int) sizeof(size);
+    char* channel_name{nullptr};
+    char* dir{nullptr};
+    char* env[HOST_MAX_ENV_VARS + 1];
+    char* argv[HOST_MAX_SHELL_ARGS + 1];
+    if (strings_length <= 0)
+        return respond_failure(request_id, "[create_session] Arguments are missing.");
+    memcpy(size, arguments, sizeof(size));
+    memcpy(strings, arguments + sizeof(size), strings_length);
+    if (!parse_create_strings(strings, strings_length, channel_name, dir, env, argv))
+        return respond_failure(request_id, "[create_session] Malformed arguments.");
+    auto session = (host_session*) calloc(1, sizeof(host_session));
+    if (session == nullptr)
+        return respond_failure(request_id, "[create_session] Failed to allocate the session.");
+    if (!platform.connect_channel(channel_name, session->read_fd, session->write_fd)) {
+        free(session);
+        return respond_failure(request_id, "[create_session] Failed to connect to the session's channel.");
+    }
+    // Forking a process with threads (the output pumps, the log writer) isn't safe, so the shell is always spawned.
+    // Either way it's a warm shell, which gets the working directory and the environment variables with the claim.
+    winsize win_size{.ws_row = size[1], .ws_col = size[0], .ws_xpixel = 0, .ws_ypixel = 0};
+    session->launch_start_us = monotonic_microseconds();
+    session->start_counter = -1;
+    pool_shell warm{};
+    if (shell_pool_matches(argv)) {
+        if (shell_pool_take(warm)) {
+            session->pty_fd = warm.pty_fd;
+            session->slave_pid = warm.slave_pid;
+            session->sync = warm.sync;
+            session->start_counter = STATS_POOL_HIT_MICROSECONDS;
+            stats_add(STATS_POOL_HITS, 1);
+        } else {
+            session->start_counter = STATS_POOL_MISS_MICROSECONDS;
+            stats_add(STATS_POOL_MISSES, 1);
+        }
+    }
+    if (session->start_counter != STATS_POOL_HIT_MICROSECONDS && !launch_session_shell(*session, win_size, argv)) {
+        close(session->read_fd);
+        close(session->write_fd);
+        free(session);
+        return respond_failure(request_id, "[create_session] Failed to launch the shell.");
+    }
+    session->id = _next_session_id++;
+    session->state = HOST_SESSION_STARTING;
+    session->sync_source = session->stop_source = EVENT_LOOP_NO_SOURCE;
+    session->exit_code = HOST_UNKNOWN_EXIT_CODE;
+    session->next = _sessions;
+    _sessions = session;
+    ++_session_count;
+    stats_add(STATS_HOST_SESSIONS_STARTED, 1);
+    logf(LOG_INFO, "[create_session] Session %u created (PID=%i%s, %i sessions).", session->id, session->slave_pid,
+         session->start_counter == STATS_POOL_HIT_MICROSECONDS ? ", warm" : "", _session_count);
+    if (platform.register_terminal != nullptr)
+        platform.register_terminal(session->pty_fd, session->slave_pid);
+    // The winsize is set before the slave continues, so that the shell starts with it.
+    if (ioctl(session->pty_fd, TIOCSWINSZ, &win_size) != 0) // NOLINT(hicpp-signed-bitwise)
+        log_lin_error(LOG_WARN, "[create_session] 'ioctl(TIOCSWINSZ)' call failed.");
+    // Claiming the slave. The rest of the handshake is done by the loop.
+    if (sync_channel_claim(session->sync.to_slave[1], dir, env))
+        session->sync_deadline_us = monotonic_microseconds() + SYNC_TIMEOUT_MS * 1000LL;
+    else
+        end_session_io(*session);
+    return respond(request_id, true, &session->id, (int) sizeof(session->id));
+}
+
+static bool close_session(uint32_t request_id, const char* arguments, int length) {
+    uint32_t id{0};
+    if (length != (int) sizeof(id))
+        return respond_failure(request_id, "[close_session] Session id is missing.");
+    memcpy(&id, arguments, sizeof(id));
+    const auto session = find_session(id);
+    if (session == nullptr)
+        return respond_failure(request_id, "[close_session] Unknown session.");
+    logf(LOG_INFO, "[close_session] Closing session %u.", id);
+    if (!session->reaped)
+        kill(-session->slave_pid, SIGHUP);
+    return respond(request_id, true, nullptr, 0);
+}
+
+static bool process_control_frames(const host_platform& platform) {
+    auto position{0};
+    char type{0};
+    const char* payload{nullptr};
+    int length{0};
+    int result;
+    _control_blocked = false;
+    while ((result = channel_next(_control, position, type, payload, length)) > 0) {
+        if (type != CHANNEL_FRAME_COMMAND || length < HOST_REQUEST_HEADER_SIZE) {
+            logf(LOG_ERROR, "[process_control_frames] Unexpected frame (type %i, %i bytes).", type, length);
+            return false;
+        }
+        if (!channel_has_room(_control, HOST_RESPONSE_MAX_SIZE)) {
+            // The rest of the requests wait until the queued frames are written.
+            _control_blocked = true;
+            break;
+        }
+        uint32_t request_id{0};
+        memcpy(&request_id, payload, sizeof(request_id));
+        const auto opcode = payload[HOST_REQUEST_HEADER_SIZE - 1];
+        const auto arguments = payload + HOST_REQUEST_HEADER_SIZE;
+        const auto arguments_length = length - HOST_REQUEST_HEADER_SIZE;
+        auto ok{true};
+        switch (opcode) {
+            case HOST_CREATE_SESSION_COMMAND:
+                ok = create_session(request_id, arguments, arguments_length, platform);
+                break;
+            case HOST_CLOSE_SESSION_COMMAND:
+                ok = close_session(request_id, arguments, arguments_length);
+                break;
+            case HOST_GET_STATS_COMMAND: {
+                char stats[STATS_SERIALIZED_SIZE];
+                ok = respond(request_id, true, stats, serialize_stats(stats));
+                break;
+            }
+            default:
+                ok = respond_failure(request_id, "[process_control_frames] Unknown command received.");
+                break;
+        }
+        if (!ok)
+            return false;
+        channel_consume(_control, payload);
+    }
+    channel_compact(_control);
+    return result >= 0;
+}
+
+static void process_handshake(host_session& session, const event_loop& loop) {
+    if (!event_loop_is_ready(loop, session.sync_source)) {
+        if (monotonic_microseconds() < session.sync_deadline_us)
+            return;
+        logf(LOG_ERROR, "[process_handshake] Session %u slave process isn't ready after %i ms.", session.id,
+             SYNC_TIMEOUT_MS);
+        kill(session.slave_pid, SIGKILL);
+        end_session_io(session);
+        return;
+    }
+    // It's ready, so this doesn't block.
+    long long waited_us{0};
+    const auto ready = sync_channel_wait(session.sync.to_master[0], SYNC_TIMEOUT_MS, waited_us);
+    sync_channel_close(session.sync);
+    if (!ready) {
+        logf(LOG_ERROR, "[process_handshake] Session %u slave process failed to start.", session.id);
+        end_session_io(session);
+        return;
+    }
+    const auto start_us = monotonic_microseconds() - session.launch_start_us;
+    logf(LOG_INFO, "[process_handshake] Session %u slave process ready %lli us after launch.", session.id, start_us);
+    if (session.start_counter >= 0)
+        stats_add(session.start_counter, start_us);
+    // The output pump's writes can't block its stop (see output_pump_request_stop).
+    if (!set_non_blocking(session.write_fd)
+        || !io_session_start(session.io, session.pty_fd, session.slave_pid, -1, -1, session.write_fd, -1, -1,
+                             session.read_fd)) {
+        logf(LOG_ERROR, "[process_handshake] Failed to start session %u I/O.", session.id);
+        end_session_io(session);
+        return;
+    }
+    session.state = HOST_SESSION_RUNNING;
+}
+
+static void reap_sessions() {
+    for (auto session = _sessions; session != nullptr; session = session->next) {
+        int status{0};
+        if (session->reaped || !child_watcher_reap(session->slave_pid, status))
+            continue;
+        session->reaped = true;
+        session->exit_code = exit_code(status);
+        if (session->state == HOST_SESSION_RUNNING)
+            io_session_slave_exited(session->io, status);
+        else if (session->state == HOST_SESSION_STARTING)
+            end_session_io(*session);
+    }
+}
+
+// Drops the sessions that are over, and reports them to the client (a session is dropped only once there's room for
+// its EXIT frame).
+static void drop_finished_sessions() {
+    char frame[sizeof(uint32_t) + sizeof(int32_t)];
+    auto link = &_sessions;
+    while (*link != nullptr) {
+        const auto session = *link;
+        if (session->state != HOST_SESSION_EXITING || !session->reaped || session->io_stopping) {
+            link = &session->next;
+            continue;
+        }
+        if (!channel_has_room(_control, (int) sizeof(frame))) {
+            _control_blocked = true;
+            return;
+        }
+        *link = session->next;
+        --_session_count;
+        stats_add(STATS_HOST_SESSIONS_FINISHED, 1);
+        logf(LOG_INFO, "[drop_finished_sessions] Session %u is over (exit code %i, %i sessions left).", session->id,
+             session->exit_code, _session_count);
+        const auto code = (int32_t) session->exit_code;
+        memcpy(frame, &session->id, sizeof(uint32_t));
+        memcpy(frame + sizeof(uint32_t), &code, sizeof(code));
+        free(session);
+        channel_queue(_control, CHANNEL_FRAME_EXIT, frame, (int) sizeof(frame));
+    }
+}
+
+static int min_timeout(int timeout_ms, int other_ms) {
+    return other_ms >= 0 && (timeout_ms < 0 || other_ms < timeout_ms) ? other_ms : timeout_ms;
+}
+
+void host_run(int ctl_in_fd, int ctl_out_fd, const host_platform& platform) {
+    log(LOG_INFO, "[host_run] Host started.");
+    if (!channel_open(_control, ctl_in_fd, ctl_out_fd)) {
+        log(LOG_ERROR, "[host_run] Failed to open the control channel. Exiting.");
+        return;
+    }
+    // The frames are written without blocking (see channel_send_queued).
+    if (!set_non_blocking(ctl_out_fd)) {
+        log(LOG_ERROR, "[host_run] Failed to make the control channel non-blocking. Exiting.");
+        channel_close(_control);
+        return;
+    }
+    const auto child_fd = child_watcher_start();
+    if (child_fd < 0) {
+        log(LOG_ERROR, "[host_run] Failed to start child watcher. Exiting.");
+        channel_close(_control);
+        return;
+    }
+    event_loop loop{};
+    while (true) {
+        // Waiting for the control channel, the child watcher, and the sources of all the sessions
+        stats_add(STATS_LOOP_ITERATIONS, 1);
+        event_loop_clear(loop);
+        const auto control_source = event_loop_add(loop, channel_can_receive(_control) ? ctl_in_fd : -1);
+        const auto control_out_source = event_loop_add(loop, channel_has_unsent(_control) ? ctl_out_fd : -1, POLLOUT);
+        const auto child_source = event_loop_add(loop, child_fd);
+        if (control_source == EVENT_LOOP_FAILED || control_out_source == EVENT_LOOP_FAILED
+            || child_source == EVENT_LOOP_FAILED) {
+            log(LOG_ERROR, "[host_run] Failed to add the control channel sources. Exiting.");
+            break;
+        }
+        // A session whose sources can't be added is ended (it would never be served), but the others go on.
+        auto sources_added{true};
+        // Frames that were waiting for room are processed right away once everything queued is written.
+        auto timeout_ms = _control_blocked && !channel_has_unsent(_control) ? 0 : -1;
+        for (auto session = _sessions; session != nullptr; session = session->next) {
+            if (session->state == HOST_SESSION_STARTING) {
+                session->sync_source = event_loop_add(loop, session->sync.to_master[0]);
+                const auto remaining_us = session->sync_deadline_us - monotonic_microseconds();
+                timeout_ms = min_timeout(timeout_ms, remaining_us > 0 ? (int) ((remaining_us + 999) / 1000) : 0);
+                sources_added = session->sync_source != EVENT_LOOP_FAILED;
+            } else if (session->state == HOST_SESSION_RUNNING) {
+                sources_added = io_session_add_sources(session->io, loop);
+                timeout_ms = min_timeout(timeout_ms, io_session_timeout_ms(session->io));
+            } else if (session->io_stopping) {
+                session->stop_source = event_loop_add(loop, io_session_stop_fd(session->io));
+                // The pump finishes by itself (see OUTPUT_PUMP_STOP_TIMEOUT_MS), so it's checked on every pass then.
+                if (session->stop_source == EVENT_LOOP_FAILED)
+                    timeout_ms = min_timeout(timeout_ms, HOST_STOP_POLL_MS);
+            }
+            if (!sources_added) {
+                logf(LOG_ERROR, "[host_run] Failed to add session %u sources. Ending it.", session->id);
+                if (session->state == HOST_SESSION_STARTING)
+                    kill(session->slave_pid, SIGKILL);
+                end_session_io(*session);
+                sources_added = true;
+                // Its stop is waited for from the next pass on.
+                timeout_ms = 0;
+            }
+        }
+        int ready_count{0};
+        if (!event_loop_wait(loop, timeout_ms, ready_count)) {
+            log(LOG_ERROR, "[host_run] Failed to wait for I/O events. Exiting.");
+            break;
+        }
+        if (ready_count == 0 && timeout_ms != 0)
+            stats_add(STATS_IDLE_WAKEUPS, 1);
+        if (event_loop_is_ready(loop, control_out_source) && !channel_send_queued(_control)) {
+            log(LOG_ERROR, "[host_run] Failed to write to the control channel. Exiting.");
+            break;
+        }
+        if (event_loop_is_ready(loop, child_source)) {
+            child_watcher_clear(child_fd);
+            reap_sessions();
+            shell_pool_reap();
+        }
+        // Sessions created now are handled in the next pass (their sources aren't registered in this one).
+        const auto existing = _sessions;
+        if (event_loop_is_ready(loop, control_source) && !channel_receive(_control)) {
+            log(LOG_INFO, "[host_run] Control channel is closed. Exiting.");
+            break;
+        }
+        if (!process_control_frames(platform)) {
+            log(LOG_ERROR, "[host_run] Failed to process control frames. Exiting.");
+            break;
+        }
+        for (auto session = existing; session != nullptr; session = session->next) {
+            if (session->state == HOST_SESSION_STARTING)
+                process_handshake(*session, loop);
+            else if (session->state == HOST_SESSION_RUNNING && !io_session_process(session->io, loop))
+                end_session_io(*session);
+            else if (session->io_stopping
+                     && (event_loop_is_ready(loop, session->stop_source) || session->stop_source == EVENT_LOOP_FAILED)
+                     && io_session_stopped(session->io))
+                finish_session_io(*session);
+        }
+        drop_finished_sessions();
+        if (!channel_send_queued(_control)) {
+            log(LOG_ERROR, "[host_run] Failed to write to the control channel. Exiting.");
+            break;
+        }
+    }
+    // Hanging up all the sessions that are left. Their output pumps stop together, and they're joined then.
+    for (auto session = _sessions; session != nullptr; session = session->next)
+        if (session->state != HOST_SESSION_EXITING)
+            end_session_io(*session);
+    while (_sessions != nullptr) {
+        const auto session = _sessions;
+        _sessions = session->next;
+        if (session->io_stopping)
+            finish_session_io(*session);
+        free(session);
+    }
+    _session_count = 0;
+    child_watcher_stop();
+    channel_close(_control);
+    event_loop_destroy(loop);
+    log(LOG_INFO, "[host_run] Host finished.");
+}
@@ -0,0 +1,45 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_SESSION_HOST_H
+#define PTYNATIVE_SESSION_HOST_H
+
+#include "includes.h"
+
+// Host mode (`--host`): a single process runs many sessions (each with its own PTY, slave process and multiplexed
+// channel) on one event loop. The sessions are created and closed over the control channel, which uses the channel
+// framing (see channel.h):
+// - COMMAND frames (client -> host): [request id: uint32][opcode: uint8][arguments], answered by COMMAND frames
+//   [request id: uint32][status: uint8 (0 - success, 1 - failure)][result / error message].
+// - EXIT frames (host -> client): [session id: uint32][exit code: int32], sent when a session is over. The exit code
+//   is 128 + signal number if the shell was killed by a signal, and -1 if it's unknown (i.e. the shell never started).
+// The host exits (and hangs up all the sessions) when the control channel is closed.
+
+// Arguments: [rows: uint16][cols: uint16], followed by NUL-terminated strings: the name of the pipe carrying the
+// session's channel (it's connected to by the host), the working directory (empty for none), the environment
+// variables to set (`NAME=VALUE`) ended by an empty string, the shell, and the shell arguments. Result: [session id:
+// uint32]. If the shell (with its arguments) is the one of the warm shell pool (`--pool`), a warm shell is used.
+#define HOST_CREATE_SESSION_COMMAND 1
+// Arguments: [session id: uint32]. The session's process group is hung up, and its EXIT frame follows.
+#define HOST_CLOSE_SESSION_COMMAND 2
+// No arguments. Result: the same as the result of the get-stats command (the counters of the whole host).
+#define HOST_GET_STATS_COMMAND 3
+
+// Everything that's platform specific (provided by main.cpp).
+struct host_platform {
+    // Connects to the pipe the client has created for a session's channel. Returns false on failure.
+    bool (*connect_channel)(const char* name, int& read_fd, int& write_fd);
+    // Registers the terminal session (utmp) of a new slave process. May be null.
+    void (*register_terminal)(int pty_fd, int slave_pid);
+};
+
+// Runs the host until the control channel is closed (read from ctl_in_fd, and written to ctl_out_fd).
+void host_run(int ctl_in_fd, int ctl_out_fd, const host_platform& platform);
+
+#endif //PTYNATIVE_SESSION_HOST_H
@@ -0,0 +1,179 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "session_socket.h"
+
+#include "file_helpers.h"
+#include "logging.h"
+
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SESSION_SOCKET_BACKLOG 4
+#define RELAY_BUFFER_SIZE (64 * 1024)
+#define LOCK_FILE_SUFFIX ".lock"
+
+// The lock file (next to the socket) that's held while the session is listening. A connection can't be used to find
+// out whether the session is live, since the session takes it for a client that's attaching.
+static int _lock_fd{-1};
+static char _lock_path[sizeof(sockaddr_un::sun_path) + sizeof(LOCK_FILE_SUFFIX)]{};
+
+static bool make_address(const char* path, sockaddr_un& address) {
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        logf(LOG_ERROR, "[make_address] Socket path is too long: %s", path);
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    return true;
+}
+
+static bool set_cloexec(int fd) {
+    const auto flags = fcntl(fd, F_GETFD);
+    return flags >= 0 && fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == 0; // NOLINT(hicpp-signed-bitwise)
+}
+
+static bool lock_session(const char* path) {
+    snprintf(_lock_path, sizeof(_lock_path), "%s" LOCK_FILE_SUFFIX, path);
+    _lock_fd = open(_lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600); // NOLINT(hicpp-signed-bitwise)
+    if (_lock_fd < 0) {
+        log_lin_error(LOG_ERROR, "[lock_session] 'open' call failed.");
+        return false;
+    }
+    if (flock(_lock_fd, LOCK_EX | LOCK_NB) == 0) // NOLINT(hicpp-signed-bitwise)
+        return true;
+    if (errno == EWOULDBLOCK)
+        logf(LOG_ERROR, "[lock_session] Another session is listening on %s.", path);
+    else
+        log_lin_error(LOG_ERROR, "[lock_session] 'flock' call failed.");
+    close(_lock_fd);
+    _lock_fd = -1;
+    return false;
+}
+
+static void unlock_session() {
+    unlink(_lock_path);
+    close(_lock_fd);
+    _lock_fd = -1;
+}
+
+static int connect_socket(const char* path) {
+    sockaddr_un address{};
+    if (!make_address(path, address))
+        return -1;
+    const auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        log_lin_error(LOG_ERROR, "[connect_socket] 'socket' call failed.");
+        return -1;
+    }
+    set_cloexec(fd);
+    if (connect(fd, (sockaddr*) &address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int session_socket_listen(const char* path) {
+    sockaddr_un address{};
+    // A socket that's left behind by a session that's gone can be replaced, but not the one of a live session.
+    if (!make_address(path, address) || !lock_session(path))
+        return -1;
+    unlink(path);
+    const auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        log_lin_error(LOG_ERROR, "[session_socket_listen] 'socket' call failed.");
+        unlock_session();
+        return -1;
+    }
+    set_cloexec(fd);
+    // Whoever connects gets the shell, so the socket is created accessible by the owner only.
+    const auto old_mask = umask(0077);
+    const auto bound = bind(fd, (sockaddr*) &address, sizeof(address)) == 0;
+    umask(old_mask);
+    if (!bound || listen(fd, SESSION_SOCKET_BACKLOG) != 0) {
+        log_lin_error(LOG_ERROR, "[session_socket_listen] 'bind' / 'listen' call failed.");
+        close(fd);
+        unlock_session();
+        return -1;
+    }
+    logf(LOG_INFO, "[session_socket_listen] Listening on %s.", path);
+    return fd;
+}
+
+bool session_socket_accept(int listen_fd, int& read_fd, int& write_fd) {
+    read_fd = accept(listen_fd, nullptr, nullptr);
+    if (read_fd < 0) {
+        log_lin_error(LOG_ERROR, "[session_socket_accept] 'accept' call failed.");
+        return false;
+    }
+    set_cloexec(read_fd);
+    write_fd = fcntl(read_fd, F_DUPFD_CLOEXEC, 0);
+    if (write_fd < 0) {
+        log_lin_error(LOG_ERROR, "[session_socket_accept] 'fcntl(F_DUPFD_CLOEXEC)' call failed.");
+        close(read_fd);
+        return false;
+    }
+    log(LOG_INFO, "[session_socket_accept] Client connected.");
+    return true;
+}
+
+void session_socket_remove(int listen_fd, const char* path) {
+    close(listen_fd);
+    if (unlink(path) != 0)
+        log_lin_error(LOG_WARN, "[session_socket_remove] 'unlink' call failed.");
+    unlock_session();
+}
+
+// Copies what's available from one side to the other. Returns false if the reading side is closed, or the writing
+// one fails.
+static bool relay_once(int from_fd, int to_fd, char* buffer) {
+    int length{0};
+    if (!read_bytes(from_fd, buffer, RELAY_BUFFER_SIZE, &length))
+        return false;
+    return write_bytes(to_fd, buffer, length);
+}
+
+bool session_socket_relay(const char* path, int chan_in_fd, int chan_out_fd) {
+    const auto socket_fd = connect_socket(path);
+    if (socket_fd < 0) {
+        logf(LOG_ERROR, "[session_socket_relay] Failed to connect to %s.", path);
+        return false;
+    }
+    logf(LOG_INFO, "[session_socket_relay] Attached to %s.", path);
+    auto buffer = (char*) malloc(RELAY_BUFFER_SIZE);
+    if (buffer == nullptr) {
+        log(LOG_ERROR, "[session_socket_relay] Failed to allocate the buffer.");
+        close(socket_fd);
+        return false;
+    }
+    while (true) {
+        pollfd sources[]{{.fd = chan_in_fd, .events = POLLIN, .revents = 0},
+                         {.fd = socket_fd, .events = POLLIN, .revents = 0}};
+        if (poll(sources, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            log_lin_error(LOG_ERROR, "[session_socket_relay] 'poll' call failed.");
+            break;
+        }
+        if (sources[0].revents != 0 && !relay_once(chan_in_fd, socket_fd, buffer)) {
+            log(LOG_INFO, "[session_socket_relay] Client is gone. Detaching.");
+            break;
+        }
+        if (sources[1].revents != 0 && !relay_once(socket_fd, chan_out_fd, buffer)) {
+            log(LOG_INFO, "[session_socket_relay] Session is over (or another client has attached).");
+            break;
+        }
+    }
+    free(buffer);
+    close(socket_fd);
+    return true;
+}
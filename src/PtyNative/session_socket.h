@@ -0,0 +1,32 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_SESSION_SOCKET_H
+#define PTYNATIVE_SESSION_SOCKET_H
+
+#include "includes.h"
+
+// Detachable session (`--persist`): the session listens on a Unix-domain socket, and a client that connects to it
+// gets the session's channel (the same frames as on `--chan`). The client that was attached before (if any) is
+// detached. The socket is accessible by the owner only. A process listens on a single socket at most.
+
+// Returns the listening socket, or -1 on failure (i.e. another session is listening on the path). While listening, a
+// lock file is held next to the socket (`<path>.lock`).
+int session_socket_listen(const char* path);
+// Accepts a client: its socket is returned as two descriptors, the same way as the channel pipe. Returns false on
+// failure.
+bool session_socket_accept(int listen_fd, int& read_fd, int& write_fd);
+// Closes the listening socket, and removes it (and the lock file) from the file system.
+void session_socket_remove(int listen_fd, const char* path);
+
+// Attach mode (`--attach`): relays everything between the channel pipe and the session's socket, until either of them
+// is closed. Returns false if the session can't be connected to.
+bool session_socket_relay(const char* path, int chan_in_fd, int chan_out_fd);
+
+#endif //PTYNATIVE_SESSION_SOCKET_H
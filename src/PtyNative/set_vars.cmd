@@ -10,6 +10,7 @@
 
 @set LOGGING=
 @if "%debug_log%"   == "YES" ( set "LOGGING=%LOGGING% -D_USE_DEBUG_LOG" )
+@if defined log_min_level ( set "LOGGING=%LOGGING% -DLOG_COMPILED_MIN_LEVEL=%log_min_level%" )
 
 @set "USE_GCC_STATIC=-static-libgcc -static-libstdc++"
 
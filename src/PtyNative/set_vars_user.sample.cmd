@@ -10,6 +10,7 @@
 @set LANG=en_EN.UTF-8
 @set verbose=NO
 @set debug_log=NO
+@set log_min_level=0
 
 @set "dumpbin=C:\Program Files (x86)\Microsoft Visual Studio 12.0\VC\bin\amd64\dumpbin.exe"
 @set "grep=%cygwin64toolchain%\bin\grep.exe"
@@ -0,0 +1,312 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+
+ Parts of this file are inspired by / taken from:
+ - https://github.com/Maximus5/cygwin-connector Copyright (c) 2015-present Maximus5
+ - https://github.com/mintty/mintty Copyright (c) 2008-13 Andy Koppe, 2015-18 Thomas Wolff
+*/
+
+#include "shell_launcher.h"
+
+#include "logging.h"
+
+#include <pthread.h>
+#include <spawn.h>
+
+//#define USE_MINTTY_CONF
+
+#ifdef USE_MINTTY_CONF
+#include <langinfo.h>
+#endif
+
+#define MAX_EXE_PATH_LENGTH 1024
+#define MAX_NUMBER_ARG_LENGTH 16
+// Helper arguments preceding the shell: SLAVE_HELPER_ARG, parent PID, sync in, sync out, log level, dir, pooled
+#define SLAVE_HELPER_ARGC 7
+
+// Shells are launched by the pool's refill thread too, and the descriptors that a launch makes inheritable (PTY slave
+// and the sync channel ends) must not leak into a helper that's spawned at the same time.
+static pthread_mutex_t _spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef USE_MINTTY_CONF
+static void slave_term_config(termios& attr) {
+    log(LOG_DEBUG, "[slave_term_config1] Using Mintty terminal configuration.");
+    attr.c_cc[VERASE] = CDEL;
+    attr.c_iflag |= IXANY | IMAXBEL; // NOLINT(hicpp-signed-bitwise)
+#ifdef IUTF8
+    bool utf8 = strcmp(nl_langinfo(CODESET), "UTF-8") == 0;
+    if (utf8)
+        attr.c_iflag |= IUTF8; // NOLINT(hicpp-signed-bitwise)
+    else
+        attr.c_iflag &= ~IUTF8; // NOLINT(hicpp-signed-bitwise)
+#endif
+    attr.c_lflag |= ECHOE | ECHOK | ECHOCTL | ECHOKE; // NOLINT(hicpp-signed-bitwise)
+}
+#else
+static void slave_term_config(termios& attr) {
+    log(LOG_DEBUG, "[slave_term_config1] Using ConEmu terminal configuration.");
+    attr.c_cc[VERASE] = CDEL;
+    attr.c_iflag |= IXANY | IMAXBEL; // NOLINT(hicpp-signed-bitwise)
+    attr.c_lflag |= ECHOE | ECHOK | ECHOCTL | ECHOKE; // NOLINT(hicpp-signed-bitwise)
+}
+#endif
+
+// Slave process part: it runs either in the child created by `forkpty`, or in the slave helper process.
+// Applies the claim of a warm slave: the working directory, and the environment variables.
+static void apply_claim(char* claim, int length, char*& dir) {
+    dir = claim[0] == 0 ? nullptr : claim;
+    for (auto position = (int) strlen(claim) + 1; position < length; position += (int) strlen(claim + position) + 1) {
+        // The claim buffer is never released (the process is about to exec), so it can be used by the environment.
+        if (putenv(claim + position) != 0)
+            logf(LOG_ERROR, "[apply_claim] 'putenv(\"%s\")' call failed. Error: %i (%s)", claim + position, errno,
+                 strerror(errno));
+    }
+}
+
+[[noreturn]] static void do_slave(int parent_pid, sync_channel& sync, char** argv, char* dir, bool pooled) {
+    // Slave process. Let's first destroy things we shouldn't use anyway
+    reset_log_file(parent_pid);
+    logf(LOG_INFO, "[do_slave] Hello from the slave process (PID=%i)!", getpid());
+    log_env();
+    log_terminal_info();
+    const auto reported_parent_pid = getppid();
+    if (reported_parent_pid != parent_pid)
+        logf(LOG_WARN, "[do_slave] getppid() returns %i although parent PID is %i.", reported_parent_pid, parent_pid);
+    // Wait for the parent process to finish its part of the setup
+    sync_channel_use_as_slave(sync);
+    char claim[SYNC_CLAIM_MAX_SIZE];
+    if (pooled) {
+        // Warm slave: idle until it's claimed for a session (which can take any time).
+        log(LOG_DEBUG, "[do_slave] Waiting to be claimed.");
+        auto claim_length{0};
+        if (!sync_channel_wait_claim(sync.to_slave[0], claim, claim_length)) {
+            log(LOG_ERROR, "[do_slave] Failed to receive the claim. Exiting.");
+            exit(EXIT_CODE_UNEXPECTED_HAPPENED);
+        }
+        apply_claim(claim, claim_length, dir);
+        log(LOG_DEBUG, "[do_slave] Claimed.");
+    } else {
+        long long waited_us{0};
+        if (!sync_channel_wait(sync.to_slave[0], SYNC_TIMEOUT_MS, waited_us)) {
+            logf(LOG_ERROR, "[do_slave] Parent process isn't ready after %lli us. Exiting.", waited_us);
+            exit(EXIT_CODE_UNEXPECTED_HAPPENED);
+        }
+        logf(LOG_DEBUG, "[do_slave] Parent process ready after %lli us.", waited_us);
+    }
+    // Reset signals
+    if (signal(SIGHUP, SIG_DFL) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[do_slave] Failed to reset signal handler for SIGHUP signal to SIG_DFL.");
+    if (signal(SIGINT, SIG_DFL) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[do_slave] Failed to reset signal handler for SIGINT signal to SIG_DFL.");
+    if (signal(SIGQUIT, SIG_DFL) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[do_slave] Failed to reset signal handler for SIGQUIT signal to SIG_DFL.");
+    if (signal(SIGTERM, SIG_DFL) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[do_slave] Failed to reset signal handler for SIGTERM signal to SIG_DFL.");
+    if (signal(SIGCHLD, SIG_DFL) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[do_slave] Failed to reset signal handler for SIGCHLD signal to SIG_DFL.");
+    // Mimic login's behavior by disabling the job control signals
+    if (signal(SIGTSTP, SIG_IGN) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[do_slave] Failed to set signal handler for SIGTSTP signal to SIG_IGN.");
+    if (signal(SIGTTIN, SIG_IGN) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[do_slave] Failed to set signal handler for SIGTTIN signal to SIG_IGN.");
+    if (signal(SIGTTOU, SIG_IGN) == SIG_ERR)
+        log_lin_error(LOG_ERROR, "[do_slave] Failed to set signal handler for SIGTTOU signal to SIG_IGN.");
+    log(LOG_TRACE, "[do_slave] Signal handlers reset successfully.");
+    // Terminal line settings
+    termios attr{};
+    if (tcgetattr(0, &attr) < 0) {
+        log_lin_error(LOG_ERROR, "[do_slave] 'tcgetattr' call failed.");
+        exit(EXIT_CODE_API_CALL_FAILED);
+    }
+    log(LOG_DEBUG, "[do_slave] 'tcgetattr' succeeded.");
+    slave_term_config(attr);
+    if (tcsetattr(0, TCSANOW, &attr) < 0) {
+        log_lin_error(LOG_ERROR, "[do_slave] 'tcsetattr' call failed.");
+        exit(EXIT_CODE_API_CALL_FAILED);
+    }
+    log(LOG_DEBUG, "[do_slave] 'tcsetattr' succeeded.");
+    // Change working directory (if required)
+    if (dir != nullptr) {
+        if (chdir(dir) < 0)
+            logf(LOG_ERROR, "[do_slave] 'chdir(\"%s\")' call failed. Error: %i (%s)", dir, errno, strerror(errno));
+        else {
+            logf(LOG_DEBUG, "[do_slave] 'chdir(\"%s\")' succeeded.", dir);
+            if (setenv("CHERE_INVOKING", "1", true) == 0)
+                log(LOG_DEBUG, R"([do_slave] 'setenv("CHERE_INVOKING", "1", true)' call succeeded.)");
+            else
+                log_lin_error(LOG_ERROR, R"([do_slave] 'setenv("CHERE_INVOKING", "1", true)' call failed.)");
+        }
+    }
+    if (_min_log_level <= LOG_DEBUG) {
+        char cwd[1000];
+        if (getcwd(cwd, 1000) == nullptr)
+            log_lin_error(LOG_ERROR, "[do_slave] 'getcwd' call failed.");
+        else
+            logf(LOG_DEBUG, "[do_slave] Current working directory: %s", cwd);
+        if (FILE *shell_file = fopen(argv[0], "r")) {
+            fclose(shell_file);
+            logf(LOG_DEBUG, "[do_slave] Shell found: %s", argv[0]);
+        } else
+            logf(LOG_ERROR, "[do_slave] Shell not found: %s", argv[0]);
+        if (argv[1] == nullptr)
+            logf(LOG_DEBUG, "[do_slave] No shell args.");
+        else
+            logf(LOG_DEBUG, "[do_slave] First shell argument: %s", argv[1]);
+    }
+    if (!sync_channel_notify(sync.to_master[1])) {
+        log(LOG_ERROR, "[do_slave] Failed to notify parent that we're ready. Exiting.");
+        exit(EXIT_CODE_API_CALL_FAILED);
+    }
+    log(LOG_DEBUG, "[do_slave] Parent process notified that we're ready.");
+    logf(LOG_DEBUG,"[do_slave] About to call 'execvp'. Shell: %s", argv[0]);
+    execvp(argv[0], argv);
+    // If we're here 'execvp' has failed.
+    log_lin_error(LOG_ERROR, "[do_slave] 'execvp' call failed.");
+    exit(EXIT_CODE_SHELL_LAUNCH_FAILED);
+}
+
+
+int launch_shell_forkpty(int& pty_fd, winsize& win_size, sync_channel& sync, char** argv, char* dir) {
+    const auto parent_pid = getpid();
+    const int slave_pid = forkpty(&pty_fd, nullptr, nullptr, &win_size);
+    if (slave_pid < 0) {
+        log_lin_error(LOG_ERROR, "[launch_shell_forkpty] 'forkpty' call failed.");
+        return -1;
+    }
+    if (slave_pid == 0)
+        do_slave(parent_pid, sync, argv, dir, false);
+    return slave_pid;
+}
+
+static bool set_cloexec(int fd, bool value) {
+    const auto flags = fcntl(fd, F_GETFD);
+    if (flags < 0)
+        return false;
+    return fcntl(fd, F_SETFD, value ? flags | FD_CLOEXEC : flags & ~FD_CLOEXEC) == 0; // NOLINT(hicpp-signed-bitwise)
+}
+
+static int spawn_slave_helper(int& pty_fd, winsize& win_size, sync_channel& sync, char** argv, char* dir,
+                              bool pooled) {
+    char helper_path[MAX_EXE_PATH_LENGTH]{0};
+    if (readlink("/proc/self/exe", helper_path, MAX_EXE_PATH_LENGTH - 1) <= 0) {
+        log_lin_error(LOG_ERROR, "[spawn_slave_helper] 'readlink(\"/proc/self/exe\")' call failed.");
+        return -1;
+    }
+    int slave_fd{-1};
+    if (openpty(&pty_fd, &slave_fd, nullptr, nullptr, &win_size) != 0) {
+        log_lin_error(LOG_ERROR, "[spawn_slave_helper] 'openpty' call failed.");
+        return -1;
+    }
+    set_cloexec(pty_fd, true);
+    // Helper arguments
+    char parent_pid_arg[MAX_NUMBER_ARG_LENGTH];
+    snprintf(parent_pid_arg, MAX_NUMBER_ARG_LENGTH, "%i", getpid());
+    char sync_in_arg[MAX_NUMBER_ARG_LENGTH];
+    snprintf(sync_in_arg, MAX_NUMBER_ARG_LENGTH, "%i", sync.to_slave[0]);
+    char sync_out_arg[MAX_NUMBER_ARG_LENGTH];
+    snprintf(sync_out_arg, MAX_NUMBER_ARG_LENGTH, "%i", sync.to_master[1]);
+    char log_level_arg[MAX_NUMBER_ARG_LENGTH];
+    snprintf(log_level_arg, MAX_NUMBER_ARG_LENGTH, "%i", _min_log_level);
+    char empty_arg[]{""};
+    char pooled_arg[]{"1"};
+    auto shell_argc{0};
+    while (argv[shell_argc] != nullptr)
+        ++shell_argc;
+    char* helper_argv[SLAVE_HELPER_ARGC + shell_argc + 2];
+    char helper_arg[]{SLAVE_HELPER_ARG};
+    helper_argv[0] = helper_path;
+    helper_argv[1] = helper_arg;
+    helper_argv[2] = parent_pid_arg;
+    helper_argv[3] = sync_in_arg;
+    helper_argv[4] = sync_out_arg;
+    helper_argv[5] = log_level_arg;
+    helper_argv[6] = dir == nullptr ? empty_arg : dir;
+    helper_argv[7] = pooled ? pooled_arg : empty_arg;
+    for (auto i = 0; i <= shell_argc; ++i)
+        helper_argv[SLAVE_HELPER_ARGC + 1 + i] = argv[i];
+    // The slave side of the PTY becomes helper's standard streams, and the slave ends of the sync channel are
+    // inherited (the master ends are close-on-exec).
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, slave_fd, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, slave_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, slave_fd, STDERR_FILENO);
+    if (slave_fd > STDERR_FILENO)
+        posix_spawn_file_actions_addclose(&actions, slave_fd);
+    // Signal handlers are reset by exec anyway, but ignored signals and the mask have to be reset explicitly.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGQUIT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGCHLD);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF); // NOLINT(hicpp-signed-bitwise)
+    set_cloexec(sync.to_slave[0], false);
+    set_cloexec(sync.to_master[1], false);
+    pid_t slave_pid{-1};
+    const auto result = posix_spawn(&slave_pid, helper_path, &actions, &attr, helper_argv, environ);
+    set_cloexec(sync.to_slave[0], true);
+    set_cloexec(sync.to_master[1], true);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(slave_fd);
+    if (result != 0) {
+        logf(LOG_ERROR, "[spawn_slave_helper] 'posix_spawn' call failed. Error: %i (%s)", result, strerror(result));
+        close(pty_fd);
+        pty_fd = -1;
+        return -1;
+    }
+    logf(LOG_DEBUG, "[spawn_slave_helper] Slave helper spawned: %s (PID=%i).", helper_path, slave_pid);
+    return slave_pid;
+}
+
+int launch_shell_spawn(int& pty_fd, winsize& win_size, sync_channel& sync, char** argv, char* dir) {
+    pthread_mutex_lock(&_spawn_lock);
+    const auto slave_pid = spawn_slave_helper(pty_fd, win_size, sync, argv, dir, false);
+    pthread_mutex_unlock(&_spawn_lock);
+    return slave_pid;
+}
+
+int launch_shell_pooled(int& pty_fd, winsize& win_size, sync_channel& sync, char** argv) {
+    pthread_mutex_lock(&_spawn_lock);
+    const auto slave_pid = spawn_slave_helper(pty_fd, win_size, sync, argv, nullptr, true);
+    pthread_mutex_unlock(&_spawn_lock);
+    return slave_pid;
+}
+
+static int read_helper_int(const char* value) {
+    char* ptr{nullptr};
+    const auto val = strtol(value, &ptr, 10);
+    if (ptr == value || ptr[0] != 0) {
+        logf(LOG_ERROR, "[read_helper_int] Invalid slave helper argument: %s", value);
+        exit(EXIT_CODE_ARGUMENTS);
+    }
+    return (int) val;
+}
+
+void run_slave_helper(int argc, char** argv) {
+    if (argc <= SLAVE_HELPER_ARGC || strcmp(argv[0], SLAVE_HELPER_ARG) != 0)
+        exit(EXIT_CODE_ARGUMENTS);
+    _min_log_level = read_helper_int(argv[4]);
+    const auto parent_pid = read_helper_int(argv[1]);
+    sync_channel sync{.to_slave = {read_helper_int(argv[2]), -1}, .to_master = {-1, read_helper_int(argv[3])}};
+    // The shell must not inherit the sync channel
+    set_cloexec(sync.to_slave[0], true);
+    set_cloexec(sync.to_master[1], true);
+    // The same as `login_tty` does in the child created by `forkpty`
+    if (setsid() < 0)
+        log_lin_error(LOG_ERROR, "[run_slave_helper] 'setsid' call failed.");
+    if (ioctl(STDIN_FILENO, TIOCSCTTY, 0) != 0) // NOLINT(hicpp-signed-bitwise)
+        log_lin_error(LOG_ERROR, "[run_slave_helper] 'ioctl(TIOCSCTTY)' call failed.");
+    do_slave(parent_pid, sync, argv + SLAVE_HELPER_ARGC, argv[5][0] == 0 ? nullptr : argv[5], argv[6][0] != 0);
+}
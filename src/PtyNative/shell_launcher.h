@@ -0,0 +1,48 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_SHELL_LAUNCHER_H
+#define PTYNATIVE_SHELL_LAUNCHER_H
+
+#include "includes.h"
+
+#include "sync_channel.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedMacroInspection"
+
+#define EXIT_CODE_ARGUMENTS 1
+#define EXIT_CODE_API_CALL_FAILED 2
+#define EXIT_CODE_SHELL_LAUNCH_FAILED 3
+#define EXIT_CODE_UNEXPECTED_HAPPENED -1
+
+// Shell launch modes:
+// - fork: `forkpty`, and the forked child prepares the terminal and executes the shell.
+// - spawn: `openpty`, and the shell is started through the slave helper (this executable, started with
+//   SLAVE_HELPER_ARG) by `posix_spawn`, so that the parent's address space is never duplicated.
+#define LAUNCH_MODE_FORK 0
+#define LAUNCH_MODE_SPAWN 1
+
+// Must be the first argument of the slave helper process. See run_slave_helper.
+#define SLAVE_HELPER_ARG "--slave-exec"
+
+#pragma clang diagnostic pop
+
+// Both functions return the PID of the slave process, or -1 on failure. pty_fd receives PTY master.
+// The parent should proceed with the handshake over sync (the master side).
+int launch_shell_forkpty(int& pty_fd, winsize& win_size, sync_channel& sync, char** argv, char* dir);
+int launch_shell_spawn(int& pty_fd, winsize& win_size, sync_channel& sync, char** argv, char* dir);
+// Spawns a warm slave for the shell pool: it prepares everything it can, and waits for the claim (see
+// sync_channel_claim), which replaces the ready notification of the parent. The rest of the handshake is the same.
+int launch_shell_pooled(int& pty_fd, winsize& win_size, sync_channel& sync, char** argv);
+
+// Entry point of the slave helper. argv[0] has to be SLAVE_HELPER_ARG. Never returns.
+void run_slave_helper(int argc, char** argv);
+
+#endif //PTYNATIVE_SHELL_LAUNCHER_H
@@ -0,0 +1,198 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "shell_pool.h"
+
+#include "child_watcher.h"
+#include "helpers.h"
+#include "logging.h"
+#include "shell_launcher.h"
+#include "stats.h"
+
+#include <pthread.h>
+
+// Delay before the next launch, after one has failed.
+#define POOL_RETRY_DELAY_MS 1000
+#define WAKE_DRAIN_BUFFER_SIZE 64
+
+// The warm shells (_shell_count of _pool_size). Guarded by _pool_lock, since the refill thread adds them.
+static pool_shell* _shells{nullptr};
+static int _shell_count{0};
+static int _pool_size{0};
+static char** _pool_argv{nullptr};
+static pthread_mutex_t _pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t _refill_thread;
+// Wakes the refill thread when a shell is taken (or dropped), or when the pool is stopping.
+static int _refill_wake[2]{-1, -1};
+static std::atomic<bool> _pool_stopping{false};
+static bool _pool_running{false};
+
+static void wake_refill() {
+    const char wake_byte{1};
+    while (write(_refill_wake[1], &wake_byte, 1) < 0 && errno == EINTR) {
+    }
+}
+
+static void close_shell(pool_shell& shell) {
+    sync_channel_close(shell.sync);
+    close(shell.pty_fd);
+}
+
+static bool launch_warm_shell(pool_shell& shell) {
+    if (!sync_channel_create(shell.sync)) {
+        log(LOG_ERROR, "[launch_warm_shell] Failed to create synchronization pipes.");
+        return false;
+    }
+    // The winsize is set when the shell is claimed.
+    winsize win_size{};
+    const auto launch_start_us = monotonic_microseconds();
+    shell.slave_pid = launch_shell_pooled(shell.pty_fd, win_size, shell.sync, _pool_argv);
+    if (shell.slave_pid < 0) {
+        sync_channel_close(shell.sync);
+        return false;
+    }
+    sync_channel_use_as_master(shell.sync);
+    stats_add(STATS_POOL_SHELLS_LAUNCHED, 1);
+    logf(LOG_DEBUG, "[launch_warm_shell] Warm shell launched in %lli us (PID=%i).",
+         monotonic_microseconds() - launch_start_us, shell.slave_pid);
+    return true;
+}
+
+static void* refill_thread(void*) {
+    log(LOG_DEBUG, "[refill_thread] Shell pool refill started.");
+    char wake_buffer[WAKE_DRAIN_BUFFER_SIZE];
+    auto retry_delay_ms{-1};
+    while (!_pool_stopping.load()) {
+        pthread_mutex_lock(&_pool_lock);
+        const auto missing = _pool_size - _shell_count;
+        pthread_mutex_unlock(&_pool_lock);
+        if (missing > 0 && retry_delay_ms < 0) {
+            pool_shell shell{};
+            if (!launch_warm_shell(shell)) {
+                log(LOG_WARN, "[refill_thread] Failed to launch a warm shell. Retrying later.");
+                retry_delay_ms = POOL_RETRY_DELAY_MS;
+                continue;
+            }
+            pthread_mutex_lock(&_pool_lock);
+            _shells[_shell_count++] = shell;
+            stats_set(STATS_POOL_WARM_SHELLS, _shell_count);
+            pthread_mutex_unlock(&_pool_lock);
+            continue;
+        }
+        // The pool is full (or the last launch failed): waiting for a shell to be taken, or for the retry.
+        pollfd source{.fd = _refill_wake[0], .events = POLLIN, .revents = 0};
+        if (poll(&source, 1, retry_delay_ms) > 0)
+            while (read(_refill_wake[0], wake_buffer, WAKE_DRAIN_BUFFER_SIZE) == WAKE_DRAIN_BUFFER_SIZE) {
+            }
+        else
+            retry_delay_ms = -1;
+    }
+    log(LOG_DEBUG, "[refill_thread] Shell pool refill stopped.");
+    return nullptr;
+}
+
+bool shell_pool_start(int size, char** argv) {
+    _shells = (pool_shell*) calloc(size, sizeof(pool_shell));
+    if (_shells == nullptr) {
+        log(LOG_ERROR, "[shell_pool_start] Failed to allocate the pool.");
+        return false;
+    }
+    _pool_size = size;
+    _pool_argv = argv;
+    _shell_count = 0;
+    _pool_stopping.store(false);
+    if (pipe2(_refill_wake, O_CLOEXEC | O_NONBLOCK) != 0) { // NOLINT(hicpp-signed-bitwise)
+        log_lin_error(LOG_ERROR, "[shell_pool_start] 'pipe2' call failed.");
+        free(_shells);
+        _shells = nullptr;
+        return false;
+    }
+    const auto result = pthread_create(&_refill_thread, nullptr, refill_thread, nullptr);
+    if (result != 0) {
+        logf(LOG_ERROR, "[shell_pool_start] 'pthread_create' call failed. Error: %i (%s)", result, strerror(result));
+        close(_refill_wake[0]);
+        close(_refill_wake[1]);
+        free(_shells);
+        _shells = nullptr;
+        return false;
+    }
+    _pool_running = true;
+    logf(LOG_INFO, "[shell_pool_start] Shell pool started (%i warm shells of %s).", size, argv[0]);
+    return true;
+}
+
+void shell_pool_stop() {
+    if (!_pool_running)
+        return;
+    _pool_running = false;
+    _pool_stopping.store(true);
+    wake_refill();
+    pthread_join(_refill_thread, nullptr);
+    for (auto i = 0; i < _shell_count; ++i)
+        close_shell(_shells[i]);
+    logf(LOG_DEBUG, "[shell_pool_stop] Shell pool stopped (%i warm shells closed).", _shell_count);
+    _shell_count = 0;
+    stats_set(STATS_POOL_WARM_SHELLS, 0);
+    close(_refill_wake[0]);
+    close(_refill_wake[1]);
+    free(_shells);
+    _shells = nullptr;
+}
+
+bool shell_pool_matches(char* const* argv) {
+    if (!_pool_running)
+        return false;
+    auto i{0};
+    for (; argv[i] != nullptr && _pool_argv[i] != nullptr; ++i)
+        if (strcmp(argv[i], _pool_argv[i]) != 0)
+            return false;
+    return argv[i] == nullptr && _pool_argv[i] == nullptr;
+}
+
+bool shell_pool_take(pool_shell& shell) {
+    if (!_pool_running)
+        return false;
+    auto taken{false};
+    pthread_mutex_lock(&_pool_lock);
+    while (!taken && _shell_count > 0) {
+        shell = _shells[--_shell_count];
+        int status{0};
+        if (child_watcher_reap(shell.slave_pid, status)) {
+            logf(LOG_WARN, "[shell_pool_take] Warm shell (PID=%i) has exited.", shell.slave_pid);
+            close_shell(shell);
+        } else
+            taken = true;
+    }
+    stats_set(STATS_POOL_WARM_SHELLS, _shell_count);
+    pthread_mutex_unlock(&_pool_lock);
+    wake_refill();
+    return taken;
+}
+
+void shell_pool_reap() {
+    if (!_pool_running)
+        return;
+    auto dropped{false};
+    pthread_mutex_lock(&_pool_lock);
+    for (auto i = 0; i < _shell_count;) {
+        int status{0};
+        if (!child_watcher_reap(_shells[i].slave_pid, status)) {
+            ++i;
+            continue;
+        }
+        logf(LOG_WARN, "[shell_pool_reap] Warm shell (PID=%i) has exited.", _shells[i].slave_pid);
+        close_shell(_shells[i]);
+        _shells[i] = _shells[--_shell_count];
+        dropped = true;
+    }
+    stats_set(STATS_POOL_WARM_SHELLS, _shell_count);
+    pthread_mutex_unlock(&_pool_lock);
+    if (dropped)
+        wake_refill();
+}
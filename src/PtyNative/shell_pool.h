@@ -0,0 +1,42 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_SHELL_POOL_H
+#define PTYNATIVE_SHELL_POOL_H
+
+#include "includes.h"
+
+#include "sync_channel.h"
+
+// Warm shell pool (`--pool`, host mode only): a number of warm slaves (see launch_shell_pooled) of one shell, each on
+// its own PTY, so that a new session of that shell doesn't wait for a process to be created. The pool is refilled by
+// a background thread as the shells are taken.
+struct pool_shell {
+    int pty_fd;
+    int slave_pid;
+    // Only the master ends are open.
+    sync_channel sync;
+};
+
+// Starts the refill thread, which keeps `size` warm shells of argv (it has to stay valid until shell_pool_stop).
+bool shell_pool_start(int size, char** argv);
+// Stops the refill thread, and closes the warm shells (they exit when they see their sync channel closed).
+void shell_pool_stop();
+
+// Whether argv is the pooled shell (the same executable and arguments).
+bool shell_pool_matches(char* const* argv);
+
+// Takes a warm shell out of the pool (it's replaced in the background), which then has to be claimed by the caller.
+// Returns false if there's none.
+bool shell_pool_take(pool_shell& shell);
+
+// Drops the warm shells that have exited (called when the child watcher fires).
+void shell_pool_reap();
+
+#endif //PTYNATIVE_SHELL_POOL_H
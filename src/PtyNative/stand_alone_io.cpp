@@ -11,6 +11,13 @@
 
 #include "logging.h"
 
+#include <pthread.h>
+
+#ifdef __CYGWIN__
+
+static int _console_watcher_fds[2]{-1, -1};
+static HANDLE _console_rearm_event{nullptr};
+
 bool disable_processed_input() {
     HANDLE inh = GetStdHandle(STD_INPUT_HANDLE);
     if (inh == INVALID_HANDLE_VALUE) {
@@ -48,16 +55,17 @@ bool read_input_records_from_console(INPUT_RECORD* records, int count, int& reco
         }
         if (available < 1)
             break;
-        while (available > 0) {
+        while (available > 0 && count > 0) {
             DWORD read{0};
             if (!ReadConsoleInputW(inh, pos, count, &read)) {
                 log_win_error(LOG_ERROR, "[read_input_record_from_console] 'ReadConsoleInput' call failed.");
                 return false;
             }
             if (read > 0) {
-                available -= read;
+                available = available > read ? available - read : 0;
                 pos += (int) read;
                 count -= (int) read;
+                records_read += (int) read;
             }
         }
     }
@@ -127,3 +135,93 @@ bool try_override_win_size(winsize& win_size) {
     win_size.ws_col = buffer_info.dwSize.X;
     return true;
 }
+
+static void* console_input_watcher(void*) {
+    HANDLE inh = GetStdHandle(STD_INPUT_HANDLE);
+    while (true) {
+        if (WaitForSingleObject(inh, INFINITE) != WAIT_OBJECT_0) {
+            log_win_error(LOG_ERROR, "[console_input_watcher] 'WaitForSingleObject' call failed for console input.");
+            break;
+        }
+        const char signal_byte{1};
+        if (write(_console_watcher_fds[1], &signal_byte, 1) != 1) {
+            log_lin_error(LOG_ERROR, "[console_input_watcher] 'write' call failed.");
+            break;
+        }
+        // Wait for the I/O loop to consume the input, otherwise the console handle would remain signaled.
+        if (WaitForSingleObject(_console_rearm_event, INFINITE) != WAIT_OBJECT_0) {
+            log_win_error(LOG_ERROR, "[console_input_watcher] 'WaitForSingleObject' call failed for re-arm event.");
+            break;
+        }
+    }
+    // Closing the write end will make the I/O loop notice that the watcher is gone.
+    close(_console_watcher_fds[1]);
+    return nullptr;
+}
+
+int start_console_input_watcher() {
+    HANDLE inh = GetStdHandle(STD_INPUT_HANDLE);
+    if (inh == INVALID_HANDLE_VALUE) {
+        log_win_error(LOG_ERROR, "[start_console_input_watcher] 'GetStdHandle' returned INVALID_HANDLE_VALUE.");
+        return -1;
+    }
+    _console_rearm_event = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+    if (_console_rearm_event == nullptr) {
+        log_win_error(LOG_ERROR, "[start_console_input_watcher] 'CreateEventA' call failed.");
+        return -1;
+    }
+    if (pipe2(_console_watcher_fds, O_CLOEXEC) != 0) {
+        log_lin_error(LOG_ERROR, "[start_console_input_watcher] 'pipe2' call failed.");
+        return -1;
+    }
+    pthread_t thread{};
+    if (pthread_create(&thread, nullptr, console_input_watcher, nullptr) != 0) {
+        log_lin_error(LOG_ERROR, "[start_console_input_watcher] 'pthread_create' call failed.");
+        return -1;
+    }
+    pthread_detach(thread);
+    log(LOG_DEBUG, "[start_console_input_watcher] Console input watcher started.");
+    return _console_watcher_fds[0];
+}
+
+void console_input_consumed(int watcher_fd) {
+    char signal_byte{0};
+    if (read(watcher_fd, &signal_byte, 1) != 1)
+        log_lin_error(LOG_WARN, "[console_input_consumed] 'read' call failed.");
+    if (!SetEvent(_console_rearm_event))
+        log_win_error(LOG_ERROR, "[console_input_consumed] 'SetEvent' call failed.");
+}
+
+#else
+
+// Stand-alone mode requires Windows console, so outside of Cygwin/MSYS2 only managed mode is available.
+
+bool disable_processed_input() {
+    log(LOG_ERROR, "[disable_processed_input] Stand-alone mode isn't supported on this platform.");
+    return false;
+}
+
+bool read_input_records_from_console(INPUT_RECORD*, int, int& records_read) {
+    records_read = 0;
+    log(LOG_ERROR, "[read_input_records_from_console] Stand-alone mode isn't supported on this platform.");
+    return false;
+}
+
+bool write_output_to_console(char*, int) {
+    log(LOG_ERROR, "[write_output_to_console] Stand-alone mode isn't supported on this platform.");
+    return false;
+}
+
+bool try_override_win_size(winsize&) {
+    return false;
+}
+
+int start_console_input_watcher() {
+    log(LOG_ERROR, "[start_console_input_watcher] Stand-alone mode isn't supported on this platform.");
+    return -1;
+}
+
+void console_input_consumed(int) {
+}
+
+#endif
@@ -20,4 +20,11 @@ bool write_output_to_console(char* buff, int length);
 
 bool try_override_win_size(winsize& win_size);
 
+// Starts a thread that waits on the console input handle, and returns a file descriptor which becomes
+// readable when console input is available, so that the console can be waited on together with the PTY.
+int start_console_input_watcher();
+
+// Must be called after the console input is consumed, so that the watcher starts waiting again.
+void console_input_consumed(int watcher_fd);
+
 #endif //PTYNATIVE_STAND_ALONE_IO_H
@@ -0,0 +1,24 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "stats.h"
+
+std::atomic<unsigned long long> _stats[STATS_COUNTER_COUNT]{};
+
+int serialize_stats(char* buffer) {
+    const unsigned short count{STATS_COUNTER_COUNT};
+    memcpy(buffer, &count, sizeof(count));
+    auto position = (int) sizeof(count);
+    for (auto i = 0; i < STATS_COUNTER_COUNT; ++i) {
+        const auto value = stats_get(i);
+        memcpy(buffer + position, &value, sizeof(value));
+        position += (int) sizeof(value);
+    }
+    return position;
+}
@@ -0,0 +1,111 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_STATS_H
+#define PTYNATIVE_STATS_H
+
+#include "includes.h"
+
+#include <atomic>
+
+// Runtime counters, returned (in this order) by the get-stats command. New counters may only be appended.
+// I/O loop:
+#define STATS_LOOP_ITERATIONS 0
+#define STATS_IDLE_WAKEUPS 1 // The loop woke up, but nothing was ready
+// Output direction (PTY -> output pump -> output):
+#define STATS_PTY_READS 2
+#define STATS_PTY_BYTES_READ 3
+#define STATS_OUTPUT_WRITES 4
+#define STATS_OUTPUT_BYTES_WRITTEN 5
+// Times (and total duration) the loop stopped reading PTY, because the output ring was full.
+#define STATS_OUTPUT_STALLS 6
+#define STATS_OUTPUT_STALL_MICROSECONDS 7
+// Input direction (input stream / records -> PTY):
+#define STATS_INPUT_READS 8
+#define STATS_INPUT_BYTES_READ 9
+#define STATS_RECORD_READS 10
+#define STATS_KEY_RECORDS 11
+#define STATS_MOUSE_RECORDS 12
+#define STATS_RESIZE_RECORDS 13
+#define STATS_OTHER_RECORDS 14
+#define STATS_PTY_WRITES 15
+#define STATS_PTY_BYTES_WRITTEN 16
+// Commands:
+#define STATS_PING_COMMANDS 17
+#define STATS_GET_WINSIZE_COMMANDS 18
+#define STATS_SET_WINSIZE_COMMANDS 19
+#define STATS_GET_TERMIOS_COMMANDS 20
+#define STATS_SET_TERMIOS_COMMANDS 21
+#define STATS_GET_STATS_COMMANDS 22
+#define STATS_UNKNOWN_COMMANDS 23
+// High-water marks (in bytes): output ring usage, single PTY read, and translated keys written to PTY at once.
+#define STATS_OUTPUT_RING_HIGH_WATER 24
+#define STATS_PTY_READ_HIGH_WATER 25
+#define STATS_KEY_BATCH_HIGH_WATER 26
+// Multiplexed channel: reads, writes of the I/O loop's batched frames, and times the output waited for credit.
+#define STATS_CHANNEL_READS 27
+#define STATS_CHANNEL_FLUSHES 28
+#define STATS_CHANNEL_CREDIT_WAITS 29
+// Host mode: sessions started and finished.
+#define STATS_HOST_SESSIONS_STARTED 30
+#define STATS_HOST_SESSIONS_FINISHED 31
+// Warm shell pool: sessions that got a warm shell (hits) or had to launch one (misses), the total time from the
+// create command until the shell was ready for each of them, warm shells launched, and the number of warm shells
+// waiting right now.
+#define STATS_POOL_HITS 32
+#define STATS_POOL_MISSES 33
+#define STATS_POOL_HIT_MICROSECONDS 34
+#define STATS_POOL_MISS_MICROSECONDS 35
+#define STATS_POOL_SHELLS_LAUNCHED 36
+#define STATS_POOL_WARM_SHELLS 37
+// Commands (continued):
+#define STATS_GET_SCROLLBACK_COMMANDS 38
+// Output backpressure: how many times the pending output has reached the high watermark (PTY reading paused), and
+// has been drained down to the low one (resumed), and the output that's dropped meanwhile (see `--opolicy`).
+#define STATS_OUTPUT_HIGH_WATER_CROSSINGS 39
+#define STATS_OUTPUT_LOW_WATER_CROSSINGS 40
+#define STATS_OUTPUT_BYTES_DROPPED 41
+// PTY writes that would have blocked (its input queue was full), so the rest of the input waited for it to be writable.
+#define STATS_PTY_WRITE_STALLS 42
+
+#define STATS_COUNTER_COUNT 43
+
+// Each counter has a single writer (the I/O loop or the output pump thread), so plain relaxed load + store is
+// enough, and the hot paths don't pay for locked read-modify-write instructions. The exception are the counters of
+// the output pumps in host mode (a pump per session), which are updated with stats_add_shared.
+extern std::atomic<unsigned long long> _stats[STATS_COUNTER_COUNT];
+
+inline void stats_add(int counter, unsigned long long value) {
+    _stats[counter].store(_stats[counter].load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+inline void stats_add_shared(int counter, unsigned long long value) {
+    _stats[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+inline void stats_max(int counter, unsigned long long value) {
+    if (value > _stats[counter].load(std::memory_order_relaxed))
+        _stats[counter].store(value, std::memory_order_relaxed);
+}
+
+inline void stats_set(int counter, unsigned long long value) {
+    _stats[counter].store(value, std::memory_order_relaxed);
+}
+
+inline unsigned long long stats_get(int counter) {
+    return _stats[counter].load(std::memory_order_relaxed);
+}
+
+#define STATS_SERIALIZED_SIZE (sizeof(unsigned short) + STATS_COUNTER_COUNT * sizeof(unsigned long long))
+
+// Stores the number of counters (unsigned short), followed by all the counters (8 bytes each), into buffer (at least
+// STATS_SERIALIZED_SIZE bytes). Returns the number of bytes stored.
+int serialize_stats(char* buffer);
+
+#endif //PTYNATIVE_STATS_H
@@ -0,0 +1,146 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "sync_channel.h"
+
+#include "file_helpers.h"
+#include "helpers.h"
+#include "logging.h"
+
+#include <cstdint>
+
+#define SYNC_READY_BYTE 'R'
+
+static void close_fd(int& fd) {
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+}
+
+bool sync_channel_create(sync_channel& channel) {
+    channel.to_slave[0] = channel.to_slave[1] = channel.to_master[0] = channel.to_master[1] = -1;
+    if (pipe2(channel.to_slave, O_CLOEXEC) != 0 || pipe2(channel.to_master, O_CLOEXEC) != 0) {
+        log_lin_error(LOG_ERROR, "[sync_channel_create] 'pipe2' call failed.");
+        sync_channel_close(channel);
+        return false;
+    }
+    return true;
+}
+
+void sync_channel_use_as_master(sync_channel& channel) {
+    close_fd(channel.to_slave[0]);
+    close_fd(channel.to_master[1]);
+}
+
+void sync_channel_use_as_slave(sync_channel& channel) {
+    close_fd(channel.to_slave[1]);
+    close_fd(channel.to_master[0]);
+}
+
+bool sync_channel_notify(int fd) {
+    const char ready_byte{SYNC_READY_BYTE};
+    while (write(fd, &ready_byte, 1) != 1) {
+        if (errno != EINTR) {
+            log_lin_error(LOG_ERROR, "[sync_channel_notify] 'write' call failed.");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sync_channel_wait(int fd, int timeout_ms, long long& waited_us) {
+    const auto start = monotonic_microseconds();
+    const auto deadline = start + (long long) timeout_ms * 1000;
+    waited_us = 0;
+    while (true) {
+        const auto now = monotonic_microseconds();
+        waited_us = now - start;
+        if (now >= deadline) {
+            logf(LOG_ERROR, "[sync_channel_wait] The other side isn't ready after %i ms.", timeout_ms);
+            return false;
+        }
+        pollfd source{.fd = fd, .events = POLLIN, .revents = 0};
+        const auto result = poll(&source, 1, (int) ((deadline - now + 999) / 1000));
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            log_lin_error(LOG_ERROR, "[sync_channel_wait] 'poll' call failed.");
+            return false;
+        }
+        if (result == 0)
+            continue;
+        char ready_byte{0};
+        const auto len = read(fd, &ready_byte, 1);
+        if (len < 0 && errno == EINTR)
+            continue;
+        waited_us = monotonic_microseconds() - start;
+        if (len == 1 && ready_byte == SYNC_READY_BYTE)
+            return true;
+        if (len == 0)
+            log(LOG_ERROR, "[sync_channel_wait] The other side has closed the channel (probably exited).");
+        else if (len < 0)
+            log_lin_error(LOG_ERROR, "[sync_channel_wait] 'read' call failed.");
+        else
+            logf(LOG_ERROR, "[sync_channel_wait] Unexpected byte received: %i.", ready_byte);
+        return false;
+    }
+}
+
+static bool append_claim_string(char* claim, int& length, const char* string) {
+    const auto size = (int) strlen(string) + 1;
+    if (length + size > SYNC_CLAIM_MAX_SIZE) {
+        log(LOG_ERROR, "[append_claim_string] The claim is too large.");
+        return false;
+    }
+    memcpy(claim + sizeof(uint32_t) + length, string, size);
+    length += size;
+    return true;
+}
+
+bool sync_channel_claim(int fd, const char* dir, char* const* env) {
+    char claim[sizeof(uint32_t) + SYNC_CLAIM_MAX_SIZE];
+    auto length{0};
+    if (!append_claim_string(claim, length, dir == nullptr ? "" : dir))
+        return false;
+    for (auto i = 0; env != nullptr && env[i] != nullptr; ++i)
+        if (!append_claim_string(claim, length, env[i]))
+            return false;
+    const auto claim_length = (uint32_t) length;
+    memcpy(claim, &claim_length, sizeof(claim_length));
+    if (!write_bytes(fd, claim, (int) sizeof(uint32_t) + length)) {
+        log(LOG_ERROR, "[sync_channel_claim] Failed to send the claim (the slave has probably exited).");
+        return false;
+    }
+    return true;
+}
+
+bool sync_channel_wait_claim(int fd, char* claim, int& length) {
+    uint32_t claim_length{0};
+    if (!read_bytes_fixed(fd, (char*) &claim_length, sizeof(claim_length))) {
+        log(LOG_ERROR, "[sync_channel_wait_claim] Failed to read the claim (the master has probably exited).");
+        return false;
+    }
+    if (claim_length < 1 || claim_length > SYNC_CLAIM_MAX_SIZE) {
+        logf(LOG_ERROR, "[sync_channel_wait_claim] Invalid claim length: %u.", claim_length);
+        return false;
+    }
+    if (!read_bytes_fixed(fd, claim, (int) claim_length) || claim[claim_length - 1] != 0) {
+        log(LOG_ERROR, "[sync_channel_wait_claim] Failed to read the claim.");
+        return false;
+    }
+    length = (int) claim_length;
+    return true;
+}
+
+void sync_channel_close(sync_channel& channel) {
+    close_fd(channel.to_slave[0]);
+    close_fd(channel.to_slave[1]);
+    close_fd(channel.to_master[0]);
+    close_fd(channel.to_master[1]);
+}
@@ -0,0 +1,52 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_SYNC_CHANNEL_H
+#define PTYNATIVE_SYNC_CHANNEL_H
+
+#include "includes.h"
+
+// Maximal time that master and slave wait for each other during startup.
+#define SYNC_TIMEOUT_MS 3000
+
+// Startup handshake between master and slave processes. It consists of two pipes created before the fork, one
+// for each direction. All the ends are close-on-exec, so nothing leaks into the shell.
+struct sync_channel {
+    int to_slave[2];
+    int to_master[2];
+};
+
+bool sync_channel_create(sync_channel& channel);
+
+// Closes the ends that belong to the other process. Must be called by each of the processes after the fork.
+void sync_channel_use_as_master(sync_channel& channel);
+void sync_channel_use_as_slave(sync_channel& channel);
+
+// Notifies the other side that we're ready.
+bool sync_channel_notify(int fd);
+
+// Waits (for at most timeout_ms) until the other side notifies that it's ready. waited_us receives the actual
+// waiting time in microseconds.
+bool sync_channel_wait(int fd, int timeout_ms, long long& waited_us);
+
+// Warm (pooled) slave: it's launched before it's needed, and it waits for the claim instead of the ready notification.
+// The claim is [length: uint32] followed by NUL-terminated strings: the working directory (empty for none), and the
+// environment variables to set (`NAME=VALUE`).
+#define SYNC_CLAIM_MAX_SIZE 4096
+
+// Sends the claim (env is null-terminated, and may be null).
+bool sync_channel_claim(int fd, const char* dir, char* const* env);
+
+// Waits (without a timeout) until the claim arrives. claim receives the strings (at least SYNC_CLAIM_MAX_SIZE bytes),
+// and length their total length. Fails if the master has closed the channel.
+bool sync_channel_wait_claim(int fd, char* claim, int& length);
+
+void sync_channel_close(sync_channel& channel);
+
+#endif //PTYNATIVE_SYNC_CHANNEL_H
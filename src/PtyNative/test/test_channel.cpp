@@ -0,0 +1,242 @@
+/*
+ Created by Fat Dragon on 10/17/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// Channel framing: several frames of different sizes that arrive with a single read are consumed in the same pass
+// (as the I/O loop does), also when some of them have to wait, and the frames of a session's channel reach the slave
+// in order (through `run`), records frames included.
+
+#include "test_helpers.h"
+
+#include "../channel.h"
+#include "../file_helpers.h"
+#include "../io_processor.h"
+#include "../logging.h"
+
+#include <cstdint>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#define MAX_FRAMES 8
+
+// Writes the frames (type and payload of each) with a single write. Payloads are strings, unless their lengths are
+// given.
+static bool send_frames(int fd, const char* types, const char* const* payloads, int count,
+                        const int* payload_lengths = nullptr) {
+    char buffer[1024];
+    auto length{0};
+    for (auto i = 0; i < count; ++i) {
+        const auto payload_length = (uint32_t) (payload_lengths ? payload_lengths[i] : (int) strlen(payloads[i]));
+        const auto frame_length = (uint32_t) (CHANNEL_FRAME_HEADER_SIZE - CHANNEL_FRAME_LENGTH_SIZE + payload_length);
+        memcpy(buffer + length, &frame_length, sizeof(frame_length));
+        buffer[length + CHANNEL_FRAME_LENGTH_SIZE] = types[i];
+        memcpy(buffer + length + CHANNEL_FRAME_HEADER_SIZE, payloads[i], payload_length);
+        length += CHANNEL_FRAME_HEADER_SIZE + (int) payload_length;
+    }
+    return write_bytes(fd, buffer, length);
+}
+
+static bool open_test_channel(channel& chan, int pipe_fds[2]) {
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+        printf("Failed to create the pipe.\n");
+        return false;
+    }
+    return channel_open(chan, pipe_fds[0], -1);
+}
+
+static void close_test_channel(channel& chan, const int pipe_fds[2]) {
+    channel_close(chan);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+}
+
+// Consumes the frames of the types in `consumed_types` (in one pass), and returns the number of frames that were
+// seen, with their payloads in `seen`. Returns -1 if a frame is invalid.
+static int consume_pass(channel& chan, const char* consumed_types, char seen[MAX_FRAMES][64]) {
+    auto position{0};
+    char type{0};
+    const char* payload{nullptr};
+    int length{0};
+    auto count{0};
+    int result;
+    while ((result = channel_next(chan, position, type, payload, length)) > 0 && count < MAX_FRAMES) {
+        snprintf(seen[count++], 64, "%.*s", length, payload);
+        if (strchr(consumed_types, type) != nullptr)
+            channel_consume(chan, payload);
+    }
+    channel_compact(chan);
+    return result < 0 ? -1 : count;
+}
+
+static void test_consume_all() {
+    channel chan{};
+    int pipe_fds[2];
+    if (!open_test_channel(chan, pipe_fds)) {
+        expect(false, "consume all: channel opened");
+        return;
+    }
+    const char types[]{CHANNEL_FRAME_INPUT, CHANNEL_FRAME_INPUT, CHANNEL_FRAME_INPUT};
+    const char* payloads[]{"ab", "0123456789", "xyz"};
+    const char consumed[]{CHANNEL_FRAME_INPUT, 0};
+    char seen[MAX_FRAMES][64];
+    expect(send_frames(pipe_fds[1], types, payloads, 3) && channel_receive(chan), "consume all: frames received");
+    expect(consume_pass(chan, consumed, seen) == 3, "consume all: three frames seen in one pass");
+    for (auto i = 0; i < 3; ++i)
+        expect(strcmp(seen[i], payloads[i]) == 0, "consume all: payloads in order");
+    expect(chan.received_count == 0, "consume all: nothing left after compacting");
+    close_test_channel(chan, pipe_fds);
+}
+
+// Frames behind one that waits (as input does while the previous input isn't written) are consumed first.
+static void test_consume_out_of_order() {
+    channel chan{};
+    int pipe_fds[2];
+    if (!open_test_channel(chan, pipe_fds)) {
+        expect(false, "out of order: channel opened");
+        return;
+    }
+    const char types[]{CHANNEL_FRAME_INPUT, CHANNEL_FRAME_COMMAND, CHANNEL_FRAME_CREDIT, CHANNEL_FRAME_INPUT};
+    const char* payloads[]{"ab", "0123456789", "wxyz", "klm"};
+    const char commands_only[]{CHANNEL_FRAME_COMMAND, CHANNEL_FRAME_CREDIT, 0};
+    const char inputs[]{CHANNEL_FRAME_INPUT, 0};
+    char seen[MAX_FRAMES][64];
+    expect(send_frames(pipe_fds[1], types, payloads, 4) && channel_receive(chan), "out of order: frames received");
+    expect(consume_pass(chan, commands_only, seen) == 4, "out of order: four frames seen in the first pass");
+    expect(consume_pass(chan, inputs, seen) == 2, "out of order: two frames left for the second pass");
+    expect(strcmp(seen[0], "ab") == 0 && strcmp(seen[1], "klm") == 0, "out of order: waiting frames kept in order");
+    expect(chan.received_count == 0, "out of order: nothing left after compacting");
+    close_test_channel(chan, pipe_fds);
+}
+
+// An incomplete frame is completed by the next read, behind the consumed ones.
+static void test_incomplete_frame() {
+    channel chan{};
+    int pipe_fds[2];
+    if (!open_test_channel(chan, pipe_fds)) {
+        expect(false, "incomplete frame: channel opened");
+        return;
+    }
+    const char types[]{CHANNEL_FRAME_INPUT, CHANNEL_FRAME_INPUT};
+    const char* payloads[]{"ab", "0123456789"};
+    const char consumed[]{CHANNEL_FRAME_INPUT, 0};
+    char seen[MAX_FRAMES][64];
+    // The first frame, and the first half of the second one.
+    char frames[64];
+    const auto first_length = CHANNEL_FRAME_HEADER_SIZE + 2;
+    const auto second_length = CHANNEL_FRAME_HEADER_SIZE + 10;
+    int frame_pipe[2];
+    expect(pipe2(frame_pipe, O_CLOEXEC) == 0 && send_frames(frame_pipe[1], types, payloads, 2)
+           && read_bytes_fixed(frame_pipe[0], frames, first_length + second_length), "incomplete frame: frames built");
+    close(frame_pipe[0]);
+    close(frame_pipe[1]);
+    expect(write_bytes(pipe_fds[1], frames, first_length + second_length / 2) && channel_receive(chan),
+           "incomplete frame: first part received");
+    expect(consume_pass(chan, consumed, seen) == 1, "incomplete frame: only the complete frame seen");
+    expect(write_bytes(pipe_fds[1], frames + first_length + second_length / 2, second_length - second_length / 2)
+           && channel_receive(chan), "incomplete frame: rest received");
+    expect(consume_pass(chan, consumed, seen) == 1 && strcmp(seen[0], payloads[1]) == 0,
+           "incomplete frame: completed frame seen");
+    expect(chan.received_count == 0, "incomplete frame: nothing left after compacting");
+    close_test_channel(chan, pipe_fds);
+}
+
+struct run_arguments {
+    int pty_fd;
+    int slave_pid;
+    int chan_fd;
+    int out_fd;
+};
+
+static void* run_thread(void* arg) {
+    const auto& a = *(run_arguments*) arg;
+    run(a.pty_fd, a.slave_pid, -1, -1, a.out_fd, -1, -1, a.chan_fd);
+    return nullptr;
+}
+
+// Key records of the characters, as a records frame payload.
+static int make_records(const char* characters, INPUT_RECORD* records) {
+    const auto count = (int) strlen(characters);
+    for (auto i = 0; i < count; ++i) {
+        records[i] = INPUT_RECORD{};
+        records[i].EventType = KEY_EVENT;
+        records[i].Event.KeyEvent.bKeyDown = 1;
+        records[i].Event.KeyEvent.wRepeatCount = 1;
+        records[i].Event.KeyEvent.uChar.UnicodeChar = (WCHAR) characters[i];
+    }
+    return count * (int) sizeof(INPUT_RECORD);
+}
+
+// Input and records frames of different sizes, sent with a single write, reach `cat` in order (records aren't written
+// ahead of the input before them), and come back as output.
+static void test_session_input_frames() {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) { // NOLINT(hicpp-signed-bitwise)
+        expect(false, "session: socket pair created");
+        return;
+    }
+    termios raw{};
+    cfmakeraw(&raw);
+    winsize win_size{.ws_row = 25, .ws_col = 80, .ws_xpixel = 0, .ws_ypixel = 0};
+    run_arguments arguments{.pty_fd = -1, .slave_pid = -1, .chan_fd = sockets[0],
+                            .out_fd = fcntl(sockets[0], F_DUPFD_CLOEXEC, 0)};
+    arguments.slave_pid = forkpty(&arguments.pty_fd, nullptr, &raw, &win_size);
+    if (arguments.slave_pid < 0) {
+        expect(false, "session: slave started");
+        return;
+    }
+    if (arguments.slave_pid == 0) {
+        execlp("cat", "cat", nullptr);
+        _exit(1);
+    }
+    pthread_t run_id;
+    pthread_create(&run_id, nullptr, run_thread, &arguments);
+    INPUT_RECORD first_records[2];
+    INPUT_RECORD second_records[1];
+    const char types[]{CHANNEL_FRAME_INPUT, CHANNEL_FRAME_RECORDS, CHANNEL_FRAME_INPUT, CHANNEL_FRAME_RECORDS,
+                       CHANNEL_FRAME_INPUT};
+    const char* payloads[]{"ab", (const char*) first_records, "0123456789", (const char*) second_records, "xyz"};
+    const int payload_lengths[]{2, make_records("RS", first_records), 10, make_records("T", second_records), 3};
+    expect(send_frames(sockets[1], types, payloads, 5, payload_lengths), "session: frames sent");
+    const char expected[]{"abRS0123456789Txyz"};
+    char output[64]{};
+    auto output_length{0};
+    while (output_length < (int) strlen(expected)) {
+        pollfd source{.fd = sockets[1], .events = POLLIN, .revents = 0};
+        uint32_t frame_length{0};
+        char type{0};
+        char payload[CHANNEL_MAX_PAYLOAD];
+        if (poll(&source, 1, 5000) <= 0 || !read_bytes_fixed(sockets[1], (char*) &frame_length, sizeof(frame_length))
+            || !read_bytes_fixed(sockets[1], &type, 1)
+            || !read_bytes_fixed(sockets[1], payload, (int) frame_length - 1))
+            break;
+        if (type != CHANNEL_FRAME_OUTPUT)
+            continue;
+        const auto length = (int) frame_length - 1;
+        if (output_length + length >= (int) sizeof(output))
+            break;
+        memcpy(output + output_length, payload, length);
+        output_length += length;
+    }
+    expect(strcmp(output, expected) == 0, "session: input frames echoed in order");
+    // Closing the channel ends the session.
+    close(sockets[1]);
+    kill(arguments.slave_pid, SIGKILL);
+    pthread_join(run_id, nullptr);
+    close(arguments.out_fd);
+    close(sockets[0]);
+}
+
+int main() {
+    _min_log_level = LOG_ERROR;
+    _debug_view = false;
+    test_consume_all();
+    test_consume_out_of_order();
+    test_incomplete_frame();
+    test_session_input_frames();
+    return report_results("test_channel");
+}
@@ -0,0 +1,26 @@
+/*
+ Created by Fat Dragon on 10/17/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#include "test_helpers.h"
+
+static int _checks{0};
+static int _failures{0};
+
+void expect(bool condition, const char* what) {
+    ++_checks;
+    if (condition)
+        return;
+    ++_failures;
+    printf("FAILED: %s\n", what);
+}
+
+int report_results(const char* test_name) {
+    printf("%s: %i of %i checks failed.\n", test_name, _failures, _checks);
+    return _failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
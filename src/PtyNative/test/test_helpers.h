@@ -0,0 +1,21 @@
+/*
+ Created by Fat Dragon on 10/17/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+#ifndef PTYNATIVE_TEST_HELPERS_H
+#define PTYNATIVE_TEST_HELPERS_H
+
+#include "../includes.h"
+
+// Records a failed check (and prints it).
+void expect(bool condition, const char* what);
+
+// Prints the number of failed checks, and returns the exit code of the test (0 if none failed).
+int report_results(const char* test_name);
+
+#endif //PTYNATIVE_TEST_HELPERS_H
@@ -0,0 +1,107 @@
+/*
+ Created by Fat Dragon on 10/17/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// Mediator event loop: while nothing can make progress (a stream is closed, or the slave doesn't read), the loop
+// waits instead of spinning.
+
+#include "test_helpers.h"
+
+#include "../io_processor.h"
+#include "../logging.h"
+
+#include <pty.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// How long the slave runs, and the CPU time (user + system) the mediator may use in the meantime.
+#define SLAVE_SECONDS "1"
+#define MAX_CPU_US 250000
+// Input written for a slave that doesn't read it (more than PTY and the input pipe take).
+#define UNREAD_INPUT_SIZE (200 * 1024)
+
+// Runs a mediator (in a child process) for a slave that only sleeps, and returns the CPU time it used (-1 on failure).
+// The command pipe is closed by its writer right away, and as much of input_size bytes of input as the input pipe
+// takes is written.
+static long long mediator_cpu_us(int input_size) {
+    int in_pipe[2], cin_pipe[2];
+    if (pipe(in_pipe) != 0 || pipe(cin_pipe) != 0)
+        return -1;
+    close(cin_pipe[1]);
+    const auto mediator_pid = fork();
+    if (mediator_pid == 0) {
+        close(in_pipe[1]);
+        const auto null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC); // NOLINT(hicpp-signed-bitwise)
+        winsize win_size{.ws_row = 25, .ws_col = 80, .ws_xpixel = 0, .ws_ypixel = 0};
+        int pty_fd{-1};
+        const auto slave_pid = forkpty(&pty_fd, nullptr, nullptr, &win_size);
+        if (slave_pid == 0) {
+            // Raw mode: PTY takes only as much input as its input queue holds.
+            execlp("sh", "sh", "-c", "stty raw -echo; sleep " SLAVE_SECONDS, nullptr);
+            _exit(127);
+        }
+        if (slave_pid < 0)
+            _exit(1);
+        run(pty_fd, slave_pid, in_pipe[0], -1, null_fd, cin_pipe[0], null_fd);
+        _exit(0);
+    }
+    close(in_pipe[0]);
+    close(cin_pipe[0]);
+    if (input_size > 0) {
+        // The slave doesn't read it, so it isn't waited for.
+        fcntl(in_pipe[1], F_SETFL, fcntl(in_pipe[1], F_GETFL) | O_NONBLOCK); // NOLINT(hicpp-signed-bitwise)
+        static char input[UNREAD_INPUT_SIZE];
+        memset(input, 'x', sizeof(input));
+        auto written{0};
+        while (written < input_size) {
+            const auto result = write(in_pipe[1], input + written, input_size - written);
+            if (result > 0)
+                written += (int) result;
+            else if (errno == EAGAIN)
+                usleep(10000);
+            else
+                break;
+            // Not reaping it (it's waited for below).
+            siginfo_t info{};
+            if (waitid(P_PID, mediator_pid, &info, WEXITED | WNOHANG | WNOWAIT) != 0 || info.si_pid != 0) // NOLINT
+                break;
+        }
+    }
+    int status{0};
+    rusage usage{};
+    const auto waited = wait4(mediator_pid, &status, 0, &usage);
+    // Input stays open (without anything written to it) until the mediator is over.
+    close(in_pipe[1]);
+    if (waited != mediator_pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL + usage.ru_utime.tv_usec
+           + usage.ru_stime.tv_usec;
+}
+
+static void test_closed_command_pipe() {
+    const auto cpu_us = mediator_cpu_us(0);
+    printf("closed command pipe: mediator used %lli us of CPU.\n", cpu_us);
+    expect(cpu_us >= 0, "closed command pipe: mediator ran, and exited cleanly");
+    expect(cpu_us < MAX_CPU_US, "closed command pipe: mediator doesn't spin");
+}
+
+// The slave doesn't read its input: the input that PTY doesn't take waits, without the loop spinning on it.
+static void test_unread_input() {
+    const auto cpu_us = mediator_cpu_us(UNREAD_INPUT_SIZE);
+    printf("unread input: mediator used %lli us of CPU.\n", cpu_us);
+    expect(cpu_us >= 0, "unread input: mediator ran, and exited cleanly");
+    expect(cpu_us < MAX_CPU_US, "unread input: mediator doesn't spin");
+}
+
+int main() {
+    _min_log_level = LOG_ERROR;
+    _debug_view = false;
+    test_closed_command_pipe();
+    test_unread_input();
+    return report_results("test_io_loop");
+}
@@ -0,0 +1,113 @@
+/*
+ Created by Fat Dragon on 10/17/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// Get-scrollback command: a scrollback bigger than a response is returned in pages, which add up to the scrollback as
+// it was when the first page was returned (also when more output is appended in the meantime).
+
+#include "test_helpers.h"
+
+#include "../command_processor.h"
+#include "../logging.h"
+
+#include <cstdint>
+
+#define GET_SCROLLBACK_COMMAND 8
+#define SCROLLBACK_BYTES 0
+#define SCROLLBACK_FROM 2
+#define SUCCESS_BYTE 0
+// Response frame (without its length field): request id, status, and the result.
+#define RESPONSE_HEADER_SIZE 5
+#define PAGE_HEADER_SIZE (2 * (int) sizeof(uint64_t))
+#define SCROLLBACK_CAPACITY (100 * 1024)
+#define OUTPUT_SIZE (3 * SCROLLBACK_CAPACITY / 2)
+
+static char _response[COMMAND_RESPONSE_MAX_SIZE];
+
+// Output byte at the position (so that each page can be checked against where it's from).
+static char output_byte(uint64_t position) {
+    return (char) ('a' + position % 23);
+}
+
+static void append_output(scrollback_ring& scrollback, uint64_t from, int length) {
+    char buffer[4096];
+    while (length > 0) {
+        const auto part = length < (int) sizeof(buffer) ? length : (int) sizeof(buffer);
+        for (auto i = 0; i < part; ++i)
+            buffer[i] = output_byte(from + i);
+        scrollback_append(scrollback, buffer, part);
+        from += part;
+        length -= part;
+    }
+}
+
+// Executes a get-scrollback command frame. Returns the size of the result (-1 if the command failed).
+static int get_page(const scrollback_ring& scrollback, char start, uint32_t count, uint64_t position) {
+    char frame[RESPONSE_HEADER_SIZE + 1 + sizeof(count) + sizeof(position)]{};
+    const uint32_t request_id{7};
+    memcpy(frame, &request_id, sizeof(request_id));
+    frame[RESPONSE_HEADER_SIZE - 1] = GET_SCROLLBACK_COMMAND;
+    frame[RESPONSE_HEADER_SIZE] = start;
+    memcpy(frame + RESPONSE_HEADER_SIZE + 1, &count, sizeof(count));
+    memcpy(frame + RESPONSE_HEADER_SIZE + 1 + sizeof(count), &position, sizeof(position));
+    const auto length = process_command_frame(-1, scrollback, frame, (int) sizeof(frame), _response);
+    if (length < RESPONSE_HEADER_SIZE || _response[RESPONSE_HEADER_SIZE - 1] != SUCCESS_BYTE)
+        return -1;
+    return length - RESPONSE_HEADER_SIZE;
+}
+
+static void test_pages() {
+    scrollback_ring scrollback{};
+    if (!scrollback_init(scrollback, SCROLLBACK_CAPACITY)) {
+        expect(false, "pages: scrollback allocated");
+        return;
+    }
+    append_output(scrollback, 0, OUTPUT_SIZE);
+    auto length = get_page(scrollback, SCROLLBACK_BYTES, 0, 0);
+    uint64_t positions[2]{};
+    if (length >= PAGE_HEADER_SIZE)
+        memcpy(positions, _response + RESPONSE_HEADER_SIZE, sizeof(positions));
+    expect(length > PAGE_HEADER_SIZE && length <= COMMAND_RESPONSE_MAX_SIZE, "pages: first page returned");
+    expect(positions[0] == OUTPUT_SIZE - SCROLLBACK_CAPACITY && positions[1] == OUTPUT_SIZE,
+           "pages: first page starts at the oldest byte, and ends at the newest one");
+    const auto end = positions[1];
+    auto position = positions[0];
+    auto pages{0};
+    auto matching{true};
+    while (length > PAGE_HEADER_SIZE && position < end) {
+        memcpy(positions, _response + RESPONSE_HEADER_SIZE, sizeof(positions));
+        matching = matching && positions[0] == position;
+        const auto data = _response + RESPONSE_HEADER_SIZE + PAGE_HEADER_SIZE;
+        const auto data_length = length - PAGE_HEADER_SIZE;
+        for (auto i = 0; i < data_length && position + i < end; ++i)
+            matching = matching && data[i] == output_byte(position + i);
+        position += data_length;
+        ++pages;
+        if (pages == 1)
+            // More output while the pages are being returned.
+            append_output(scrollback, end, 1000);
+        if (position < end)
+            length = get_page(scrollback, SCROLLBACK_FROM, 0, position);
+    }
+    expect(pages > 1, "pages: the scrollback takes more than one page");
+    expect(position >= end, "pages: all the pages returned");
+    expect(matching, "pages: pages add up to the scrollback");
+    // Once the bytes at a position are overwritten, it can't be continued from.
+    append_output(scrollback, end + 1000, SCROLLBACK_CAPACITY);
+    expect(get_page(scrollback, SCROLLBACK_FROM, 0, end - 1) < 0, "pages: overwritten position fails");
+    expect(get_page(scrollback, SCROLLBACK_FROM, 0, end + 1000 + SCROLLBACK_CAPACITY + 1) < 0,
+           "pages: position after the newest byte fails");
+    scrollback_destroy(scrollback);
+}
+
+int main() {
+    _min_log_level = LOG_ERROR;
+    _debug_view = false;
+    test_pages();
+    return report_results("test_scrollback");
+}
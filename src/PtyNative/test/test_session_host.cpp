@@ -0,0 +1,294 @@
+/*
+ Created by Fat Dragon on 10/17/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// Host control channel: requests that arrive with a single read (pipelined by the client) are all answered, in order,
+// and the sessions they create run (and report their exit). A session whose client doesn't read its channel doesn't
+// hold up the host, neither while it runs, nor when it ends.
+
+#include "test_helpers.h"
+
+#include "../channel.h"
+#include "../file_helpers.h"
+#include "../logging.h"
+#include "../session_host.h"
+#include "../shell_launcher.h"
+
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define REQUEST_HEADER_SIZE 5
+#define PIPELINED_SESSIONS 2
+#define RESPONSE_TIMEOUT_MS 10000
+// Session command frame: [length: uint32][type: uint8][request id: uint32][opcode: uint8] (get-stats).
+#define SESSION_COMMAND_FRAME_SIZE 10
+#define SESSION_GET_STATS_COMMAND 6
+// Get-stats commands sent to the session whose client doesn't read (their responses are far more than the channel
+// and the session's queue take).
+#define STALLING_COMMANDS 4000
+
+// The sessions of test_pipelined_requests, and the two of test_stalled_session_client.
+static char _socket_paths[PIPELINED_SESSIONS + 2][sizeof(sockaddr_un::sun_path)];
+
+static void make_address(const char* path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+}
+
+// host_platform.connect_channel: the channel "pipes" are Unix-domain sockets the test listens on.
+static bool connect_channel(const char* name, int& read_fd, int& write_fd) {
+    sockaddr_un address{};
+    make_address(name, address);
+    read_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0); // NOLINT(hicpp-signed-bitwise)
+    if (read_fd < 0 || connect(read_fd, (sockaddr*) &address, sizeof(address)) != 0) {
+        close(read_fd);
+        return false;
+    }
+    write_fd = fcntl(read_fd, F_DUPFD_CLOEXEC, 0);
+    return true;
+}
+
+static int listen_channel(const char* path) {
+    sockaddr_un address{};
+    make_address(path, address);
+    unlink(path);
+    const auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0); // NOLINT(hicpp-signed-bitwise)
+    if (fd < 0 || bind(fd, (sockaddr*) &address, sizeof(address)) != 0 || listen(fd, 1) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Appends a request frame to the buffer.
+static int add_request(char* buffer, int length, uint32_t request_id, char opcode, const char* arguments,
+                       int arguments_length) {
+    const auto frame_length = (uint32_t) (CHANNEL_FRAME_HEADER_SIZE - CHANNEL_FRAME_LENGTH_SIZE + REQUEST_HEADER_SIZE
+                                          + arguments_length);
+    memcpy(buffer + length, &frame_length, sizeof(frame_length));
+    buffer[length + CHANNEL_FRAME_LENGTH_SIZE] = CHANNEL_FRAME_COMMAND;
+    memcpy(buffer + length + CHANNEL_FRAME_HEADER_SIZE, &request_id, sizeof(request_id));
+    buffer[length + CHANNEL_FRAME_HEADER_SIZE + REQUEST_HEADER_SIZE - 1] = opcode;
+    memcpy(buffer + length + CHANNEL_FRAME_HEADER_SIZE + REQUEST_HEADER_SIZE, arguments, arguments_length);
+    return length + CHANNEL_FRAME_HEADER_SIZE + REQUEST_HEADER_SIZE + arguments_length;
+}
+
+// Create-session arguments: the winsize, the channel name, no dir, no environment variables, and `sh -c <command>`.
+static int create_arguments(char* arguments, const char* channel_name, const char* command) {
+    const unsigned short size[]{80, 25};
+    memcpy(arguments, size, sizeof(size));
+    auto length = (int) sizeof(size);
+    const char* strings[]{channel_name, "", "", "/bin/sh", "-c", command};
+    for (auto string: strings) {
+        strcpy(arguments + length, string);
+        length += (int) strlen(string) + 1;
+    }
+    return length;
+}
+
+// Reads the next frame from the control channel. Returns its type, or -1 if there's none in time.
+static int read_frame(int fd, char* payload, int& length) {
+    pollfd source{.fd = fd, .events = POLLIN, .revents = 0};
+    uint32_t frame_length{0};
+    char type{0};
+    if (poll(&source, 1, RESPONSE_TIMEOUT_MS) <= 0 || !read_bytes_fixed(fd, (char*) &frame_length, sizeof(frame_length))
+        || frame_length < 1 || frame_length > CHANNEL_MAX_PAYLOAD + 1 || !read_bytes_fixed(fd, &type, 1))
+        return -1;
+    length = (int) frame_length - 1;
+    return length == 0 || read_bytes_fixed(fd, payload, length) ? type : -1;
+}
+
+// Two create-session requests and a get-stats one (and a close-session of an unknown session) with a single write.
+static void test_pipelined_requests(int control_fd) {
+    int listen_fds[PIPELINED_SESSIONS];
+    char requests[2048];
+    auto length{0};
+    for (auto i = 0; i < PIPELINED_SESSIONS; ++i) {
+        snprintf(_socket_paths[i], sizeof(_socket_paths[i]), "/tmp/test_session_host_%i_%i.sock", (int) getpid(), i);
+        listen_fds[i] = listen_channel(_socket_paths[i]);
+        expect(listen_fds[i] >= 0, "pipelined: channel socket listening");
+        char arguments[256];
+        char command[16];
+        snprintf(command, sizeof(command), "exit %i", 3 + i);
+        const auto arguments_length = create_arguments(arguments, _socket_paths[i], command);
+        length = add_request(requests, length, 1 + i, HOST_CREATE_SESSION_COMMAND, arguments, arguments_length);
+    }
+    length = add_request(requests, length, 10, HOST_GET_STATS_COMMAND, nullptr, 0);
+    const uint32_t unknown_session{1000};
+    length = add_request(requests, length, 11, HOST_CLOSE_SESSION_COMMAND, (const char*) &unknown_session,
+                         (int) sizeof(unknown_session));
+    expect(write_bytes(control_fd, requests, length), "pipelined: requests written");
+    // Responses in the order of the requests. The sessions' EXIT frames may come in between.
+    const uint32_t expected_ids[]{1, 2, 10, 11};
+    const char expected_statuses[]{0, 0, 0, 1};
+    auto responses{0};
+    auto exits{0};
+    int exit_codes[PIPELINED_SESSIONS]{};
+    uint32_t session_ids[PIPELINED_SESSIONS]{};
+    char payload[CHANNEL_MAX_PAYLOAD];
+    int payload_length{0};
+    while (responses < 4 || exits < PIPELINED_SESSIONS) {
+        const auto type = read_frame(control_fd, payload, payload_length);
+        if (type == CHANNEL_FRAME_COMMAND && payload_length >= REQUEST_HEADER_SIZE && responses < 4) {
+            uint32_t request_id{0};
+            memcpy(&request_id, payload, sizeof(request_id));
+            expect(request_id == expected_ids[responses], "pipelined: response to the next request");
+            expect(payload[REQUEST_HEADER_SIZE - 1] == expected_statuses[responses], "pipelined: response status");
+            if (responses < PIPELINED_SESSIONS && payload_length == REQUEST_HEADER_SIZE + (int) sizeof(uint32_t))
+                memcpy(&session_ids[responses], payload + REQUEST_HEADER_SIZE, sizeof(uint32_t));
+            ++responses;
+        } else if (type == CHANNEL_FRAME_EXIT && payload_length == 2 * (int) sizeof(uint32_t)) {
+            uint32_t session_id{0};
+            int32_t code{0};
+            memcpy(&session_id, payload, sizeof(session_id));
+            memcpy(&code, payload + sizeof(session_id), sizeof(code));
+            for (auto i = 0; i < PIPELINED_SESSIONS; ++i)
+                if (session_ids[i] == session_id)
+                    exit_codes[i] = code;
+            ++exits;
+        } else {
+            expect(false, "pipelined: all responses and exits received");
+            break;
+        }
+    }
+    for (auto i = 0; i < PIPELINED_SESSIONS; ++i) {
+        expect(exit_codes[i] == 3 + i, "pipelined: session ran, and exited with its code");
+        close(listen_fds[i]);
+        unlink(_socket_paths[i]);
+    }
+}
+
+// Reads frames from the control channel until the response to the request (or an EXIT frame, if request_id is 0).
+// Returns the status of the response (0 for an EXIT frame), or -1 if it doesn't come in time. The EXIT frames read
+// before the response are counted in exits (if it isn't null).
+static int wait_for_frame(int control_fd, uint32_t request_id, char* payload, int* exits = nullptr) {
+    int payload_length{0};
+    while (true) {
+        const auto type = read_frame(control_fd, payload, payload_length);
+        if (type < 0)
+            return -1;
+        if (type == CHANNEL_FRAME_EXIT && request_id == 0)
+            return 0;
+        if (type == CHANNEL_FRAME_EXIT && exits != nullptr)
+            ++*exits;
+        uint32_t response_id{0};
+        if (type == CHANNEL_FRAME_COMMAND && payload_length >= REQUEST_HEADER_SIZE
+            && (memcpy(&response_id, payload, sizeof(response_id)), response_id == request_id))
+            return payload[REQUEST_HEADER_SIZE - 1];
+    }
+}
+
+// Reads the session's frames until `count` command responses are read. Returns false if they don't come in time.
+static bool read_responses(int client_fd, int count) {
+    static char payload[CHANNEL_MAX_PAYLOAD];
+    int length{0};
+    while (count > 0) {
+        const auto type = read_frame(client_fd, payload, length);
+        if (type < 0)
+            return false;
+        if (type == CHANNEL_FRAME_COMMAND)
+            --count;
+    }
+    return true;
+}
+
+// The client of a session sends commands, but doesn't read the responses: the host keeps answering the control
+// requests (and serving the other sessions) while the session's responses wait. Then either the client reads them
+// (they all come), and closes its channel, which ends the session, or (if host_closes) the session is closed by the
+// host while the client is still connected, and not reading: its output pump can't write the rest then, which
+// doesn't hold up the host either.
+static void test_stalled_session_client(int control_fd, bool host_closes) {
+    const auto path = _socket_paths[PIPELINED_SESSIONS + (host_closes ? 1 : 0)];
+    snprintf(path, sizeof(_socket_paths[0]), "/tmp/test_session_host_%i_stalled_%i.sock", (int) getpid(),
+             (int) host_closes);
+    const auto listen_fd = listen_channel(path);
+    expect(listen_fd >= 0, "stalled client: channel socket listening");
+    char arguments[256];
+    const auto arguments_length = create_arguments(arguments, path, "exec sleep 30");
+    char request[512];
+    auto length = add_request(request, 0, 20, HOST_CREATE_SESSION_COMMAND, arguments, arguments_length);
+    expect(write_bytes(control_fd, request, length), "stalled client: create request written");
+    char payload[CHANNEL_MAX_PAYLOAD];
+    expect(wait_for_frame(control_fd, 20, payload) == 0, "stalled client: session created");
+    uint32_t session_id{0};
+    memcpy(&session_id, payload + REQUEST_HEADER_SIZE, sizeof(session_id));
+    const auto client_fd = accept(listen_fd, nullptr, nullptr);
+    expect(client_fd >= 0, "stalled client: channel connected");
+    static char commands[STALLING_COMMANDS * SESSION_COMMAND_FRAME_SIZE];
+    for (auto i = 0; i < STALLING_COMMANDS; ++i) {
+        const auto frame = commands + i * SESSION_COMMAND_FRAME_SIZE;
+        const uint32_t frame_length{SESSION_COMMAND_FRAME_SIZE - CHANNEL_FRAME_LENGTH_SIZE};
+        const auto request_id = (uint32_t) i;
+        memcpy(frame, &frame_length, sizeof(frame_length));
+        frame[CHANNEL_FRAME_LENGTH_SIZE] = CHANNEL_FRAME_COMMAND;
+        memcpy(frame + CHANNEL_FRAME_HEADER_SIZE, &request_id, sizeof(request_id));
+        frame[SESSION_COMMAND_FRAME_SIZE - 1] = SESSION_GET_STATS_COMMAND;
+    }
+    expect(write_bytes(client_fd, commands, (int) sizeof(commands)), "stalled client: commands written");
+    // Giving the host the time to fill the channel.
+    usleep(200000);
+    length = add_request(request, 0, 21, HOST_GET_STATS_COMMAND, nullptr, 0);
+    expect(write_bytes(control_fd, request, length), "stalled client: get-stats request written");
+    expect(wait_for_frame(control_fd, 21, payload) == 0, "stalled client: host answers while the session waits");
+    if (host_closes) {
+        length = add_request(request, 0, 22, HOST_CLOSE_SESSION_COMMAND, (const char*) &session_id,
+                             (int) sizeof(session_id));
+        expect(write_bytes(control_fd, request, length), "host closes: close request written");
+        expect(wait_for_frame(control_fd, 22, payload) == 0, "host closes: session closed");
+        // Giving the session the time to end (its output pump is stopping then).
+        usleep(500000);
+        length = add_request(request, 0, 23, HOST_GET_STATS_COMMAND, nullptr, 0);
+        expect(write_bytes(control_fd, request, length), "host closes: get-stats request written");
+        auto exits{0};
+        expect(wait_for_frame(control_fd, 23, payload, &exits) == 0,
+               "host closes: host answers while the session ends");
+        expect(exits == 1 || wait_for_frame(control_fd, 0, payload) == 0, "host closes: session is over");
+        close(client_fd);
+    } else {
+        expect(read_responses(client_fd, STALLING_COMMANDS), "stalled client: all the commands answered");
+        // Closing the client's channel ends the session.
+        close(client_fd);
+        expect(wait_for_frame(control_fd, 0, payload) == 0, "stalled client: session is over");
+    }
+    close(listen_fd);
+    unlink(path);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], SLAVE_HELPER_ARG) == 0)
+        // The host spawns the shells through this executable.
+        run_slave_helper(argc - 1, argv + 1);
+    _min_log_level = LOG_ERROR;
+    _debug_view = false;
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) { // NOLINT(hicpp-signed-bitwise)
+        printf("'socketpair' failed.\n");
+        return EXIT_FAILURE;
+    }
+    const auto host_pid = fork();
+    if (host_pid == 0) {
+        // As in main: a client that's gone is reported by the failing write.
+        signal(SIGPIPE, SIG_IGN);
+        close(sockets[1]);
+        const host_platform platform{.connect_channel = connect_channel, .register_terminal = nullptr};
+        host_run(sockets[0], fcntl(sockets[0], F_DUPFD_CLOEXEC, 0), platform);
+        _exit(0);
+    }
+    close(sockets[0]);
+    test_pipelined_requests(sockets[1]);
+    test_stalled_session_client(sockets[1], false);
+    test_stalled_session_client(sockets[1], true);
+    // Closing the control channel ends the host.
+    close(sockets[1]);
+    int status{0};
+    expect(waitpid(host_pid, &status, 0) == host_pid && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+           "host exited cleanly");
+    return report_results("test_session_host");
+}
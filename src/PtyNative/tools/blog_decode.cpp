@@ -0,0 +1,260 @@
+/*
+ Created by Fat Dragon on 10/16/2026.
+
+ Copyright (c) 2019-present Fat Dragon
+
+ This file is part of win-nix-pty project (https://github.com/peske/win-nix-pty)
+ which is released under BSD-3-Clause license (https://github.com/peske/win-nix-pty/blob/master/LICENSE).
+*/
+
+// Renders a binary log (`--blog`) as text, in the same format as the text log.
+// Usage: blog_decode <file.blog>
+
+#include "../binary_log.h"
+
+#define LINE_BUFFER_SIZE 4096
+#define SPEC_BUFFER_SIZE 64
+
+struct format_entry {
+    const char* text;
+    int length;
+};
+
+static format_entry _formats[BINARY_LOG_MAX_FORMATS];
+static long long _realtime_start_us{0};
+static long long _monotonic_start_us{0};
+
+template<typename T>
+static inline T get(const char*& pos) {
+    T value;
+    memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+}
+
+static const char* level_tag(int level) {
+    static const char* tags[]{"[TRC]", "[DBG]", "[INF]", "[WRN]", "[ERR]"};
+    return level >= 0 && level < (int) (sizeof(tags) / sizeof(tags[0])) ? tags[level] : "[???]";
+}
+
+static void print_prefix(int level, long long time_us) {
+    const auto realtime_us = _realtime_start_us + (time_us - _monotonic_start_us);
+    const auto seconds = (time_t) (realtime_us / 1000000);
+    tm time_info{};
+    if (localtime_r(&seconds, &time_info) != nullptr)
+        printf("[%02i:%02i:%02i.%03i]", time_info.tm_hour, time_info.tm_min, time_info.tm_sec,
+               (int) (realtime_us % 1000000) / 1000);
+    printf("FD:%s", level_tag(level));
+}
+
+// Appends the printf-formatted value of one argument, reading it from the record.
+static bool format_argument(char* line, int& line_length, const char* spec, int kind, const char*& pos,
+                            const char* end) {
+    const auto space = LINE_BUFFER_SIZE - line_length;
+    int written;
+    switch (kind) {
+        case BINARY_LOG_ARGUMENT_INT:
+            if (end - pos < (int) sizeof(int))
+                return false;
+            written = snprintf(line + line_length, space, spec, get<int>(pos));
+            break;
+        case BINARY_LOG_ARGUMENT_LONG:
+        case BINARY_LOG_ARGUMENT_LONG_LONG:
+            if (end - pos < (int) sizeof(long long))
+                return false;
+            written = snprintf(line + line_length, space, spec, get<long long>(pos));
+            break;
+        case BINARY_LOG_ARGUMENT_DOUBLE:
+            if (end - pos < (int) sizeof(double))
+                return false;
+            written = snprintf(line + line_length, space, spec, get<double>(pos));
+            break;
+        case BINARY_LOG_ARGUMENT_POINTER:
+            if (end - pos < (int) sizeof(long long))
+                return false;
+            written = snprintf(line + line_length, space, spec, (void*) (uintptr_t) get<long long>(pos));
+            break;
+        default: { // BINARY_LOG_ARGUMENT_STRING
+            if (end - pos < (int) sizeof(unsigned short))
+                return false;
+            const auto length = get<unsigned short>(pos);
+            if (end - pos < length)
+                return false;
+            char value[LINE_BUFFER_SIZE];
+            const auto copied = length < LINE_BUFFER_SIZE ? length : LINE_BUFFER_SIZE - 1;
+            memcpy(value, pos, copied);
+            value[copied] = 0;
+            pos += length;
+            written = snprintf(line + line_length, space, spec, value);
+            break;
+        }
+    }
+    if (written > 0)
+        line_length = written < space ? line_length + written : LINE_BUFFER_SIZE - 1;
+    return true;
+}
+
+// Renders the format with the recorded arguments. Each conversion is re-formatted with snprintf, with the length
+// modifier replaced by the one matching the recorded size, and `*` replaced by the recorded width / precision.
+static bool render_event(char* line, int& line_length, const format_entry& format, const char*& pos,
+                         const char* end) {
+    unsigned char kinds[BINARY_LOG_MAX_ARGUMENTS];
+    char format_text[LINE_BUFFER_SIZE];
+    const auto format_length = format.length < LINE_BUFFER_SIZE ? format.length : LINE_BUFFER_SIZE - 1;
+    memcpy(format_text, format.text, format_length);
+    format_text[format_length] = 0;
+    if (binary_log_parse_format(format_text, kinds, BINARY_LOG_MAX_ARGUMENTS) < 0)
+        return false;
+    auto kind_index{0};
+    auto text = format_text;
+    while (*text && line_length < LINE_BUFFER_SIZE - 1) {
+        if (*text != '%') {
+            line[line_length++] = *(text++);
+            continue;
+        }
+        if (text[1] == '%') {
+            line[line_length++] = '%';
+            text += 2;
+            continue;
+        }
+        char spec[SPEC_BUFFER_SIZE];
+        auto spec_length{0};
+        spec[spec_length++] = *(text++);
+        while (*text && strchr("-+ #0'.0123456789*hlLqjzt", *text) && spec_length < SPEC_BUFFER_SIZE - 8) {
+            if (*text == '*') {
+                if (end - pos < (int) sizeof(int))
+                    return false;
+                spec_length += snprintf(spec + spec_length, SPEC_BUFFER_SIZE - spec_length, "%i", get<int>(pos));
+                ++kind_index;
+            } else if (!strchr("hlLqjzt", *text))
+                spec[spec_length++] = *text;
+            ++text;
+        }
+        const auto kind = kinds[kind_index++];
+        if (kind == BINARY_LOG_ARGUMENT_LONG || kind == BINARY_LOG_ARGUMENT_LONG_LONG) {
+            spec[spec_length++] = 'l';
+            spec[spec_length++] = 'l';
+        }
+        spec[spec_length++] = *(text++);
+        spec[spec_length] = 0;
+        if (!format_argument(line, line_length, spec, kind, pos, end))
+            return false;
+    }
+    line[line_length] = 0;
+    return true;
+}
+
+// Reads all the FORMAT records, and returns the end of the last whole record.
+static const char* read_formats(const char* data, const char* end) {
+    auto pos = data;
+    while (pos < end) {
+        const auto record = pos;
+        const auto type = get<unsigned char>(pos);
+        if (type == BINARY_LOG_RECORD_FORMAT) {
+            if (end - pos < 4)
+                return record;
+            const auto id = get<unsigned short>(pos);
+            const auto length = get<unsigned short>(pos);
+            if (end - pos < length || id >= BINARY_LOG_MAX_FORMATS)
+                return record;
+            _formats[id].text = pos;
+            _formats[id].length = length;
+            pos += length;
+        } else if (type == BINARY_LOG_RECORD_EVENT || type == BINARY_LOG_RECORD_TEXT) {
+            // level, flags, id and time, or level and time
+            const auto fixed = type == BINARY_LOG_RECORD_EVENT ? 12 : 9;
+            if (end - pos < fixed + 2)
+                return record;
+            pos += fixed;
+            const auto length = get<unsigned short>(pos);
+            if (end - pos < length)
+                return record;
+            pos += length;
+        } else
+            return record;
+    }
+    return end;
+}
+
+static void print_records(const char* data, const char* end) {
+    char line[LINE_BUFFER_SIZE];
+    auto pos = data;
+    while (pos < end) {
+        const auto type = get<unsigned char>(pos);
+        if (type == BINARY_LOG_RECORD_FORMAT) {
+            get<unsigned short>(pos);
+            pos += get<unsigned short>(pos);
+            continue;
+        }
+        const auto level = (int) get<unsigned char>(pos);
+        if (type == BINARY_LOG_RECORD_TEXT) {
+            const auto time_us = get<long long>(pos);
+            const auto length = get<unsigned short>(pos);
+            print_prefix(level, time_us);
+            printf("%.*s\n", (int) length, pos);
+            pos += length;
+            continue;
+        }
+        const auto flags = get<unsigned char>(pos);
+        const auto id = get<unsigned short>(pos);
+        const auto time_us = get<long long>(pos);
+        const auto arguments_length = get<unsigned short>(pos);
+        const auto arguments_end = pos + arguments_length;
+        print_prefix(level, time_us);
+        auto line_length{0};
+        if (_formats[id].text == nullptr || !render_event(line, line_length, _formats[id], pos, arguments_end)) {
+            printf("<undecodable event: format %u>\n", id);
+            pos = arguments_end;
+            continue;
+        }
+        if ((flags & BINARY_LOG_FLAG_ERROR_SUFFIX) // NOLINT(hicpp-signed-bitwise)
+            && arguments_end - pos >= (int) (sizeof(int) + sizeof(unsigned short))) {
+            const auto error = get<int>(pos);
+            auto length = (int) get<unsigned short>(pos);
+            if (length > arguments_end - pos)
+                length = (int) (arguments_end - pos);
+            snprintf(line + line_length, LINE_BUFFER_SIZE - line_length, " Error: %i (%.*s)", error, length, pos);
+        }
+        printf("%s\n", line);
+        pos = arguments_end;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printf("Usage: blog_decode <file.blog>\n");
+        return 1;
+    }
+    const auto fd = open(argv[1], O_RDONLY); // NOLINT(hicpp-signed-bitwise)
+    struct stat file_stat{};
+    if (fd < 0 || fstat(fd, &file_stat) != 0) {
+        printf("Failed to open %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    auto data = (char*) malloc(file_stat.st_size + 1);
+    auto size{0L};
+    ssize_t count;
+    while (size < file_stat.st_size && (count = read(fd, data + size, file_stat.st_size - size)) > 0)
+        size += count;
+    close(fd);
+    if (size < BINARY_LOG_HEADER_SIZE || memcmp(data, BINARY_LOG_MAGIC, BINARY_LOG_MAGIC_LENGTH) != 0) {
+        printf("%s isn't a binary log file.\n", argv[1]);
+        return 1;
+    }
+    const char* pos = data + BINARY_LOG_MAGIC_LENGTH;
+    const auto version = get<unsigned int>(pos);
+    const auto header_size = get<unsigned int>(pos);
+    if (version != BINARY_LOG_VERSION) {
+        printf("Unsupported binary log version %u.\n", version);
+        return 1;
+    }
+    _realtime_start_us = get<long long>(pos);
+    _monotonic_start_us = get<long long>(pos);
+    // The file may be cut in the middle of a record (if the process was killed), so only whole records are read.
+    const auto end = read_formats(data + header_size, data + size);
+    if (end != data + size)
+        fprintf(stderr, "The log is truncated or corrupted, decoding what's readable.\n");
+    print_records(data + header_size, end);
+    free(data);
+    return 0;
+}